@@ -61,6 +61,21 @@ void interp_bathy(int nx, int ny, const parameters_t param, all_data_t *all_data
             SET(all_data->h_interp, i, j, val);
         }
     }
+
+    // Face coefficients for update_eta: depth of the cell east/north of the
+    // face, the closing wall faces reuse the last cell
+    for(int j = 0; j < ny; j++) {
+        for(int i = 0; i <= nx; i++) {
+            double h_face = GET(all_data->h_interp, i < nx ? i : nx - 1, j);
+            SET(all_data->hu, i, j, param.dt / param.dx * h_face);
+        }
+    }
+    for(int j = 0; j <= ny; j++) {
+        for(int i = 0; i < nx; i++) {
+            double h_face = GET(all_data->h_interp, i, j < ny ? j : ny - 1);
+            SET(all_data->hv, i, j, param.dt / param.dy * h_face);
+        }
+    }
 }
 
 /*===========================================================
@@ -69,111 +84,107 @@ void interp_bathy(int nx, int ny, const parameters_t param, all_data_t *all_data
 
 /**
  * Updates water elevation (eta) using GPU acceleration
+ * Also refreshes the eta ghost cells read by update_velocities
  * 
  * @param nx, ny Grid dimensions
  * @param param Simulation parameters
  * @param all_data Simulation data structures
  */
 void update_eta(int nx, int ny, const parameters_t param, all_data_t *all_data) {
-    double* eta_gpu = all_data->eta->values;
-    double* h_interp_gpu = all_data->h_interp->values;
-    double* u_gpu = all_data->u->values;
-    double* v_gpu = all_data->v->values;
+    data_t *eta = all_data->eta, *hu = all_data->hu, *hv = all_data->hv;
+    data_t *u = all_data->u, *v = all_data->v;
+    double* eta_gpu = eta->storage;
+    double* hu_gpu = hu->storage;
+    double* hv_gpu = hv->storage;
+    double* u_gpu = u->storage;
+    double* v_gpu = v->storage;
+    size_t eta_n = FIELD_SPAN(eta), hu_n = FIELD_SPAN(hu), hv_n = FIELD_SPAN(hv);
+    size_t u_n = FIELD_SPAN(u), v_n = FIELD_SPAN(v);
+    int pe = eta->pitch, oe = eta->offset;
+    int pu = u->pitch, ou = u->offset;
+    int pv = v->pitch, ov = v->offset;
 
+    // hu shares the u layout and hv the v layout (same dimensions)
     #pragma omp target teams distribute parallel for collapse(2) \
-        map(tofrom: eta_gpu[0:nx*ny]) \
-        map(to: h_interp_gpu[0:nx*ny], u_gpu[0:(nx+1)*ny], v_gpu[0:nx*(ny+1)])
+        map(tofrom: eta_gpu[0:eta_n]) \
+        map(to: hu_gpu[0:hu_n], hv_gpu[0:hv_n], u_gpu[0:u_n], v_gpu[0:v_n])
     for(int i = 0; i < nx; i++) {
         for(int j = 0; j < ny; j++) {
-            double h_ij = h_interp_gpu[nx * j + i];
-            double c1 = param.dt * h_ij;
-            
-            // u on staggered grid (nx+1) x ny
-            double u_i = u_gpu[(nx+1) * j + i];
-            double u_ip1 = u_gpu[(nx+1) * j + (i+1)];
-            
-            // v on staggered grid nx x (ny+1)
-            double v_j = v_gpu[nx * j + i];
-            double v_jp1 = v_gpu[nx * (j+1) + i];
-            
-            eta_gpu[nx * j + i] = eta_gpu[nx * j + i] 
-                - c1 * ((u_ip1 - u_i) / param.dx 
-                     + (v_jp1 - v_j) / param.dy);
+            // u-faces on staggered grid (nx+1) x ny
+            int w = ou + pu * j + i;
+            double flux_x = hu_gpu[w + 1] * u_gpu[w + 1] - hu_gpu[w] * u_gpu[w];
+
+            // v-faces on staggered grid nx x (ny+1)
+            int s = ov + pv * j + i;
+            double flux_y = hv_gpu[s + pv] * v_gpu[s + pv] - hv_gpu[s] * v_gpu[s];
+
+            eta_gpu[oe + pe * j + i] = eta_gpu[oe + pe * j + i] - flux_x - flux_y;
         }
     }
+
+    // Ghost cells repeat the edge values (zero gradient at the walls)
+    #pragma omp target teams distribute parallel for \
+        map(tofrom: eta_gpu[0:eta_n])
+    for(int j = 0; j < ny; j++) {
+        eta_gpu[oe + pe * j - 1] = eta_gpu[oe + pe * j];
+        eta_gpu[oe + pe * j + nx] = eta_gpu[oe + pe * j + nx - 1];
+    }
+
+    #pragma omp target teams distribute parallel for \
+        map(tofrom: eta_gpu[0:eta_n])
+    for(int i = 0; i < nx; i++) {
+        eta_gpu[oe - pe + i] = eta_gpu[oe + i];
+        eta_gpu[oe + pe * ny + i] = eta_gpu[oe + pe * (ny - 1) + i];
+    }
 }
 
 /**
  * Updates water velocities (u,v) using GPU acceleration
+ * The wall faces read eta from the ghost cells filled by update_eta
  * 
  * @param nx, ny Grid dimensions
  * @param param Simulation parameters
  * @param all_data Simulation data structures
  */
 void update_velocities(int nx, int ny, const parameters_t param, all_data_t *all_data) {
-    double* u_gpu = all_data->u->values;
-    double* v_gpu = all_data->v->values;
-    double* eta_gpu = all_data->eta->values;
+    data_t *eta = all_data->eta, *u = all_data->u, *v = all_data->v;
+    double* u_gpu = u->storage;
+    double* v_gpu = v->storage;
+    double* eta_gpu = eta->storage;
+    size_t eta_n = FIELD_SPAN(eta), u_n = FIELD_SPAN(u), v_n = FIELD_SPAN(v);
+    int pe = eta->pitch, oe = eta->offset;
+    int pu = u->pitch, ou = u->offset;
+    int pv = v->pitch, ov = v->offset;
+    double c1 = param.dt * param.g;
+    double c2 = param.dt * param.gamma;
 
     // For u: grid (nx+1) x ny
     #pragma omp target teams distribute parallel for collapse(2) \
-        map(tofrom: u_gpu[0:(nx+1)*ny]) \
-        map(to: eta_gpu[0:nx*ny])
+        map(tofrom: u_gpu[0:u_n]) \
+        map(to: eta_gpu[0:eta_n])
     for(int i = 0; i < nx + 1; i++) {
         for(int j = 0; j < ny; j++) {
-            double c1 = param.dt * param.g;
-            double c2 = param.dt * param.gamma;
-            
-            double eta_ij, eta_im1j;
-            
-            if (i < nx) {
-                eta_ij = eta_gpu[nx * j + i];
-            } else {
-                eta_ij = eta_gpu[nx * j + (nx-1)];  // last valid point
-            }
-            
-            if (i > 0) {
-                eta_im1j = eta_gpu[nx * j + (i-1)];
-            } else {
-                eta_im1j = eta_gpu[nx * j + 0];     // first valid point
-            }
-            
-            double u_old = u_gpu[(nx+1) * j + i];
+            int k = oe + pe * j + i;
+            double u_old = u_gpu[ou + pu * j + i];
             double new_u = (1. - c2) * u_old 
-                - c1 / param.dx * (eta_ij - eta_im1j);
+                - c1 / param.dx * (eta_gpu[k] - eta_gpu[k - 1]);
             
-            u_gpu[(nx+1) * j + i] = new_u;
+            u_gpu[ou + pu * j + i] = new_u;
         }
     }
 
     // For v: grid nx x (ny+1)
     #pragma omp target teams distribute parallel for collapse(2) \
-        map(tofrom: v_gpu[0:nx*(ny+1)]) \
-        map(to: eta_gpu[0:nx*ny])
+        map(tofrom: v_gpu[0:v_n]) \
+        map(to: eta_gpu[0:eta_n])
     for(int i = 0; i < nx; i++) {
         for(int j = 0; j < ny + 1; j++) {
-            double c1 = param.dt * param.g;
-            double c2 = param.dt * param.gamma;
-            
-            double eta_ij, eta_ijm1;
-            
-            if (j < ny) {
-                eta_ij = eta_gpu[nx * j + i];
-            } else {
-                eta_ij = eta_gpu[nx * (ny-1) + i];  // last valid point
-            }
-            
-            if (j > 0) {
-                eta_ijm1 = eta_gpu[nx * (j-1) + i];
-            } else {
-                eta_ijm1 = eta_gpu[nx * 0 + i];     // first valid point
-            }
-            
-            double v_old = v_gpu[nx * j + i];
+            int k = oe + pe * j + i;
+            double v_old = v_gpu[ov + pv * j + i];
             double new_v = (1. - c2) * v_old
-                - c1 / param.dy * (eta_ij - eta_ijm1);
+                - c1 / param.dy * (eta_gpu[k] - eta_gpu[k - pe]);
             
-            v_gpu[nx * j + i] = new_v;
+            v_gpu[ov + pv * j + i] = new_v;
         }
     }
 }
@@ -190,22 +201,24 @@ void update_velocities(int nx, int ny, const parameters_t param, all_data_t *all
  * @param all_data Simulation data structures
  */
 void boundary_conditions(int nx, int ny, const parameters_t param, all_data_t *all_data) {
-    double* u_gpu = all_data->u->values;
-    double* v_gpu = all_data->v->values;
-    double* eta_gpu = all_data->eta->values;
+    double* u_gpu = all_data->u->storage;
+    double* v_gpu = all_data->v->storage;
+    size_t u_n = FIELD_SPAN(all_data->u), v_n = FIELD_SPAN(all_data->v);
+    int pu = all_data->u->pitch, ou = all_data->u->offset;
+    int pv = all_data->v->pitch, ov = all_data->v->offset;
 
     #pragma omp target teams distribute parallel for \
-        map(tofrom: u_gpu[0:ny*(nx+1)])
+        map(tofrom: u_gpu[0:u_n])
     for(int j = 0; j < ny; j++) {
-        u_gpu[(nx+1)*j + 0] = 0.0;     // Left boundary
-        u_gpu[(nx+1)*j + (nx)] = 0.0;  // Right boundary
+        u_gpu[ou + pu*j + 0] = 0.0;     // Left boundary
+        u_gpu[ou + pu*j + (nx)] = 0.0;  // Right boundary
     }
 
     #pragma omp target teams distribute parallel for \
-        map(tofrom: v_gpu[0:nx*(ny+1)])
+        map(tofrom: v_gpu[0:v_n])
     for(int i = 0; i < nx; i++) {
-        v_gpu[i] = 0.0;            // Bottom boundary
-        v_gpu[nx*(ny) + i] = 0.0;  // Top boundary
+        v_gpu[ov + i] = 0.0;            // Bottom boundary
+        v_gpu[ov + pv*(ny) + i] = 0.0;  // Top boundary
     }
 }
 
@@ -218,8 +231,11 @@ void boundary_conditions(int nx, int ny, const parameters_t param, all_data_t *a
  * @param all_data Simulation data structures
  */
 void apply_source(int n, int nx, int ny, const parameters_t param, all_data_t *all_data) {
-    double* v_gpu = all_data->v->values;
-    double* eta_gpu = all_data->eta->values;
+    double* v_gpu = all_data->v->storage;
+    double* eta_gpu = all_data->eta->storage;
+    size_t v_n = FIELD_SPAN(all_data->v), eta_n = FIELD_SPAN(all_data->eta);
+    int pv = all_data->v->pitch, ov = all_data->v->offset;
+    int pe = all_data->eta->pitch, oe = all_data->eta->offset;
     double t = n * param.dt;
     double A = 5.0;
     double f = 1.0 / 20.0;
@@ -231,13 +247,13 @@ void apply_source(int n, int nx, int ny, const parameters_t param, all_data_t *a
     switch(param.source_type) {
         case 1:
             #pragma omp target teams distribute parallel for \
-                map(tofrom: v_gpu[0:nx*(ny+1)])
+                map(tofrom: v_gpu[0:v_n])
             for(int i = 0; i < nx; i++) {
                 for(int j = 0; j < ny + 1; j++) {
                     if(j == ny) {
                         double x_pos = i * param.dx;
                         double spatial_mod = sin(2.0 * M_PI * x_pos / (nx * param.dx) * 2);
-                        v_gpu[nx * j + i] = source * (1.0 + 0.3 * spatial_mod);
+                        v_gpu[ov + pv * j + i] = source * (1.0 + 0.3 * spatial_mod);
                     }
                 }
             }
@@ -245,9 +261,9 @@ void apply_source(int n, int nx, int ny, const parameters_t param, all_data_t *a
 
         case 2:
             #pragma omp target \
-                map(tofrom: eta_gpu[0:nx*ny])
+                map(tofrom: eta_gpu[0:eta_n])
             {
-                eta_gpu[nx * (ny/2) + nx/2] = source;
+                eta_gpu[oe + pe * (ny/2) + nx/2] = source;
             }
             break;
 
@@ -262,14 +278,14 @@ void apply_source(int n, int nx, int ny, const parameters_t param, all_data_t *a
                 double phase_shifts[3] = {0.0, 2.0*M_PI/3.0, 4.0*M_PI/3.0};
 
                 #pragma omp target \
-                    map(tofrom: eta_gpu[0:nx*ny])
+                    map(tofrom: eta_gpu[0:eta_n])
                 {
                     for (int s = 0; s < num_sources; s++) {
                         int i = source_positions[s][0];
                         int j = source_positions[s][1];
                         if (i >= 0 && i < nx && j >= 0 && j < ny) {
                             double phase_shifted_source = A * sin(2.0 * M_PI * f * t + phase_shifts[s]) * envelope;
-                            eta_gpu[nx * j + i] = phase_shifted_source;
+                            eta_gpu[oe + pe * j + i] = phase_shifted_source;
                         }
                     }
                 }
@@ -283,10 +299,10 @@ void apply_source(int n, int nx, int ny, const parameters_t param, all_data_t *a
                 int source_j = (int)(ny/2 + (ny/4) * cos(speed * t));
 
                 #pragma omp target \
-                    map(tofrom: eta_gpu[0:nx*ny])
+                    map(tofrom: eta_gpu[0:eta_n])
                 {
                     if (source_i >= 0 && source_i < nx && source_j >= 0 && source_j < ny) {
-                        eta_gpu[nx * source_j + source_i] = source;
+                        eta_gpu[oe + pe * source_j + source_i] = source;
                     }
                 }
             }
@@ -37,11 +37,22 @@
 #define M_PI 3.14159265358979323846
 #endif
 
+// Padded field layout: GHOST_WIDTH ghost cells around every field and rows
+// padded to a multiple of FIELD_ALIGN bytes (build with -DGHOST_WIDTH=n)
+#ifndef GHOST_WIDTH
+#define GHOST_WIDTH 1
+#endif
+#define FIELD_ALIGN 64
+
 /*===========================================================
  * DATA ACCESS AND MANIPULATION MACROS
  ===========================================================*/
-#define GET(data, i, j) ((data)->values[(data)->nx * (j) + (i)])
-#define SET(data, i, j, val) ((data)->values[(data)->nx * (j) + (i)] = (val))
+// (i, j from -ghost to nx+ghost-1; kernels index storage[offset + pitch*j + i])
+#define GET(data, i, j) ((data)->values[(data)->pitch * (j) + (i)])
+#define SET(data, i, j, val) ((data)->values[(data)->pitch * (j) + (i)] = (val))
+
+// Number of elements in a field allocation, ghosts and padding included
+#define FIELD_SPAN(data) ((size_t)(data)->pitch * ((data)->ny + 2 * (data)->ghost))
 
 /*===========================================================
  * TYPE DEFINITIONS AND STRUCTURES
@@ -63,8 +74,12 @@ typedef struct {
 
 // Grid data structure
 typedef struct {
-    double *values;
+    double *values;     // points at (0,0) inside storage
+    double *storage;    // allocation holding values and ghost cells
     int nx, ny;
+    int ghost;          // ghost cells on each side
+    int pitch;          // distance between rows (elements)
+    int offset;         // values - storage
     double dx, dy;
 } data_t;
 
@@ -75,14 +90,16 @@ typedef struct {
     data_t *eta;
     data_t *h;
     data_t *h_interp;
+    data_t *hu;    // u-face depth times dt/dx ((nx+1) x ny)
+    data_t *hv;    // v-face depth times dt/dy (nx x (ny+1))
 } all_data_t;
 
 /*===========================================================
  * GPU DATA MAPPING DECLARATIONS
  ===========================================================*/
 #pragma omp declare mapper(data_t data) \
-    map(to: data.nx, data.ny, data.dx, data.dy) \
-    map(tofrom: data.values[0:data.nx*data.ny])
+    map(to: data.nx, data.ny, data.ghost, data.pitch, data.offset, data.dx, data.dy) \
+    map(tofrom: data.storage[0:data.pitch*(data.ny+2*data.ghost)])
 
 /*===========================================================
  * FUNCTION PROTOTYPES - CORE COMPUTATION
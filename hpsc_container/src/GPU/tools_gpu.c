@@ -138,15 +138,12 @@ int read_data(data_t *data, const char *filename)
       printf("Error: Invalid number of data points %d\n", N);
       ok = 0;
     }
+    else if(init_data(data, data->nx, data->ny, data->dx, data->dy, 0.)) {
+      ok = 0;
+    }
     else {
-      data->values = (double*)malloc(N * sizeof(double));
-      if(!data->values) {
-        printf("Error: Could not allocate data (%d doubles)\n", N);
-        ok = 0;
-      }
-      else {
-        ok = (fread(data->values, sizeof(double), N, fp) == N);
-      }
+      for(int j = 0; ok && j < data->ny; j++)
+        ok = (fread(&GET(data, 0, j), sizeof(double), data->nx, fp) == (size_t)data->nx);
     }
   }
   fclose(fp);
@@ -182,8 +179,8 @@ int write_data(const data_t *data, const char *filename, int step)
   if(ok) ok = (fwrite(&data->ny, sizeof(int), 1, fp) == 1);
   if(ok) ok = (fwrite(&data->dx, sizeof(double), 1, fp) == 1);
   if(ok) ok = (fwrite(&data->dy, sizeof(double), 1, fp) == 1);
-  int N = data->nx * data->ny;
-  if(ok) ok = (fwrite(data->values, sizeof(double), N, fp) == N);
+  for(int j = 0; ok && j < data->ny; j++)
+    ok = (fwrite(&GET(data, 0, j), sizeof(double), data->nx, fp) == (size_t)data->nx);
   fclose(fp);
   if(!ok) {
     printf("Error writing data file '%s'\n", out);
@@ -240,7 +237,8 @@ int write_data_vtk(const data_t *data, const char *name,
   fprintf(fp, "  <AppendedData encoding=\"raw\">\n_");
 
   fwrite(&num_bytes, sizeof(uint64_t), 1, fp);
-  fwrite(data->values, sizeof(double), num_points, fp);
+  for(int j = 0; j < data->ny; j++)
+    fwrite(&GET(data, 0, j), sizeof(double), data->nx, fp);
 
   fprintf(fp, "  </AppendedData>\n");
   fprintf(fp, "</VTKFile>\n");
@@ -306,12 +304,24 @@ int init_data(data_t *data, int nx, int ny, double dx, double dy,
   data->ny = ny;
   data->dx = dx;
   data->dy = dy;
-  data->values = (double*)malloc(nx * ny * sizeof(double));
-  if(!data->values){
+
+  // Interior rows start on a FIELD_ALIGN boundary: the west ghosts are
+  // padded up to the alignment and the pitch is a whole number of lines
+  int align = FIELD_ALIGN / sizeof(double);
+  int pad = (GHOST_WIDTH + align - 1) / align * align;
+  data->ghost = GHOST_WIDTH;
+  data->pitch = (pad + nx + GHOST_WIDTH + align - 1) / align * align;
+  data->offset = GHOST_WIDTH * data->pitch + pad;
+
+  size_t count = FIELD_SPAN(data);
+  if(posix_memalign((void **)&data->storage, FIELD_ALIGN, count * sizeof(double))){
+    data->storage = data->values = NULL;
     printf("Error: Could not allocate data\n");
     return 1;
   }
-  for(int i = 0; i < nx * ny; i++) data->values[i] = val;
+  data->values = data->storage + data->offset;
+
+  for(size_t k = 0; k < count; k++) data->storage[k] = val;
   return 0;
 }
 
@@ -355,11 +365,15 @@ all_data_t* init_all_data(const parameters_t *param) {
     all_data->u = malloc(sizeof(data_t));
     all_data->v = malloc(sizeof(data_t));
     all_data->h_interp = malloc(sizeof(data_t));
+    all_data->hu = malloc(sizeof(data_t));
+    all_data->hv = malloc(sizeof(data_t));
 
     init_data(all_data->eta, nx, ny, param->dx, param->dy, 0.);
     init_data(all_data->u, nx + 1, ny, param->dx, param->dy, 0.);
     init_data(all_data->v, nx, ny + 1, param->dx, param->dy, 0.);
     init_data(all_data->h_interp, nx, ny, param->dx, param->dy, 0.);
+    init_data(all_data->hu, nx + 1, ny, param->dx, param->dy, 0.);
+    init_data(all_data->hv, nx, ny + 1, param->dx, param->dy, 0.);
 
    
 
@@ -373,7 +387,7 @@ all_data_t* init_all_data(const parameters_t *param) {
  */
 void free_data(data_t *data)
 {
-  free(data->values);
+  free(data->storage);
 }
 
 /**
@@ -384,6 +398,8 @@ void free_data(data_t *data)
 void free_all_data(all_data_t* all_data){
 
     free_data(all_data->h_interp);
+    free_data(all_data->hu);
+    free_data(all_data->hv);
     free_data(all_data->eta);
     free_data(all_data->u);
     free_data(all_data->v);
@@ -25,11 +25,23 @@ int main(int argc, char **argv) {
 
     parameters_t param;
     if (read_parameters(&param, argv[1])) {
-        MPI_Abort(topo.cart_comm, 1); 
+        MPI_Abort(MPI_COMM_WORLD, 1);
         return 1;
     }
+
+    // I/O servers write the snapshots the compute ranks send them, then stop
+    if (topo.io_comm != MPI_COMM_NULL) {
+        int err = run_io_server(&param, "water elevation", &topo);
+        cleanup_mpi_topology(&topo);
+        MPI_Finalize();
+        return err;
+    }
     if (topo.cart_rank == 0) print_parameters(&param);
 
+    // Select the SIMD kernel path (every rank sees the same CPU features)
+    const char *simd_path = init_simd();
+    if (topo.cart_rank == 0) printf(" - SIMD kernels: %s\n", simd_path);
+
     all_data_t* all_data = init_all_data(&param, &topo);
     if (all_data == NULL) {
         fprintf(stderr, "Failed to initialize all_data\n");
@@ -75,26 +87,46 @@ int main(int argc, char **argv) {
     //----------------------//
 
     // Interpolate bathymetry
-    interp_bathy(param, nx_glob, ny_glob, all_data, gdata, &topo);
+    interp_bathy(param, all_data, gdata, &topo);
 	  check_cfl(param, all_data, &topo);
+    report_load(param, all_data, &topo);
+    select_halo_backend(all_data, &topo);
+    select_halo_depth(param, all_data, &topo);
 
     // Loop over timestep
     double start = GET_TIME(); 
+    double output_time = 0.0;
     for (int n = 0; n < nt; n++) {
 
-		if (param.sampling_rate && !(n % param.sampling_rate)) 
-			gather_and_assemble_data(param, all_data, gdata, &topo, nx_glob, ny_glob, n);
-
-		if (topo.cart_rank == 0 && param.sampling_rate && !(n % param.sampling_rate)){
-			write_data_vtk((gdata->gathered_output), "water elevation", param.output_eta_filename, n);
-			
+		if (param.sampling_rate && !(n % param.sampling_rate)) {
+			double output_start = GET_TIME();
+			if (topo.io_server != MPI_PROC_NULL) {
+				send_io_block(all_data->eta, n, nx_glob, ny_glob, &all_data->io, &topo);
+			} else if (param.output == OUTPUT_PIECES) {
+				write_data_vtk_pieces(all_data->eta, "water elevation", param.output_eta_filename, n,
+				                      nx_glob, ny_glob, &topo);
+			} else if (param.output == OUTPUT_MPIIO) {
+				write_data_vtk_mpiio(all_data->eta, "water elevation", param.output_eta_filename, n,
+				                     nx_glob, ny_glob, &topo);
+			} else {
+				gather_and_assemble_data(param, all_data, gdata, &topo, nx_glob, ny_glob, n);
+				if (topo.cart_rank == 0)
+					write_data_vtk((gdata->gathered_output), "water elevation", param.output_eta_filename, n);
+			}
+			output_time += GET_TIME() - output_start;
 		}
 
-		boundary_conditions(param, all_data, &topo);
-		apply_source(n, nx_glob, ny_glob, param, all_data, gdata, &topo);
-		
-		update_eta(param, all_data, gdata, &topo);
-		update_velocities(param, all_data, gdata, &topo);
+		if (param.rebalance) start_balance_step(all_data);
+		if (all_data->deep.depth > 1) {
+			deep_halo_step(n, nx_glob, ny_glob, param, all_data, gdata, &topo);
+		} else {
+			boundary_conditions(param, all_data, &topo, 0);
+			apply_source(n, nx_glob, ny_glob, param, all_data, gdata, &topo, 0);
+
+			update_eta(param, all_data, gdata, &topo);
+			update_velocities(param, all_data, gdata, &topo);
+		}
+		if (param.rebalance) end_balance_step(n, nt, nx_glob, ny_glob, param, all_data, gdata, &topo);
 
 		if (topo.rank ==0) print_progress(n, nt, start, &topo);
 
@@ -105,6 +137,18 @@ int main(int argc, char **argv) {
     printf("\nDone: %g seconds (%g MUpdates/s)\n", time,
            1e-6 * (double)nx_glob * (double)ny_glob * (double)nt / time);
   }
+  double output_start = GET_TIME();
+  flush_io_blocks(&all_data->io);
+  output_time += GET_TIME() - output_start;
+  if (topo.rank == 0) printf("Output: %g seconds\n", output_time);
+
+  const char *extension = "vti";
+  if (topo.io_server != MPI_PROC_NULL) extension = param.io_raw ? NULL : "vti";
+  else if (param.output == OUTPUT_PIECES) extension = "pvti";
+  if (topo.rank == 0 && param.sampling_rate && extension)
+    write_manifest_vtk(param.output_eta_filename, param.dt, nt, param.sampling_rate, extension);
+  report_halo(all_data, nt, &topo);
+  if (param.rebalance) report_balance(all_data, &topo);
         
   // Clean up all variables
   MPI_Barrier(topo.cart_comm);
@@ -32,7 +32,7 @@ mkdir -p "$OUTPUT_PATH"
 
 # Compilation
 echo "Compiling..."
-mpicc -O3 -fopenmp -o "$BIN_PATH/shallow_mpi" "$SCRIPT_DIR/shallow_mpi.c" "$SCRIPT_DIR/tools_mpi.c" "$SCRIPT_DIR/main_mpi.c" -lm
+mpicc -O3 -fopenmp -o "$BIN_PATH/shallow_mpi" "$SCRIPT_DIR/shallow_mpi.c" "$SCRIPT_DIR/tools_mpi.c" "$SCRIPT_DIR/main_mpi.c" "$SCRIPT_DIR/simd_mpi.c" -lm
 
 # Run
 if [ $? -eq 0 ]; then
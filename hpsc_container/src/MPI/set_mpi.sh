@@ -29,7 +29,7 @@ fi
 chown -R $TMP_USER:$TMP_USER /opt/hpsc_container
 
 # Compilation
-mpicc -O3 -fopenmp -o ${BIN_PATH}/shallow_mpi shallow_mpi.c tools_mpi.c main_mpi.c -lm
+mpicc -O3 -fopenmp -o ${BIN_PATH}/shallow_mpi shallow_mpi.c tools_mpi.c main_mpi.c simd_mpi.c -lm
 
 # Execute as temporary user
 if [ $? -eq 0 ]; then
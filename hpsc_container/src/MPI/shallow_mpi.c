@@ -5,6 +5,7 @@
  ===========================================================*/
 
 #include "shallow_mpi.h"
+#include <sched.h>
 
 #undef MPI_STATUSES_IGNORE
 #define MPI_STATUSES_IGNORE (MPI_Status *)0 
@@ -41,6 +42,79 @@
  * INITIALIZATION AND CONFIGURATION FUNCTIONS 
  ===========================================================*/
 
+/**
+ * Sets the I/O servers of SHALLOW_IO_SERVERS apart from the compute ranks:
+ * a count takes the last ranks of MPI_COMM_WORLD and shares the compute
+ * ranks out in turn, "node" takes the last rank of every node, which
+ * serves the other ranks of its node
+ * 
+ * @param compute_comm Set to the communicator of the compute ranks
+ * @param topo MPI topology information (I/O fields set)
+ * @return 0 on success, 1 on failure
+ */
+static int split_io_servers(MPI_Comm *compute_comm, MPITopology *topo) {
+    int world_size, world_rank;
+    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+    MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+
+    *compute_comm = MPI_COMM_WORLD;
+    topo->io_comm = MPI_COMM_NULL;
+    topo->io_server = MPI_PROC_NULL;
+    topo->num_io_servers = topo->num_io_clients = 0;
+    topo->io_clients = NULL;
+
+    const char *request = getenv(IO_SERVERS_ENV);
+    if (!request || !*request || !strcmp(request, "0")) return 0;
+
+    // World rank of the server of every rank (itself for a server)
+    int server;
+    if (!strcmp(request, "node")) {
+        MPI_Comm node_comm;
+        MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node_comm);
+        MPI_Allreduce(&world_rank, &server, 1, MPI_INT, MPI_MAX, node_comm);
+        MPI_Comm_free(&node_comm);
+    } else {
+        int count = atoi(request);
+        if (count < 1 || count >= world_size) {
+            if (world_rank == 0)
+                fprintf(stderr, "Error: %s=%s must leave at least one of the %d ranks computing\n",
+                        IO_SERVERS_ENV, request, world_size);
+            return 1;
+        }
+        int first = world_size - count;
+        server = (world_rank >= first) ? world_rank : first + world_rank % count;
+    }
+
+    int *servers = malloc(world_size * sizeof(int));
+    topo->io_clients = malloc(world_size * sizeof(int));
+    if (!servers || !topo->io_clients) {
+        fprintf(stderr, "Rank %d: Failed to allocate the I/O server map\n", world_rank);
+        free(servers);
+        return 1;
+    }
+    MPI_Allgather(&server, 1, MPI_INT, servers, 1, MPI_INT, MPI_COMM_WORLD);
+    for (int w = 0; w < world_size; w++) {
+        if (servers[w] == w) topo->num_io_servers++;
+        else if (servers[w] == world_rank) topo->io_clients[topo->num_io_clients++] = w;
+    }
+    free(servers);
+    if (topo->num_io_servers == world_size) {
+        if (world_rank == 0)
+            fprintf(stderr, "Error: %s=%s leaves no rank computing\n", IO_SERVERS_ENV, request);
+        return 1;
+    }
+
+    int is_server = (server == world_rank);
+    MPI_Comm comm;
+    MPI_Comm_split(MPI_COMM_WORLD, is_server, world_rank, &comm);
+    if (is_server) topo->io_comm = comm;
+    else {
+        *compute_comm = comm;
+        topo->io_server = server;
+    }
+    return 0;
+}
+
 int initialize_mpi_topology(int argc, char **argv, MPITopology *topo) {
     int err;
     char error_string[MPI_MAX_ERROR_STRING];
@@ -50,10 +124,25 @@ int initialize_mpi_topology(int argc, char **argv, MPITopology *topo) {
     int reorder = 1;
     topo->dims[0] = 0;
     topo->dims[1] = 0;
+    topo->splits[0] = topo->splits[1] = NULL;
     
     MPI_Init(&argc, &argv);
-    MPI_Comm_size(MPI_COMM_WORLD, &topo->nb_process);
-    MPI_Comm_rank(MPI_COMM_WORLD, &topo->rank);
+
+    // I/O servers stay out of the Cartesian grid
+    MPI_Comm compute_comm;
+    if (split_io_servers(&compute_comm, topo)) {
+        MPI_Abort(MPI_COMM_WORLD, 1);
+        return 1;
+    }
+    if (topo->io_comm != MPI_COMM_NULL) {
+        topo->cart_comm = topo->node_comm = MPI_COMM_NULL;
+        MPI_Comm_size(topo->io_comm, &topo->nb_process);
+        topo->rank = topo->cart_rank = -1;
+        return 0;
+    }
+
+    MPI_Comm_size(compute_comm, &topo->nb_process);
+    MPI_Comm_rank(compute_comm, &topo->rank);
     MPI_Dims_create(topo->nb_process, 2, topo->dims);
     
     if (topo->dims[0] * topo->dims[1] != topo->nb_process) {
@@ -64,14 +153,32 @@ int initialize_mpi_topology(int argc, char **argv, MPITopology *topo) {
         return 1;
     }
     
-    MPI_Cart_create(MPI_COMM_WORLD, 2, topo->dims, periods, reorder, &topo->cart_comm);
+    MPI_Cart_create(compute_comm, 2, topo->dims, periods, reorder, &topo->cart_comm);
+    if (compute_comm != MPI_COMM_WORLD) MPI_Comm_free(&compute_comm);
     MPI_Comm_rank(topo->cart_comm, &topo->cart_rank);
     MPI_Cart_coords(topo->cart_comm, topo->cart_rank, 2, topo->coords);
     MPI_Cart_shift(topo->cart_comm, 0, 1, &topo->neighbors[LEFT], &topo->neighbors[RIGHT]);
     MPI_Cart_shift(topo->cart_comm, 1, 1, &topo->neighbors[DOWN], &topo->neighbors[UP]);
+
+    // Neighbours that can map our memory (shared-memory halo backend)
+    MPI_Group cart_group, node_group;
+    MPI_Comm_split_type(topo->cart_comm, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &topo->node_comm);
+    MPI_Comm_group(topo->cart_comm, &cart_group);
+    MPI_Comm_group(topo->node_comm, &node_group);
+    for (int side = 0; side < NEIGHBOR_NUM; side++) {
+        topo->node_neighbors[side] = MPI_PROC_NULL;
+        if (topo->neighbors[side] == MPI_PROC_NULL) continue;
+        int node_rank;
+        MPI_Group_translate_ranks(cart_group, 1, &topo->neighbors[side], node_group, &node_rank);
+        if (node_rank != MPI_UNDEFINED) topo->node_neighbors[side] = node_rank;
+    }
+    MPI_Group_free(&cart_group);
+    MPI_Group_free(&node_group);
         
     if (topo->rank == 0) {
         printf("Dimensions of the grid : %d x %d\n", topo->dims[0], topo->dims[1]);
+        if (topo->num_io_servers)
+            printf("I/O servers: %d\n", topo->num_io_servers);
         fflush(stdout);
     }
     
@@ -114,37 +221,26 @@ int initialize_gather_structures(const MPITopology *topo,
         }
     }
 
-    // Calculate base dimensions and remainders
-    int base_nx = nx_glob / topo->dims[0];
-    int base_ny = ny_glob / topo->dims[1];
-    int remainder_x = nx_glob % topo->dims[0];
-    int remainder_y = ny_glob % topo->dims[1];
-
-    // Keep track of current position
-    int current_x = 0;
-    int current_y = 0;
-
     if (topo->cart_rank == 0) {
         int total_offset = 0;
         
         // Search processes (in the order of the cartesian grid)
         for (int j = 0; j < topo->dims[1]; j++) {
-            current_x = 0;  // Reset X position for each row
-            
             for (int i = 0; i < topo->dims[0]; i++) {
                 int coords[2] = {i, j};
                 int rank;
                 MPI_Cart_rank(topo->cart_comm, coords, &rank);
 
-                // Calculate local dimensions
-                int local_nx = base_nx + (i < remainder_x ? 1 : 0);
-                int local_ny = base_ny + (j < remainder_y ? 1 : 0);
+                // Block of process column i and process row j (see decompose_domain)
+                int current_x = topo->splits[0][i];
+                int current_y = topo->splits[1][j];
+                int local_nx = topo->splits[0][i + 1] - current_x;
+                int local_ny = topo->splits[1][j + 1] - current_y;
 
                 // Set start and end positions for X direction
                 gdata->rank_glob[rank][0].start = current_x;
                 gdata->rank_glob[rank][0].n = local_nx;
                 gdata->rank_glob[rank][0].end = current_x + local_nx;
-                current_x += local_nx;
 
                 // Set start and end positions for Y direction
                 gdata->rank_glob[rank][1].start = current_y;
@@ -162,7 +258,6 @@ int initialize_gather_structures(const MPITopology *topo,
                 
                 total_offset += gdata->recv_size_eta[rank];
             }
-            current_y += base_ny + (j < remainder_y ? 1 : 0);  // Update Y position after each row
         }
 
         // Allocate reception buffers for rank 0
@@ -184,6 +279,9 @@ int initialize_gather_structures(const MPITopology *topo,
             gdata->gathered_output[i].dy = dy;
             gdata->gathered_output[i].vals = calloc(nx_glob * ny_glob, sizeof(double));
             if (!gdata->gathered_output[i].vals) return 1;
+            gdata->gathered_output[i].storage = gdata->gathered_output[i].vals;
+            gdata->gathered_output[i].ghost = 0;
+            gdata->gathered_output[i].pitch = nx_glob;
         }
     }
 
@@ -207,22 +305,780 @@ int initialize_gather_structures(const MPITopology *topo,
     return 0;
 }
 
+/*===========================================================
+ * DOMAIN DECOMPOSITION
+ ===========================================================*/
+
+/**
+ * Places the cuts of one axis by recursive bisection of its cell weights:
+ * the parts are split in two halves, and the cut leaves each side the
+ * weight of its parts (ties go to the cut closest to an even cell split)
+ * 
+ * @param prefix Weight of the cells before each position (n + 1 entries)
+ * @param lo, hi Cell range to split [lo, hi)
+ * @param first First part of the range
+ * @param parts Number of parts of the range
+ * @param min_cells Cells each part keeps at least
+ * @param splits Cuts (splits[first + k] starts part first + k)
+ */
+static void bisect_axis(const long long *prefix, int lo, int hi, int first, int parts,
+                        int min_cells, int *splits) {
+    if (parts < 2) return;
+    int left = parts / 2;
+    long long target = prefix[lo] + (prefix[hi] - prefix[lo]) * left / parts;
+    int even = lo + (int)((long long)(hi - lo) * left / parts);
+
+    int best = lo + left * min_cells;
+    for (int c = best; c <= hi - (parts - left) * min_cells; c++) {
+        long long gap = llabs(prefix[c] - target);
+        long long best_gap = llabs(prefix[best] - target);
+        if (gap < best_gap || (gap == best_gap && abs(c - even) < abs(best - even))) best = c;
+    }
+    splits[first + left] = best;
+    bisect_axis(prefix, lo, best, first, left, min_cells, splits);
+    bisect_axis(prefix, best, hi, first + left, parts - left, min_cells, splits);
+}
+
+/**
+ * Splits the global grid over the Cartesian process grid
+ * Uniform blocks by default. With SHALLOW_DECOMP=weighted every cell
+ * weighs its cost, derived from the interpolated depth (dry cells weigh
+ * SHALLOW_DRY_COST), and each axis is cut by recursive bisection of the
+ * weights of its columns/rows. The blocks stay a tensor product, so every
+ * rank keeps one neighbour per side sharing its whole edge
+ * 
+ * @param param Simulation parameters
+ * @param h Bathymetry header (each rank reads the patch of its rows)
+ * @param nx_glob, ny_glob Global grid dimensions
+ * @param topo MPI topology information (splits set in place)
+ * @return 0 on success, 1 on failure
+ */
+int decompose_domain(const parameters_t *param, const data_t *h,
+                     int nx_glob, int ny_glob, MPITopology *topo) {
+    const int n[2] = {nx_glob, ny_glob};
+    for (int a = 0; a < 2; a++) {
+        topo->splits[a] = malloc((topo->dims[a] + 1) * sizeof(int));
+        if (topo->splits[a] == NULL) return 1;
+        int base = n[a] / topo->dims[a];
+        int remainder = n[a] % topo->dims[a];
+        for (int p = 0; p <= topo->dims[a]; p++)
+            topo->splits[a][p] = p * base + (p < remainder ? p : remainder);
+    }
+    if (!param->weighted) return 0;
+
+    // Column and row weights, and the blocks of the uniform split for
+    // comparison; each rank interpolates a band of rows
+    int j0 = (int)((long long)ny_glob * topo->cart_rank / topo->nb_process);
+    int j1 = (int)((long long)ny_glob * (topo->cart_rank + 1) / topo->nb_process);
+    data_t band = *h;
+    long long *col = calloc(nx_glob + 1, sizeof(long long));
+    long long *row = calloc(ny_glob + 1, sizeof(long long));
+    long long *blocks = calloc(topo->nb_process, sizeof(long long));
+    int err = read_bathy_patch(&band, param->input_h_filename, 0.0, (nx_glob - 1) * param->dx,
+                               j0 * param->dy, (j1 - 1) * param->dy, topo);
+    if (!col || !row || !blocks || err) {
+        free(col);
+        free(row);
+        free(blocks);
+        free(band.storage);
+        return 1;
+    }
+
+    long long dry = llround(DECOMP_WEIGHT_SCALE * param->dry_cost);
+    for (int j = j0; j < j1; j++) {
+        int py = 0, px = 0;
+        while (topo->splits[1][py + 1] <= j) py++;
+        for (int i = 0; i < nx_glob; i++) {
+            while (topo->splits[0][px + 1] <= i) px++;
+            double depth = interpolate_data(&band, i * param->dx, j * param->dy);
+            long long w = (depth > param->dry_depth) ? DECOMP_WEIGHT_SCALE : dry;
+            col[i + 1] += w;
+            row[j + 1] += w;
+            blocks[py * topo->dims[0] + px] += w;
+        }
+    }
+    free(band.storage);
+    MPI_Allreduce(MPI_IN_PLACE, col, nx_glob + 1, MPI_LONG_LONG, MPI_SUM, topo->cart_comm);
+    MPI_Allreduce(MPI_IN_PLACE, row, ny_glob + 1, MPI_LONG_LONG, MPI_SUM, topo->cart_comm);
+    MPI_Allreduce(MPI_IN_PLACE, blocks, topo->nb_process, MPI_LONG_LONG, MPI_SUM, topo->cart_comm);
+
+    for (int i = 0; i < nx_glob; i++) col[i + 1] += col[i];
+    for (int j = 0; j < ny_glob; j++) row[j + 1] += row[j];
+    bisect_axis(col, 0, nx_glob, 0, topo->dims[0], 1, topo->splits[0]);
+    bisect_axis(row, 0, ny_glob, 0, topo->dims[1], 1, topo->splits[1]);
+
+    if (topo->cart_rank == 0) {
+        long long busiest = 0;
+        for (int r = 0; r < topo->nb_process; r++)
+            if (blocks[r] > busiest) busiest = blocks[r];
+        double mean = (double)col[nx_glob] / topo->nb_process;
+        printf(" - weighted decomposition: uniform blocks would load the busiest rank %.2fx the mean\n",
+               (mean > 0.0) ? busiest / mean : 1.0);
+    }
+    free(col);
+    free(row);
+    free(blocks);
+    return 0;
+}
+
+/**
+ * Prints the load of every rank before the first step (weighted
+ * decomposition only): block, cells, wet cells and share of the weight,
+ * computed from h_interp, and the weight of the busiest rank against the
+ * mean, which bounds the idle time of the others (the kernels skip land,
+ * so the weight is the work of a step)
+ * 
+ * @param param Simulation parameters
+ * @param all_data Data structures containing fields
+ * @param topo MPI topology information
+ */
+void report_load(const parameters_t param, const all_data_t *all_data, MPITopology *topo) {
+    if (!param.weighted) return;
+
+    const data_t *h = all_data->h_interp;
+    long long dry = llround(DECOMP_WEIGHT_SCALE * param.dry_cost);
+    long long load[3] = {(long long)h->nx * h->ny, 0, 0};
+    for (int j = 0; j < h->ny; j++)
+        for (int i = 0; i < h->nx; i++) {
+            int wet = GET(h, i, j) > param.dry_depth;
+            load[1] += wet;
+            load[2] += wet ? DECOMP_WEIGHT_SCALE : dry;
+        }
+
+    long long *loads = NULL;
+    if (topo->cart_rank == 0) {
+        loads = malloc(3 * topo->nb_process * sizeof(long long));
+        if (loads == NULL) fprintf(stderr, "Rank 0: Failed to allocate the load report\n");
+    }
+    MPI_Gather(load, 3, MPI_LONG_LONG, loads, 3, MPI_LONG_LONG, 0, topo->cart_comm);
+    if (loads == NULL) return;
+
+    long long total = 0, busiest = 0;
+    for (int r = 0; r < topo->nb_process; r++) {
+        total += loads[3 * r + 2];
+        if (loads[3 * r + 2] > busiest) busiest = loads[3 * r + 2];
+    }
+    printf("Load balance (dry at or below %g m, dry cost %g):\n", param.dry_depth, param.dry_cost);
+    printf("  rank  coords        block       cells   wet cells  weight\n");
+    for (int r = 0; r < topo->nb_process; r++) {
+        int coords[2];
+        MPI_Cart_coords(topo->cart_comm, r, 2, coords);
+        int bx = topo->splits[0][coords[0] + 1] - topo->splits[0][coords[0]];
+        int by = topo->splits[1][coords[1] + 1] - topo->splits[1][coords[1]];
+        printf("  %4d  (%d,%d)  %6d x %-6d %10lld  %10lld  %5.1f%%\n", r, coords[0], coords[1],
+               bx, by, loads[3 * r], loads[3 * r + 1],
+               (total > 0) ? 100.0 * loads[3 * r + 2] / total : 0.0);
+    }
+    double mean = (double)total / topo->nb_process;
+    printf(" - busiest rank: %.2fx the mean weight\n", (mean > 0.0) ? busiest / mean : 1.0);
+    fflush(stdout);
+    free(loads);
+}
+
+/*===========================================================
+ * HALO EXCHANGE
+ ===========================================================*/
+
+// Backend names accepted by SHALLOW_HALO
+static const char *halo_backend_names[HALO_BACKEND_NUM] = {"p2p", "neighbor", "rma", "shm"};
+
+// Neighbour order of the Cartesian communicator: dimension 0 then 1,
+// each as (source, destination) of MPI_Cart_shift
+static const int cart_order[NEIGHBOR_NUM] = {LEFT, RIGHT, DOWN, UP};
+
+/**
+ * Describes a field line exchanged with one neighbour
+ * Columns are strided by the row pitch (MPI_Type_vector), rows are
+ * contiguous (MPI_Type_contiguous); both are sent from and received into
+ * the field storage, with no packing
+ * 
+ * @param halo Exchange being described
+ * @param side Neighbour the line is exchanged with
+ * @param n Number of points in the line
+ * @param pitch Row pitch of the field (column stride)
+ * @param send, recv First element sent / received (NULL if none)
+ * @param send_tag, recv_tag Message tags
+ */
+static void halo_side(halo_t *halo, int side, int n, int pitch,
+                      double *send, double *recv, int send_tag, int recv_tag) {
+    if (side == LEFT || side == RIGHT)
+        MPI_Type_vector(n, 1, pitch, MPI_DOUBLE, &halo->type[side]);
+    else
+        MPI_Type_contiguous(n, MPI_DOUBLE, &halo->type[side]);
+    MPI_Type_commit(&halo->type[side]);
+
+    halo->length[side] = n;
+    halo->pitch[side] = pitch;
+    halo->send_buf[side] = send;
+    halo->recv_buf[side] = recv;
+    halo->send_tag[side] = send_tag;
+    halo->recv_tag[side] = recv_tag;
+}
+
+/**
+ * Clears an exchange so it can be described or freed safely
+ * 
+ * @param halo Exchange to clear
+ */
+void clear_halo(halo_t *halo) {
+    for (int side = 0; side < NEIGHBOR_NUM; side++) {
+        halo->send_buf[side] = halo->recv_buf[side] = NULL;
+        halo->type[side] = halo->target_type[side] = MPI_DATATYPE_NULL;
+        halo->peer_line[side] = NULL;
+        halo->peer_flags[side] = NULL;
+    }
+    halo->flags = NULL;
+    halo->epoch = 0;
+    halo->count = halo->remote_count = 0;
+    halo->backend = HALO_P2P;
+    halo->data = NULL;
+    halo->fields[0] = halo->fields[1] = NULL;
+    halo->win = MPI_WIN_NULL;
+    halo->post_group = halo->start_group = MPI_GROUP_NULL;
+    halo->time = halo->overlap = 0.0;
+}
+
+/**
+ * Creates persistent requests for the described sides (receives first)
+ * 
+ * @param halo Exchange whose sides are described
+ * @param topo MPI topology information
+ * @param off_node_only Skip the neighbours of this node
+ * @param req, count Requests created and their number
+ * @return MPI_SUCCESS or the OR of the MPI error codes
+ */
+static int side_requests(halo_t *halo, MPITopology *topo, int off_node_only,
+                         MPI_Request *req, int *count) {
+    int err = MPI_SUCCESS;
+    *count = 0;
+    for (int side = 0; side < NEIGHBOR_NUM; side++) {
+        int peer = topo->neighbors[side];
+        if (peer == MPI_PROC_NULL || !halo->recv_buf[side]) continue;
+        if (off_node_only && topo->node_neighbors[side] != MPI_PROC_NULL) continue;
+        err |= MPI_Recv_init(halo->recv_buf[side], 1, halo->type[side], peer,
+                             halo->recv_tag[side], topo->cart_comm, &req[(*count)++]);
+    }
+    for (int side = 0; side < NEIGHBOR_NUM; side++) {
+        int peer = topo->neighbors[side];
+        if (peer == MPI_PROC_NULL || !halo->send_buf[side]) continue;
+        if (off_node_only && topo->node_neighbors[side] != MPI_PROC_NULL) continue;
+        err |= MPI_Send_init(halo->send_buf[side], 1, halo->type[side], peer,
+                             halo->send_tag[side], topo->cart_comm, &req[(*count)++]);
+    }
+    return err;
+}
+
+/**
+ * Builds the persistent requests of the described sides that have a
+ * neighbour (receives first) and the arguments of the neighbourhood
+ * collective
+ * 
+ * @param halo Exchange whose sides are described
+ * @param topo MPI topology information
+ * @return 0 on success, 1 on failure
+ */
+static int halo_requests(halo_t *halo, MPITopology *topo) {
+    int err = MPI_SUCCESS;
+
+    for (int side = 0; side < NEIGHBOR_NUM; side++) halo->peer[side] = topo->neighbors[side];
+
+    // Neighbourhood collective: the same lines as absolute addresses
+    halo->comm = topo->cart_comm;
+    for (int k = 0; k < NEIGHBOR_NUM; k++) {
+        int side = cart_order[k];
+        halo->send_count[k] = halo->send_buf[side] ? 1 : 0;
+        halo->recv_count[k] = halo->recv_buf[side] ? 1 : 0;
+        halo->send_type[k] = halo->send_buf[side] ? halo->type[side] : MPI_DOUBLE;
+        halo->recv_type[k] = halo->recv_buf[side] ? halo->type[side] : MPI_DOUBLE;
+        halo->send_disp[k] = halo->recv_disp[k] = 0;
+        if (halo->send_buf[side]) MPI_Get_address(halo->send_buf[side], &halo->send_disp[k]);
+        if (halo->recv_buf[side]) MPI_Get_address(halo->recv_buf[side], &halo->recv_disp[k]);
+    }
+
+    // Every side with a neighbour, then only the off-node ones (shm backend)
+    err |= side_requests(halo, topo, 0, halo->requests, &halo->count);
+    err |= side_requests(halo, topo, 1, halo->remote, &halo->remote_count);
+
+    if (err != MPI_SUCCESS) {
+        fprintf(stderr, "Rank %d: Failed to create halo requests\n", topo->cart_rank);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Creates the persistent exchange of the edge lines of a field with the
+ * four neighbours. Sends read the first/last interior column and row,
+ * receives land directly in the ghost columns -1 and nx and the ghost rows
+ * -1 and ny. Sides without a neighbour get the edge values (see fill_ghosts)
+ * 
+ * @param halo Exchange to initialize
+ * @param data Field to exchange (nx x ny interior)
+ * @param tag Base tag, the exchange uses tag..tag+3
+ * @param topo MPI topology information
+ * @return 0 on success, 1 on failure
+ */
+int init_halo(halo_t *halo, data_t *data, int tag, MPITopology *topo) {
+    int nx = data->nx;
+    int ny = data->ny;
+
+    int pitch = data->pitch;
+
+    clear_halo(halo);
+    halo->data = data;
+    halo->fields[0] = data;
+    halo_side(halo, LEFT, ny, pitch, &GET(data, 0, 0), &GET(data, -1, 0), tag + 1, tag);
+    halo_side(halo, RIGHT, ny, pitch, &GET(data, nx - 1, 0), &GET(data, nx, 0), tag, tag + 1);
+    halo_side(halo, DOWN, nx, pitch, &GET(data, 0, 0), &GET(data, 0, -1), tag + 3, tag + 2);
+    halo_side(halo, UP, nx, pitch, &GET(data, 0, ny - 1), &GET(data, 0, ny), tag + 2, tag + 3);
+    return halo_requests(halo, topo);
+}
+
+/**
+ * Creates the persistent exchange of the faces shared with the east and
+ * north neighbours: our east u-faces and north v-faces are the neighbours'
+ * first ones, received straight into u(nx) and v(ny)
+ * 
+ * @param halo Exchange to initialize
+ * @param u, v Velocity fields
+ * @param tag Base tag, the exchange uses tag..tag+2
+ * @param topo MPI topology information
+ * @return 0 on success, 1 on failure
+ */
+int init_face_halo(halo_t *halo, data_t *u, data_t *v, int tag, MPITopology *topo) {
+    int nx = v->nx;
+    int ny = u->ny;
+
+    clear_halo(halo);
+    halo->fields[0] = u;
+    halo->fields[1] = v;
+    halo_side(halo, LEFT, ny, u->pitch, &GET(u, 0, 0), NULL, tag, 0);
+    halo_side(halo, RIGHT, ny, u->pitch, NULL, &GET(u, nx, 0), 0, tag);
+    halo_side(halo, DOWN, nx, v->pitch, &GET(v, 0, 0), NULL, tag + 2, 0);
+    halo_side(halo, UP, nx, v->pitch, NULL, &GET(v, 0, ny), 0, tag + 2);
+    return halo_requests(halo, topo);
+}
+
+/**
+ * Sets up the one-sided backend of an exchange (collective)
+ * Each rank sends every neighbour the address and pitch of the ghost line
+ * facing it, attaches its receiving fields to a dynamic window and builds
+ * the post/start groups of the PSCW epochs
+ * 
+ * @param halo Exchange to set up
+ * @param topo MPI topology information
+ * @return 0 on success, 1 on failure
+ */
+static int init_rma(halo_t *halo, MPITopology *topo) {
+    // A single rank has nothing to put (and may lack a one-sided transport)
+    if (halo->win != MPI_WIN_NULL || topo->nb_process == 1) return 0;
+
+    MPI_Aint mine[2 * NEIGHBOR_NUM], theirs[2 * NEIGHBOR_NUM];
+    for (int k = 0; k < NEIGHBOR_NUM; k++) {
+        int side = cart_order[k];
+        mine[2 * k] = halo->recv_disp[k];
+        mine[2 * k + 1] = halo->pitch[side];
+        theirs[2 * k] = theirs[2 * k + 1] = 0;
+    }
+    MPI_Neighbor_alltoall(mine, 2, MPI_AINT, theirs, 2, MPI_AINT, topo->cart_comm);
+
+    int post_ranks[NEIGHBOR_NUM], start_ranks[NEIGHBOR_NUM];
+    int num_post = 0, num_start = 0;
+    for (int k = 0; k < NEIGHBOR_NUM; k++) {
+        int side = cart_order[k];
+        int peer = topo->neighbors[side];
+        if (peer == MPI_PROC_NULL) continue;
+        if (halo->recv_buf[side]) post_ranks[num_post++] = peer;
+        if (!halo->send_buf[side]) continue;
+
+        start_ranks[num_start++] = peer;
+        halo->target_disp[side] = theirs[2 * k];
+        if (side == LEFT || side == RIGHT)
+            MPI_Type_vector(halo->length[side], 1, (int)theirs[2 * k + 1], MPI_DOUBLE,
+                            &halo->target_type[side]);
+        else
+            MPI_Type_contiguous(halo->length[side], MPI_DOUBLE, &halo->target_type[side]);
+        MPI_Type_commit(&halo->target_type[side]);
+    }
+
+    MPI_Group group;
+    MPI_Comm_group(topo->cart_comm, &group);
+    MPI_Group_incl(group, num_post, post_ranks, &halo->post_group);
+    MPI_Group_incl(group, num_start, start_ranks, &halo->start_group);
+    MPI_Group_free(&group);
+
+    if (MPI_Win_create_dynamic(MPI_INFO_NULL, topo->cart_comm, &halo->win) != MPI_SUCCESS) {
+        fprintf(stderr, "Rank %d: Failed to create the halo window\n", topo->cart_rank);
+        return 1;
+    }
+    for (int f = 0; f < 2; f++) {
+        data_t *data = halo->fields[f];
+        if (data == NULL) continue;
+        MPI_Win_attach(halo->win, data->storage,
+                       (MPI_Aint)data->pitch * (data->ny + 2 * data->ghost) * sizeof(double));
+    }
+    return 0;
+}
+
+/**
+ * Tells whether SHALLOW_HALO may select the shared-memory backend, in
+ * which case the fields must be allocated with init_shared_window
+ * 
+ * @return 1 for shm or bench, 0 otherwise
+ */
+int shared_halo_requested(void) {
+    const char *request = getenv(HALO_ENV);
+    return request && (!strcmp(request, "shm") || !strcmp(request, "bench"));
+}
+
+/**
+ * Allocates this rank's segment of the node-shared field window and the
+ * counters of the shared-memory backend (collective over the node)
+ * 
+ * @param shared Shared memory description (set in place)
+ * @param bytes Size of this rank's segment
+ * @param topo MPI topology information
+ * @return 0 on success, 1 on failure
+ */
+int init_shared_window(shared_t *shared, size_t bytes, MPITopology *topo) {
+    // Segments of different ranks are placed on separate pages
+    MPI_Info info;
+    MPI_Info_create(&info);
+    MPI_Info_set(info, "alloc_shared_noncontig", "true");
+    int err = MPI_Win_allocate_shared((MPI_Aint)bytes, 1, info, topo->node_comm,
+                                      &shared->base, &shared->win);
+    err |= MPI_Win_allocate_shared(SHM_FLAGS_BYTES, 1, info, topo->node_comm,
+                                   &shared->flags, &shared->flags_win);
+    MPI_Info_free(&info);
+
+    if (err != MPI_SUCCESS) {
+        fprintf(stderr, "Rank %d: Failed to allocate the shared field window\n", topo->cart_rank);
+        return 1;
+    }
+    memset(shared->flags, 0, SHM_FLAGS_BYTES);
+    MPI_Barrier(topo->node_comm);
+    return 0;
+}
+
+/**
+ * Frees the node-shared windows (collective over the node)
+ * 
+ * @param shared Shared memory description (left empty)
+ */
+void free_shared_window(shared_t *shared) {
+    if (shared->win != MPI_WIN_NULL) MPI_Win_free(&shared->win);
+    if (shared->flags_win != MPI_WIN_NULL) MPI_Win_free(&shared->flags_win);
+    shared->base = NULL;
+    shared->flags = NULL;
+}
+
+/**
+ * Sets up the shared-memory backend of an exchange (collective)
+ * Each rank sends every neighbour the offset and pitch of the line it
+ * copies from us; node-local neighbours map it through the shared window
+ * 
+ * @param halo Exchange to set up
+ * @param slot Counter pair of this exchange (0 or 1)
+ * @param shared Node-shared windows holding the fields
+ * @param topo MPI topology information
+ * @return 0 on success, 1 on failure
+ */
+static int init_shm(halo_t *halo, int slot, const shared_t *shared, MPITopology *topo) {
+    if (shared->win == MPI_WIN_NULL) return 1;
+
+    MPI_Aint mine[2 * NEIGHBOR_NUM], theirs[2 * NEIGHBOR_NUM];
+    for (int k = 0; k < NEIGHBOR_NUM; k++) {
+        int side = cart_order[k];
+        mine[2 * k] = halo->send_buf[side] ? (char *)halo->send_buf[side] - shared->base : -1;
+        mine[2 * k + 1] = halo->pitch[side];
+        theirs[2 * k] = -1;
+        theirs[2 * k + 1] = 0;
+    }
+    MPI_Neighbor_alltoall(mine, 2, MPI_AINT, theirs, 2, MPI_AINT, topo->cart_comm);
+
+    halo->flags = shared->flags + 2 * slot;
+    halo->epoch = 0;
+    for (int k = 0; k < NEIGHBOR_NUM; k++) {
+        int side = cart_order[k];
+        int peer = topo->node_neighbors[side];
+        if (peer == MPI_PROC_NULL) continue;
+
+        MPI_Aint size;
+        int disp_unit;
+        char *base;
+        long *flags;
+        MPI_Win_shared_query(shared->win, peer, &size, &disp_unit, &base);
+        MPI_Win_shared_query(shared->flags_win, peer, &size, &disp_unit, &flags);
+        halo->peer_flags[side] = flags + 2 * slot;
+        if (halo->recv_buf[side] && theirs[2 * k] >= 0) {
+            halo->peer_line[side] = (const double *)(base + theirs[2 * k]);
+            halo->peer_pitch[side] = (int)theirs[2 * k + 1];
+        }
+    }
+    return 0;
+}
+
+/**
+ * Spins until a neighbour's counter reaches the current round
+ * 
+ * @param flag Neighbour's counter
+ * @param epoch Round to wait for
+ */
+static void wait_flag(volatile long *flag, long epoch) {
+    while (__atomic_load_n(flag, __ATOMIC_ACQUIRE) < epoch) sched_yield();
+}
+
+/**
+ * Copies the node-local neighbours' lines into our ghosts, then tells the
+ * neighbours we are done with theirs
+ * 
+ * @param halo Exchange of the current round
+ */
+static void copy_shared_lines(halo_t *halo) {
+    for (int side = 0; side < NEIGHBOR_NUM; side++) {
+        const double *src = halo->peer_line[side];
+        if (src == NULL) continue;
+        wait_flag(&halo->peer_flags[side][0], halo->epoch);
+
+        double *dst = halo->recv_buf[side];
+        int n = halo->length[side];
+        if (side == LEFT || side == RIGHT) {
+            for (int k = 0; k < n; k++)
+                dst[(size_t)k * halo->pitch[side]] = src[(size_t)k * halo->peer_pitch[side]];
+        } else {
+            memcpy(dst, src, n * sizeof(double));
+        }
+    }
+    __atomic_store_n(&halo->flags[1], halo->epoch, __ATOMIC_RELEASE);
+}
+
+/**
+ * Starts one round of an exchange with the selected backend
+ * 
+ * @param halo Exchange to start
+ */
+void start_halo(halo_t *halo) {
+    double t0 = MPI_Wtime();
+    if (halo->backend == HALO_NEIGHBOR) {
+        MPI_Ineighbor_alltoallw(MPI_BOTTOM, halo->send_count, halo->send_disp, halo->send_type,
+                                MPI_BOTTOM, halo->recv_count, halo->recv_disp, halo->recv_type,
+                                halo->comm, &halo->collective);
+    } else if (halo->backend == HALO_RMA && halo->win != MPI_WIN_NULL) {
+        // Expose our ghosts to the neighbours, then put our lines into theirs
+        MPI_Win_post(halo->post_group, 0, halo->win);
+        MPI_Win_start(halo->start_group, 0, halo->win);
+        for (int side = 0; side < NEIGHBOR_NUM; side++) {
+            if (halo->target_type[side] == MPI_DATATYPE_NULL) continue;
+            MPI_Put(halo->send_buf[side], 1, halo->type[side], halo->peer[side],
+                    halo->target_disp[side], 1, halo->target_type[side], halo->win);
+        }
+    } else if (halo->backend == HALO_SHM) {
+        // Our lines are final: node-local neighbours may copy them
+        halo->epoch++;
+        __atomic_store_n(&halo->flags[0], halo->epoch, __ATOMIC_RELEASE);
+        if (halo->remote_count > 0) MPI_Startall(halo->remote_count, halo->remote);
+    } else if (halo->count > 0)
+        MPI_Startall(halo->count, halo->requests);
+    halo->started = MPI_Wtime();
+    halo->time += halo->started - t0;
+}
+
+/**
+ * Completes the round started by start_halo; the wall ghosts of the field
+ * are filled while the messages are in flight
+ * 
+ * @param halo Exchange to complete
+ * @param topo MPI topology information
+ */
+void wait_halo(halo_t *halo, const MPITopology *topo) {
+    double t0 = MPI_Wtime();
+    halo->overlap += t0 - halo->started;
+    if (halo->data) fill_ghosts(halo->data, topo, 0);
+    if (halo->backend == HALO_NEIGHBOR) {
+        MPI_Wait(&halo->collective, MPI_STATUS_IGNORE);
+    } else if (halo->backend == HALO_RMA && halo->win != MPI_WIN_NULL) {
+        MPI_Win_complete(halo->win);
+        MPI_Win_wait(halo->win);
+    } else if (halo->backend == HALO_SHM) {
+        copy_shared_lines(halo);
+        if (halo->remote_count > 0)
+            MPI_Waitall(halo->remote_count, halo->remote, MPI_STATUSES_IGNORE);
+        // Our lines may change once the neighbours have copied them
+        for (int side = 0; side < NEIGHBOR_NUM; side++)
+            if (halo->peer_flags[side] && halo->send_buf[side])
+                wait_flag(&halo->peer_flags[side][1], halo->epoch);
+    } else if (halo->count > 0)
+        MPI_Waitall(halo->count, halo->requests, MPI_STATUSES_IGNORE);
+    halo->time += MPI_Wtime() - t0;
+}
+
+/**
+ * Times HALO_BENCH_ROUNDS eta exchanges with each backend
+ * The slowest rank sets the time of a backend, so every rank picks the same
+ * 
+ * @param all_data Data structures holding the exchanges
+ * @param topo MPI topology information
+ * @return Fastest backend
+ */
+static int benchmark_halo(all_data_t *all_data, MPITopology *topo) {
+    halo_t *halo = &all_data->halo_eta;
+    int best = HALO_P2P;
+    double best_time = 0.0;
+
+    for (int backend = 0; backend < HALO_BACKEND_NUM; backend++) {
+        halo->backend = backend;
+        MPI_Barrier(topo->cart_comm);
+        double t0 = MPI_Wtime();
+        for (int r = 0; r < HALO_BENCH_ROUNDS; r++) {
+            start_halo(halo);
+            wait_halo(halo, topo);
+        }
+        double time = (MPI_Wtime() - t0) / HALO_BENCH_ROUNDS;
+        MPI_Allreduce(MPI_IN_PLACE, &time, 1, MPI_DOUBLE, MPI_MAX, topo->cart_comm);
+
+        if (topo->cart_rank == 0)
+            printf(" - halo benchmark: %-8s %8.2f us/exchange\n",
+                   halo_backend_names[backend], 1e6 * time);
+        if (backend == 0 || time < best_time) {
+            best = backend;
+            best_time = time;
+        }
+    }
+
+    halo->time = halo->overlap = 0.0;
+    return best;
+}
+
+/**
+ * Sets up the windows of the backends SHALLOW_HALO may select (collective,
+ * before any rank uses them)
+ * 
+ * @param all_data Data structures holding the exchanges
+ * @param request Value of SHALLOW_HALO (NULL if unset)
+ * @param topo MPI topology information
+ */
+static void init_halo_windows(all_data_t *all_data, const char *request, MPITopology *topo) {
+    if (request && (!strcmp(request, "rma") || !strcmp(request, "bench"))) {
+        if (init_rma(&all_data->halo_faces, topo) || init_rma(&all_data->halo_eta, topo))
+            MPI_Abort(topo->cart_comm, 1);
+    }
+    if (shared_halo_requested()) {
+        if (init_shm(&all_data->halo_faces, 0, &all_data->shared, topo) ||
+            init_shm(&all_data->halo_eta, 1, &all_data->shared, topo))
+            MPI_Abort(topo->cart_comm, 1);
+    }
+}
+
+/**
+ * Selects the halo backend from SHALLOW_HALO: p2p (default), neighbor,
+ * rma, shm, or bench to time them all inside the solver and keep the
+ * fastest
+ * 
+ * @param all_data Data structures holding the exchanges
+ * @param topo MPI topology information
+ */
+void select_halo_backend(all_data_t *all_data, MPITopology *topo) {
+    const char *request = getenv(HALO_ENV);
+    int backend = HALO_P2P;
+
+    init_halo_windows(all_data, request, topo);
+    if (request && !strcmp(request, "bench")) {
+        backend = benchmark_halo(all_data, topo);
+    } else if (request && *request) {
+        int found = 0;
+        for (int b = 0; b < HALO_BACKEND_NUM; b++)
+            if (!strcmp(request, halo_backend_names[b])) backend = b, found = 1;
+        if (!found && topo->cart_rank == 0)
+            printf("Warning: unknown halo backend '%s', using %s\n",
+                   request, halo_backend_names[HALO_P2P]);
+    }
+
+    all_data->halo_faces.backend = backend;
+    all_data->halo_eta.backend = backend;
+    if (topo->cart_rank == 0)
+        printf(" - halo backend: %s\n", halo_backend_names[backend]);
+}
+
+/**
+ * Releases the persistent requests, the line datatypes and the window
+ * 
+ * @param halo Exchange to free (left empty)
+ */
+void free_halo(halo_t *halo) {
+    for (int r = 0; r < halo->count; r++) MPI_Request_free(&halo->requests[r]);
+    for (int r = 0; r < halo->remote_count; r++) MPI_Request_free(&halo->remote[r]);
+    halo->count = halo->remote_count = 0;
+    for (int side = 0; side < NEIGHBOR_NUM; side++) {
+        if (halo->type[side] != MPI_DATATYPE_NULL) MPI_Type_free(&halo->type[side]);
+        if (halo->target_type[side] != MPI_DATATYPE_NULL) MPI_Type_free(&halo->target_type[side]);
+    }
+
+    if (halo->win != MPI_WIN_NULL) {
+        for (int f = 0; f < 2; f++)
+            if (halo->fields[f]) MPI_Win_detach(halo->win, halo->fields[f]->storage);
+        MPI_Win_free(&halo->win);
+    }
+    if (halo->post_group != MPI_GROUP_NULL) MPI_Group_free(&halo->post_group);
+    if (halo->start_group != MPI_GROUP_NULL) MPI_Group_free(&halo->start_group);
+}
+
+/**
+ * Reports the halo exchange latency per time step (both exchanges),
+ * averaged over the run, with its spread over the ranks, and the
+ * computation done while the messages were in flight. Comparing with a
+ * SHALLOW_OVERLAP=0 run shows how much of the exchange was hidden; deep
+ * halos (depth > 1) are not overlapped, so no overlap is reported for them
+ * 
+ * @param all_data Data structures holding the exchanges
+ * @param nt Number of time steps
+ * @param topo MPI topology information
+ */
+void report_halo(const all_data_t *all_data, int nt, MPITopology *topo) {
+    if (nt <= 0) return;
+    double step = (all_data->halo_faces.time + all_data->halo_eta.time + all_data->deep.time) / nt;
+    double overlap = (all_data->halo_faces.overlap + all_data->halo_eta.overlap) / nt;
+    double min, max, sum, overlap_sum;
+    double traffic[2] = {all_data->deep.messages, all_data->deep.bytes}, traffic_sum[2];
+    MPI_Reduce(traffic, traffic_sum, 2, MPI_DOUBLE, MPI_SUM, 0, topo->cart_comm);
+    MPI_Reduce(&step, &min, 1, MPI_DOUBLE, MPI_MIN, 0, topo->cart_comm);
+    MPI_Reduce(&step, &max, 1, MPI_DOUBLE, MPI_MAX, 0, topo->cart_comm);
+    MPI_Reduce(&step, &sum, 1, MPI_DOUBLE, MPI_SUM, 0, topo->cart_comm);
+    MPI_Reduce(&overlap, &overlap_sum, 1, MPI_DOUBLE, MPI_SUM, 0, topo->cart_comm);
+
+    if (topo->cart_rank == 0) {
+        printf("Halo exchange: %.2f us/step (min %.2f, max %.2f over %d ranks)\n",
+               1e6 * sum / topo->nb_process, 1e6 * min, 1e6 * max, topo->nb_process);
+        if (all_data->deep.depth > 1)
+            printf("Halo overlap: not applicable at depth %d (deep halos are waited for)\n",
+                   all_data->deep.depth);
+        else
+            printf("Halo overlap: %.2f us/step of computation while messages were in flight\n",
+                   1e6 * overlap_sum / topo->nb_process);
+        printf("Halo traffic: %.2f messages/step, %.2f KiB/step per rank (depth %d)\n",
+               traffic_sum[0] / topo->nb_process, traffic_sum[1] / (1024.0 * topo->nb_process),
+               all_data->deep.depth);
+    }
+}
+
 /*===========================================================
  * PREPROCESS AND INTERPOLATION FUNCTIONS 
  ===========================================================*/
 double interpolate_data(const data_t *data,
-                        int nx_glob, int ny_glob,
                         double x, 
                         double y) {
 
    int i = (int)(x / data->dx);
    int j = (int)(y / data->dy);
-
-   // Boundary cases
-   if (i < 0 || j < 0 || i >= nx_glob - 1 || j >= ny_glob - 1) {
-       i = (i < 0) ? 0 : (i >= nx_glob) ? nx_glob - 1 : i;
-       j = (j < 0) ? 0 : (j >= ny_glob) ? ny_glob - 1 : j;
-       return GET(data, i, j);
+   int pi = i - data->x0;   // position in the patch read by this rank
+   int pj = j - data->y0;
+
+   // Boundary cases: clamp to the bathymetry grid itself, which may be
+   // coarser than the simulation grid (the padded layout no longer lets an
+   // overrun wrap onto the next row)
+   if (i < 0 || j < 0 || i >= data->nx - 1 || j >= data->ny - 1) {
+       i = (i < 0) ? 0 : (i >= data->nx) ? data->nx - 1 : i;
+       j = (j < 0) ? 0 : (j >= data->ny) ? data->ny - 1 : j;
+       return GET(data, i - data->x0, j - data->y0);
    }
 
    // Four positions surrounding (x,y)
@@ -232,10 +1088,10 @@ double interpolate_data(const data_t *data,
    double y2 = (j + 1) * data->dy;
 
    // Four vals of data surrounding (i,j)
-   double Q11 = GET(data, i, j);
-   double Q12 = GET(data, i, j + 1);
-   double Q21 = GET(data, i + 1, j);
-   double Q22 = GET(data, i + 1, j + 1);
+   double Q11 = GET(data, pi, pj);
+   double Q12 = GET(data, pi, pj + 1);
+   double Q21 = GET(data, pi + 1, pj);
+   double Q22 = GET(data, pi + 1, pj + 1);
 
    // Weighted coef
    double wx = (x2 - x) / (x2 - x1);
@@ -251,7 +1107,6 @@ double interpolate_data(const data_t *data,
 }
 
 void interp_bathy(const parameters_t param,
-                  int nx_glob, int ny_glob,
                   all_data_t *all_data,
                   gather_data_t *gdata, 
                   MPITopology *topo) {
@@ -261,85 +1116,147 @@ void interp_bathy(const parameters_t param,
     int local_nx = all_data->h_interp->nx;
     int local_ny = all_data->h_interp->ny;
 
+    // Only the bathymetry under this block is read, and released after use
+    if (read_bathy_patch(all_data->h, param.input_h_filename,
+                         start_i * param.dx, (start_i + local_nx - 1) * param.dx,
+                         start_j * param.dy, (start_j + local_ny - 1) * param.dy, topo))
+        MPI_Abort(topo->cart_comm, 1);
     
     for(int i = 0; i < local_nx; i++) {
         for(int j = 0; j < local_ny; j++) {
             double x = (i + start_i) * param.dx;
             double y = (j + start_j) * param.dy;
-            double val = interpolate_data(all_data->h, nx_glob, ny_glob, x, y);
+            double val = interpolate_data(all_data->h, x, y);
             SET(all_data->h_interp, i, j, val);
         }
     }
+    free(all_data->h->storage);
+    all_data->h->storage = all_data->h->vals = NULL;
+
+    // Neighbour depths land in the ghost column nx and ghost row ny
+    halo_t halo;
+    if (init_halo(&halo, all_data->h_interp, 0, topo)) MPI_Abort(topo->cart_comm, 1);
+    start_halo(&halo);
+    wait_halo(&halo, topo);
+    free_halo(&halo);
+
+    // Face coefficients for update_eta. A face takes the depth of the cell
+    // on its east/north side, so both ranks of a boundary agree on it; at
+    // the domain walls the ghost cells repeat the last cell of the row/column.
+    // With SHALLOW_DECOMP=weighted, cells at or below the dry depth are land
+    // and the faces next to them are closed
+    double c1_x = param.dt / param.dx;
+    double c1_y = param.dt / param.dy;
+    const data_t *h = all_data->h_interp;
+    double dry = param.weighted ? param.dry_depth : -INFINITY;
 
-    MPI_Request request_recv[4] = {MPI_REQUEST_NULL};
-    MPI_Request request_send[4] = {MPI_REQUEST_NULL};
-    MPI_Status status[4];
+    for (int j = 0; j < local_ny; j++) {
+        for (int i = 0; i <= local_nx; i++) {
+            int closed = GET(h, i - 1, j) <= dry || GET(h, i, j) <= dry;
+            SET(all_data->hu, i, j, closed ? 0.0 : c1_x * GET(h, i, j));
+        }
+    }
 
-    double *send_left = calloc(local_ny, sizeof(double));
-    double *send_right = calloc(local_ny, sizeof(double));
-    double *send_down = calloc(local_nx, sizeof(double));
-    double *send_up = calloc(local_nx, sizeof(double));
-    
-    double *recv_left = NULL;
-    double *recv_right = NULL;
-    double *recv_down = NULL;
-    double *recv_up = NULL;
+    for (int j = 0; j <= local_ny; j++) {
+        for (int i = 0; i < local_nx; i++) {
+            int closed = GET(h, i, j - 1) <= dry || GET(h, i, j) <= dry;
+            SET(all_data->hv, i, j, closed ? 0.0 : c1_y * GET(h, i, j));
+        }
+    }
 
-    if (topo->neighbors[LEFT] != MPI_PROC_NULL) recv_left = calloc(local_ny, sizeof(double));
-    if (topo->neighbors[RIGHT] != MPI_PROC_NULL) recv_right = calloc(local_ny, sizeof(double));
-    if (topo->neighbors[DOWN] != MPI_PROC_NULL) recv_down = calloc(local_nx, sizeof(double));
-    if (topo->neighbors[UP] != MPI_PROC_NULL) recv_up = calloc(local_nx, sizeof(double));
+    if (param.weighted && build_wet_runs(all_data)) {
+        fprintf(stderr, "Rank %d: Failed to allocate the wet runs\n", topo->cart_rank);
+        MPI_Abort(topo->cart_comm, 1);
+    }
+}
 
-    for (int j = 0; j < local_ny; j++) {
-        send_left[j] = GET(all_data->h_interp, 0, j);
-        send_right[j] = GET(all_data->h_interp, local_nx-1, j);
-    }
-    for (int i = 0; i < local_nx; i++) {
-        send_down[i] = GET(all_data->h_interp, i, 0);
-        send_up[i] = GET(all_data->h_interp, i, local_ny-1);
-    }
-
-    int recv_count = 0;
-    if (topo->neighbors[LEFT] != MPI_PROC_NULL)
-        MPI_Irecv(recv_left, local_ny, MPI_DOUBLE, topo->neighbors[LEFT], 0,
-                  topo->cart_comm, &request_recv[recv_count++]);
-    if (topo->neighbors[RIGHT] != MPI_PROC_NULL)
-        MPI_Irecv(recv_right, local_ny, MPI_DOUBLE, topo->neighbors[RIGHT], 1,
-                  topo->cart_comm, &request_recv[recv_count++]);
-    if (topo->neighbors[DOWN] != MPI_PROC_NULL)
-        MPI_Irecv(recv_down, local_nx, MPI_DOUBLE, topo->neighbors[DOWN], 2,
-                  topo->cart_comm, &request_recv[recv_count++]);
-    if (topo->neighbors[UP] != MPI_PROC_NULL)
-        MPI_Irecv(recv_up, local_nx, MPI_DOUBLE, topo->neighbors[UP], 3,
-                  topo->cart_comm, &request_recv[recv_count++]);
-
-    int send_count = 0;
-    if (topo->neighbors[RIGHT] != MPI_PROC_NULL)
-        MPI_Isend(send_right, local_ny, MPI_DOUBLE, topo->neighbors[RIGHT], 0,
-                  topo->cart_comm, &request_send[send_count++]);
-    if (topo->neighbors[LEFT] != MPI_PROC_NULL)
-        MPI_Isend(send_left, local_ny, MPI_DOUBLE, topo->neighbors[LEFT], 1,
-                  topo->cart_comm, &request_send[send_count++]);
-    if (topo->neighbors[UP] != MPI_PROC_NULL)
-        MPI_Isend(send_up, local_nx, MPI_DOUBLE, topo->neighbors[UP], 2,
-                  topo->cart_comm, &request_send[send_count++]);
-    if (topo->neighbors[DOWN] != MPI_PROC_NULL)
-        MPI_Isend(send_down, local_nx, MPI_DOUBLE, topo->neighbors[DOWN], 3,
-                  topo->cart_comm, &request_send[send_count++]);
-
-    if (recv_count > 0) MPI_Waitall(recv_count, request_recv, status);
-    if (send_count > 0) MPI_Waitall(send_count, request_send, status);
+/**
+ * Tells whether the eta update of a cell can change it: with its four
+ * faces closed, the flux difference is exactly zero
+ */
+static int eta_open(const all_data_t *all_data, int i, int j) {
+    return GET(all_data->hu, i, j) != 0.0 || GET(all_data->hu, i + 1, j) != 0.0
+        || GET(all_data->hv, i, j) != 0.0 || GET(all_data->hv, i, j + 1) != 0.0;
+}
 
-    MPI_Barrier(topo->cart_comm);
+// Velocities on closed faces stay at rest
+static int u_open(const all_data_t *all_data, int i, int j) {
+    return GET(all_data->hu, i, j) != 0.0;
+}
 
-    free(send_left);
-    free(send_right);
-    free(send_down);
-    free(send_up);
-    if (recv_left) free(recv_left);
-    if (recv_right) free(recv_right);
-    if (recv_down) free(recv_down);
-    if (recv_up) free(recv_up);
+static int v_open(const all_data_t *all_data, int i, int j) {
+    return GET(all_data->hv, i, j) != 0.0;
+}
+
+/**
+ * Collects the runs of open points of every row of a field, ghost rows and
+ * columns included (the deep halos update them)
+ * 
+ * @param wet Runs to build (previous runs are released)
+ * @param all_data Data structures containing fields
+ * @param field Field swept by the kernel
+ * @param open Whether the kernel can change a point
+ * @return 0 on success, 1 on failure
+ */
+static int build_runs(wet_runs_t *wet, const all_data_t *all_data, const data_t *field,
+                      int (*open)(const all_data_t *, int, int)) {
+    int g = field->ghost;
+    free(wet->first);
+    free(wet->runs);
+    wet->row0 = -g;
+    wet->num_rows = field->ny + 2 * g;
+    wet->first = malloc((wet->num_rows + 1) * sizeof(int));
+    // At most one run every other column
+    wet->runs = malloc((size_t)wet->num_rows * (field->nx / 2 + g + 1) * 2 * sizeof(int));
+    if (!wet->first || !wet->runs) return 1;
+
+    int count = 0;
+    for (int r = 0; r < wet->num_rows; r++) {
+        int j = wet->row0 + r;
+        wet->first[r] = count;
+        for (int i = -g; i < field->nx + g; i++) {
+            if (!open(all_data, i, j)) continue;
+            wet->runs[2 * count] = i;
+            while (i < field->nx + g && open(all_data, i, j)) i++;
+            wet->runs[2 * count + 1] = i;
+            count++;
+        }
+    }
+    wet->first[wet->num_rows] = count;
+
+    int *runs = realloc(wet->runs, (2 * (size_t)count + 1) * sizeof(int));
+    if (runs) wet->runs = runs;
+    return 0;
+}
+
+/**
+ * Builds the runs of points the kernels update from the face coefficients:
+ * land cells (all faces closed) keep their elevation and closed faces keep
+ * their velocity at rest, so eta_block and gradient_block skip them and a
+ * dry cell costs a fraction of a wet one (SHALLOW_DRY_COST). Called once
+ * hu and hv are final (again after the deep halos complete them)
+ * 
+ * @param all_data Data structures containing fields
+ * @return 0 on success, 1 on failure
+ */
+int build_wet_runs(all_data_t *all_data) {
+    return build_runs(&all_data->wet_eta, all_data, all_data->eta, eta_open)
+         | build_runs(&all_data->wet_u, all_data, all_data->u, u_open)
+         | build_runs(&all_data->wet_v, all_data, all_data->v, v_open);
+}
+
+/**
+ * Releases the runs of the kernels (every point is updated again)
+ * 
+ * @param all_data Data structures containing fields
+ */
+void free_wet_runs(all_data_t *all_data) {
+    wet_runs_t *wets[] = {&all_data->wet_eta, &all_data->wet_u, &all_data->wet_v};
+    for (int f = 0; f < 3; f++) {
+        free(wets[f]->first);
+        free(wets[f]->runs);
+        memset(wets[f], 0, sizeof(wet_runs_t));
+    }
 }
 
 void check_cfl(parameters_t param, all_data_t *all_data, MPITopology *topo) {
@@ -354,7 +1271,7 @@ void check_cfl(parameters_t param, all_data_t *all_data, MPITopology *topo) {
     }
 
     double global_h_max;
-    MPI_Allreduce(&h_max, &global_h_max, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    MPI_Allreduce(&h_max, &global_h_max, 1, MPI_DOUBLE, MPI_MAX, topo->cart_comm);
 
     double c = sqrt(param.g * global_h_max);
 
@@ -378,10 +1295,21 @@ void check_cfl(parameters_t param, all_data_t *all_data, MPITopology *topo) {
 /*===========================================================
  * BOUNDARY CONDITIONS AND SOURCE TERMS
  ===========================================================*/
-void boundary_conditions(const parameters_t param, all_data_t *all_data, MPITopology *topo) {
+/**
+ * Closes the domain walls: zero normal velocity on the wall faces
+ * 
+ * @param param Simulation parameters
+ * @param all_data Data structures containing fields
+ * @param topo MPI topology information
+ * @param ext Cells past the interior covered towards the neighbours (deep halo)
+ */
+void boundary_conditions(const parameters_t param, all_data_t *all_data, MPITopology *topo,
+                         int ext) {
+    int e[NEIGHBOR_NUM];
+    halo_extent(topo, ext, e);
 
     
-    for (int j = 0; j < all_data->u->ny; j++) {
+    for (int j = -e[DOWN]; j < all_data->u->ny + e[UP]; j++) {
         if (topo->neighbors[LEFT] == MPI_PROC_NULL) {
             SET(all_data->u, 0, j, 0.0);
         }
@@ -391,7 +1319,7 @@ void boundary_conditions(const parameters_t param, all_data_t *all_data, MPITopo
     }
 
     
-    for (int i = 0; i < all_data->v->nx; i++) {
+    for (int i = -e[LEFT]; i < all_data->v->nx + e[RIGHT]; i++) {
         if (topo->neighbors[DOWN] == MPI_PROC_NULL) {
             SET(all_data->v, i, 0, 0.0);
         }
@@ -401,11 +1329,25 @@ void boundary_conditions(const parameters_t param, all_data_t *all_data, MPITopo
     }
 }
 
+/**
+ * Drives the water with the selected source at time step timestep
+ * 
+ * @param timestep Current time step
+ * @param nx_glob, ny_glob Global grid dimensions
+ * @param param Simulation parameters
+ * @param all_data Data structures containing fields
+ * @param gdata Global positions of the ranks
+ * @param topo MPI topology information
+ * @param ext Cells past the interior covered towards the neighbours (deep halo)
+ */
 void apply_source(int timestep, int nx_glob, int ny_glob,
                   const parameters_t param,
                   all_data_t *all_data,
                   gather_data_t *gdata,
-                  MPITopology *topo) {
+                  MPITopology *topo,
+                  int ext) {
+    int e[NEIGHBOR_NUM];
+    halo_extent(topo, ext, e);
     
     double t = timestep * param.dt;
     const double A = 5.0;        
@@ -421,7 +1363,7 @@ void apply_source(int timestep, int nx_glob, int ny_glob,
         case 1: {  // Top boundary wave maker
             if (topo->neighbors[UP] == MPI_PROC_NULL) {
                 
-                for (int i = 0; i < all_data->v->nx; i++) {
+                for (int i = -e[LEFT]; i < all_data->v->nx + e[RIGHT]; i++) {
 
                     double x_pos = (START_I(gdata, topo->cart_rank) + i) * param.dx;
                     double spatial_mod = sin(2.0 * M_PI * x_pos / (nx_glob * param.dx) * 2);
@@ -438,8 +1380,8 @@ void apply_source(int timestep, int nx_glob, int ny_glob,
             int local_i = global_middle_i - START_I(gdata, topo->cart_rank);
             int local_j = global_middle_j - START_J(gdata, topo->cart_rank);
             
-            if (local_i >= 0 && local_i < all_data->eta->nx &&
-                local_j >= 0 && local_j < all_data->eta->ny) {
+            if (local_i >= -e[LEFT] && local_i < all_data->eta->nx + e[RIGHT] &&
+                local_j >= -e[DOWN] && local_j < all_data->eta->ny + e[UP]) {
                 SET(all_data->eta, local_i, local_j, source);
             }
             break;
@@ -458,8 +1400,8 @@ void apply_source(int timestep, int nx_glob, int ny_glob,
                 int local_i = source_positions[s][0] - START_I(gdata, topo->cart_rank);
                 int local_j = source_positions[s][1] - START_J(gdata, topo->cart_rank);
                 
-                if (local_i >= 0 && local_i < all_data->eta->nx &&
-                    local_j >= 0 && local_j < all_data->eta->ny) {
+                if (local_i >= -e[LEFT] && local_i < all_data->eta->nx + e[RIGHT] &&
+                    local_j >= -e[DOWN] && local_j < all_data->eta->ny + e[UP]) {
                     double phase_shifted_source = A * sin(2.0 * M_PI * f * t + phase_shifts[s]) * envelope;
                     SET(all_data->eta, local_i, local_j, phase_shifted_source);
                 }
@@ -475,8 +1417,8 @@ void apply_source(int timestep, int nx_glob, int ny_glob,
             int local_i = source_i - START_I(gdata, topo->cart_rank);
             int local_j = source_j - START_J(gdata, topo->cart_rank);
             
-            if (local_i >= 0 && local_i < all_data->eta->nx &&
-                local_j >= 0 && local_j < all_data->eta->ny) {
+            if (local_i >= -e[LEFT] && local_i < all_data->eta->nx + e[RIGHT] &&
+                local_j >= -e[DOWN] && local_j < all_data->eta->ny + e[UP]) {
                 SET(all_data->eta, local_i, local_j, source);
             }
             break;
@@ -494,282 +1436,906 @@ void apply_source(int timestep, int nx_glob, int ny_glob,
 /*===========================================================
  * MAIN COMPUTATION FUNCTIONS
  ===========================================================*/
+
+/**
+ * Returns the runs of points of one row that the kernels update
+ * 
+ * @param wet Runs of the field
+ * @param j Row
+ * @param count Number of runs (set)
+ * @return Start and end column of every run
+ */
+static const int *row_runs(const wet_runs_t *wet, int j, int *count) {
+    int r = j - wet->row0;
+    *count = wet->first[r + 1] - wet->first[r];
+    return wet->runs + 2 * wet->first[r];
+}
+
+/**
+ * Updates eta on a block of cells, skipping land (see build_wet_runs)
+ * 
+ * @param all_data Data structures containing fields
+ * @param i0, i1 Column range of the block [i0, i1)
+ * @param j0, j1 Row range of the block [j0, j1)
+ */
+static void eta_block(all_data_t *all_data, int i0, int i1, int j0, int j1) {
+    if (i0 >= i1) return;
+    const wet_runs_t *wet = &all_data->wet_eta;
+    for (int j = j0; j < j1; j++) {
+        int count = 1;
+        const int span[2] = {i0, i1};
+        const int *runs = wet->first ? row_runs(wet, j, &count) : span;
+        for (int k = 0; k < count && runs[2 * k] < i1; k++) {
+            int a = (runs[2 * k] > i0) ? runs[2 * k] : i0;
+            int b = (runs[2 * k + 1] < i1) ? runs[2 * k + 1] : i1;
+            if (a >= b) continue;
+            eta_row(&GET(all_data->eta, a, j), &GET(all_data->hu, a, j), &GET(all_data->u, a, j),
+                    &GET(all_data->hv, a, j), &GET(all_data->hv, a, j + 1),
+                    &GET(all_data->v, a, j), &GET(all_data->v, a, j + 1), b - a);
+        }
+    }
+}
+
+/**
+ * Updates a velocity field on a block of faces from the eta difference
+ * across each face
+ * 
+ * @param vel Velocity field (u or v)
+ * @param eta Water elevation
+ * @param wet Faces updated (closed faces next to land are skipped)
+ * @param di, dj Offset of the second cell of a face (1,0 for u, 0,1 for v)
+ * @param damping 1 - dt*gamma
+ * @param c dt*g/dx or dt*g/dy
+ * @param i0, i1 Column range of the block [i0, i1)
+ * @param j0, j1 Row range of the block [j0, j1)
+ */
+static void gradient_block(data_t *vel, data_t *eta, const wet_runs_t *wet, int di, int dj,
+                           double damping, double c, int i0, int i1, int j0, int j1) {
+    if (i0 >= i1) return;
+    for (int j = j0; j < j1; j++) {
+        int count = 1;
+        const int span[2] = {i0, i1};
+        const int *runs = wet->first ? row_runs(wet, j, &count) : span;
+        for (int k = 0; k < count && runs[2 * k] < i1; k++) {
+            int a = (runs[2 * k] > i0) ? runs[2 * k] : i0;
+            int b = (runs[2 * k + 1] < i1) ? runs[2 * k + 1] : i1;
+            if (a >= b) continue;
+            gradient_row(&GET(vel, a, j), &GET(eta, a, j),
+                         &GET(eta, a - di, j - dj), damping, c, b - a);
+        }
+    }
+}
+
 void update_eta(const parameters_t param, 
                 all_data_t *all_data,
                 gather_data_t *gdata,
                 MPITopology *topo) {
 
-    MPI_Request request_recv[4] = {MPI_REQUEST_NULL, MPI_REQUEST_NULL, 
-                                  MPI_REQUEST_NULL, MPI_REQUEST_NULL};
-    MPI_Request request_send[4] = {MPI_REQUEST_NULL, MPI_REQUEST_NULL,
-                                  MPI_REQUEST_NULL, MPI_REQUEST_NULL};
-    MPI_Status status[4];
-
     int nx = all_data->eta->nx;
     int ny = all_data->eta->ny;
 
-    // Allocate all buffers
-    double *send_left = calloc(ny, sizeof(double));
-    double *send_right = calloc(ny, sizeof(double));
-    double *send_down = calloc(nx, sizeof(double));
-    double *send_up = calloc(nx, sizeof(double));
+    // Our east u-faces and north v-faces are the neighbours' first ones:
+    // they are received straight into u(nx) and v(ny)
+    start_halo(&all_data->halo_faces);
+    if (!param.overlap) wait_halo(&all_data->halo_faces, topo);
+
+    // Only the last column/row reads a received face, and only when
+    // there is a neighbour on that side
+    int ie = nx - (param.overlap && topo->neighbors[RIGHT] != MPI_PROC_NULL);
+    int je = ny - (param.overlap && topo->neighbors[UP] != MPI_PROC_NULL);
+
+    // Update eta: pure flux difference over the face coefficients,
+    // interior first, then the east and north strips
+    eta_block(all_data, 0, ie, 0, je);
+    if (param.overlap) wait_halo(&all_data->halo_faces, topo);
+    eta_block(all_data, ie, nx, 0, je);
+    eta_block(all_data, 0, nx, je, ny);
+}
+
+void update_velocities(const parameters_t param,
+                      all_data_t *all_data,
+                      gather_data_t *gdata,
+                      MPITopology *topo) {
+
+    int nx = all_data->eta->nx;
+    int ny = all_data->eta->ny;
     
-    double *recv_left = NULL;
-    double *recv_right = NULL;
-    double *recv_down = NULL;
-    double *recv_up = NULL;
-
-    if (topo->neighbors[LEFT] != MPI_PROC_NULL) recv_left = calloc(ny, sizeof(double));
-    if (topo->neighbors[RIGHT] != MPI_PROC_NULL) recv_right = calloc(ny, sizeof(double));
-    if (topo->neighbors[DOWN] != MPI_PROC_NULL) recv_down = calloc(nx, sizeof(double));
-    if (topo->neighbors[UP] != MPI_PROC_NULL) recv_up = calloc(nx, sizeof(double));
-
-    // Prepare send buffers
-    for (int j = 0; j < ny; j++) {
-        send_left[j] = GET(all_data->u, 0, j);
-        send_right[j] = GET(all_data->u, nx+1, j);
-    }
-    for (int i = 0; i < nx; i++) {
-        send_down[i] = GET(all_data->v, i, 0);
-        send_up[i] = GET(all_data->v, i, ny);
-    }
-
-    // Post receives first
-    int recv_count = 0;
-    if (topo->neighbors[LEFT] != MPI_PROC_NULL)
-        MPI_Irecv(recv_left, ny, MPI_DOUBLE, topo->neighbors[LEFT], 100,
-                  topo->cart_comm, &request_recv[recv_count++]);
-    if (topo->neighbors[RIGHT] != MPI_PROC_NULL)
-        MPI_Irecv(recv_right, ny, MPI_DOUBLE, topo->neighbors[RIGHT], 101,
-                  topo->cart_comm, &request_recv[recv_count++]);
-    if (topo->neighbors[DOWN] != MPI_PROC_NULL)
-        MPI_Irecv(recv_down, nx, MPI_DOUBLE, topo->neighbors[DOWN], 102,
-                  topo->cart_comm, &request_recv[recv_count++]);
-    if (topo->neighbors[UP] != MPI_PROC_NULL)
-        MPI_Irecv(recv_up, nx, MPI_DOUBLE, topo->neighbors[UP], 103,
-                  topo->cart_comm, &request_recv[recv_count++]);
-
-    // Post sends
-    int send_count = 0;
-    if (topo->neighbors[RIGHT] != MPI_PROC_NULL)
-        MPI_Isend(send_right, ny, MPI_DOUBLE, topo->neighbors[RIGHT], 100,
-                  topo->cart_comm, &request_send[send_count++]);
-    if (topo->neighbors[LEFT] != MPI_PROC_NULL)
-        MPI_Isend(send_left, ny, MPI_DOUBLE, topo->neighbors[LEFT], 101,
-                  topo->cart_comm, &request_send[send_count++]);
-    if (topo->neighbors[UP] != MPI_PROC_NULL)
-        MPI_Isend(send_up, nx, MPI_DOUBLE, topo->neighbors[UP], 102,
-                  topo->cart_comm, &request_send[send_count++]);
-    if (topo->neighbors[DOWN] != MPI_PROC_NULL)
-        MPI_Isend(send_down, nx, MPI_DOUBLE, topo->neighbors[DOWN], 103,
-                  topo->cart_comm, &request_send[send_count++]);
-
-    // Wait for all receives to complete
-    if (recv_count > 0) {
-        MPI_Waitall(recv_count, request_recv, status);
-    }
-
-    // Update eta with proper boundary handling
+    // Neighbour elevations land in the eta ghost cells, the domain edges
+    // repeat the last cell (zero gradient)
+    start_halo(&all_data->halo_eta);
+    if (!param.overlap) wait_halo(&all_data->halo_eta, topo);
     
-    for (int j = 0; j < ny; j++) {
-        for (int i = 0; i < nx; i++) {
+    // Update velocities
+    double dx = param.dx;
+    double dy = param.dy;
+    double c1 = param.dt * param.g;
+    double c2 = param.dt * param.gamma;
 
-            double h_ui_j = GET(all_data->h_interp, i, j);
-            double h_vi_j = h_ui_j;
+    // Faces 0 and nx of u and rows 0 and ny of v read the eta ghosts:
+    // with overlap they wait for the exchange
+    int edge = param.overlap;
 
-            // boundary handling
-            double h_ui_ip1_j = (i < nx - 1) ? GET(all_data->h_interp, i + 1, j) : h_ui_j;
-            double h_vi_jp1 = (j < ny - 1) ? GET(all_data->h_interp, i, j + 1) : h_vi_j;
+    // Update u (includes one extra point in x direction)
+    gradient_block(all_data->u, all_data->eta, &all_data->wet_u, 1, 0, 1.0 - c2, c1 / dx, edge, nx + 1 - edge, 0, ny);
 
-    
-            double u_i = GET(all_data->u, i, j);
-            double u_ip1 = (i < nx - 1) ? GET(all_data->u, i + 1, j)
-                                       : (topo->neighbors[RIGHT] != MPI_PROC_NULL) ? recv_right[j] : u_i;
+    // Update v (includes one extra point in y direction)
+    gradient_block(all_data->v, all_data->eta, &all_data->wet_v, 0, 1, 1.0 - c2, c1 / dy, 0, nx, edge, ny + 1 - edge);
+
+    if (edge) {
+        wait_halo(&all_data->halo_eta, topo);
+        gradient_block(all_data->u, all_data->eta, &all_data->wet_u, 1, 0, 1.0 - c2, c1 / dx, 0, 1, 0, ny);
+        gradient_block(all_data->u, all_data->eta, &all_data->wet_u, 1, 0, 1.0 - c2, c1 / dx, nx, nx + 1, 0, ny);
+        gradient_block(all_data->v, all_data->eta, &all_data->wet_v, 0, 1, 1.0 - c2, c1 / dy, 0, nx, 0, 1);
+        gradient_block(all_data->v, all_data->eta, &all_data->wet_v, 0, 1, 1.0 - c2, c1 / dy, 0, nx, ny, ny + 1);
+    }
+}
 
-            double v_j = GET(all_data->v, i, j);
-            double v_jp1 = (j < ny - 1) ? GET(all_data->v, i, j + 1)
-                                       : (topo->neighbors[UP] != MPI_PROC_NULL) ? recv_up[i] : v_j;
+/*===========================================================
+ * COMMUNICATION-AVOIDING DEEP HALOS
+ ===========================================================*/
 
-            double du_dx = (h_ui_ip1_j * u_ip1 - h_ui_j * u_i) / param.dx;
-            double dv_dy = (h_vi_jp1 * v_jp1 - h_vi_j * v_j) / param.dy;
+/**
+ * Clears a deep halo: regular one-cell exchanges every step
+ * 
+ * @param deep Deep halo to clear
+ */
+void clear_deep_halo(deep_halo_t *deep) {
+    deep->depth = 1;
+    deep->step = 0;
+    for (int side = 0; side < NEIGHBOR_NUM; side++)
+        deep->send_type[side] = deep->recv_type[side] = MPI_DATATYPE_NULL;
+    deep->count[0] = deep->count[1] = 0;
+    deep->time = deep->messages = deep->bytes = 0.0;
+}
 
-            double eta_old = GET(all_data->eta, i, j);
-            double eta_new = eta_old - param.dt * (du_dx + dv_dy);
-            SET(all_data->eta, i, j, eta_new);
+/**
+ * Creates the persistent deep exchange of a set of fields, every field of
+ * a side travelling in one message (struct of absolute addresses)
+ * A field with one more face than cells in x or y is staggered: its first
+ * face is the neighbour's last one, so the lines start one face further.
+ * Columns cover the interior rows, rows cover depth columns past both ends
+ * 
+ * @param deep Deep halo to initialize
+ * @param fields Fields to exchange (up to DEEP_FIELDS_MAX)
+ * @param num_fields Number of fields
+ * @param nx, ny Local cell dimensions
+ * @param depth Lines exchanged per side (at most the ghost width)
+ * @param tag Base tag, the exchange uses tag..tag+3
+ * @param topo MPI topology information
+ * @return 0 on success, 1 on failure
+ */
+int init_deep_halo(deep_halo_t *deep, data_t **fields, int num_fields, int nx, int ny,
+                   int depth, int tag, MPITopology *topo) {
+    const int send_tags[NEIGHBOR_NUM] = {[LEFT] = tag + 1, [RIGHT] = tag, [DOWN] = tag + 3, [UP] = tag + 2};
+    const int recv_tags[NEIGHBOR_NUM] = {[LEFT] = tag, [RIGHT] = tag + 1, [DOWN] = tag + 2, [UP] = tag + 3};
+    const int order[NEIGHBOR_NUM] = {LEFT, RIGHT, DOWN, UP};
+    int err = MPI_SUCCESS;
+
+    clear_deep_halo(deep);
+    deep->depth = depth;
+    for (int k = 0; k < NEIGHBOR_NUM; k++) {
+        int side = order[k];
+        MPI_Datatype lines[DEEP_FIELDS_MAX];
+        MPI_Aint send_disp[DEEP_FIELDS_MAX], recv_disp[DEEP_FIELDS_MAX];
+        int ones[DEEP_FIELDS_MAX];
+
+        for (int f = 0; f < num_fields; f++) {
+            data_t *d = fields[f];
+            int sx = d->nx - nx;
+            int sy = d->ny - ny;
+            double *send, *recv;
+            if (side == LEFT || side == RIGHT) {
+                MPI_Type_vector(d->ny, depth, d->pitch, MPI_DOUBLE, &lines[f]);
+                send = (side == LEFT) ? &GET(d, sx, 0) : &GET(d, nx - depth, 0);
+                recv = (side == LEFT) ? &GET(d, -depth, 0) : &GET(d, nx + sx, 0);
+            } else {
+                MPI_Type_vector(depth, d->nx + 2 * depth, d->pitch, MPI_DOUBLE, &lines[f]);
+                send = (side == DOWN) ? &GET(d, -depth, sy) : &GET(d, -depth, ny - depth);
+                recv = (side == DOWN) ? &GET(d, -depth, -depth) : &GET(d, -depth, ny + sy);
+            }
+            MPI_Get_address(send, &send_disp[f]);
+            MPI_Get_address(recv, &recv_disp[f]);
+            ones[f] = 1;
         }
+        MPI_Type_create_struct(num_fields, ones, send_disp, lines, &deep->send_type[side]);
+        MPI_Type_create_struct(num_fields, ones, recv_disp, lines, &deep->recv_type[side]);
+        MPI_Type_commit(&deep->send_type[side]);
+        MPI_Type_commit(&deep->recv_type[side]);
+        for (int f = 0; f < num_fields; f++) MPI_Type_free(&lines[f]);
     }
 
-    // Wait for all sends to complete
-    if (send_count > 0) {
-        MPI_Waitall(send_count, request_send, status);
+    // Receives first, per phase: columns, then rows
+    for (int phase = 0; phase < 2; phase++) {
+        MPI_Request *req = deep->requests[phase];
+        int *count = &deep->count[phase];
+        for (int k = 2 * phase; k < 2 * phase + 2; k++) {
+            int side = order[k];
+            if (topo->neighbors[side] == MPI_PROC_NULL) continue;
+            err |= MPI_Recv_init(MPI_BOTTOM, 1, deep->recv_type[side], topo->neighbors[side],
+                                 recv_tags[side], topo->cart_comm, &req[(*count)++]);
+        }
+        for (int k = 2 * phase; k < 2 * phase + 2; k++) {
+            int side = order[k];
+            if (topo->neighbors[side] == MPI_PROC_NULL) continue;
+            err |= MPI_Send_init(MPI_BOTTOM, 1, deep->send_type[side], topo->neighbors[side],
+                                 send_tags[side], topo->cart_comm, &req[(*count)++]);
+        }
     }
 
-    // Clean up
-    free(send_left);
-    free(send_right);
-    free(send_down);
-    free(send_up);
-    if (recv_left) free(recv_left);
-    if (recv_right) free(recv_right);
-    if (recv_down) free(recv_down);
-    if (recv_up) free(recv_up);
+    if (err != MPI_SUCCESS) {
+        fprintf(stderr, "Rank %d: Failed to create deep halo requests\n", topo->cart_rank);
+        return 1;
+    }
+    return 0;
 }
 
-void update_velocities(const parameters_t param,
-                      all_data_t *all_data,
-                      gather_data_t *gdata,
-                      MPITopology *topo) {
+/**
+ * Runs one deep exchange: the columns, then the rows that carry them on
+ * to the diagonal neighbours
+ * 
+ * @param deep Deep halo to exchange
+ */
+void exchange_deep_halo(deep_halo_t *deep) {
+    double t0 = MPI_Wtime();
+    for (int phase = 0; phase < 2; phase++) {
+        if (deep->count[phase] == 0) continue;
+        MPI_Startall(deep->count[phase], deep->requests[phase]);
+        MPI_Waitall(deep->count[phase], deep->requests[phase], MPI_STATUSES_IGNORE);
+    }
+    deep->time += MPI_Wtime() - t0;
+}
 
-    MPI_Request request_recv[4] = {MPI_REQUEST_NULL, MPI_REQUEST_NULL,
-                                  MPI_REQUEST_NULL, MPI_REQUEST_NULL};
-    MPI_Request request_send[4] = {MPI_REQUEST_NULL, MPI_REQUEST_NULL,
-                                  MPI_REQUEST_NULL, MPI_REQUEST_NULL};
-    MPI_Status status[4];
+/**
+ * Releases the persistent requests and the datatypes of a deep halo
+ * 
+ * @param deep Deep halo to free (left cleared)
+ */
+void free_deep_halo(deep_halo_t *deep) {
+    for (int phase = 0; phase < 2; phase++)
+        for (int r = 0; r < deep->count[phase]; r++) MPI_Request_free(&deep->requests[phase][r]);
+    for (int side = 0; side < NEIGHBOR_NUM; side++) {
+        if (deep->send_type[side] != MPI_DATATYPE_NULL) MPI_Type_free(&deep->send_type[side]);
+        if (deep->recv_type[side] != MPI_DATATYPE_NULL) MPI_Type_free(&deep->recv_type[side]);
+    }
+    deep->count[0] = deep->count[1] = 0;
+}
 
+/**
+ * Advances one time step with the deep halo: every depth steps eta, u and
+ * v are exchanged depth cells deep, then each step recomputes the overlap
+ * with the neighbours, one cell narrower than the step before. The walls,
+ * the sources and the zero-gradient ghosts are applied to the overlap too,
+ * so every rank reproduces its neighbours' values bit for bit
+ * 
+ * @param timestep Current time step
+ * @param nx_glob, ny_glob Global grid dimensions
+ * @param param Simulation parameters
+ * @param all_data Data structures containing fields
+ * @param gdata Global positions of the ranks
+ * @param topo MPI topology information
+ */
+void deep_halo_step(int timestep, int nx_glob, int ny_glob,
+                    const parameters_t param,
+                    all_data_t *all_data,
+                    gather_data_t *gdata,
+                    MPITopology *topo) {
+    deep_halo_t *deep = &all_data->deep;
     int nx = all_data->eta->nx;
     int ny = all_data->eta->ny;
-    
-    // Allocate all buffers
-    double *send_left = calloc(ny, sizeof(double));
-    double *send_right = calloc(ny, sizeof(double));
-    double *send_down = calloc(nx, sizeof(double));
-    double *send_up = calloc(nx, sizeof(double));
-    
-    double *recv_left = NULL;
-    double *recv_right = NULL;
-    double *recv_down = NULL;
-    double *recv_up = NULL;
-
-    if (topo->neighbors[LEFT] != MPI_PROC_NULL) recv_left = calloc(ny, sizeof(double));
-    if (topo->neighbors[RIGHT] != MPI_PROC_NULL) recv_right = calloc(ny, sizeof(double));
-    if (topo->neighbors[DOWN] != MPI_PROC_NULL) recv_down = calloc(nx, sizeof(double));
-    if (topo->neighbors[UP] != MPI_PROC_NULL) recv_up = calloc(nx, sizeof(double));
-
-    // Prepare send buffers with eta values
-    for (int j = 0; j < ny; j++) {
-        send_left[j] = GET(all_data->eta, 0, j);
-        send_right[j] = GET(all_data->eta, nx-1, j);
-    }
-    for (int i = 0; i < nx; i++) {
-        send_down[i] = GET(all_data->eta, i, 0);
-        send_up[i] = GET(all_data->eta, i, ny-1);
-    }
-
-    // Post all receives first
-    int recv_count = 0;
-    if (topo->neighbors[LEFT] != MPI_PROC_NULL)
-        MPI_Irecv(recv_left, ny, MPI_DOUBLE, topo->neighbors[LEFT], 200,
-                  topo->cart_comm, &request_recv[recv_count++]);
-    if (topo->neighbors[RIGHT] != MPI_PROC_NULL)
-        MPI_Irecv(recv_right, ny, MPI_DOUBLE, topo->neighbors[RIGHT], 201,
-                  topo->cart_comm, &request_recv[recv_count++]);
-    if (topo->neighbors[DOWN] != MPI_PROC_NULL)
-        MPI_Irecv(recv_down, nx, MPI_DOUBLE, topo->neighbors[DOWN], 202,
-                  topo->cart_comm, &request_recv[recv_count++]);
-    if (topo->neighbors[UP] != MPI_PROC_NULL)
-        MPI_Irecv(recv_up, nx, MPI_DOUBLE, topo->neighbors[UP], 203,
-                  topo->cart_comm, &request_recv[recv_count++]);
-
-    // Post all sends
-    int send_count = 0;
-    if (topo->neighbors[RIGHT] != MPI_PROC_NULL)
-        MPI_Isend(send_right, ny, MPI_DOUBLE, topo->neighbors[RIGHT], 200,
-                  topo->cart_comm, &request_send[send_count++]);
-    if (topo->neighbors[LEFT] != MPI_PROC_NULL)
-        MPI_Isend(send_left, ny, MPI_DOUBLE, topo->neighbors[LEFT], 201,
-                  topo->cart_comm, &request_send[send_count++]);
-    if (topo->neighbors[UP] != MPI_PROC_NULL)
-        MPI_Isend(send_up, nx, MPI_DOUBLE, topo->neighbors[UP], 202,
-                  topo->cart_comm, &request_send[send_count++]);
-    if (topo->neighbors[DOWN] != MPI_PROC_NULL)
-        MPI_Isend(send_down, nx, MPI_DOUBLE, topo->neighbors[DOWN], 203,
-                  topo->cart_comm, &request_send[send_count++]);
-
-    // Wait for all receives to complete before updating
-    if (recv_count > 0) {
-        MPI_Waitall(recv_count, request_recv, status);
+    double c1 = param.dt * param.g;
+    double c2 = param.dt * param.gamma;
+    int e[NEIGHBOR_NUM];
+
+    if (deep->step == 0) exchange_deep_halo(deep);
+
+    // eta is valid depth - step cells past the interior, the velocities
+    // one cell less (they read eta on both sides of the face)
+    int ext = deep->depth - deep->step;
+    boundary_conditions(param, all_data, topo, ext);
+    apply_source(timestep, nx_glob, ny_glob, param, all_data, gdata, topo, ext);
+
+    halo_extent(topo, ext, e);
+    eta_block(all_data, -e[LEFT], nx + e[RIGHT], -e[DOWN], ny + e[UP]);
+    fill_ghosts(all_data->eta, topo, ext);
+
+    halo_extent(topo, ext - 1, e);
+    gradient_block(all_data->u, all_data->eta, &all_data->wet_u, 1, 0, 1.0 - c2, c1 / param.dx,
+                   -e[LEFT], nx + 1 + e[RIGHT], -e[DOWN], ny + e[UP]);
+    gradient_block(all_data->v, all_data->eta, &all_data->wet_v, 0, 1, 1.0 - c2, c1 / param.dy,
+                   -e[LEFT], nx + e[RIGHT], -e[DOWN], ny + 1 + e[UP]);
+
+    deep->step = (deep->step + 1) % deep->depth;
+}
+
+/**
+ * Points recomputed per time step by a depth-k deep halo, beyond the
+ * interior: eta on the overlap of each step and the velocities on one cell
+ * less, averaged over the k steps between exchanges
+ * 
+ * @param topo MPI topology information
+ * @param nx, ny Local grid dimensions
+ * @param depth Deep halo depth
+ * @return Redundant point updates per step
+ */
+static double redundant_points(const MPITopology *topo, int nx, int ny, int depth) {
+    double points = 0.0;
+    int e[NEIGHBOR_NUM];
+    for (int step = 0; step < depth; step++) {
+        int ext = depth - step;
+        halo_extent(topo, ext, e);
+        points += (double)(nx + e[LEFT] + e[RIGHT]) * (ny + e[DOWN] + e[UP]) - (double)nx * ny;
+        halo_extent(topo, ext - 1, e);
+        points += (double)(nx + 1 + e[LEFT] + e[RIGHT]) * (ny + e[DOWN] + e[UP]) - (double)(nx + 1) * ny;
+        points += (double)(nx + e[LEFT] + e[RIGHT]) * (ny + 1 + e[DOWN] + e[UP]) - (double)nx * (ny + 1);
     }
-    
-    // Update velocities
-    double dx = param.dx;
-    double dy = param.dy;
+    return points / depth;
+}
+
+/**
+ * Messages and bytes a depth-k deep halo sends per time step
+ * 
+ * @param topo MPI topology information
+ * @param nx, ny Local grid dimensions
+ * @param depth Deep halo depth
+ * @param messages, bytes Set to the traffic per step
+ */
+static void deep_traffic(const MPITopology *topo, int nx, int ny, int depth,
+                         double *messages, double *bytes) {
+    // eta, u and v: columns of ny, ny and ny + 1 points, rows of
+    // nx, nx + 1 and nx points plus depth cells past both ends
+    double column = (double)depth * (3 * ny + 1);
+    double row = (double)depth * (3 * (nx + 2 * depth) + 1);
+    *messages = *bytes = 0.0;
+    for (int side = 0; side < NEIGHBOR_NUM; side++) {
+        if (topo->neighbors[side] == MPI_PROC_NULL) continue;
+        *messages += 1.0;
+        *bytes += sizeof(double) * ((side == LEFT || side == RIGHT) ? column : row);
+    }
+    *messages /= depth;
+    *bytes /= depth;
+}
+
+/**
+ * Times HALO_BENCH_ROUNDS deep exchanges of eta, u and v
+ * 
+ * @param all_data Data structures containing fields
+ * @param depth Deep halo depth
+ * @param topo MPI topology information
+ * @return Seconds per exchange on this rank
+ */
+static double time_deep_halo(all_data_t *all_data, int depth, MPITopology *topo) {
+    data_t *fields[] = {all_data->eta, all_data->u, all_data->v};
+    deep_halo_t deep;
+    if (init_deep_halo(&deep, fields, 3, all_data->eta->nx, all_data->eta->ny, depth, 300, topo)) MPI_Abort(topo->cart_comm, 1);
+    MPI_Barrier(topo->cart_comm);
+    for (int r = 0; r < HALO_BENCH_ROUNDS; r++) exchange_deep_halo(&deep);
+    free_deep_halo(&deep);
+    return deep.time / HALO_BENCH_ROUNDS;
+}
+
+/**
+ * Picks the halo depth with a latency/bandwidth model fitted inside the
+ * solver. A deep exchange costs alpha + beta * bytes, with alpha and beta
+ * fitted from exchanges one cell and max_depth cells deep; a depth of k
+ * pays it once every k steps plus the redundant points, timed from a sweep
+ * of the kernels. Depth 1 costs the measured regular exchanges (both
+ * halos, selected backend). The slowest rank decides, so all ranks agree
+ * 
+ * @param param Simulation parameters
+ * @param all_data Data structures containing fields (still at rest)
+ * @param max_depth Deepest halo the fields allow
+ * @param costs Set to the modelled seconds per step of depths 1..max_depth
+ * @param topo MPI topology information
+ */
+static void model_halo_depth(const parameters_t param, all_data_t *all_data, int max_depth,
+                             double *costs, MPITopology *topo) {
+    int nx = all_data->eta->nx;
+    int ny = all_data->eta->ny;
+    double messages, bytes_1, bytes_max;
+
+    // Regular exchanges, as run by update_eta and update_velocities
+    MPI_Barrier(topo->cart_comm);
+    double t0 = MPI_Wtime();
+    for (int r = 0; r < HALO_BENCH_ROUNDS; r++) {
+        start_halo(&all_data->halo_faces);
+        wait_halo(&all_data->halo_faces, topo);
+        start_halo(&all_data->halo_eta);
+        wait_halo(&all_data->halo_eta, topo);
+    }
+    costs[0] = (MPI_Wtime() - t0) / HALO_BENCH_ROUNDS;
+    all_data->halo_faces.time = all_data->halo_faces.overlap = 0.0;
+    all_data->halo_eta.time = all_data->halo_eta.overlap = 0.0;
+
+    // Fit of the deep exchanges (traffic per exchange = per step * depth)
+    double time_1 = time_deep_halo(all_data, 1, topo);
+    double time_max = time_deep_halo(all_data, max_depth, topo);
+    deep_traffic(topo, nx, ny, 1, &messages, &bytes_1);
+    deep_traffic(topo, nx, ny, max_depth, &messages, &bytes_max);
+    bytes_max *= max_depth;
+    double beta = (bytes_max > bytes_1) ? (time_max - time_1) / (bytes_max - bytes_1) : 0.0;
+    if (beta < 0.0) beta = 0.0;
+    double alpha = time_1 - beta * bytes_1;
+    if (alpha < 0.0) alpha = 0.0;
+
+    // The fields are still at rest: sweeping the kernels leaves them at zero
+    const int sweeps = 3;
     double c1 = param.dt * param.g;
     double c2 = param.dt * param.gamma;
+    t0 = MPI_Wtime();
+    for (int r = 0; r < sweeps; r++) {
+        eta_block(all_data, 0, nx, 0, ny);
+        gradient_block(all_data->u, all_data->eta, &all_data->wet_u, 1, 0, 1.0 - c2, c1 / param.dx, 0, nx + 1, 0, ny);
+        gradient_block(all_data->v, all_data->eta, &all_data->wet_v, 0, 1, 1.0 - c2, c1 / param.dy, 0, nx, 0, ny + 1);
+    }
+    double points = (double)nx * ny + (double)(nx + 1) * ny + (double)nx * (ny + 1);
+    double gamma = (MPI_Wtime() - t0) / (sweeps * points);
+
+    for (int depth = 2; depth <= max_depth; depth++) {
+        double bytes;
+        deep_traffic(topo, nx, ny, depth, &messages, &bytes);
+        costs[depth - 1] = (alpha + beta * bytes * depth) / depth
+                         + gamma * redundant_points(topo, nx, ny, depth);
+    }
+    MPI_Allreduce(MPI_IN_PLACE, costs, max_depth, MPI_DOUBLE, MPI_MAX, topo->cart_comm);
 
-    // Update u (includes one extra point in x direction)
-    
-    for (int j = 0; j < ny; j++) {
-        for (int i = 0; i < nx + 1; i++) {
-            double eta_ij;
-            double eta_im1j;
-
-            if (i < nx) {
-                eta_ij = GET(all_data->eta, i, j);
-            } else if (topo->neighbors[RIGHT] != MPI_PROC_NULL) {
-                eta_ij = recv_right[j];
-            } else {
-                eta_ij = GET(all_data->eta, nx-1, j);  
-            }
+    double fit[3] = {alpha, beta, gamma};
+    MPI_Allreduce(MPI_IN_PLACE, fit, 3, MPI_DOUBLE, MPI_MAX, topo->cart_comm);
+    if (topo->cart_rank == 0)
+        printf(" - halo model: %.2f us/exchange + %.3f ns/byte, %.3f ns/point\n",
+               1e6 * fit[0], 1e9 * fit[1], 1e9 * fit[2]);
+}
 
-            if (i > 0) {
-                eta_im1j = GET(all_data->eta, i-1, j);
-            } else if (topo->neighbors[LEFT] != MPI_PROC_NULL) {
-                eta_im1j = recv_left[j];
-            } else {
-                eta_im1j = eta_ij;  
-            }
+/**
+ * Sets up the deep exchanges of eta, u and v, and completes the face
+ * depths hu and hv once (the traffic counters are kept)
+ * 
+ * @param all_data Data structures containing fields
+ * @param depth Deep halo depth (> 1)
+ * @param topo MPI topology information
+ */
+static void start_deep_halo(all_data_t *all_data, int depth, MPITopology *topo) {
+    int nx = all_data->eta->nx;
+    int ny = all_data->eta->ny;
+    deep_halo_t *deep = &all_data->deep;
+
+    // Face depths are exchanged once, then eta, u and v every depth steps
+    data_t *faces[] = {all_data->hu, all_data->hv};
+    data_t *fields[] = {all_data->eta, all_data->u, all_data->v};
+    deep_halo_t face_halo;
+    if (init_deep_halo(&face_halo, faces, 2, nx, ny, depth, 400, topo)) MPI_Abort(topo->cart_comm, 1);
+    exchange_deep_halo(&face_halo);
+    free_deep_halo(&face_halo);
+
+    double messages = deep->messages, bytes = deep->bytes;
+    if (init_deep_halo(deep, fields, 3, nx, ny, depth, 300, topo)) MPI_Abort(topo->cart_comm, 1);
+    deep->messages = messages;
+    deep->bytes = bytes;
+
+    // The ghost faces are final now: the kernels sweep them too
+    if (all_data->wet_eta.first && build_wet_runs(all_data)) MPI_Abort(topo->cart_comm, 1);
+}
 
-            double u_ij = GET(all_data->u, i, j);
-            double new_u = (1.0 - c2) * u_ij - c1 / dx * (eta_ij - eta_im1j);
-            SET(all_data->u, i, j, new_u);
+/**
+ * Selects the halo depth from SHALLOW_HALO_DEPTH: k to exchange k cells
+ * deep every k steps, or auto (default) for the depth of lowest modelled
+ * cost. Depth 1 keeps the regular exchanges of update_eta and
+ * update_velocities. Deep exchanges always use point-to-point requests, so
+ * a non-p2p backend named in SHALLOW_HALO keeps depth 1 unless
+ * SHALLOW_HALO_DEPTH is set too (with a warning when that bypasses it). Prints the halo
+ * volume against the message count of every depth, then sets up the deep
+ * exchanges and completes the face depths hu and hv once
+ * 
+ * @param param Simulation parameters
+ * @param all_data Data structures containing fields
+ * @param topo MPI topology information
+ */
+void select_halo_depth(const parameters_t param, all_data_t *all_data, MPITopology *topo) {
+    const char *request = getenv(HALO_DEPTH_ENV);
+    int nx = all_data->eta->nx;
+    int ny = all_data->eta->ny;
+    deep_halo_t *deep = &all_data->deep;
+
+    // The lines sent must belong to the sender: no deeper than a subdomain
+    int max_depth = (nx < ny) ? nx : ny;
+    MPI_Allreduce(MPI_IN_PLACE, &max_depth, 1, MPI_INT, MPI_MIN, topo->cart_comm);
+    if (max_depth > all_data->eta->ghost) max_depth = all_data->eta->ghost;
+    if (topo->nb_process == 1) max_depth = 1;
+
+    // A backend chosen by name is kept: the default depth does not trade it
+    // for the point-to-point deep halos
+    const char *backend_request = getenv(HALO_ENV);
+    int pinned = !(request && *request) && all_data->halo_eta.backend != HALO_P2P
+              && backend_request && strcmp(backend_request, "bench");
+
+    int depth = 1;
+    double costs[GHOST_WIDTH];
+    int modelled = 0;
+    if (request && *request && strcmp(request, "auto")) {
+        depth = atoi(request);
+        if (depth < 1 || depth > max_depth) {
+            if (topo->cart_rank == 0)
+                printf("Warning: halo depth %s out of range 1..%d, using %d\n", request, max_depth,
+                       (depth < 1) ? 1 : max_depth);
+            depth = (depth < 1) ? 1 : max_depth;
         }
+    } else if (max_depth > 1 && !pinned) {
+        model_halo_depth(param, all_data, max_depth, costs, topo);
+        modelled = 1;
+        for (int k = 2; k <= max_depth; k++)
+            if (costs[k - 1] < costs[depth - 1]) depth = k;
     }
 
-    // Update v (includes one extra point in y direction)
-    for (int j = 0; j < ny + 1; j++) {
-        for (int i = 0; i < nx; i++) {
-            double eta_ij;
-            double eta_ijm1;
-
-            if (j < ny) {
-                eta_ij = GET(all_data->eta, i, j);
-            } else if (topo->neighbors[UP] != MPI_PROC_NULL) {
-                eta_ij = recv_up[i];
-            } else {
-                eta_ij = GET(all_data->eta, i, ny-1); 
+    // Traffic per step: regular sends of both exchanges, or the deep ones
+    double traffic[2 * GHOST_WIDTH];
+    for (int k = 1; k <= max_depth; k++) {
+        if (k > 1) {
+            deep_traffic(topo, nx, ny, k, &traffic[2 * (k - 1)], &traffic[2 * k - 1]);
+            continue;
+        }
+        traffic[0] = traffic[1] = 0.0;
+        const halo_t *halos[] = {&all_data->halo_faces, &all_data->halo_eta};
+        for (int h = 0; h < 2; h++)
+            for (int side = 0; side < NEIGHBOR_NUM; side++) {
+                if (topo->neighbors[side] == MPI_PROC_NULL || !halos[h]->send_buf[side]) continue;
+                traffic[0] += 1.0;
+                traffic[1] += sizeof(double) * halos[h]->length[side];
             }
+    }
+    deep->messages = traffic[2 * (depth - 1)];
+    deep->bytes = traffic[2 * depth - 1];
+    MPI_Allreduce(MPI_IN_PLACE, traffic, 2 * max_depth, MPI_DOUBLE, MPI_MAX, topo->cart_comm);
+    if (topo->cart_rank == 0) {
+        for (int k = 1; k <= max_depth; k++) {
+            printf(" - halo depth %d: %5.2f messages/step, %8.2f KiB/step", k,
+                   traffic[2 * (k - 1)], traffic[2 * k - 1] / 1024.0);
+            if (modelled) printf(", model %8.2f us/step", 1e6 * costs[k - 1]);
+            printf("%s\n", (k == depth) ? "  <-" : "");
+        }
+        printf(" - halo depth: %d (%s", depth,
+               modelled ? "auto" : pinned ? "kept for SHALLOW_HALO" : "fixed");
+        if (modelled)
+            printf(", model %.2f us/step against %.2f us/step at depth 1",
+                   1e6 * costs[depth - 1], 1e6 * costs[0]);
+        printf(")%s\n", (depth > 1) ? ", halo overlap does not apply" : "");
+        if (depth > 1 && all_data->halo_eta.backend != HALO_P2P)
+            printf("Warning: deep halos exchange point-to-point, the %s backend is bypassed\n",
+                   halo_backend_names[all_data->halo_eta.backend]);
+    }
+    if (depth > 1) start_deep_halo(all_data, depth, topo);
+}
 
-            if (j > 0) {
-                eta_ijm1 = GET(all_data->eta, i, j-1);
-            } else if (topo->neighbors[DOWN] != MPI_PROC_NULL) {
-                eta_ijm1 = recv_down[i];
-            } else {
-                eta_ijm1 = eta_ij;  
-            }
 
-            double v_ij = GET(all_data->v, i, j);
-            double new_v = (1.0 - c2) * v_ij - c1 / dy * (eta_ij - eta_ijm1);
-            SET(all_data->v, i, j, new_v);
+
+/*===========================================================
+ * DYNAMIC LOAD BALANCING
+ ===========================================================*/
+
+/**
+ * Seconds this rank has spent in the halo exchanges so far
+ *
+ * @param all_data Data structures holding the exchanges
+ * @return Starting and waiting time of every exchange
+ */
+static double halo_seconds(const all_data_t *all_data) {
+    return all_data->halo_faces.time + all_data->halo_eta.time + all_data->deep.time;
+}
+
+/**
+ * Starts timing the computation of one step (SHALLOW_REBALANCE)
+ *
+ * @param all_data Data structures containing fields
+ */
+void start_balance_step(all_data_t *all_data) {
+    all_data->balance.start = MPI_Wtime();
+    all_data->balance.comm = halo_seconds(all_data);
+}
+
+/**
+ * Cells shared by two ranges [a0, a1) and [b0, b1)
+ */
+static long long overlap_cells(int a0, int a1, int b0, int b1) {
+    int lo = (a0 > b0) ? a0 : b0;
+    int hi = (a1 < b1) ? a1 : b1;
+    return (hi > lo) ? hi - lo : 0;
+}
+
+/**
+ * Points of a field held by a rank in the blocks of splits, as
+ * {x0, x1, y0, y1}. A rank owns its cells, plus the east and north wall
+ * faces on the last process column and row; it also holds the east and
+ * north faces it shares with the next blocks
+ *
+ * @param topo MPI topology information
+ * @param splits Block cuts along x and y
+ * @param rank Rank in the Cartesian communicator
+ * @param stagger Extra column and row of the field (u, v)
+ * @param shared 1 for every point held, 0 for the owned ones only
+ * @param block Range of points, filled in
+ */
+static void field_block(const MPITopology *topo, int *const splits[2], int rank,
+                        const int stagger[2], int shared, int block[4]) {
+    int c[2];
+    MPI_Cart_coords(topo->cart_comm, rank, 2, c);
+    block[0] = splits[0][c[0]];
+    block[1] = splits[0][c[0] + 1] + ((shared || c[0] == topo->dims[0] - 1) ? stagger[0] : 0);
+    block[2] = splits[1][c[1]];
+    block[3] = splits[1][c[1] + 1] + ((shared || c[1] == topo->dims[1] - 1) ? stagger[1] : 0);
+}
+
+/**
+ * Subarray type of the points shared by two ranges, within a buffer
+ * of the given rows and pitch whose point (0, 0) is origin
+ *
+ * @param a, b Ranges of points {x0, x1, y0, y1}
+ * @param origin Global position of the first point of the buffer
+ * @param rows, pitch Rows and row length of the buffer
+ * @param type Committed type, MPI_DOUBLE when nothing is shared
+ * @return 1 if the ranges share points, 0 otherwise
+ */
+static int overlap_type(const int a[4], const int b[4], const int origin[2], int rows, int pitch,
+                        MPI_Datatype *type) {
+    int lo[2] = {(a[0] > b[0]) ? a[0] : b[0], (a[2] > b[2]) ? a[2] : b[2]};
+    int hi[2] = {(a[1] < b[1]) ? a[1] : b[1], (a[3] < b[3]) ? a[3] : b[3]};
+    *type = MPI_DOUBLE;
+    if (hi[0] <= lo[0] || hi[1] <= lo[1]) return 0;
+
+    int sizes[2] = {rows, pitch};
+    int subsizes[2] = {hi[1] - lo[1], hi[0] - lo[0]};
+    int starts[2] = {lo[1] - origin[1], lo[0] - origin[0]};
+    MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C, MPI_DOUBLE, type);
+    MPI_Type_commit(type);
+    return 1;
+}
+
+/**
+ * Moves eta, u and v to the blocks of new_splits (collective)
+ * Every rank keeps a copy of the points it owns (see field_block), since
+ * the fields are released and allocated again at the new size. Each rank
+ * then sends every other one the part of its old block that the other
+ * holds in its new block, shared faces included, straight into the
+ * resized fields: one MPI_Alltoallw per field, with subarray types and no
+ * global array. The ghosts are refreshed by the next exchanges
+ *
+ * @param param Simulation parameters
+ * @param all_data Data structures containing fields
+ * @param new_splits Cuts of the new blocks (take the place of topo->splits)
+ * @param topo MPI topology information
+ * @return 0 on success, 1 on failure
+ */
+static int migrate_fields(const parameters_t param, all_data_t *all_data,
+                          int *new_splits[2], MPITopology *topo) {
+    const int stagger[3][2] = {{0, 0}, {1, 0}, {0, 1}};  // eta, u, v
+    int num_ranks = topo->nb_process;
+    int me = topo->cart_rank;
+    int *counts = malloc(2 * num_ranks * sizeof(int));   // sent, then received
+    int *displs = calloc(num_ranks, sizeof(int));         // offsets are in the types
+    MPI_Datatype *types = malloc(2 * num_ranks * sizeof(MPI_Datatype));
+    double *kept[3] = {NULL, NULL, NULL};
+    int old_block[3][4];
+    int err = !counts || !displs || !types;
+
+    // Copy of the owned points, packed row by row
+    data_t *fields[3] = {all_data->eta, all_data->u, all_data->v};
+    for (int f = 0; f < 3 && !err; f++) {
+        field_block(topo, topo->splits, me, stagger[f], 0, old_block[f]);
+        int w = old_block[f][1] - old_block[f][0], h = old_block[f][3] - old_block[f][2];
+        kept[f] = malloc((size_t)w * h * sizeof(double));
+        err = (kept[f] == NULL);
+        for (int j = 0; j < h && !err; j++)
+            memcpy(kept[f] + (size_t)j * w, &GET(fields[f], 0, j), w * sizeof(double));
+    }
+
+    int *old_splits[2] = {topo->splits[0], topo->splits[1]};
+    if (!err) {
+        for (int a = 0; a < 2; a++) {
+            topo->splits[a] = new_splits[a];
+            new_splits[a] = NULL;
         }
+        err = resize_all_data(all_data, &param, topo);
     }
 
-    // Wait for all sends to complete
-    if (send_count > 0) {
-        MPI_Waitall(send_count, request_send, status);
+    data_t *resized[3] = {all_data->eta, all_data->u, all_data->v};
+    for (int f = 0; f < 3 && !err; f++) {
+        int new_block[4], block[4];
+        field_block(topo, topo->splits, me, stagger[f], 1, new_block);
+        const int send_origin[2] = {old_block[f][0], old_block[f][2]};
+        const int recv_origin[2] = {new_block[0], new_block[2]};
+        int w = old_block[f][1] - old_block[f][0], h = old_block[f][3] - old_block[f][2];
+
+        for (int r = 0; r < num_ranks; r++) {
+            // Old block of mine in the new block of r, and the other way round
+            field_block(topo, topo->splits, r, stagger[f], 1, block);
+            counts[r] = overlap_type(old_block[f], block, send_origin, h, w, &types[r]);
+            field_block(topo, old_splits, r, stagger[f], 0, block);
+            counts[num_ranks + r] = overlap_type(block, new_block, recv_origin, resized[f]->ny,
+                                                 resized[f]->pitch, &types[num_ranks + r]);
+        }
+        MPI_Alltoallw(kept[f], counts, displs, types, resized[f]->vals, counts + num_ranks, displs,
+                      types + num_ranks, topo->cart_comm);
+        for (int k = 0; k < 2 * num_ranks; k++)
+            if (counts[k]) MPI_Type_free(&types[k]);
     }
-    
-    // Clean up
-    free(send_left);
-    free(send_right);
-    free(send_down);
-    free(send_up);
-    if (recv_left) free(recv_left);
-    if (recv_right) free(recv_right);
-    if (recv_down) free(recv_down);
-    if (recv_up) free(recv_up);
+
+    // The old cuts are released once replaced
+    for (int a = 0; a < 2; a++)
+        if (topo->splits[a] != old_splits[a]) free(old_splits[a]);
+    for (int f = 0; f < 3; f++) free(kept[f]);
+    free(counts);
+    free(displs);
+    free(types);
+    return err;
 }
 
+/**
+ * Moves the block cuts to even out the computation time of the last
+ * window (collective)
+ * The seconds per cell of every rank are spread over its block, and each
+ * axis is cut again by recursive bisection of the column/row costs, as in
+ * decompose_domain. Every rank predicts the same loads from the gathered
+ * timings, so they all agree whether the busiest rank gains enough to
+ * migrate. Blocks keep at least the deep halo depth in each direction
+ *
+ * @param timestep Steps completed
+ * @param nx_glob, ny_glob Global grid dimensions
+ * @param param Simulation parameters
+ * @param all_data Data structures containing fields
+ * @param gdata Global positions of the ranks (rebuilt after a migration)
+ * @param topo MPI topology information
+ */
+static void rebalance_domain(int timestep, int nx_glob, int ny_glob,
+                             const parameters_t param,
+                             all_data_t *all_data,
+                             gather_data_t *gdata,
+                             MPITopology *topo) {
+    balance_t *balance = &all_data->balance;
+    double t0 = MPI_Wtime();
+    int num_ranks = topo->nb_process;
+    const int *dims = topo->dims;
+
+    // Seconds per cell of every block, indexed by process column and row
+    double density = balance->compute / ((double)all_data->eta->nx * all_data->eta->ny);
+    double *ranks = malloc(num_ranks * sizeof(double));
+    double *blocks = malloc(num_ranks * sizeof(double));
+    long long *col = calloc(nx_glob + 1, sizeof(long long));
+    long long *row = calloc(ny_glob + 1, sizeof(long long));
+    int *new_splits[2] = {malloc((dims[0] + 1) * sizeof(int)), malloc((dims[1] + 1) * sizeof(int))};
+    if (!ranks || !blocks || !col || !row || !new_splits[0] || !new_splits[1]) {
+        fprintf(stderr, "Rank %d: Failed to allocate the rebalancing\n", topo->cart_rank);
+        MPI_Abort(topo->cart_comm, 1);
+    }
+    MPI_Allgather(&density, 1, MPI_DOUBLE, ranks, 1, MPI_DOUBLE, topo->cart_comm);
+    for (int r = 0; r < num_ranks; r++) {
+        int c[2];
+        MPI_Cart_coords(topo->cart_comm, r, 2, c);
+        blocks[c[1] * dims[0] + c[0]] = ranks[r];
+    }
+    balance->compute = 0.0;
+
+    // Column and row costs in nanoseconds, then their prefix sums
+    int *const *cut = topo->splits;
+    for (int px = 0; px < dims[0]; px++) {
+        double w = 0.0;
+        for (int py = 0; py < dims[1]; py++) w += blocks[py * dims[0] + px] * (cut[1][py + 1] - cut[1][py]);
+        for (int i = cut[0][px]; i < cut[0][px + 1]; i++) col[i + 1] = llround(1e9 * w);
+    }
+    for (int py = 0; py < dims[1]; py++) {
+        double w = 0.0;
+        for (int px = 0; px < dims[0]; px++) w += blocks[py * dims[0] + px] * (cut[0][px + 1] - cut[0][px]);
+        for (int j = cut[1][py]; j < cut[1][py + 1]; j++) row[j + 1] = llround(1e9 * w);
+    }
+    for (int i = 0; i < nx_glob; i++) col[i + 1] += col[i];
+    for (int j = 0; j < ny_glob; j++) row[j + 1] += row[j];
+
+    int min_cells = all_data->deep.depth;
+    new_splits[0][0] = new_splits[1][0] = 0;
+    new_splits[0][dims[0]] = nx_glob;
+    new_splits[1][dims[1]] = ny_glob;
+    bisect_axis(col, 0, nx_glob, 0, dims[0], min_cells, new_splits[0]);
+    bisect_axis(row, 0, ny_glob, 0, dims[1], min_cells, new_splits[1]);
+
+    // Current and predicted load of every block, and the cells that stay
+    double busiest = 0.0, predicted = 0.0, total = 0.0;
+    long long kept = 0;
+    for (int qy = 0; qy < dims[1]; qy++)
+        for (int qx = 0; qx < dims[0]; qx++) {
+            double now = blocks[qy * dims[0] + qx] * (cut[0][qx + 1] - cut[0][qx]) * (cut[1][qy + 1] - cut[1][qy]);
+            double next = 0.0;
+            for (int py = 0; py < dims[1]; py++)
+                for (int px = 0; px < dims[0]; px++)
+                    next += blocks[py * dims[0] + px]
+                          * overlap_cells(new_splits[0][qx], new_splits[0][qx + 1], cut[0][px], cut[0][px + 1])
+                          * overlap_cells(new_splits[1][qy], new_splits[1][qy + 1], cut[1][py], cut[1][py + 1]);
+            kept += overlap_cells(new_splits[0][qx], new_splits[0][qx + 1], cut[0][qx], cut[0][qx + 1])
+                  * overlap_cells(new_splits[1][qy], new_splits[1][qy + 1], cut[1][qy], cut[1][qy + 1]);
+            if (now > busiest) busiest = now;
+            if (next > predicted) predicted = next;
+            total += now;
+        }
+    free(ranks);
+    free(blocks);
+    free(col);
+    free(row);
+
+    if (predicted < (1.0 - REBALANCE_GAIN) * busiest) {
+        // The exchanges are rebuilt for the new blocks: keep their
+        // backend, depth and counters
+        int backend = all_data->halo_eta.backend;
+        int depth = all_data->deep.depth;
+        halo_t saved_faces = all_data->halo_faces, saved_eta = all_data->halo_eta;
+        deep_halo_t saved_deep = all_data->deep;
+
+        if (migrate_fields(param, all_data, new_splits, topo)) {
+            fprintf(stderr, "Rank %d: Failed to migrate the fields\n", topo->cart_rank);
+            MPI_Abort(topo->cart_comm, 1);
+        }
+        free_gather_structures(gdata, topo);
+        if (initialize_gather_structures(topo, gdata, nx_glob, ny_glob, param.dx, param.dy))
+            MPI_Abort(topo->cart_comm, 1);
+        interp_bathy(param, all_data, gdata, topo);
+
+        init_halo_windows(all_data, getenv(HALO_ENV), topo);
+        all_data->halo_faces.backend = all_data->halo_eta.backend = backend;
+        all_data->deep.messages = saved_deep.messages;
+        all_data->deep.bytes = saved_deep.bytes;
+        if (depth > 1) start_deep_halo(all_data, depth, topo);
+        all_data->halo_faces.time = saved_faces.time;
+        all_data->halo_faces.overlap = saved_faces.overlap;
+        all_data->halo_eta.time = saved_eta.time;
+        all_data->halo_eta.overlap = saved_eta.overlap;
+        all_data->deep.time = saved_deep.time;
+
+        long long moved = (long long)nx_glob * ny_glob - kept;
+        balance->migrations++;
+        balance->moved += moved;
+        if (topo->cart_rank == 0) {
+            double mean = total / num_ranks;
+            printf(" - step %d: rebalanced, busiest rank %.2fx -> %.2fx the mean (predicted), "
+                   "%lld cells moved\n", timestep, busiest / mean, predicted / mean, moved);
+            fflush(stdout);
+        }
+    }
+    free(new_splits[0]);
+    free(new_splits[1]);
+    balance->time += MPI_Wtime() - t0;
+}
+
+/**
+ * Ends the timing of one step, and rebalances the blocks at the end of
+ * every window of SHALLOW_REBALANCE steps but the last. The halo time is
+ * left out: waiting for a slower neighbour is not load
+ *
+ * @param timestep Current time step
+ * @param nt Number of time steps
+ * @param nx_glob, ny_glob Global grid dimensions
+ * @param param Simulation parameters
+ * @param all_data Data structures containing fields
+ * @param gdata Global positions of the ranks
+ * @param topo MPI topology information
+ */
+void end_balance_step(int timestep, int nt, int nx_glob, int ny_glob,
+                      const parameters_t param,
+                      all_data_t *all_data,
+                      gather_data_t *gdata,
+                      MPITopology *topo) {
+    balance_t *balance = &all_data->balance;
+    balance->compute += (MPI_Wtime() - balance->start) - (halo_seconds(all_data) - balance->comm);
+    if ((timestep + 1) % param.rebalance || timestep + 1 >= nt || topo->nb_process == 1) return;
+    rebalance_domain(timestep + 1, nx_glob, ny_glob, param, all_data, gdata, topo);
+}
 
+/**
+ * Reports the migrations of the run and the time they took (slowest rank)
+ *
+ * @param all_data Data structures containing fields
+ * @param topo MPI topology information
+ */
+void report_balance(const all_data_t *all_data, MPITopology *topo) {
+    double time;
+    MPI_Reduce(&all_data->balance.time, &time, 1, MPI_DOUBLE, MPI_MAX, 0, topo->cart_comm);
+    if (topo->cart_rank == 0)
+        printf("Rebalancing: %d migrations, %lld cells moved, %.2f ms\n",
+               all_data->balance.migrations, all_data->balance.moved, 1e3 * time);
+}
 
 /*===========================================================
  * DATA COLLECTION AND OUTPUT FUNCTIONS
@@ -795,12 +2361,18 @@ void gather_and_assemble_data(const parameters_t param,
     // Gather and assemble each field
     for (int field = 0; field < 3; field++) {
         data_t *local_data = output_data[field];
-        int send_size = local_data->nx * local_data->ny;
+
+        // Interior block of the padded field, rows a pitch apart
+        MPI_Datatype interior;
+        MPI_Type_vector(local_data->ny, local_data->nx, local_data->pitch,
+                        MPI_DOUBLE, &interior);
+        MPI_Type_commit(&interior);
 
         // Gathering data
-        MPI_Gatherv(local_data->vals, send_size, MPI_DOUBLE,
+        MPI_Gatherv(local_data->vals, 1, interior,
                     receive_buffers[field], recv_sizes[field],
                     displacements[field], MPI_DOUBLE, 0, topo->cart_comm);
+        MPI_Type_free(&interior);
 
         // Assembly on rank 0
         if (topo->cart_rank == 0) {
@@ -32,26 +32,59 @@ int main(int argc, char **argv) {
     printf(" - number of time steps: %d\n", nt);
 
 
+    // Choose the kernel path and the sweep tile size
+    printf(" - field storage: %s\n", REAL_NAME);
+    printf(" - SIMD kernels: %s\n", init_simd());
+    init_sweep(&param, nx, ny);
+    if (getenv(TILE_BENCH_ENV)) benchmark_sweep(nx, ny, &param, all_data);
+
+    // Place the field pages next to the threads that sweep them
+    first_touch(ny, param, all_data);
+    report_placement(&all_data->arena);
+
     // Interpolate bathymetry
     interp_bathy(nx, ny, param, all_data);
 
+    // Optional diamond temporal blocking or persistent parallel region
+    init_diamond(&param, ny);
+    init_persistent(&param);
+
+    // Snapshots are written by a background thread
+    init_writer(&all_data->writer, all_data->eta, "water elevation", param.output_eta_filename);
+
     // Loop over timestep
     double start = GET_TIME();
-    for(int n = 0; n < nt; n++) {
+    if (param.persistent) run_persistent(nt, nx, ny, param, all_data, start);
+
+    int steps = 1;
+    for(int n = 0; n < nt && !param.persistent; n += steps) {
        
         // output solution
-        if(param.sampling_rate && !(n % param.sampling_rate)) 
-            write_data_vtk(all_data->eta, "water elevation", param.output_eta_filename, n);
-
-        boundary_conditions(nx, ny, param, all_data);
-        apply_source(n, nx, ny, param, all_data);
-
-        update_eta(nx, ny, param, all_data);
-        update_velocities(nx, ny, param, all_data);
-
-        print_progress(n, nt, start);
+        if(param.sampling_rate && !(n % param.sampling_rate)) {
+            write_snapshot(&all_data->writer, all_data->eta, n);
+            report_deviation(all_data->eta, param.output_eta_filename, n);
+        }
+
+        if (param.diamond_steps) {
+            // Blocks stop at the next output step so snapshots stay exact
+            steps = (nt - n < param.diamond_steps) ? nt - n : param.diamond_steps;
+            if (param.sampling_rate) {
+                int to_output = param.sampling_rate - n % param.sampling_rate;
+                if (to_output < steps) steps = to_output;
+            }
+            advance_diamond(n, steps, nx, ny, param, all_data);
+        } else {
+            boundary_conditions(nx, ny, param, all_data);
+            apply_source(n, nx, ny, param, all_data);
+
+            update_eta(nx, ny, param, all_data);
+            update_velocities(nx, ny, param, all_data);
+        }
+
+        for (int s = 0; s < steps; s++) print_progress(n + s, nt, start);
     }
 
+    finish_writer(&all_data->writer);
     write_manifest_vtk(param.output_eta_filename, param.dt, nt, param.sampling_rate);
 
     double time = GET_TIME() - start;
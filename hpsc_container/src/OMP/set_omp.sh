@@ -18,8 +18,14 @@ fi
 # Give temporary permissions
 chown -R $TMP_USER:$TMP_USER /opt/hpsc_container
 
+# Optional float32 field storage (arithmetic stays float64): SINGLE=1
+PRECISION_FLAGS=""
+if [ "${SINGLE:-0}" = "1" ]; then
+    PRECISION_FLAGS="-DSHALLOW_SINGLE"
+fi
+
 # Compilation
-gcc -O3 -fopenmp -o ${BIN_PATH}/shallow_omp shallow_omp.c tools_omp.c main_omp.c -lm
+gcc -O3 -fopenmp ${PRECISION_FLAGS} -o ${BIN_PATH}/shallow_omp shallow_omp.c tools_omp.c main_omp.c simd_omp.c -pthread -lz -lm
 
 # Execute as temporary user
 if [ $? -eq 0 ]; then
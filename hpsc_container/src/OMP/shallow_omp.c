@@ -52,7 +52,10 @@ double interpolate_data(const data_t *data, double x, double y) {
 }
 
 /**
- * Interpolates bathymetry data onto computation grid
+ * Interpolates bathymetry data onto computation grid and builds the
+ * face coefficients used by update_eta: hu(i,j) = dt/dx * h at the u-face
+ * i (the depth of cell i, the last cell for the east wall face) and
+ * hv(i,j) = dt/dy * h at the v-face j (same rule towards the north wall)
  * 
  * @param nx, ny Grid dimensions
  * @param param Simulation parameters
@@ -68,77 +71,389 @@ void interp_bathy(int nx, int ny, const parameters_t param, all_data_t *all_data
             SET(all_data->h_interp, i, j, val);
         }
     }
+
+    double c1_x = param.dt / param.dx;
+    double c1_y = param.dt / param.dy;
+
+    #pragma omp parallel for
+    for(int j = 0; j < ny; j++) {
+        for(int i = 0; i <= nx; i++)
+            SET(all_data->hu, i, j, c1_x * GET(all_data->h_interp, (i < nx) ? i : nx - 1, j));
+    }
+
+    #pragma omp parallel for
+    for(int j = 0; j <= ny; j++) {
+        for(int i = 0; i < nx; i++)
+            SET(all_data->hv, i, j, c1_y * GET(all_data->h_interp, i, (j < ny) ? j : ny - 1));
+    }
 }
 
 /*===========================================================
  * MAIN COMPUTATION FUNCTIONS
  ===========================================================*/
 
+/**
+ * Updates water height (eta) on one tile of the grid
+ * Rows are swept in the outer loop so the inner loop is unit-stride;
+ * the face coefficients already hold the boundary faces, so every row
+ * is a single flux-difference sweep. The ghost cells of the tile's
+ * domain edges are refreshed for the velocity update
+ * 
+ * @param i0, i1 Column range of the tile [i0, i1)
+ * @param j0, j1 Row range of the tile [j0, j1)
+ * @param all_data Data structures containing fields
+ */
+static void update_eta_tile(int i0, int i1, int j0, int j1, all_data_t *all_data) {
+    for (int j = j0; j < j1; j++) {
+        eta_row(&GET(all_data->eta, i0, j), &GET(all_data->hu, i0, j), &GET(all_data->u, i0, j),
+                &GET(all_data->hv, i0, j), &GET(all_data->hv, i0, j + 1),
+                &GET(all_data->v, i0, j), &GET(all_data->v, i0, j + 1), i1 - i0);
+    }
+    fill_ghosts(all_data->eta, i0, i1, j0, j1);
+}
+
+/**
+ * Updates velocity fields (u,v) on one tile of the grid
+ * Rows are swept in the outer loop so the inner loop is unit-stride;
+ * the west and south differences of the first column and row read the
+ * eta ghost cells, which hold the edge values (zero gradient)
+ * 
+ * @param i0, i1 Column range of the tile [i0, i1)
+ * @param j0, j1 Row range of the tile [j0, j1)
+ * @param param Simulation parameters
+ * @param all_data Data structures containing fields
+ */
+static void update_velocities_tile(int i0, int i1, int j0, int j1,
+                                   const parameters_t param, all_data_t *all_data) {
+    // Compute coefficients
+    double c1 = param.dt * param.g;
+    double c2 = param.dt * param.gamma;
+
+    for (int j = j0; j < j1; j++) {
+        velocity_row(&GET(all_data->u, i0, j), &GET(all_data->v, i0, j),
+                     &GET(all_data->eta, i0, j), &GET(all_data->eta, i0, j - 1),
+                     1. - c2, c1 / param.dx, c1 / param.dy, i1 - i0);
+    }
+}
+
 /**
  * Updates water height (eta) using shallow water equations
+ * The grid is swept tile by tile, each thread owning whole rows of tiles
  * 
  * @param nx, ny Grid dimensions
  * @param param Simulation parameters
  * @param all_data Data structures containing fields
  */
 void update_eta(int nx, int ny, const parameters_t param, all_data_t *all_data) {
-    #pragma omp parallel for
-    for (int i = 0; i < nx; i++) {
-        for (int j = 0; j < ny; j++) {
-            // Get bathymetry values with boundary handling
-            double h_ui_plus_1_j = (i < nx - 1) ? GET(all_data->h_interp, i + 1, j) : GET(all_data->h_interp, i, j);
-            double h_ui_j = GET(all_data->h_interp, i, j);
-            double h_vi_j_plus_1 = (j < ny - 1) ? GET(all_data->h_interp, i, j + 1) : GET(all_data->h_interp, i, j);
-            double h_vi_j = GET(all_data->h_interp, i, j);
-
-            // Get velocity values with boundary handling
-            double u_ip1_j = (i < nx - 1) ? GET(all_data->u, i + 1, j) : GET(all_data->u, i, j);
-            double u_i_j = GET(all_data->u, i, j);
-            double v_i_jp1 = (j < ny - 1) ? GET(all_data->v, i, j + 1) : GET(all_data->v, i, j);
-            double v_i_j = GET(all_data->v, i, j);
-
-            // Compute spatial derivatives
-            double c1_x = param.dt / param.dx;
-            double c1_y = param.dt / param.dy;
-
-            // Update eta value
-            double eta_ij = GET(all_data->eta, i, j)
-                - c1_x * (h_ui_plus_1_j * u_ip1_j - h_ui_j * u_i_j)
-                - c1_y * (h_vi_j_plus_1 * v_i_jp1 - h_vi_j * v_i_j);
-
-            SET(all_data->eta, i, j, eta_ij);
+    #pragma omp parallel for schedule(static)
+    for (int j0 = 0; j0 < ny; j0 += param.tile_ny) {
+        int j1 = (j0 + param.tile_ny < ny) ? j0 + param.tile_ny : ny;
+        for (int i0 = 0; i0 < nx; i0 += param.tile_nx) {
+            int i1 = (i0 + param.tile_nx < nx) ? i0 + param.tile_nx : nx;
+            update_eta_tile(i0, i1, j0, j1, all_data);
         }
     }
 }
 
 /**
  * Updates velocity fields (u,v) using shallow water equations
+ * The grid is swept tile by tile, each thread owning whole rows of tiles
  * 
  * @param nx, ny Grid dimensions
  * @param param Simulation parameters
  * @param all_data Data structures containing fields
  */
 void update_velocities(int nx, int ny, const parameters_t param, all_data_t *all_data) {
-    #pragma omp parallel for
-    for(int i = 0; i < nx; i++) {
-        for(int j = 0; j < ny; j++) {
-            // Compute coefficients
-            double c1 = param.dt * param.g;
-            double c2 = param.dt * param.gamma;
-
-            // Get eta values with boundary handling
-            double eta_ij = GET(all_data->eta, i, j);
-            double eta_imj = GET(all_data->eta, (i == 0) ? 0 : i - 1, j);
-            double eta_ijm = GET(all_data->eta, i, (j == 0) ? 0 : j - 1);
-
-            // Update velocities
-            double u_ij = (1. - c2) * GET(all_data->u, i, j)
-                - c1 / param.dx * (eta_ij - eta_imj);
-            double v_ij = (1. - c2) * GET(all_data->v, i, j)
-                - c1 / param.dy * (eta_ij - eta_ijm);
-
-            SET(all_data->u, i, j, u_ij);
-            SET(all_data->v, i, j, v_ij);
+    #pragma omp parallel for schedule(static)
+    for (int j0 = 0; j0 < ny; j0 += param.tile_ny) {
+        int j1 = (j0 + param.tile_ny < ny) ? j0 + param.tile_ny : ny;
+        for (int i0 = 0; i0 < nx; i0 += param.tile_nx) {
+            int i1 = (i0 + param.tile_nx < nx) ? i0 + param.tile_nx : nx;
+            update_velocities_tile(i0, i1, j0, j1, param, all_data);
+        }
+    }
+}
+
+/**
+ * Writes the arena fields once with the thread-to-row mapping of the
+ * sweep (static schedule over tile rows), so each page lands on the NUMA
+ * node of the thread that updates it. The first tile row also owns the
+ * south ghost rows and the last one the north ghost rows and the extra
+ * row of v and hv. Runs after the tile size is final (benchmark_sweep
+ * included) so that the placement matches the sweep
+ * 
+ * @param ny Grid height
+ * @param param Simulation parameters (sweep tile size)
+ * @param all_data Data structures containing fields
+ */
+void first_touch(int ny, const parameters_t param, all_data_t *all_data) {
+    data_t *fields[] = {all_data->eta, all_data->u, all_data->v,
+                        all_data->h_interp, all_data->hu, all_data->hv};
+    const int num_fields = sizeof(fields) / sizeof(fields[0]);
+
+    #pragma omp parallel for schedule(static)
+    for (int j0 = 0; j0 < ny; j0 += param.tile_ny) {
+        int j1 = (j0 + param.tile_ny < ny) ? j0 + param.tile_ny : ny;
+        for (int f = 0; f < num_fields; f++) {
+            data_t *data = fields[f];
+            int first = (j0 == 0) ? -data->ghost : j0;
+            int last = (j1 == ny) ? data->ny + data->ghost : j1;
+            real_t *row = &GET(data, -data->ghost, first);
+            memset(row, 0, (size_t)(last - first) * data->pitch * sizeof(real_t));
+        }
+    }
+}
+
+/**
+ * Measures the update rate of a set of tile configurations
+ * Runs a few time steps per configuration on scratch copies of the fields,
+ * reports MUpdates/s for each and keeps the fastest in param
+ * 
+ * @param nx, ny Grid dimensions
+ * @param param Simulation parameters (tile size updated in place)
+ * @param all_data Data structures containing fields (left untouched)
+ */
+void benchmark_sweep(int nx, int ny, parameters_t *param, all_data_t *all_data) {
+    const int widths[] = {64, 128, 256, 512, 1024, nx};
+    const int heights[] = {4, 16, 64, param->tile_ny};
+    const int num_widths = sizeof(widths) / sizeof(widths[0]);
+    const int num_heights = sizeof(heights) / sizeof(heights[0]);
+
+    // Scratch fields so the benchmark does not disturb the simulation
+    data_t eta, u, v;
+    if (init_data(&eta, nx, ny, param->dx, param->dy, 0.) ||
+        init_data(&u, nx + 1, ny, param->dx, param->dy, 0.) ||
+        init_data(&v, nx, ny + 1, param->dx, param->dy, 0.)) {
+        fprintf(stderr, "Error: Could not allocate sweep benchmark fields\n");
+        return;
+    }
+    all_data_t scratch = *all_data;
+    scratch.eta = &eta;
+    scratch.u = &u;
+    scratch.v = &v;
+
+    parameters_t trial = *param;
+    double best_rate = 0.0;
+    int best_nx = param->tile_nx;
+    int best_ny = param->tile_ny;
+
+    printf("Sweep benchmark (%d steps per configuration):\n", TILE_BENCH_STEPS);
+    for (int a = 0; a < num_widths; a++) {
+        if (widths[a] > nx || (a < num_widths - 1 && widths[a] == nx)) continue;
+        for (int b = 0; b < num_heights; b++) {
+            if (heights[b] > ny || (b < num_heights - 1 && heights[b] == param->tile_ny)) continue;
+            trial.tile_nx = widths[a];
+            trial.tile_ny = heights[b];
+
+            double start = GET_TIME();
+            for (int n = 0; n < TILE_BENCH_STEPS; n++) {
+                update_eta(nx, ny, trial, &scratch);
+                update_velocities(nx, ny, trial, &scratch);
+            }
+            double time = GET_TIME() - start;
+            double rate = 1e-6 * (double)nx * (double)ny * TILE_BENCH_STEPS / time;
+
+            printf(" - tile %5d x %-5d: %10.2f MUpdates/s\n", trial.tile_nx, trial.tile_ny, rate);
+            if (rate > best_rate) {
+                best_rate = rate;
+                best_nx = trial.tile_nx;
+                best_ny = trial.tile_ny;
+            }
+        }
+    }
+
+    param->tile_nx = best_nx;
+    param->tile_ny = best_ny;
+    printf(" - selected tile: %d x %d\n", best_nx, best_ny);
+
+    free_data(&eta);
+    free_data(&u);
+    free_data(&v);
+}
+
+/*===========================================================
+ * TEMPORAL BLOCKING (DIAMOND SCHEDULE)
+ ===========================================================*/
+/*
+ * One time step is an eta half-step E(j) followed by a velocity half-step
+ * V(j) on every row j.  E(j) reads v on rows j and j+1, V(j) reads eta on
+ * rows j and j-1, so information travels one row per step.  The rows are
+ * split into tiles that advance several steps while they stay in cache:
+ *
+ *   step  ^      tile 0          tile 1          tile 2
+ *         |  +-----------\   /-----------\   /-----------+
+ *         |  |  phase 1   \ /  phase 1    \ /  phase 1   |
+ *         |  |             X  (phase 2)    X             |
+ *         |  +------------/ \------------/ \------------+
+ *            0                                          ny
+ *
+ * Phase 1 advances every tile, shrinking by one row per step on its
+ * interior sides.  Phase 2 fills the inverted diamonds left around each
+ * tile boundary.  Tiles of a phase never touch each other's rows, so both
+ * phases run in parallel without locks.
+ */
+
+/**
+ * Advances a band of rows by one time step of the diamond schedule
+ * 
+ * @param timestep Time step being computed
+ * @param e0, e1 Rows whose eta is updated [e0, e1)
+ * @param v0, v1 Rows whose velocities are updated [v0, v1)
+ * @param nx, ny Grid dimensions
+ * @param param Simulation parameters
+ * @param all_data Data structures containing fields
+ */
+static void advance_band(int timestep, int e0, int e1, int v0, int v1, int nx, int ny,
+                         const parameters_t param, all_data_t *all_data) {
+    if (e0 < e1) {
+        apply_source_rows(timestep, e0, e1, nx, ny, param, all_data);
+        update_eta_tile(0, nx, e0, e1, all_data);
+    }
+    if (v0 < v1) update_velocities_tile(0, nx, v0, v1, param, all_data);
+}
+
+/**
+ * Advances the solution by several time steps with diamond temporal blocking
+ * Produces the same fields as calling boundary_conditions, apply_source,
+ * update_eta and update_velocities once per step
+ * 
+ * @param timestep First time step of the block
+ * @param steps Number of time steps in the block
+ * @param nx, ny Grid dimensions
+ * @param param Simulation parameters
+ * @param all_data Data structures containing fields
+ */
+void advance_diamond(int timestep, int steps, int nx, int ny,
+                     const parameters_t param, all_data_t *all_data) {
+    // The last tile absorbs the remainder so every tile is tall enough
+    int rows = param.diamond_rows;
+    int num_tiles = (ny / rows > 0) ? ny / rows : 1;
+
+    // Kernels keep the closed boundaries at zero, so one call per block suffices
+    boundary_conditions(nx, ny, param, all_data);
+
+    // Phase 1: tiles shrink by one row per step on their interior sides
+    #pragma omp parallel for schedule(static)
+    for (int t = 0; t < num_tiles; t++) {
+        int a = t * rows;
+        int b = (t == num_tiles - 1) ? ny : a + rows;
+        for (int s = 0; s < steps; s++) {
+            int e0 = (a == 0) ? 0 : a + s;
+            int v0 = (a == 0) ? 0 : a + s + 1;
+            int e1 = (b == ny) ? ny : b - s;
+            advance_band(timestep + s, e0, e1, v0, e1, nx, ny, param, all_data);
+        }
+    }
+
+    // Phase 2: the gaps around tile boundaries grow by one row per step
+    #pragma omp parallel for schedule(static)
+    for (int t = 1; t < num_tiles; t++) {
+        int b = t * rows;
+        for (int s = 0; s < steps; s++) {
+            advance_band(timestep + s, b - s, b + s, b - s, b + s + 1, nx, ny, param, all_data);
+        }
+    }
+}
+
+/*===========================================================
+ * PERSISTENT PARALLEL REGION
+ ===========================================================*/
+
+/**
+ * Rows owned by one thread of the persistent region
+ * Splits the tile rows like schedule(static) does, so each thread keeps
+ * the rows it placed in first_touch
+ * 
+ * @param ny Number of rows
+ * @param tile_ny Sweep tile height
+ * @param thread, num_threads Thread number and team size
+ * @param j0, j1 Row range of the band [j0, j1) (empty for idle threads)
+ */
+static void thread_band(int ny, int tile_ny, int thread, int num_threads, int *j0, int *j1) {
+    int num_tiles = (ny + tile_ny - 1) / tile_ny;
+    int q = num_tiles / num_threads;
+    int r = num_tiles % num_threads;
+    int first = thread * q + (thread < r ? thread : r);
+    int count = q + (thread < r);
+
+    *j0 = (first * tile_ny < ny) ? first * tile_ny : ny;
+    *j1 = ((first + count) * tile_ny < ny) ? (first + count) * tile_ny : ny;
+}
+
+/**
+ * Advances a band of rows by one time step, tile by tile
+ * The barrier between both half-steps is left to the caller
+ * 
+ * @param timestep Time step being computed
+ * @param j0, j1 Row range of the band [j0, j1)
+ * @param nx, ny Grid dimensions
+ * @param param Simulation parameters
+ * @param all_data Data structures containing fields
+ * @param velocities 0 for the eta half-step, 1 for the velocity half-step
+ */
+static void sweep_band(int timestep, int j0, int j1, int nx, int ny, const parameters_t param,
+                       all_data_t *all_data, int velocities) {
+    if (j0 >= j1) return;
+
+    if (!velocities) {
+        // Closed boundaries of the band, then its sources
+        for (int j = j0; j < j1; j++) {
+            SET(all_data->u, 0, j, 0.0);
+            SET(all_data->u, nx, j, 0.0);
+        }
+        for (int i = 0; i < nx; i++) {
+            if (j0 == 0) SET(all_data->v, i, 0, 0.0);
+            if (j1 == ny) SET(all_data->v, i, ny, 0.0);
+        }
+        apply_source_rows(timestep, j0, j1, nx, ny, param, all_data);
+    }
+
+    for (int t0 = j0; t0 < j1; t0 += param.tile_ny) {
+        int t1 = (t0 + param.tile_ny < j1) ? t0 + param.tile_ny : j1;
+        for (int i0 = 0; i0 < nx; i0 += param.tile_nx) {
+            int i1 = (i0 + param.tile_nx < nx) ? i0 + param.tile_nx : nx;
+            if (velocities) update_velocities_tile(i0, i1, t0, t1, param, all_data);
+            else update_eta_tile(i0, i1, t0, t1, all_data);
+        }
+    }
+}
+
+/**
+ * Runs the whole time loop inside a single parallel region
+ * Each thread owns a fixed band of rows for the whole run. E(j) reads v
+ * on row j+1 and V(j) reads eta on row j-1, so two barriers per step
+ * replace the fork/join of every loop; one thread writes the outputs
+ * 
+ * @param nt Number of time steps
+ * @param nx, ny Grid dimensions
+ * @param param Simulation parameters
+ * @param all_data Data structures containing fields
+ * @param start_time Simulation start time (progress report)
+ */
+void run_persistent(int nt, int nx, int ny, const parameters_t param,
+                    all_data_t *all_data, double start_time) {
+    #pragma omp parallel
+    {
+        int j0, j1;
+        thread_band(ny, param.tile_ny, omp_get_thread_num(), omp_get_num_threads(), &j0, &j1);
+
+        for (int n = 0; n < nt; n++) {
+            // The other threads wait at the end of single: eta is not touched
+            if (param.sampling_rate && !(n % param.sampling_rate)) {
+                #pragma omp single
+                {
+                    write_snapshot(&all_data->writer, all_data->eta, n);
+                    report_deviation(all_data->eta, param.output_eta_filename, n);
+                }
+            }
+
+            sweep_band(n, j0, j1, nx, ny, param, all_data, 0);
+            #pragma omp barrier
+            sweep_band(n, j0, j1, nx, ny, param, all_data, 1);
+            #pragma omp barrier
+
+            #pragma omp master
+            print_progress(n, nt, start_time);
         }
     }
 }
@@ -181,6 +496,22 @@ void boundary_conditions(int nx, int ny, const parameters_t param, all_data_t *a
  * @param all_data Data structures containing fields
  */
 void apply_source(int timestep, int nx, int ny, const parameters_t param, all_data_t *all_data) {
+    apply_source_rows(timestep, 0, ny, nx, ny, param, all_data);
+}
+
+/**
+ * Apply the source terms that fall inside a band of rows
+ * Lets row-blocked integrators inject each source exactly when its row is
+ * updated; the top boundary wave maker belongs to the last row
+ * 
+ * @param timestep Current simulation timestep
+ * @param j0, j1 Row range of the band [j0, j1)
+ * @param nx, ny Grid dimensions
+ * @param param Simulation parameters
+ * @param all_data Data structures containing fields
+ */
+void apply_source_rows(int timestep, int j0, int j1, int nx, int ny,
+                       const parameters_t param, all_data_t *all_data) {
     double t = timestep * param.dt;
     const double A = 5.0;        // Amplitude 
     const double f = 1.0 / 20.0; // Frequency
@@ -192,6 +523,7 @@ void apply_source(int timestep, int nx, int ny, const parameters_t param, all_da
     
     switch(param.source_type) {
         case 1: {  // Top boundary wave maker
+            if (j1 < ny) break;
             #pragma omp parallel for
             for(int i = 0; i < nx; i++) {
                 double x_pos = i * param.dx;
@@ -202,7 +534,8 @@ void apply_source(int timestep, int nx, int ny, const parameters_t param, all_da
         }
         
         case 2: {  // Central point source
-            SET(all_data->eta, nx / 2, ny / 2, source);
+            if (ny / 2 >= j0 && ny / 2 < j1)
+                SET(all_data->eta, nx / 2, ny / 2, source);
             break;
         }
 
@@ -219,6 +552,7 @@ void apply_source(int timestep, int nx, int ny, const parameters_t param, all_da
             for (int s = 0; s < num_sources; s++) {
                 int i = source_positions[s][0];
                 int j = source_positions[s][1];
+                if (j < j0 || j >= j1) continue;
                 double phase_shifted_source = A * sin(2.0 * M_PI * f * t + phase_shifts[s]) * envelope;
                 SET(all_data->eta, i, j, phase_shifted_source);
             }
@@ -231,7 +565,7 @@ void apply_source(int timestep, int nx, int ny, const parameters_t param, all_da
             int source_j = (int)(ny/2 + (ny/4) * cos(speed * t));
             
             // Vérification que la source reste dans les limites du domaine
-            if (source_i >= 0 && source_i < nx && source_j >= 0 && source_j < ny) {
+            if (source_i >= 0 && source_i < nx && source_j >= j0 && source_j < j1) {
                 SET(all_data->eta, source_i, source_j, source);
             }
             break;
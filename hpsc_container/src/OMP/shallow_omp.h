@@ -13,6 +13,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <zlib.h>
 #include <math.h>
 #include <string.h>
 #include <time.h>
@@ -33,6 +36,48 @@
 #define INPUT_DIR getenv("SHALLOW_INPUT_DIR")
 #define MAX_PATH_LENGTH 512
 
+// Sweep engine configuration (overridable through the environment)
+#define TILE_NX_ENV "SHALLOW_TILE_NX"          // tile width (grid points)
+#define TILE_NY_ENV "SHALLOW_TILE_NY"          // tile height (grid rows)
+#define TILE_BENCH_ENV "SHALLOW_TILE_BENCH"    // benchmark tile configurations
+#define DEFAULT_L2_BYTES (1024 * 1024)          // fallback when L2 size is unknown
+#define MAX_TILE_NX 1024                        // widest default tile, so a tile keeps several rows in L2
+#define TILE_BENCH_STEPS 20                     // time steps per benchmarked tile
+#define DIAMOND_STEPS_ENV "SHALLOW_DIAMOND_STEPS"  // time steps per diamond block
+#define DIAMOND_ROWS_ENV "SHALLOW_DIAMOND_ROWS"    // rows per diamond tile
+#define PERSISTENT_ENV "SHALLOW_PERSISTENT"      // one parallel region for the time loop
+#define SIMD_ENV "SHALLOW_SIMD"                 // force a kernel path (scalar, sse2, avx2, avx512)
+#define REFERENCE_DIR_ENV "SHALLOW_REFERENCE_DIR"  // float64 outputs to compare against
+#define VTK_COMPRESS_ENV "SHALLOW_VTK_COMPRESS"    // zlib level of VTK snapshots (1-9, 0: raw)
+#define VTK_SHUFFLE_ENV "SHALLOW_VTK_SHUFFLE"      // byte-shuffle compressed values (not VTK-standard)
+#define VTK_SHUFFLE_EXT "vtis"                     // extension of shuffled snapshots (not .vti)
+#define VTK_BLOCK_BYTES (256 * 1024)               // uncompressed bytes per zlib block
+#define WRITER_SLOTS_ENV "SHALLOW_WRITER_SLOTS"    // snapshot buffers of the writer thread (0: none)
+#define WRITER_SLOTS 2                              // default: double buffering
+#define WRITER_POLL_NS 100000                       // pause of a waiting queue end (ns)
+#define HUGE_PAGES_ENV "SHALLOW_HUGE_PAGES"     // back the field arena with huge pages
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)        // transparent huge page size
+#define MAX_NUMA_NODES 64                       // nodes shown by the placement report
+
+// Field storage precision: build with -DSHALLOW_SINGLE to store fields as
+// float32, arithmetic is always carried out in float64
+#ifdef SHALLOW_SINGLE
+typedef float real_t;
+#define REAL_NAME "float32"
+#define VTK_REAL_TYPE "Float32"
+#else
+typedef double real_t;
+#define REAL_NAME "float64"
+#define VTK_REAL_TYPE "Float64"
+#endif
+
+// Padded field layout: GHOST_WIDTH ghost cells around every field and rows
+// padded to a multiple of FIELD_ALIGN bytes (build with -DGHOST_WIDTH=n)
+#ifndef GHOST_WIDTH
+#define GHOST_WIDTH 1
+#endif
+#define FIELD_ALIGN 64
+
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
 #endif
@@ -40,8 +85,9 @@
 /*===========================================================
  * DATA ACCESS MACROS
  ===========================================================*/
-#define GET(data, i, j) ((data)->values[(data)->nx * (j) + (i)])
-#define SET(data, i, j, val) ((data)->values[(data)->nx * (j) + (i)] = (val))
+// i, j range from -ghost to nx+ghost-1 / ny+ghost-1
+#define GET(data, i, j) ((data)->values[(data)->pitch * (j) + (i)])
+#define SET(data, i, j, val) ((data)->values[(data)->pitch * (j) + (i)] = (val))
 
 /*===========================================================
  * TYPE DEFINITIONS
@@ -55,6 +101,10 @@ typedef struct {
     double g, gamma;             // Physical parameters
     int source_type;             // Source configuration
     int sampling_rate;           // Output frequency
+    int tile_nx, tile_ny;        // Sweep tile size (grid points)
+    int diamond_steps;           // Time steps per diamond block (0 = off)
+    int diamond_rows;            // Rows per diamond tile
+    int persistent;              // Single parallel region for the time loop (0 = off)
     char input_h_filename[MAX_PATH_LENGTH];      // Input file paths
     char output_eta_filename[MAX_PATH_LENGTH];   // Output file paths
     char output_u_filename[MAX_PATH_LENGTH];
@@ -63,13 +113,55 @@ typedef struct {
 
 /**
  * Grid data structure
+ * Interior rows start on a FIELD_ALIGN boundary and are surrounded by
+ * ghost cells
  */
 typedef struct {
-    double *values;              // Field values
+    real_t *values;              // Field values, points at (0,0)
+    real_t *storage;             // Allocation holding values and ghost cells
     int nx, ny;                 // Grid dimensions
+    int ghost;                  // Ghost cells on each side
+    int pitch;                  // Distance between rows (elements)
     double dx, dy;              // Grid spacing
 } data_t;
 
+/**
+ * Field arena: one page-aligned mapping holding every field except the
+ * bathymetry, its pages placed by a parallel first touch
+ */
+typedef struct {
+    char *base;                 // Start of the mapping
+    size_t size;                // Mapped bytes
+    char *start;                // First field (huge page aligned)
+    size_t used;                // Bytes spanned by the fields
+    int huge_pages;             // Huge pages requested through madvise
+} arena_t;
+
+/**
+ * Background snapshot writer
+ * Single-producer single-consumer ring of snapshot buffers: the time loop
+ * fills slot head, the writer thread writes out slot tail. Both ends only
+ * publish their index (release) and read the other one (acquire)
+ */
+typedef struct {
+    real_t **slots;             // Snapshot buffers (nx * ny values each)
+    int *steps;                 // Time step held by each slot
+    int num_slots;              // 0: write synchronously
+    int nx, ny;                 // Field dimensions
+    double dx, dy;              // Grid spacing
+    const char *name;           // Field name for VTK file
+    const char *filename;       // Base name for output files
+    atomic_int head;            // Slots filled by the time loop
+    atomic_int tail;            // Slots written by the thread
+    atomic_int done;            // No snapshot will follow
+    pthread_t thread;
+    int snapshots, stalls;      // Snapshots handed over, waits on a full queue
+    double copy_time;           // Seconds the time loop spent handing over
+    double stall_time;          // Part of it spent waiting for a free slot
+    double write_time;          // Seconds the writer spent writing
+    int errors;                 // Snapshots that could not be written
+} writer_t;
+
 /**
  * Collection of all simulation fields
  */
@@ -79,8 +171,26 @@ typedef struct {
     data_t *eta;                // Water elevation
     data_t *h;                  // Bathymetry
     data_t *h_interp;           // Interpolated bathymetry
+    data_t *hu;                 // U-face depth times dt/dx
+    data_t *hv;                 // V-face depth times dt/dy
+    arena_t arena;              // Storage of eta, u, v, h_interp, hu, hv
+    writer_t writer;            // Background writer of eta snapshots
 } all_data_t;
 
+/**
+ * Row kernels selected at startup by init_simd
+ * eta_row reads one u-face past the segment, velocity_row one point before it
+ */
+typedef void (*eta_row_fn)(real_t *eta, const real_t *hu, const real_t *u,
+                           const real_t *hv, const real_t *hv_n,
+                           const real_t *v, const real_t *v_n, int n);
+typedef void (*velocity_row_fn)(real_t *u, real_t *v, const real_t *eta,
+                                const real_t *eta_s, double damping,
+                                double c_x, double c_y, int n);
+
+extern eta_row_fn eta_row;
+extern velocity_row_fn velocity_row;
+
 /*===========================================================
  * COMPUTATION FUNCTION PROTOTYPES
  ===========================================================*/
@@ -88,10 +198,16 @@ typedef struct {
 // Core computation functions
 void update_velocities(int nx, int ny, const parameters_t param, all_data_t *all_data);
 void update_eta(int nx, int ny, const parameters_t param, all_data_t *all_data);
+void benchmark_sweep(int nx, int ny, parameters_t *param, all_data_t *all_data);
+void advance_diamond(int timestep, int steps, int nx, int ny, const parameters_t param, all_data_t *all_data);
+void first_touch(int ny, const parameters_t param, all_data_t *all_data);
+void run_persistent(int nt, int nx, int ny, const parameters_t param, all_data_t *all_data, double start_time);
+const char *init_simd(void);
 
 // Boundary and source terms
 void boundary_conditions(int nx, int ny, const parameters_t param, all_data_t *all_data);
 void apply_source(int timestep, int nx, int ny, const parameters_t param, all_data_t *all_data);
+void apply_source_rows(int timestep, int j0, int j1, int nx, int ny, const parameters_t param, all_data_t *all_data);
 
 // Interpolation functions
 double interpolate_data(const data_t *data, double x, double y);
@@ -110,14 +226,24 @@ int read_data(data_t *data, const char *filename);
 int write_data(const data_t *data, const char *filename, int step);
 int write_data_vtk(const data_t *data, const char *name, const char *filename, int step);
 int write_manifest_vtk(const char *filename, double dt, int nt, int sampling_rate);
+int report_deviation(const data_t *data, const char *filename, int step);
+int init_writer(writer_t *writer, const data_t *field, const char *name, const char *filename);
+int write_snapshot(writer_t *writer, const data_t *field, int step);
+int finish_writer(writer_t *writer);
 
 // Initialization and cleanup
 int init_data(data_t *data, int nx, int ny, double dx, double dy, double val);
 void free_data(data_t *data);
+void fill_ghosts(data_t *data, int i0, int i1, int j0, int j1);
+int init_arena(all_data_t *all_data, int nx, int ny, double dx, double dy);
+void report_placement(const arena_t *arena);
 all_data_t* init_all_data(const parameters_t *param);
 void free_all_data(all_data_t* all_data);
 
 // Utility functions
 void print_progress(int current_step, int total_steps, double start_time);
+void init_sweep(parameters_t *param, int nx, int ny);
+void init_diamond(parameters_t *param, int ny);
+void init_persistent(parameters_t *param);
 
 #endif // SHALLOW_H
\ No newline at end of file
@@ -0,0 +1,249 @@
+/*===========================================================
+ * SHALLOW WATER EQUATIONS SOLVER - OPENMP VERSION
+ * SIMD Kernels File
+ * Contains vectorized row kernels and runtime ISA dispatch
+ ===========================================================*/
+
+// Keep every path bit-identical to the scalar kernels: no FMA contraction
+#pragma GCC optimize ("fp-contract=off")
+
+#include "shallow_omp.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_X86 1
+
+// Vector loads widen to float64 and stores round back to the storage type
+#ifdef SHALLOW_SINGLE
+#define LOAD_SSE2(p) _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64((const __m128i *)(p))))
+#define STORE_SSE2(p, x) _mm_storel_pi((__m64 *)(p), _mm_cvtpd_ps(x))
+#define LOAD_AVX2(p) _mm256_cvtps_pd(_mm_loadu_ps(p))
+#define STORE_AVX2(p, x) _mm_storeu_ps((p), _mm256_cvtpd_ps(x))
+#define LOAD_AVX512(p) _mm512_cvtps_pd(_mm256_loadu_ps(p))
+#define STORE_AVX512(p, x) _mm256_storeu_ps((p), _mm512_cvtpd_ps(x))
+#else
+#define LOAD_SSE2(p) _mm_loadu_pd(p)
+#define STORE_SSE2(p, x) _mm_storeu_pd((p), (x))
+#define LOAD_AVX2(p) _mm256_loadu_pd(p)
+#define STORE_AVX2(p, x) _mm256_storeu_pd((p), (x))
+#define LOAD_AVX512(p) _mm512_loadu_pd(p)
+#define STORE_AVX512(p, x) _mm512_storeu_pd((p), (x))
+#endif
+#endif
+
+/*===========================================================
+ * SCALAR KERNELS
+ ===========================================================*/
+
+/**
+ * Updates eta on one row segment (scalar reference)
+ * Pure flux difference: reads hu[k+1] and u[k+1] (east faces) and the
+ * v-faces of this row and the next one
+ *
+ * @param eta Water elevation row
+ * @param hu, u U-face coefficients and x-velocity on this row
+ * @param hv, hv_n V-face coefficients on this row and the next one
+ * @param v, v_n Y-velocity on this row and the next one
+ * @param n Number of points to update
+ */
+static void eta_row_scalar(real_t *eta, const real_t *hu, const real_t *u,
+                           const real_t *hv, const real_t *hv_n,
+                           const real_t *v, const real_t *v_n, int n) {
+    for (int k = 0; k < n; k++) {
+        eta[k] = eta[k]
+            - ((double)hu[k + 1] * u[k + 1] - (double)hu[k] * u[k])
+            - ((double)hv_n[k] * v_n[k] - (double)hv[k] * v[k]);
+    }
+}
+
+/**
+ * Updates u and v on one row segment (scalar reference)
+ *
+ * @param u, v Velocity rows
+ * @param eta Water elevation row
+ * @param eta_s Water elevation on the previous row
+ * @param damping 1 - dt*gamma
+ * @param c_x, c_y dt*g/dx and dt*g/dy
+ * @param n Number of points to update
+ */
+static void velocity_row_scalar(real_t *u, real_t *v, const real_t *eta,
+                                const real_t *eta_s, double damping,
+                                double c_x, double c_y, int n) {
+    for (int k = 0; k < n; k++) {
+        double eta_k = eta[k];
+        u[k] = damping * u[k] - c_x * (eta_k - eta[k - 1]);
+        v[k] = damping * v[k] - c_y * (eta_k - eta_s[k]);
+    }
+}
+
+#ifdef SIMD_X86
+/*===========================================================
+ * SSE2 KERNELS
+ ===========================================================*/
+
+static void eta_row_sse2(real_t *eta, const real_t *hu, const real_t *u,
+                         const real_t *hv, const real_t *hv_n,
+                         const real_t *v, const real_t *v_n, int n) {
+    int k = 0;
+    for (; k + 2 <= n; k += 2) {
+        __m128d flux_x = _mm_sub_pd(_mm_mul_pd(LOAD_SSE2(hu + k + 1), LOAD_SSE2(u + k + 1)),
+                                _mm_mul_pd(LOAD_SSE2(hu + k), LOAD_SSE2(u + k)));
+        __m128d flux_y = _mm_sub_pd(_mm_mul_pd(LOAD_SSE2(hv_n + k), LOAD_SSE2(v_n + k)),
+                                _mm_mul_pd(LOAD_SSE2(hv + k), LOAD_SSE2(v + k)));
+        __m128d e = _mm_sub_pd(_mm_sub_pd(LOAD_SSE2(eta + k), flux_x), flux_y);
+        STORE_SSE2(eta + k, e);
+    }
+    eta_row_scalar(eta + k, hu + k, u + k, hv + k, hv_n + k, v + k, v_n + k, n - k);
+}
+
+static void velocity_row_sse2(real_t *u, real_t *v, const real_t *eta,
+                              const real_t *eta_s, double damping,
+                              double c_x, double c_y, int n) {
+    __m128d d = _mm_set1_pd(damping);
+    __m128d cx = _mm_set1_pd(c_x);
+    __m128d cy = _mm_set1_pd(c_y);
+    int k = 0;
+    for (; k + 2 <= n; k += 2) {
+        __m128d e = LOAD_SSE2(eta + k);
+        __m128d du = _mm_sub_pd(e, LOAD_SSE2(eta + k - 1));
+        __m128d dv = _mm_sub_pd(e, LOAD_SSE2(eta_s + k));
+        STORE_SSE2(u + k, _mm_sub_pd(_mm_mul_pd(d, LOAD_SSE2(u + k)), _mm_mul_pd(cx, du)));
+        STORE_SSE2(v + k, _mm_sub_pd(_mm_mul_pd(d, LOAD_SSE2(v + k)), _mm_mul_pd(cy, dv)));
+    }
+    velocity_row_scalar(u + k, v + k, eta + k, eta_s + k, damping, c_x, c_y, n - k);
+}
+
+/*===========================================================
+ * AVX2 KERNELS
+ ===========================================================*/
+
+__attribute__((target("avx2")))
+static void eta_row_avx2(real_t *eta, const real_t *hu, const real_t *u,
+                         const real_t *hv, const real_t *hv_n,
+                         const real_t *v, const real_t *v_n, int n) {
+    int k = 0;
+    for (; k + 4 <= n; k += 4) {
+        __m256d flux_x = _mm256_sub_pd(_mm256_mul_pd(LOAD_AVX2(hu + k + 1), LOAD_AVX2(u + k + 1)),
+                                _mm256_mul_pd(LOAD_AVX2(hu + k), LOAD_AVX2(u + k)));
+        __m256d flux_y = _mm256_sub_pd(_mm256_mul_pd(LOAD_AVX2(hv_n + k), LOAD_AVX2(v_n + k)),
+                                _mm256_mul_pd(LOAD_AVX2(hv + k), LOAD_AVX2(v + k)));
+        __m256d e = _mm256_sub_pd(_mm256_sub_pd(LOAD_AVX2(eta + k), flux_x), flux_y);
+        STORE_AVX2(eta + k, e);
+    }
+    eta_row_scalar(eta + k, hu + k, u + k, hv + k, hv_n + k, v + k, v_n + k, n - k);
+}
+
+__attribute__((target("avx2")))
+static void velocity_row_avx2(real_t *u, real_t *v, const real_t *eta,
+                              const real_t *eta_s, double damping,
+                              double c_x, double c_y, int n) {
+    __m256d d = _mm256_set1_pd(damping);
+    __m256d cx = _mm256_set1_pd(c_x);
+    __m256d cy = _mm256_set1_pd(c_y);
+    int k = 0;
+    for (; k + 4 <= n; k += 4) {
+        __m256d e = LOAD_AVX2(eta + k);
+        __m256d du = _mm256_sub_pd(e, LOAD_AVX2(eta + k - 1));
+        __m256d dv = _mm256_sub_pd(e, LOAD_AVX2(eta_s + k));
+        STORE_AVX2(u + k, _mm256_sub_pd(_mm256_mul_pd(d, LOAD_AVX2(u + k)),
+                                              _mm256_mul_pd(cx, du)));
+        STORE_AVX2(v + k, _mm256_sub_pd(_mm256_mul_pd(d, LOAD_AVX2(v + k)),
+                                              _mm256_mul_pd(cy, dv)));
+    }
+    velocity_row_scalar(u + k, v + k, eta + k, eta_s + k, damping, c_x, c_y, n - k);
+}
+
+/*===========================================================
+ * AVX-512 KERNELS
+ ===========================================================*/
+
+__attribute__((target("avx512f")))
+static void eta_row_avx512(real_t *eta, const real_t *hu, const real_t *u,
+                           const real_t *hv, const real_t *hv_n,
+                           const real_t *v, const real_t *v_n, int n) {
+    int k = 0;
+    for (; k + 8 <= n; k += 8) {
+        __m512d flux_x = _mm512_sub_pd(_mm512_mul_pd(LOAD_AVX512(hu + k + 1), LOAD_AVX512(u + k + 1)),
+                                _mm512_mul_pd(LOAD_AVX512(hu + k), LOAD_AVX512(u + k)));
+        __m512d flux_y = _mm512_sub_pd(_mm512_mul_pd(LOAD_AVX512(hv_n + k), LOAD_AVX512(v_n + k)),
+                                _mm512_mul_pd(LOAD_AVX512(hv + k), LOAD_AVX512(v + k)));
+        __m512d e = _mm512_sub_pd(_mm512_sub_pd(LOAD_AVX512(eta + k), flux_x), flux_y);
+        STORE_AVX512(eta + k, e);
+    }
+    eta_row_scalar(eta + k, hu + k, u + k, hv + k, hv_n + k, v + k, v_n + k, n - k);
+}
+
+__attribute__((target("avx512f")))
+static void velocity_row_avx512(real_t *u, real_t *v, const real_t *eta,
+                                const real_t *eta_s, double damping,
+                                double c_x, double c_y, int n) {
+    __m512d d = _mm512_set1_pd(damping);
+    __m512d cx = _mm512_set1_pd(c_x);
+    __m512d cy = _mm512_set1_pd(c_y);
+    int k = 0;
+    for (; k + 8 <= n; k += 8) {
+        __m512d e = LOAD_AVX512(eta + k);
+        __m512d du = _mm512_sub_pd(e, LOAD_AVX512(eta + k - 1));
+        __m512d dv = _mm512_sub_pd(e, LOAD_AVX512(eta_s + k));
+        STORE_AVX512(u + k, _mm512_sub_pd(_mm512_mul_pd(d, LOAD_AVX512(u + k)),
+                                              _mm512_mul_pd(cx, du)));
+        STORE_AVX512(v + k, _mm512_sub_pd(_mm512_mul_pd(d, LOAD_AVX512(v + k)),
+                                              _mm512_mul_pd(cy, dv)));
+    }
+    velocity_row_scalar(u + k, v + k, eta + k, eta_s + k, damping, c_x, c_y, n - k);
+}
+#endif // SIMD_X86
+
+/*===========================================================
+ * RUNTIME DISPATCH
+ ===========================================================*/
+
+// Selected row kernels (scalar until init_simd runs)
+eta_row_fn eta_row = eta_row_scalar;
+velocity_row_fn velocity_row = velocity_row_scalar;
+
+/**
+ * Selects the widest kernel path supported by the running CPU
+ * SHALLOW_SIMD=scalar|sse2|avx2|avx512 forces a narrower path; other
+ * values are reported and ignored
+ *
+ * @return Name of the selected kernel path
+ */
+const char *init_simd(void) {
+    const char *request = getenv(SIMD_ENV);
+    if (request && !*request) request = NULL;
+
+    // Unknown paths fall back to the default
+    if (request && strcmp(request, "scalar") && strcmp(request, "sse2") &&
+        strcmp(request, "avx2") && strcmp(request, "avx512")) {
+        printf("Warning: unknown SIMD path '%s', using the widest supported\n", request);
+        request = NULL;
+    }
+    const char *path = "scalar";
+    eta_row = eta_row_scalar;
+    velocity_row = velocity_row_scalar;
+
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+    int allow_avx512 = !request || !strcmp(request, "avx512");
+    int allow_avx2 = allow_avx512 || !strcmp(request, "avx2");
+    int allow_sse2 = allow_avx2 || !strcmp(request, "sse2");
+
+    if (allow_avx512 && __builtin_cpu_supports("avx512f")) {
+        eta_row = eta_row_avx512;
+        velocity_row = velocity_row_avx512;
+        path = "avx512";
+    } else if (allow_avx2 && __builtin_cpu_supports("avx2")) {
+        eta_row = eta_row_avx2;
+        velocity_row = velocity_row_avx2;
+        path = "avx2";
+    } else if (allow_sse2 && __builtin_cpu_supports("sse2")) {
+        eta_row = eta_row_sse2;
+        velocity_row = velocity_row_sse2;
+        path = "sse2";
+    }
+#endif
+
+    return path;
+}
@@ -6,6 +6,9 @@
 
 #include "shallow_omp.h"
 #include <ctype.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 
 /*===========================================================
  * FILE I/O FUNCTIONS 
@@ -117,13 +120,20 @@ int read_data(data_t *data, const char *filename) {
         if(N <= 0) {
             printf("Error: Invalid number of data points %d\n", N);
             ok = 0;
+        } else if(init_data(data, data->nx, data->ny, data->dx, data->dy, 0.)) {
+            ok = 0;
         } else {
-            data->values = (double*)malloc(N * sizeof(double));
-            if(!data->values) {
-                printf("Error: Could not allocate data (%d doubles)\n", N);
-                ok = 0;
-            } else {
-                ok = (fread(data->values, sizeof(double), N, fp) == N);
+            for(int j = 0; ok && j < data->ny; j++) {
+#ifdef SHALLOW_SINGLE
+                // Input files are float64: narrow while reading
+                for(int i = 0; ok && i < data->nx; i++) {
+                    double val;
+                    ok = (fread(&val, sizeof(double), 1, fp) == 1);
+                    SET(data, i, j, (real_t)val);
+                }
+#else
+                ok = (fread(&GET(data, 0, j), sizeof(double), data->nx, fp) == (size_t)data->nx);
+#endif
             }
         }
     }
@@ -165,8 +175,17 @@ int write_data(const data_t *data, const char *filename, int step) {
     if(ok) ok = (fwrite(&data->dx, sizeof(double), 1, fp) == 1);
     if(ok) ok = (fwrite(&data->dy, sizeof(double), 1, fp) == 1);
     
-    int N = data->nx * data->ny;
-    if(ok) ok = (fwrite(data->values, sizeof(double), N, fp) == N);
+    for(int j = 0; ok && j < data->ny; j++) {
+#ifdef SHALLOW_SINGLE
+        // The .dat format is float64: widen while writing
+        for(int i = 0; ok && i < data->nx; i++) {
+            double val = GET(data, i, j);
+            ok = (fwrite(&val, sizeof(double), 1, fp) == 1);
+        }
+#else
+        ok = (fwrite(&GET(data, 0, j), sizeof(double), data->nx, fp) == (size_t)data->nx);
+#endif
+    }
     
     fclose(fp);
     if(!ok) {
@@ -176,6 +195,107 @@ int write_data(const data_t *data, const char *filename, int step) {
     return 0;
 }
 
+/**
+ * Reads the VTK compression settings: SHALLOW_VTK_COMPRESS gives the zlib
+ * level (0 or unset: raw data) and SHALLOW_VTK_SHUFFLE byte-shuffles the
+ * values before they are compressed
+ * 
+ * @param shuffle Set to 1 when the values are to be shuffled
+ * @return zlib level (0 for raw data)
+ */
+static int vtk_compression(int *shuffle) {
+    const char *level_env = getenv(VTK_COMPRESS_ENV);
+    const char *shuffle_env = getenv(VTK_SHUFFLE_ENV);
+    int level = (level_env && *level_env) ? atoi(level_env) : 0;
+    if(level < 0) level = 0;
+    if(level > 9) level = 9;
+    *shuffle = level && shuffle_env && atoi(shuffle_env);
+    return level;
+}
+
+/**
+ * Writes the values of a field as appended data in the vtkZLibDataCompressor
+ * layout: a UInt64 header (number of blocks, uncompressed block size, size
+ * of a partial last block or 0, compressed size of every block) followed
+ * by the blocks, each compressed on its own by one of the threads. With
+ * shuffle, byte k of every value goes to the k-th byte plane of the array,
+ * which groups the slowly varying sign and exponent bytes of a smooth field
+ * 
+ * @param fp Output file, positioned after the appended data marker
+ * @param data Field to write
+ * @param level zlib compression level (1-9)
+ * @param shuffle Byte-shuffle the values before compressing them
+ * @return 0 on success, 1 on failure
+ */
+static int write_zlib_blocks(FILE *fp, const data_t *data, int level, int shuffle) {
+    size_t num_points = (size_t)data->nx * data->ny;
+    size_t num_bytes = num_points * sizeof(real_t);
+    size_t num_blocks = (num_bytes + VTK_BLOCK_BYTES - 1) / VTK_BLOCK_BYTES;
+    size_t bound = compressBound(VTK_BLOCK_BYTES);
+
+    unsigned char *raw = malloc(num_bytes + 1);
+    unsigned char *packed = malloc(num_blocks * bound + 1);
+    uint64_t *header = malloc((3 + num_blocks) * sizeof(uint64_t));
+    int failed = !raw || !packed || !header;
+
+    if(!failed) {
+        // Contiguous values, split into byte planes when shuffled
+        #pragma omp parallel for
+        for(int j = 0; j < data->ny; j++) {
+            const unsigned char *row = (const unsigned char *)&GET(data, 0, j);
+            size_t first = (size_t)j * data->nx;
+            if(!shuffle) {
+                memcpy(raw + first * sizeof(real_t), row, data->nx * sizeof(real_t));
+                continue;
+            }
+            for(int i = 0; i < data->nx; i++)
+                for(size_t k = 0; k < sizeof(real_t); k++)
+                    raw[k * num_points + first + i] = row[i * sizeof(real_t) + k];
+        }
+
+        #pragma omp parallel for schedule(dynamic) reduction(|:failed)
+        for(long b = 0; b < (long)num_blocks; b++) {
+            size_t start = (size_t)b * VTK_BLOCK_BYTES;
+            uLong length = (num_bytes - start < VTK_BLOCK_BYTES) ? num_bytes - start : VTK_BLOCK_BYTES;
+            uLongf size = bound;
+            if(compress2(packed + (size_t)b * bound, &size, raw + start, length, level) != Z_OK)
+                failed = 1;
+            header[3 + b] = size;
+        }
+    }
+
+    if(!failed) {
+        header[0] = num_blocks;
+        header[1] = VTK_BLOCK_BYTES;
+        header[2] = num_bytes % VTK_BLOCK_BYTES;
+        failed = (fwrite(header, sizeof(uint64_t), 3 + num_blocks, fp) != 3 + num_blocks);
+        for(size_t b = 0; !failed && b < num_blocks; b++)
+            failed = (fwrite(packed + b * bound, 1, header[3 + b], fp) != header[3 + b]);
+    }
+
+    free(raw);
+    free(packed);
+    free(header);
+    return failed;
+}
+
+/**
+ * Names a VTK snapshot, relative to the output directory: the files, the
+ * entries of the .pvd manifest and the SHALLOW_REFERENCE_DIR references
+ * all use this name
+ * 
+ * @param out Name buffer (MAX_PATH_LENGTH)
+ * @param filename Base filename
+ * @param step Time step (-1 for none)
+ * @param extension File extension (vti, or VTK_SHUFFLE_EXT)
+ */
+static void vtk_name(char *out, const char *filename, int step, const char *extension) {
+    char suffix[16] = "";
+    if(step >= 0) snprintf(suffix, sizeof(suffix), "_%d", step);
+    if(snprintf(out, MAX_PATH_LENGTH, "%s%s.%s", filename, suffix, extension) >= MAX_PATH_LENGTH)
+        fprintf(stderr, "Warning: snapshot name truncated to '%s'\n", out);
+}
+
 /**
  * Writes data to VTK image format file
  * 
@@ -187,10 +307,13 @@ int write_data(const data_t *data, const char *filename, int step) {
  */
 int write_data_vtk(const data_t *data, const char *name,
                    const char *filename, int step) {
-    char out[MAX_PATH_LENGTH];
-    sprintf(out, "../../output/%s%s.vti", filename,
-            (step < 0) ? "" : "_");
-    if(step >= 0) sprintf(out + strlen(out), "%d", step);
+    // Shuffled snapshots get their own extension so VTK readers reject them
+    int shuffle;
+    int level = vtk_compression(&shuffle);
+    char snapshot[MAX_PATH_LENGTH], out[MAX_PATH_LENGTH];
+    vtk_name(snapshot, filename, step, shuffle ? VTK_SHUFFLE_EXT : "vti");
+    if(snprintf(out, MAX_PATH_LENGTH, "../../output/%s", snapshot) >= MAX_PATH_LENGTH)
+        fprintf(stderr, "Warning: output path truncated to '%s'\n", out);
 
     FILE *fp = fopen(out, "wb");
     if(!fp) {
@@ -199,34 +322,112 @@ int write_data_vtk(const data_t *data, const char *name,
     }
 
     uint64_t num_points = data->nx * data->ny;
-    uint64_t num_bytes = num_points * sizeof(double);
+    uint64_t num_bytes = num_points * sizeof(real_t);
 
     // Write VTK XML header and structure
     fprintf(fp, "<?xml version=\"1.0\"?>\n");
     fprintf(fp, "<VTKFile type=\"ImageData\" version=\"1.0\" "
-            "byte_order=\"LittleEndian\" header_type=\"UInt64\">\n");
+            "byte_order=\"LittleEndian\" header_type=\"UInt64\"%s>\n",
+            level ? " compressor=\"vtkZLibDataCompressor\"" : "");
     fprintf(fp, "  <ImageData WholeExtent=\"0 %d 0 %d 0 0\" "
             "Spacing=\"%lf %lf 0.0\">\n",
             data->nx - 1, data->ny - 1, data->dx, data->dy);
     fprintf(fp, "    <Piece Extent=\"0 %d 0 %d 0 0\">\n",
             data->nx - 1, data->ny - 1);
     fprintf(fp, "      <PointData Scalars=\"scalar_data\">\n");
-    fprintf(fp, "        <DataArray type=\"Float64\" Name=\"%s\" "
-            "format=\"appended\" offset=\"0\">\n", name);
+    fprintf(fp, "        <DataArray type=\"%s\" Name=\"%s\" "
+            "format=\"appended\" offset=\"0\">\n", VTK_REAL_TYPE, name);
     fprintf(fp, "        </DataArray>\n");
     fprintf(fp, "      </PointData>\n");
     fprintf(fp, "    </Piece>\n");
     fprintf(fp, "  </ImageData>\n");
     fprintf(fp, "  <AppendedData encoding=\"raw\">\n_");
 
-    // Write binary data
-    fwrite(&num_bytes, sizeof(uint64_t), 1, fp);
-    fwrite(data->values, sizeof(double), num_points, fp);
+    // Write binary data (zlib blocks when compressed)
+    int failed = 0;
+    if(level) {
+        failed = write_zlib_blocks(fp, data, level, shuffle);
+    } else {
+        fwrite(&num_bytes, sizeof(uint64_t), 1, fp);
+        for(int j = 0; j < data->ny; j++)
+            fwrite(&GET(data, 0, j), sizeof(real_t), data->nx, fp);
+    }
 
     fprintf(fp, "  </AppendedData>\n");
     fprintf(fp, "</VTKFile>\n");
 
     fclose(fp);
+    if(failed) {
+        printf("Error: Could not compress VTK file '%s'\n", out);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Compares a field with the same output step of a float64 reference run
+ * Reference files are looked up in SHALLOW_REFERENCE_DIR under the names
+ * written by write_data_vtk, and may be stored as Float64 or Float32
+ * 
+ * @param data Pointer to data structure
+ * @param filename Base name of the output file
+ * @param step Timestep number
+ * @return 0 on success, 1 on failure
+ */
+int report_deviation(const data_t *data, const char *filename, int step) {
+    const char *dir = getenv(REFERENCE_DIR_ENV);
+    if(!dir) return 0;
+
+    char snapshot[MAX_PATH_LENGTH], ref[MAX_PATH_LENGTH];
+    vtk_name(snapshot, filename, step, "vti");
+    if(snprintf(ref, MAX_PATH_LENGTH, "%s/%s", dir, snapshot) >= MAX_PATH_LENGTH)
+        fprintf(stderr, "Warning: reference path truncated to '%s'\n", ref);
+
+    FILE *fp = fopen(ref, "rb");
+    if(!fp) {
+        printf("Error: Could not open reference file '%s'\n", ref);
+        return 1;
+    }
+
+    // Skip the XML header up to the appended data marker
+    const char *marker = "<AppendedData encoding=\"raw\">\n_";
+    int matched = 0, c;
+    while(marker[matched] && (c = fgetc(fp)) != EOF) {
+        if(c == marker[matched]) matched++;
+        else matched = (c == marker[0]) ? 1 : 0;
+    }
+
+    uint64_t num_points = data->nx * data->ny;
+    uint64_t num_bytes = 0;
+    int ok = !marker[matched] && (fread(&num_bytes, sizeof(uint64_t), 1, fp) == 1);
+    int width = ok ? (int)(num_bytes / num_points) : 0;
+    ok = ok && (width == 4 || width == 8) && num_bytes == num_points * width;
+
+    double max_dev = 0.0, max_ref = 0.0, sum_sq = 0.0;
+    for(uint64_t k = 0; ok && k < num_points; k++) {
+        double val;
+        if(width == 8) {
+            ok = (fread(&val, sizeof(double), 1, fp) == 1);
+        } else {
+            float val_f;
+            ok = (fread(&val_f, sizeof(float), 1, fp) == 1);
+            val = val_f;
+        }
+        double dev = fabs((double)GET(data, k % data->nx, k / data->nx) - val);
+        if(dev > max_dev) max_dev = dev;
+        if(fabs(val) > max_ref) max_ref = fabs(val);
+        sum_sq += dev * dev;
+    }
+    fclose(fp);
+
+    if(!ok) {
+        printf("Error reading reference file '%s'\n", ref);
+        return 1;
+    }
+
+    printf(" - step %d: deviation from reference max %.3e (rel %.3e), rms %.3e\n",
+           step, max_dev, (max_ref > 0.0) ? max_dev / max_ref : 0.0,
+           sqrt(sum_sq / num_points));
     return 0;
 }
 
@@ -241,7 +442,7 @@ int write_data_vtk(const data_t *data, const char *name,
  */
 int write_manifest_vtk(const char *filename, double dt, int nt,
                        int sampling_rate) {
-    char out[MAX_PATH_LENGTH];
+    char snapshot[MAX_PATH_LENGTH], out[MAX_PATH_LENGTH];
     sprintf(out, "../../output/%s.pvd", filename);
 
     FILE *fp = fopen(out, "wb");
@@ -250,6 +451,8 @@ int write_manifest_vtk(const char *filename, double dt, int nt,
         return 1;
     }
 
+    int shuffle;
+    vtk_compression(&shuffle);
     fprintf(fp, "<VTKFile type=\"Collection\" version=\"0.1\" "
             "byte_order=\"LittleEndian\">\n");
     fprintf(fp, "  <Collection>\n");
@@ -257,8 +460,8 @@ int write_manifest_vtk(const char *filename, double dt, int nt,
     for(int n = 0; n < nt; n++) {
         if(sampling_rate && !(n % sampling_rate)) {
             double t = n * dt;
-            fprintf(fp, "    <DataSet timestep=\"%g\" file='%s_%d.vti'/>\n", 
-                    t, filename, n);
+            vtk_name(snapshot, filename, n, shuffle ? VTK_SHUFFLE_EXT : "vti");
+            fprintf(fp, "    <DataSet timestep=\"%g\" file='%s'/>\n", t, snapshot);
         }
     }
     
@@ -268,10 +471,219 @@ int write_manifest_vtk(const char *filename, double dt, int nt,
     return 0;
 }
 
+/*===========================================================
+ * BACKGROUND OUTPUT
+ ===========================================================*/
+
+/**
+ * Pauses the calling thread for WRITER_POLL_NS while a queue end waits
+ */
+static void writer_pause(void) {
+    struct timespec pause = {0, WRITER_POLL_NS};
+    nanosleep(&pause, NULL);
+}
+
+/**
+ * Body of the writer thread: writes the filled slots in order and hands
+ * them back to the time loop, until finish_writer has no more snapshots.
+ * Its OpenMP regions (zlib compression) run on one thread, so they do not
+ * compete with the compute team for the cores
+ * 
+ * @param arg Writer
+ * @return NULL
+ */
+static void *writer_main(void *arg) {
+    writer_t *writer = arg;
+
+    // The compute team keeps every core: compress on this thread alone
+    omp_set_num_threads(1);
+    data_t snapshot = {0};
+    snapshot.nx = writer->nx;
+    snapshot.ny = writer->ny;
+    snapshot.pitch = writer->nx;
+    snapshot.dx = writer->dx;
+    snapshot.dy = writer->dy;
+
+    int tail = atomic_load_explicit(&writer->tail, memory_order_relaxed);
+    for(;;) {
+        int head = atomic_load_explicit(&writer->head, memory_order_acquire);
+        if(head == tail) {
+            if(atomic_load_explicit(&writer->done, memory_order_acquire) &&
+               head == atomic_load_explicit(&writer->head, memory_order_acquire)) break;
+            writer_pause();
+            continue;
+        }
+
+        int slot = tail % writer->num_slots;
+        snapshot.values = writer->slots[slot];
+        double start = GET_TIME();
+        if(write_data_vtk(&snapshot, writer->name, writer->filename, writer->steps[slot]))
+            writer->errors++;
+        writer->write_time += GET_TIME() - start;
+
+        // Release the slot only once its values are on their way to disk
+        atomic_store_explicit(&writer->tail, ++tail, memory_order_release);
+    }
+    return NULL;
+}
+
+/**
+ * Sets up the snapshot writer of a field: SHALLOW_WRITER_SLOTS snapshot
+ * buffers (WRITER_SLOTS by default, 0 writes synchronously) and the
+ * thread that empties them
+ * 
+ * @param writer Writer to set up
+ * @param field Field written at every sampled step (only its size is kept)
+ * @param name Field name for VTK file
+ * @param filename Base name for output files
+ * @return 0 on success, 1 on failure
+ */
+int init_writer(writer_t *writer, const data_t *field, const char *name,
+                const char *filename) {
+    memset(writer, 0, sizeof(writer_t));
+    writer->nx = field->nx;
+    writer->ny = field->ny;
+    writer->dx = field->dx;
+    writer->dy = field->dy;
+    writer->name = name;
+    writer->filename = filename;
+    atomic_init(&writer->head, 0);
+    atomic_init(&writer->tail, 0);
+    atomic_init(&writer->done, 0);
+
+    const char *env = getenv(WRITER_SLOTS_ENV);
+    writer->num_slots = (env && *env) ? atoi(env) : WRITER_SLOTS;
+    if(writer->num_slots < 0) writer->num_slots = 0;
+    printf(" - snapshot writer: %s (%d slots)\n",
+           writer->num_slots ? "background thread" : "synchronous", writer->num_slots);
+
+    int shuffle;
+    int level = vtk_compression(&shuffle);
+    if(level)
+        printf(" - VTK compression: zlib level %d%s\n", level, shuffle ? ", byte-shuffled" : "");
+    if(writer->num_slots == 0) return 0;
+
+    size_t bytes = (size_t)writer->nx * writer->ny * sizeof(real_t);
+    writer->slots = calloc(writer->num_slots, sizeof(real_t *));
+    writer->steps = calloc(writer->num_slots, sizeof(int));
+    int ok = writer->slots && writer->steps;
+    for(int s = 0; ok && s < writer->num_slots; s++)
+        ok = !posix_memalign((void **)&writer->slots[s], FIELD_ALIGN, bytes);
+    if(ok) ok = !pthread_create(&writer->thread, NULL, writer_main, writer);
+
+    if(!ok) {
+        printf("Error: Could not start the snapshot writer, writing synchronously\n");
+        for(int s = 0; writer->slots && s < writer->num_slots; s++) free(writer->slots[s]);
+        free(writer->slots);
+        free(writer->steps);
+        writer->slots = NULL;
+        writer->steps = NULL;
+        writer->num_slots = 0;
+    }
+    return 0;
+}
+
+/**
+ * Hands one snapshot of the field to the writer: its interior is copied
+ * into the next free slot and the time loop goes on. When every slot is
+ * still waiting for the disk, the loop stalls until one is written
+ * (back-pressure)
+ * 
+ * @param writer Writer of the field
+ * @param field Field to write
+ * @param step Timestep number
+ * @return 0 on success, 1 on failure
+ */
+int write_snapshot(writer_t *writer, const data_t *field, int step) {
+    double start = GET_TIME();
+    writer->snapshots++;
+    if(writer->num_slots == 0) {
+        int err = write_data_vtk(field, writer->name, writer->filename, step);
+        writer->write_time += GET_TIME() - start;
+        writer->copy_time += GET_TIME() - start;
+        return err;
+    }
+
+    int head = atomic_load_explicit(&writer->head, memory_order_relaxed);
+    if(head - atomic_load_explicit(&writer->tail, memory_order_acquire) >= writer->num_slots) {
+        writer->stalls++;
+        while(head - atomic_load_explicit(&writer->tail, memory_order_acquire) >= writer->num_slots)
+            writer_pause();
+        writer->stall_time += GET_TIME() - start;
+    }
+
+    int slot = head % writer->num_slots;
+    real_t *dst = writer->slots[slot];
+    #pragma omp parallel for if(!omp_in_parallel())
+    for(int j = 0; j < field->ny; j++)
+        memcpy(dst + (size_t)j * field->nx, &GET(field, 0, j), field->nx * sizeof(real_t));
+    writer->steps[slot] = step;
+    atomic_store_explicit(&writer->head, head + 1, memory_order_release);
+
+    writer->copy_time += GET_TIME() - start;
+    return 0;
+}
+
+/**
+ * Waits for the writer to empty its slots, stops its thread and prints the
+ * output statistics: time the loop spent handing snapshots over, stalls
+ * on a full queue and time the writer spent writing
+ * 
+ * @param writer Writer to stop
+ * @return 0 on success, 1 if a snapshot could not be written
+ */
+int finish_writer(writer_t *writer) {
+    double start = GET_TIME();
+    if(writer->num_slots) {
+        atomic_store_explicit(&writer->done, 1, memory_order_release);
+        pthread_join(writer->thread, NULL);
+        for(int s = 0; s < writer->num_slots; s++) free(writer->slots[s]);
+        free(writer->slots);
+        free(writer->steps);
+        writer->slots = NULL;
+        writer->steps = NULL;
+    }
+    double drain = GET_TIME() - start;
+
+    if(writer->snapshots) {
+        printf("\nOutput: %d snapshots, %g s in the time loop (%g s stalled in %d full-queue waits), "
+               "%g s writing, %g s draining at the end\n",
+               writer->snapshots, writer->copy_time, writer->stall_time, writer->stalls,
+               writer->write_time, drain);
+    }
+    return writer->errors ? 1 : 0;
+}
+
 /*===========================================================
  * INITIALIZATION AND CLEANUP FUNCTIONS
  ===========================================================*/
 
+/**
+ * Sets the dimensions and padded layout of a field without allocating it
+ * Interior rows start on a FIELD_ALIGN boundary: the west ghosts are
+ * padded up to the alignment and the pitch is a whole number of lines
+ * 
+ * @param data Data structure to set up
+ * @param nx, ny Grid dimensions
+ * @param dx, dy Grid spacing
+ * @param offset Set to the position of (0,0) in the storage (elements)
+ * @return Number of elements of the storage
+ */
+static size_t field_layout(data_t *data, int nx, int ny, double dx, double dy, size_t *offset) {
+    data->nx = nx;
+    data->ny = ny;
+    data->dx = dx;
+    data->dy = dy;
+
+    int align = FIELD_ALIGN / sizeof(real_t);
+    int pad = (GHOST_WIDTH + align - 1) / align * align;
+    data->ghost = GHOST_WIDTH;
+    data->pitch = (pad + nx + GHOST_WIDTH + align - 1) / align * align;
+
+    *offset = (size_t)GHOST_WIDTH * data->pitch + pad;
+    return (size_t)data->pitch * (ny + 2 * GHOST_WIDTH);
+}
+
 /**
  * Initializes data structure with given dimensions and value
  * 
@@ -282,21 +694,139 @@ int write_manifest_vtk(const char *filename, double dt, int nt,
  * @return 0 on success, 1 on failure
  */
 int init_data(data_t *data, int nx, int ny, double dx, double dy, double val) {
-    data->nx = nx;
-    data->ny = ny;
-    data->dx = dx;
-    data->dy = dy;
-    
-    data->values = (double*)malloc(nx * ny * sizeof(double));
-    if(!data->values) {
+    size_t offset;
+    size_t count = field_layout(data, nx, ny, dx, dy, &offset);
+    if(posix_memalign((void **)&data->storage, FIELD_ALIGN, count * sizeof(real_t))) {
+        data->storage = data->values = NULL;
         printf("Error: Could not allocate data\n");
         return 1;
     }
-    
-    for(int i = 0; i < nx * ny; i++) data->values[i] = val;
+    data->values = data->storage + offset;
+
+    for(size_t k = 0; k < count; k++) data->storage[k] = val;
+    return 0;
+}
+
+/**
+ * Copies the edge values of a tile into the ghost cells beyond the domain
+ * edge (zero normal gradient), so kernels reading past the interior need
+ * no boundary branches
+ * 
+ * @param data Pointer to data structure
+ * @param i0, i1 Column range of the tile [i0, i1)
+ * @param j0, j1 Row range of the tile [j0, j1)
+ */
+void fill_ghosts(data_t *data, int i0, int i1, int j0, int j1) {
+    int nx = data->nx;
+    int ny = data->ny;
+    for(int g = 1; g <= data->ghost; g++) {
+        if(i0 == 0)
+            for(int j = j0; j < j1; j++) SET(data, -g, j, GET(data, 0, j));
+        if(i1 == nx)
+            for(int j = j0; j < j1; j++) SET(data, nx - 1 + g, j, GET(data, nx - 1, j));
+        if(j0 == 0)
+            for(int i = i0; i < i1; i++) SET(data, i, -g, GET(data, i, 0));
+        if(j1 == ny)
+            for(int i = i0; i < i1; i++) SET(data, i, ny - 1 + g, GET(data, i, ny - 1));
+    }
+}
+
+/**
+ * Carves eta, u, v, h_interp, hu and hv out of a single anonymous mapping
+ * Every field starts on a page boundary. The pages are left untouched so
+ * that first_touch places them on the NUMA node of the thread that sweeps
+ * them; SHALLOW_HUGE_PAGES=1 asks for transparent huge pages
+ * 
+ * @param all_data Simulation data (fields set up in place)
+ * @param nx, ny Grid dimensions
+ * @param dx, dy Grid spacing
+ * @return 0 on success, 1 on failure
+ */
+int init_arena(all_data_t *all_data, int nx, int ny, double dx, double dy) {
+    data_t *fields[] = {all_data->eta, all_data->u, all_data->v,
+                        all_data->h_interp, all_data->hu, all_data->hv};
+    const int dims[][2] = {{nx, ny}, {nx + 1, ny}, {nx, ny + 1},
+                           {nx, ny}, {nx + 1, ny}, {nx, ny + 1}};
+    const int num_fields = sizeof(fields) / sizeof(fields[0]);
+    arena_t *arena = &all_data->arena;
+
+    const char *env_huge = getenv(HUGE_PAGES_ENV);
+    arena->huge_pages = env_huge && atoi(env_huge);
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t granule = arena->huge_pages ? HUGE_PAGE_SIZE : page;
+
+    size_t offsets[6], starts[6], total = 0;
+    for (int f = 0; f < num_fields; f++) {
+        size_t count = field_layout(fields[f], dims[f][0], dims[f][1], dx, dy, &offsets[f]);
+        starts[f] = total;
+        total += (count * sizeof(real_t) + page - 1) / page * page;
+    }
+
+    // Over-map by one granule so the arena can start on a huge page boundary
+    arena->size = (total + granule - 1) / granule * granule + granule;
+    void *map = mmap(NULL, arena->size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        arena->base = NULL;
+        printf("Error: Could not map the field arena (%zu bytes)\n", arena->size);
+        return 1;
+    }
+    arena->base = map;
+    arena->start = (char *)(((uintptr_t)map + granule - 1) / granule * granule);
+    arena->used = total;
+#ifdef MADV_HUGEPAGE
+    if (arena->huge_pages) madvise(arena->start, total, MADV_HUGEPAGE);
+#endif
+
+    // Anonymous pages read as zero, the initial value of every field
+    for (int f = 0; f < num_fields; f++) {
+        fields[f]->storage = (real_t *)(arena->start + starts[f]);
+        fields[f]->values = fields[f]->storage + offsets[f];
+    }
     return 0;
 }
 
+/**
+ * Prints how the pages of the field arena are spread over NUMA nodes
+ * Queries the kernel with move_pages (no migration), so it is only
+ * available on Linux
+ * 
+ * @param arena Field arena, after first_touch
+ */
+void report_placement(const arena_t *arena) {
+#ifdef SYS_move_pages
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t num_pages = arena->used / page;
+    long counts[MAX_NUMA_NODES] = {0};
+    long untouched = 0;
+
+    void *pages[1024];
+    int status[1024];
+    for (size_t p = 0; p < num_pages; p += 1024) {
+        int batch = (num_pages - p < 1024) ? (int)(num_pages - p) : 1024;
+        for (int k = 0; k < batch; k++) pages[k] = arena->start + (p + k) * page;
+        if (syscall(SYS_move_pages, 0, batch, pages, NULL, status, 0) != 0) {
+            printf(" - page placement: unavailable\n");
+            return;
+        }
+        for (int k = 0; k < batch; k++) {
+            if (status[k] >= 0 && status[k] < MAX_NUMA_NODES) counts[status[k]]++;
+            else untouched++;
+        }
+    }
+
+    printf(" - page placement of %zu pages (%s pages requested):", num_pages,
+           arena->huge_pages ? "huge" : "base");
+    for (int node = 0; node < MAX_NUMA_NODES; node++) {
+        if (counts[node]) printf(" node %d: %.1f%%", node, 100.0 * counts[node] / num_pages);
+    }
+    if (untouched) printf(" untouched: %.1f%%", 100.0 * untouched / num_pages);
+    printf("\n");
+#else
+    printf(" - page placement: unavailable\n");
+#endif
+}
+
 /**
  * Initializes all simulation data structures
  * 
@@ -309,6 +839,7 @@ all_data_t* init_all_data(const parameters_t *param) {
         fprintf(stderr, "Error: Failed to allocate all_data\n");
         return NULL;
     }
+    all_data->arena.base = NULL;
 
     // Allocate and read bathymetry data
     all_data->h = malloc(sizeof(data_t));
@@ -335,11 +866,13 @@ all_data_t* init_all_data(const parameters_t *param) {
     all_data->u = malloc(sizeof(data_t));
     all_data->v = malloc(sizeof(data_t));
     all_data->h_interp = malloc(sizeof(data_t));
+    all_data->hu = malloc(sizeof(data_t));
+    all_data->hv = malloc(sizeof(data_t));
 
-    init_data(all_data->eta, nx, ny, param->dx, param->dy, 0.);
-    init_data(all_data->u, nx + 1, ny, param->dx, param->dy, 0.);
-    init_data(all_data->v, nx, ny + 1, param->dx, param->dy, 0.);
-    init_data(all_data->h_interp, nx, ny, param->dx, param->dy, 0.);
+    if (init_arena(all_data, nx, ny, param->dx, param->dy)) {
+        fprintf(stderr, "Error: Failed to allocate the field arena\n");
+        return NULL;
+    }
 
     return all_data;
 }
@@ -383,13 +916,95 @@ void print_progress(int current_step, int total_steps, double start_time) {
     }
 }
 
+/**
+ * Chooses the tile size used by the sweep engine
+ * Defaults to full-width tiles, at most MAX_TILE_NX columns wide, whose
+ * rows of eta, u, v, hu and hv fit in half of the L2 cache, no taller than
+ * ny / threads so that every thread gets a tile. The width cap keeps a
+ * dozen rows per tile on wide grids, so the row above is still in cache
+ * when the next row reads it; SHALLOW_TILE_NX / SHALLOW_TILE_NY override it
+ * 
+ * @param param Simulation parameters (tile size set in place)
+ * @param nx, ny Grid dimensions
+ */
+void init_sweep(parameters_t *param, int nx, int ny) {
+    long l2_bytes = DEFAULT_L2_BYTES;
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    long detected = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (detected > 0) l2_bytes = detected;
+#endif
+
+    // Five fields are streamed per tile (eta, u, v, hu, hv)
+    param->tile_nx = (nx < MAX_TILE_NX) ? nx : MAX_TILE_NX;
+    param->tile_ny = (int)(l2_bytes / 2 / (5 * sizeof(real_t) * param->tile_nx));
+
+    // Tile rows are what the threads share, so every thread needs one
+    int threads = omp_get_max_threads();
+    int band = (ny + threads - 1) / threads;
+    if (param->tile_ny > band) param->tile_ny = band;
+
+    const char *env_nx = getenv(TILE_NX_ENV);
+    const char *env_ny = getenv(TILE_NY_ENV);
+    if (env_nx) param->tile_nx = atoi(env_nx);
+    if (env_ny) param->tile_ny = atoi(env_ny);
+
+    if (param->tile_nx <= 0 || param->tile_nx > nx) param->tile_nx = nx;
+    if (param->tile_ny <= 0 || param->tile_ny > ny) param->tile_ny = ny;
+
+    printf(" - sweep tile: %d x %d (L2: %ld KiB)\n",
+           param->tile_nx, param->tile_ny, l2_bytes / 1024);
+}
+
+/**
+ * Configures diamond temporal blocking from SHALLOW_DIAMOND_STEPS/ROWS
+ * Tiles must be taller than twice the block depth so the diamonds of
+ * neighbouring tile boundaries never overlap
+ * 
+ * @param param Simulation parameters (diamond settings set in place)
+ * @param ny Grid height
+ */
+void init_diamond(parameters_t *param, int ny) {
+    const char *env_steps = getenv(DIAMOND_STEPS_ENV);
+    const char *env_rows = getenv(DIAMOND_ROWS_ENV);
+
+    param->diamond_steps = env_steps ? atoi(env_steps) : 0;
+    if (param->diamond_steps <= 1) {
+        param->diamond_steps = 0;
+        param->diamond_rows = 0;
+        return;
+    }
+
+    // Default tile height: one tile per thread
+    param->diamond_rows = env_rows ? atoi(env_rows) : ny / omp_get_max_threads();
+    if (param->diamond_rows < 2 * param->diamond_steps + 1)
+        param->diamond_rows = 2 * param->diamond_steps + 1;
+
+    printf(" - diamond blocking: %d steps per block, %d rows per tile\n",
+           param->diamond_steps, param->diamond_rows);
+}
+
+/**
+ * Enables the persistent parallel region from SHALLOW_PERSISTENT
+ * Diamond blocking keeps its own schedule and takes precedence
+ * 
+ * @param param Simulation parameters (persistent flag set in place)
+ */
+void init_persistent(parameters_t *param) {
+    const char *env = getenv(PERSISTENT_ENV);
+    param->persistent = (env && atoi(env) && !param->diamond_steps);
+    if (env && atoi(env) && param->diamond_steps)
+        printf(" - persistent region: off (diamond blocking is enabled)\n");
+    if (param->persistent)
+        printf(" - persistent region: %d threads, 2 barriers per step\n", omp_get_max_threads());
+}
+
 /**
  * Frees memory for single data structure
  * 
  * @param data Data structure to free
  */
 void free_data(data_t *data) {
-    free(data->values);
+    free(data->storage);
 }
 
 /**
@@ -398,10 +1013,8 @@ void free_data(data_t *data) {
  * @param all_data Main data structure to free
  */
 void free_all_data(all_data_t* all_data) {
-    free_data(all_data->h_interp);
-    free_data(all_data->eta);
-    free_data(all_data->u);
-    free_data(all_data->v);
+    // eta, u, v, h_interp, hu and hv live in the arena
+    if (all_data->arena.base) munmap(all_data->arena.base, all_data->arena.size);
     free_data(all_data->h);
     free(all_data);
 }
\ No newline at end of file
@@ -33,12 +33,17 @@ int main(int argc, char **argv) {
     }
     if (topo.cart_rank == 0) print_parameters(&param);
 
+    // Select the SIMD kernel path (every rank sees the same CPU features)
+    const char *simd_path = init_simd();
+    if (topo.cart_rank == 0) printf(" - SIMD kernels: %s\n", simd_path);
+
     all_data_t* all_data = init_all_data(&param, &topo);
     if (all_data == NULL) {
         fprintf(stderr, "Failed to initialize all_data\n");
         MPI_Abort(topo.cart_comm, 1); 
         return 1;
     }
+    report_placement(&all_data->arena, &topo);
 
     // Infer size of domain from input bathymetric data
     double hx = all_data->h->nx * all_data->h->dx;
@@ -78,8 +83,14 @@ int main(int argc, char **argv) {
     //----------------------//
 
     // Interpolate bathymetry
-    interp_bathy(param, nx_glob, ny_glob, all_data, gdata, &topo);
+    interp_bathy(param, all_data, gdata, &topo);
 	check_cfl(param, all_data, &topo);
+    if (init_coriolis(param, ny_glob, all_data, gdata, &topo) ||
+        init_pml(param, nx_glob, ny_glob, all_data, gdata, &topo)) {
+        fprintf(stderr, "Rank %d: Failed to allocate Coriolis/PML profiles\n", topo.cart_rank);
+        MPI_Abort(topo.cart_comm, 1);
+        return 1;
+    }
 
     // Loop over timestep
     double start = GET_TIME(); 
@@ -94,8 +105,8 @@ int main(int argc, char **argv) {
 		}
 
 		apply_source(n, nx_glob, ny_glob, param, all_data, gdata, &topo);
-		update_eta(param, all_data, gdata, &topo);
-		update_velocities(param, all_data, gdata, &topo);
+		update_eta(all_data, gdata, &topo);
+		update_velocities(param, all_data, &topo);
 
 		if (topo.rank ==0) print_progress(n, nt, start, &topo);
 
@@ -32,7 +32,7 @@ mkdir -p "$OUTPUT_PATH"
 
 # Compilation
 echo "Compiling..."
-mpicc -O3 -fopenmp -o "$BIN_PATH/shallow_coriolis_pml" "$SCRIPT_DIR/shallow_coriolis_pml.c" "$SCRIPT_DIR/tools_coriolis_pml.c" "$SCRIPT_DIR/main_coriolis_pml.c" -lm
+mpicc -O3 -fopenmp -o "$BIN_PATH/shallow_coriolis_pml" "$SCRIPT_DIR/shallow_coriolis_pml.c" "$SCRIPT_DIR/tools_coriolis_pml.c" "$SCRIPT_DIR/main_coriolis_pml.c" "$SCRIPT_DIR/simd_coriolis_pml.c" -lm
 
 # Run
 if [ $? -eq 0 ]; then
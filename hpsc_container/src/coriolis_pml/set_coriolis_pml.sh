@@ -29,7 +29,7 @@ fi
 chown -R $TMP_USER:$TMP_USER /opt/hpsc_container
 
 # Compilation
-mpicc -O3 -fopenmp -o ${BIN_PATH}/shallow_coriolis_pml shallow_coriolis_pml.c tools_coriolis_pml.c main_coriolis_pml.c -lm
+mpicc -O3 -fopenmp -o ${BIN_PATH}/shallow_coriolis_pml shallow_coriolis_pml.c tools_coriolis_pml.c main_coriolis_pml.c simd_coriolis_pml.c -lm
 
 # Execute as temporary user
 if [ $? -eq 0 ]; then
@@ -184,6 +184,9 @@ int initialize_gather_structures(const MPITopology *topo,
             gdata->gathered_output[i].dy = dy;
             gdata->gathered_output[i].vals = calloc(nx_glob * ny_glob, sizeof(double));
             if (!gdata->gathered_output[i].vals) return 1;
+            gdata->gathered_output[i].storage = gdata->gathered_output[i].vals;
+            gdata->gathered_output[i].ghost = 0;
+            gdata->gathered_output[i].pitch = nx_glob;
         }
     }
 
@@ -207,21 +210,77 @@ int initialize_gather_structures(const MPITopology *topo,
     return 0;
 }
 
+/*===========================================================
+ * HALO EXCHANGE
+ ===========================================================*/
+
+/**
+ * Exchanges the edge lines of a field with the four neighbours
+ * Sends read the first/last interior column and row, receives land
+ * directly in the ghost columns -1 and nx and the ghost rows -1 and ny.
+ * Sides without a neighbour get the edge values (see fill_ghosts)
+ * 
+ * @param data Field to exchange (nx x ny interior)
+ * @param tag Base tag, the exchange uses tag..tag+3
+ * @param topo MPI topology information
+ */
+static void exchange_halo(data_t *data, int tag, MPITopology *topo) {
+    int nx = data->nx;
+    int ny = data->ny;
+
+    // Columns are strided by the row pitch, rows are contiguous
+    MPI_Datatype column;
+    MPI_Type_vector(ny, 1, data->pitch, MPI_DOUBLE, &column);
+    MPI_Type_commit(&column);
+
+    MPI_Request requests[8];
+    int count = 0;
+    if (topo->neighbors[LEFT] != MPI_PROC_NULL) {
+        MPI_Irecv(&GET(data, -1, 0), 1, column, topo->neighbors[LEFT], tag,
+                  topo->cart_comm, &requests[count++]);
+        MPI_Isend(&GET(data, 0, 0), 1, column, topo->neighbors[LEFT], tag + 1,
+                  topo->cart_comm, &requests[count++]);
+    }
+    if (topo->neighbors[RIGHT] != MPI_PROC_NULL) {
+        MPI_Irecv(&GET(data, nx, 0), 1, column, topo->neighbors[RIGHT], tag + 1,
+                  topo->cart_comm, &requests[count++]);
+        MPI_Isend(&GET(data, nx - 1, 0), 1, column, topo->neighbors[RIGHT], tag,
+                  topo->cart_comm, &requests[count++]);
+    }
+    if (topo->neighbors[DOWN] != MPI_PROC_NULL) {
+        MPI_Irecv(&GET(data, 0, -1), nx, MPI_DOUBLE, topo->neighbors[DOWN], tag + 2,
+                  topo->cart_comm, &requests[count++]);
+        MPI_Isend(&GET(data, 0, 0), nx, MPI_DOUBLE, topo->neighbors[DOWN], tag + 3,
+                  topo->cart_comm, &requests[count++]);
+    }
+    if (topo->neighbors[UP] != MPI_PROC_NULL) {
+        MPI_Irecv(&GET(data, 0, ny), nx, MPI_DOUBLE, topo->neighbors[UP], tag + 3,
+                  topo->cart_comm, &requests[count++]);
+        MPI_Isend(&GET(data, 0, ny - 1), nx, MPI_DOUBLE, topo->neighbors[UP], tag + 2,
+                  topo->cart_comm, &requests[count++]);
+    }
+
+    fill_ghosts(data, topo);
+    if (count > 0) MPI_Waitall(count, requests, MPI_STATUSES_IGNORE);
+    MPI_Type_free(&column);
+}
+
 /*===========================================================
  * PREPROCESS AND INTERPOLATION FUNCTIONS 
  ===========================================================*/
 double interpolate_data(const data_t *data,
-                        int nx_glob, int ny_glob,
                         double x, 
                         double y) {
 
    int i = (int)(x / data->dx);
    int j = (int)(y / data->dy);
 
-   // Boundary cases
-   if (i < 0 || j < 0 || i >= nx_glob - 1 || j >= ny_glob - 1) {
-       i = (i < 0) ? 0 : (i >= nx_glob) ? nx_glob - 1 : i;
-       j = (j < 0) ? 0 : (j >= ny_glob) ? ny_glob - 1 : j;
+   // Boundary cases: clamp to the bathymetry grid itself, which may be
+   // coarser than the simulation grid (the padded layout no longer lets an
+   // overrun wrap onto the next row)
+   if (i < 0 || j < 0 || i >= data->nx - 1 || j >= data->ny - 1) {
+       i = (i < 0) ? 0 : (i >= data->nx) ? data->nx - 1 : i;
+       j = (j < 0) ? 0 : (j >= data->ny) ? data->ny - 1 : j;
        return GET(data, i, j);
    }
 
@@ -251,7 +310,6 @@ double interpolate_data(const data_t *data,
 }
 
 void interp_bathy(const parameters_t param,
-                  int nx_glob, int ny_glob,
                   all_data_t *all_data,
                   gather_data_t *gdata, 
                   MPITopology *topo) {
@@ -266,80 +324,31 @@ void interp_bathy(const parameters_t param,
         for(int j = 0; j < local_ny; j++) {
             double x = (i + start_i) * param.dx;
             double y = (j + start_j) * param.dy;
-            double val = interpolate_data(all_data->h, nx_glob, ny_glob, x, y);
+            double val = interpolate_data(all_data->h, x, y);
             SET(all_data->h_interp, i, j, val);
         }
     }
 
-    MPI_Request request_recv[4] = {MPI_REQUEST_NULL};
-    MPI_Request request_send[4] = {MPI_REQUEST_NULL};
-    MPI_Status status[4];
-
-    double *send_left = calloc(local_ny, sizeof(double));
-    double *send_right = calloc(local_ny, sizeof(double));
-    double *send_down = calloc(local_nx, sizeof(double));
-    double *send_up = calloc(local_nx, sizeof(double));
-    
-    double *recv_left = NULL;
-    double *recv_right = NULL;
-    double *recv_down = NULL;
-    double *recv_up = NULL;
+    // Neighbour depths land in the ghost column nx and ghost row ny
+    exchange_halo(all_data->h_interp, 0, topo);
 
-    if (topo->neighbors[LEFT] != MPI_PROC_NULL) recv_left = calloc(local_ny, sizeof(double));
-    if (topo->neighbors[RIGHT] != MPI_PROC_NULL) recv_right = calloc(local_ny, sizeof(double));
-    if (topo->neighbors[DOWN] != MPI_PROC_NULL) recv_down = calloc(local_nx, sizeof(double));
-    if (topo->neighbors[UP] != MPI_PROC_NULL) recv_up = calloc(local_nx, sizeof(double));
+    // Face coefficients for update_eta. A face takes the depth of the cell
+    // on its east/north side, so both ranks of a boundary agree on it; at
+    // the domain walls the ghost cells repeat the last cell of the row/column
+    double c1_x = param.dt / param.dx;
+    double c1_y = param.dt / param.dy;
 
+    #pragma omp parallel for
     for (int j = 0; j < local_ny; j++) {
-        send_left[j] = GET(all_data->h_interp, 0, j);
-        send_right[j] = GET(all_data->h_interp, local_nx-1, j);
-    }
-    for (int i = 0; i < local_nx; i++) {
-        send_down[i] = GET(all_data->h_interp, i, 0);
-        send_up[i] = GET(all_data->h_interp, i, local_ny-1);
+        for (int i = 0; i <= local_nx; i++)
+            SET(all_data->hu, i, j, c1_x * GET(all_data->h_interp, i, j));
     }
 
-    int recv_count = 0;
-    if (topo->neighbors[LEFT] != MPI_PROC_NULL)
-        MPI_Irecv(recv_left, local_ny, MPI_DOUBLE, topo->neighbors[LEFT], 0,
-                  topo->cart_comm, &request_recv[recv_count++]);
-    if (topo->neighbors[RIGHT] != MPI_PROC_NULL)
-        MPI_Irecv(recv_right, local_ny, MPI_DOUBLE, topo->neighbors[RIGHT], 1,
-                  topo->cart_comm, &request_recv[recv_count++]);
-    if (topo->neighbors[DOWN] != MPI_PROC_NULL)
-        MPI_Irecv(recv_down, local_nx, MPI_DOUBLE, topo->neighbors[DOWN], 2,
-                  topo->cart_comm, &request_recv[recv_count++]);
-    if (topo->neighbors[UP] != MPI_PROC_NULL)
-        MPI_Irecv(recv_up, local_nx, MPI_DOUBLE, topo->neighbors[UP], 3,
-                  topo->cart_comm, &request_recv[recv_count++]);
-
-    int send_count = 0;
-    if (topo->neighbors[RIGHT] != MPI_PROC_NULL)
-        MPI_Isend(send_right, local_ny, MPI_DOUBLE, topo->neighbors[RIGHT], 0,
-                  topo->cart_comm, &request_send[send_count++]);
-    if (topo->neighbors[LEFT] != MPI_PROC_NULL)
-        MPI_Isend(send_left, local_ny, MPI_DOUBLE, topo->neighbors[LEFT], 1,
-                  topo->cart_comm, &request_send[send_count++]);
-    if (topo->neighbors[UP] != MPI_PROC_NULL)
-        MPI_Isend(send_up, local_nx, MPI_DOUBLE, topo->neighbors[UP], 2,
-                  topo->cart_comm, &request_send[send_count++]);
-    if (topo->neighbors[DOWN] != MPI_PROC_NULL)
-        MPI_Isend(send_down, local_nx, MPI_DOUBLE, topo->neighbors[DOWN], 3,
-                  topo->cart_comm, &request_send[send_count++]);
-
-    if (recv_count > 0) MPI_Waitall(recv_count, request_recv, status);
-    if (send_count > 0) MPI_Waitall(send_count, request_send, status);
-
-    MPI_Barrier(topo->cart_comm);
-
-    free(send_left);
-    free(send_right);
-    free(send_down);
-    free(send_up);
-    if (recv_left) free(recv_left);
-    if (recv_right) free(recv_right);
-    if (recv_down) free(recv_down);
-    if (recv_up) free(recv_up);
+    #pragma omp parallel for
+    for (int j = 0; j <= local_ny; j++) {
+        for (int i = 0; i < local_nx; i++)
+            SET(all_data->hv, i, j, c1_y * GET(all_data->h_interp, i, j));
+    }
 }
 
 void check_cfl(parameters_t param, all_data_t *all_data, MPITopology *topo) {
@@ -495,367 +504,264 @@ void apply_source(int timestep, int nx_glob, int ny_glob,
 /*===========================================================
  * MAIN COMPUTATION FUNCTIONS
  ===========================================================*/
-void update_eta(const parameters_t param, 
-                all_data_t *all_data,
+void update_eta(all_data_t *all_data,
                 gather_data_t *gdata,
                 MPITopology *topo) {
 
-    MPI_Request request_recv[4] = {MPI_REQUEST_NULL, MPI_REQUEST_NULL, 
-                                  MPI_REQUEST_NULL, MPI_REQUEST_NULL};
-    MPI_Request request_send[4] = {MPI_REQUEST_NULL, MPI_REQUEST_NULL,
-                                  MPI_REQUEST_NULL, MPI_REQUEST_NULL};
-    MPI_Status status[4];
-
     int nx = all_data->eta->nx;
     int ny = all_data->eta->ny;
 
-    // Allocate all buffers
-    double *send_left = calloc(ny, sizeof(double));
-    double *send_right = calloc(ny, sizeof(double));
-    double *send_down = calloc(nx, sizeof(double));
-    double *send_up = calloc(nx, sizeof(double));
-    
-    double *recv_left = NULL;
-    double *recv_right = NULL;
-    double *recv_down = NULL;
-    double *recv_up = NULL;
-
-    if (topo->neighbors[LEFT] != MPI_PROC_NULL) recv_left = calloc(ny, sizeof(double));
-    if (topo->neighbors[RIGHT] != MPI_PROC_NULL) recv_right = calloc(ny, sizeof(double));
-    if (topo->neighbors[DOWN] != MPI_PROC_NULL) recv_down = calloc(nx, sizeof(double));
-    if (topo->neighbors[UP] != MPI_PROC_NULL) recv_up = calloc(nx, sizeof(double));
+    // Our east u-faces and north v-faces are the neighbours' first ones:
+    // they are received straight into u(nx) and v(ny)
+    MPI_Datatype column;
+    MPI_Type_vector(ny, 1, all_data->u->pitch, MPI_DOUBLE, &column);
+    MPI_Type_commit(&column);
 
-    // Prepare send buffers
-    for (int j = 0; j < ny; j++) {
-        send_left[j] = GET(all_data->u, 0, j);
-        send_right[j] = GET(all_data->u, nx+1, j);
-    }
-    for (int i = 0; i < nx; i++) {
-        send_down[i] = GET(all_data->v, i, 0);
-        send_up[i] = GET(all_data->v, i, ny);
-    }
-
-    // Post receives first
-    int recv_count = 0;
-    if (topo->neighbors[LEFT] != MPI_PROC_NULL)
-        MPI_Irecv(recv_left, ny, MPI_DOUBLE, topo->neighbors[LEFT], 100,
-                  topo->cart_comm, &request_recv[recv_count++]);
+    MPI_Request requests[4];
+    int count = 0;
     if (topo->neighbors[RIGHT] != MPI_PROC_NULL)
-        MPI_Irecv(recv_right, ny, MPI_DOUBLE, topo->neighbors[RIGHT], 101,
-                  topo->cart_comm, &request_recv[recv_count++]);
-    if (topo->neighbors[DOWN] != MPI_PROC_NULL)
-        MPI_Irecv(recv_down, nx, MPI_DOUBLE, topo->neighbors[DOWN], 102,
-                  topo->cart_comm, &request_recv[recv_count++]);
+        MPI_Irecv(&GET(all_data->u, nx, 0), 1, column, topo->neighbors[RIGHT], 101,
+                  topo->cart_comm, &requests[count++]);
     if (topo->neighbors[UP] != MPI_PROC_NULL)
-        MPI_Irecv(recv_up, nx, MPI_DOUBLE, topo->neighbors[UP], 103,
-                  topo->cart_comm, &request_recv[recv_count++]);
-
-    // Post sends
-    int send_count = 0;
-    if (topo->neighbors[RIGHT] != MPI_PROC_NULL)
-        MPI_Isend(send_right, ny, MPI_DOUBLE, topo->neighbors[RIGHT], 100,
-                  topo->cart_comm, &request_send[send_count++]);
+        MPI_Irecv(&GET(all_data->v, 0, ny), nx, MPI_DOUBLE, topo->neighbors[UP], 103,
+                  topo->cart_comm, &requests[count++]);
     if (topo->neighbors[LEFT] != MPI_PROC_NULL)
-        MPI_Isend(send_left, ny, MPI_DOUBLE, topo->neighbors[LEFT], 101,
-                  topo->cart_comm, &request_send[send_count++]);
-    if (topo->neighbors[UP] != MPI_PROC_NULL)
-        MPI_Isend(send_up, nx, MPI_DOUBLE, topo->neighbors[UP], 102,
-                  topo->cart_comm, &request_send[send_count++]);
+        MPI_Isend(&GET(all_data->u, 0, 0), 1, column, topo->neighbors[LEFT], 101,
+                  topo->cart_comm, &requests[count++]);
     if (topo->neighbors[DOWN] != MPI_PROC_NULL)
-        MPI_Isend(send_down, nx, MPI_DOUBLE, topo->neighbors[DOWN], 103,
-                  topo->cart_comm, &request_send[send_count++]);
+        MPI_Isend(&GET(all_data->v, 0, 0), nx, MPI_DOUBLE, topo->neighbors[DOWN], 103,
+                  topo->cart_comm, &requests[count++]);
 
-    // Wait for all receives to complete
-    if (recv_count > 0) {
-        MPI_Waitall(recv_count, request_recv, status);
-    }
+    if (count > 0) MPI_Waitall(count, requests, MPI_STATUSES_IGNORE);
+    MPI_Type_free(&column);
 
-    // Update eta with proper boundary handling
+    // Update eta: pure flux difference over the face coefficients
     #pragma omp parallel for
     for (int j = 0; j < ny; j++) {
-        for (int i = 0; i < nx; i++) {
-
-            double h_ui_j = GET(all_data->h_interp, i, j);
-            double h_vi_j = h_ui_j;
-
-            // boundary handling
-            double h_ui_ip1_j = (i < nx - 1) ? GET(all_data->h_interp, i + 1, j) : h_ui_j;
-            double h_vi_jp1 = (j < ny - 1) ? GET(all_data->h_interp, i, j + 1) : h_vi_j;
+        eta_row(&GET(all_data->eta, 0, j), &GET(all_data->hu, 0, j), &GET(all_data->u, 0, j),
+                &GET(all_data->hv, 0, j), &GET(all_data->hv, 0, j + 1),
+                &GET(all_data->v, 0, j), &GET(all_data->v, 0, j + 1), nx);
+    }
+}
 
-    
-            double u_i = GET(all_data->u, i, j);
-            double u_ip1 = (i < nx - 1) ? GET(all_data->u, i + 1, j)
-                                       : (topo->neighbors[RIGHT] != MPI_PROC_NULL) ? recv_right[j] : u_i;
+/**
+ * Builds the per-row Coriolis parameter of this rank
+ * u rows sit at y = j*dy and v rows half a cell lower, both measured from
+ * the centre of the global domain
+ *
+ * @param param Simulation parameters (f and beta)
+ * @param ny_glob Global number of rows
+ * @param all_data Simulation data structures
+ * @param gdata Rank offsets in the global grid
+ * @param topo MPI topology
+ * @return 0 on success, 1 on allocation failure
+ */
+int init_coriolis(const parameters_t param,
+                  int ny_glob,
+                  all_data_t *all_data,
+                  gather_data_t *gdata,
+                  MPITopology *topo) {
 
-            double v_j = GET(all_data->v, i, j);
-            double v_jp1 = (j < ny - 1) ? GET(all_data->v, i, j + 1)
-                                       : (topo->neighbors[UP] != MPI_PROC_NULL) ? recv_up[i] : v_j;
+    int ny = all_data->eta->ny;
+    int start_j = START_J(gdata, topo->cart_rank);
+    double y_centre = 0.5 * ny_glob * param.dy;
+    coriolis_t *cor = &all_data->cor;
 
-            double du_dx = (h_ui_ip1_j * u_ip1 - h_ui_j * u_i) / param.dx;
-            double dv_dy = (h_vi_jp1 * v_jp1 - h_vi_j * v_j) / param.dy;
+    cor->f_u = malloc(ny * sizeof(double));
+    cor->f_v = malloc((ny + 1) * sizeof(double));
+    if (!cor->f_u || !cor->f_v) return 1;
 
-            double eta_old = GET(all_data->eta, i, j);
-            double eta_new = eta_old - param.dt * (du_dx + dv_dy);
-            SET(all_data->eta, i, j, eta_new);
-        }
-    }
+    for (int j = 0; j < ny; j++)
+        cor->f_u[j] = param.f + param.beta * ((start_j + j) * param.dy - y_centre);
+    for (int j = 0; j <= ny; j++)
+        cor->f_v[j] = param.f + param.beta * ((start_j + j - 0.5) * param.dy - y_centre);
 
-    // Wait for all sends to complete
-    if (send_count > 0) {
-        MPI_Waitall(send_count, request_send, status);
-    }
+    return 0;
+}
 
-    // Clean up
-    free(send_left);
-    free(send_right);
-    free(send_down);
-    free(send_up);
-    if (recv_left) free(recv_left);
-    if (recv_right) free(recv_right);
-    if (recv_down) free(recv_down);
-    if (recv_up) free(recv_up);
+/**
+ * Four-point staggered average of one row: a and b are two adjacent rows
+ * of a velocity field, each output point averages columns k-1 and k of
+ * both. Unit stride in every operand, so the compiler vectorizes it
+ *
+ * @param avg Output row
+ * @param a, b Input rows (read from column -1)
+ * @param n Number of points
+ */
+static void stagger_average(double *avg, const double *a, const double *b, int n) {
+    for (int k = 0; k < n; k++)
+        avg[k] = 0.25 * ((a[k - 1] + b[k - 1]) + (a[k] + b[k]));
 }
 
-double calculate_pml_damping(int global_i, int global_j, int nx_glob, int ny_glob, int pml_width, double sigma_max) {
-        // Calculate distances from boundaries
-    
-        double dist_x = fmin(global_i, nx_glob - 1 - global_i);
-        double dist_y = fmin(global_j, ny_glob - 1 - global_j);
-        
-        // Calculate damping only if in PML zone
-        double sigma_x = 0.0;
-        double sigma_y = 0.0;
-        
-        if (dist_x < pml_width) {
-            double x = (pml_width - dist_x) / pml_width;
-            sigma_x = sigma_max * (x*x*x);
-        }
-        if (dist_y < pml_width) {
-            double y = (pml_width - dist_y) / pml_width;
-            sigma_y = sigma_max * (y*y*y);
-        }
-        
-        // Return maximum damping between x and y components
-        return fmax(sigma_x, sigma_y);
-    }
+/**
+ * PML damping coefficient along one axis: cubic ramp from 0 at the inner
+ * edge of the strip to sigma_max at the domain boundary
+ *
+ * @param global Global index along the axis
+ * @param n_glob Global number of cells along the axis
+ * @param pml_width Strip width in cells
+ * @param sigma_max Damping coefficient at the boundary
+ * @return Damping coefficient (0 outside the strip)
+ */
+static double pml_sigma(int global, int n_glob, int pml_width, double sigma_max) {
+    double dist = fmin(global, n_glob - 1 - global);
+    if (dist >= pml_width) return 0.0;
 
-void update_velocities(const parameters_t param,
-                      all_data_t *all_data,
-                      gather_data_t *gdata,
-                      MPITopology *topo) {
+    double x = (pml_width - dist) / pml_width;
+    return sigma_max * (x*x*x);
+}
 
-    MPI_Request request_recv[4] = {MPI_REQUEST_NULL, MPI_REQUEST_NULL,
-                                  MPI_REQUEST_NULL, MPI_REQUEST_NULL};
-    MPI_Request request_send[4] = {MPI_REQUEST_NULL, MPI_REQUEST_NULL,
-                                  MPI_REQUEST_NULL, MPI_REQUEST_NULL};
-    MPI_Status status[4];
+/**
+ * Builds the PML multipliers exp(-sigma*dt) of this rank once for the run
+ * The damping of a point is the larger of its x and y coefficients, so its
+ * multiplier is the smaller of the column and row multipliers
+ *
+ * @param param Simulation parameters
+ * @param nx_glob, ny_glob Global grid dimensions
+ * @param all_data Simulation data structures
+ * @param gdata Rank offsets in the global grid
+ * @param topo MPI topology
+ * @return 0 on success, 1 on allocation failure
+ */
+int init_pml(const parameters_t param,
+             int nx_glob, int ny_glob,
+             all_data_t *all_data,
+             gather_data_t *gdata,
+             MPITopology *topo) {
 
     int nx = all_data->eta->nx;
     int ny = all_data->eta->ny;
+    int start_i = START_I(gdata, topo->cart_rank);
+    int start_j = START_J(gdata, topo->cart_rank);
+    pml_t *pml = &all_data->pml;
 
-    // Calculate global dimensions
-    double hx = all_data->h->nx * all_data->h->dx;
-    double hy = all_data->h->ny * all_data->h->dy;
-    int nx_glob = floor(hx / param.dx);
-    int ny_glob = floor(hy / param.dy);
-    
-    // Allocate all buffers
-    double *send_left = calloc(ny, sizeof(double));
-    double *send_right = calloc(ny, sizeof(double));
-    double *send_down = calloc(nx, sizeof(double));
-    double *send_up = calloc(nx, sizeof(double));
-    
-    double *recv_left = NULL;
-    double *recv_right = NULL;
-    double *recv_down = NULL;
-    double *recv_up = NULL;
+    // Use minimum of both widths for consistent corners
+    int pml_width = fmin((int)(0.08 * nx_glob), (int)(0.08 * ny_glob));
+    double sigma_max = 20.0 * (25.0/param.dx);
 
-    if (topo->neighbors[LEFT] != MPI_PROC_NULL) recv_left = calloc(ny, sizeof(double));
-    if (topo->neighbors[RIGHT] != MPI_PROC_NULL) recv_right = calloc(ny, sizeof(double));
-    if (topo->neighbors[DOWN] != MPI_PROC_NULL) recv_down = calloc(nx, sizeof(double));
-    if (topo->neighbors[UP] != MPI_PROC_NULL) recv_up = calloc(nx, sizeof(double));
+    pml->damp_x = malloc((nx + 1) * sizeof(double));
+    pml->damp_y = malloc((ny + 1) * sizeof(double));
+    if (!pml->damp_x || !pml->damp_y) return 1;
 
-    // Prepare send buffers with eta values
-    for (int j = 0; j < ny; j++) {
-        send_left[j] = GET(all_data->eta, 0, j);
-        send_right[j] = GET(all_data->eta, nx-1, j);
-    }
-    for (int i = 0; i < nx; i++) {
-        send_down[i] = GET(all_data->eta, i, 0);
-        send_up[i] = GET(all_data->eta, i, ny-1);
-    }
+    for (int i = 0; i <= nx; i++)
+        pml->damp_x[i] = exp(-pml_sigma(start_i + i, nx_glob, pml_width, sigma_max) * param.dt);
+    for (int j = 0; j <= ny; j++)
+        pml->damp_y[j] = exp(-pml_sigma(start_j + j, ny_glob, pml_width, sigma_max) * param.dt);
 
-    // Post all receives first
-    int recv_count = 0;
-    if (topo->neighbors[LEFT] != MPI_PROC_NULL)
-        MPI_Irecv(recv_left, ny, MPI_DOUBLE, topo->neighbors[LEFT], 200,
-                  topo->cart_comm, &request_recv[recv_count++]);
-    if (topo->neighbors[RIGHT] != MPI_PROC_NULL)
-        MPI_Irecv(recv_right, ny, MPI_DOUBLE, topo->neighbors[RIGHT], 201,
-                  topo->cart_comm, &request_recv[recv_count++]);
-    if (topo->neighbors[DOWN] != MPI_PROC_NULL)
-        MPI_Irecv(recv_down, nx, MPI_DOUBLE, topo->neighbors[DOWN], 202,
-                  topo->cart_comm, &request_recv[recv_count++]);
-    if (topo->neighbors[UP] != MPI_PROC_NULL)
-        MPI_Irecv(recv_up, nx, MPI_DOUBLE, topo->neighbors[UP], 203,
-                  topo->cart_comm, &request_recv[recv_count++]);
+    // Undamped columns form one range between the west and east strips
+    pml->x_lo = 0;
+    while (pml->x_lo <= nx && pml->damp_x[pml->x_lo] < 1.0) pml->x_lo++;
+    pml->x_hi = nx + 1;
+    while (pml->x_hi > pml->x_lo && pml->damp_x[pml->x_hi - 1] < 1.0) pml->x_hi--;
 
-    // Post all sends
-    int send_count = 0;
-    if (topo->neighbors[RIGHT] != MPI_PROC_NULL)
-        MPI_Isend(send_right, ny, MPI_DOUBLE, topo->neighbors[RIGHT], 200,
-                  topo->cart_comm, &request_send[send_count++]);
-    if (topo->neighbors[LEFT] != MPI_PROC_NULL)
-        MPI_Isend(send_left, ny, MPI_DOUBLE, topo->neighbors[LEFT], 201,
-                  topo->cart_comm, &request_send[send_count++]);
-    if (topo->neighbors[UP] != MPI_PROC_NULL)
-        MPI_Isend(send_up, nx, MPI_DOUBLE, topo->neighbors[UP], 202,
-                  topo->cart_comm, &request_send[send_count++]);
-    if (topo->neighbors[DOWN] != MPI_PROC_NULL)
-        MPI_Isend(send_down, nx, MPI_DOUBLE, topo->neighbors[DOWN], 203,
-                  topo->cart_comm, &request_send[send_count++]);
+    return 0;
+}
 
-    // Wait for all receives to complete before updating
-    if (recv_count > 0) {
-        MPI_Waitall(recv_count, request_recv, status);
+/**
+ * Applies the PML multipliers to one velocity row
+ * Rows outside the south/north strips only touch the west/east strips,
+ * so interior rows of an interior rank return without any work
+ *
+ * @param vel Velocity row
+ * @param pml PML multipliers of this rank
+ * @param j Local row index
+ * @param n Number of points in the row
+ */
+static void damp_row(double *vel, const pml_t *pml, int j, int n) {
+    double damp_y = pml->damp_y[j];
+    if (damp_y < 1.0) {
+        for (int i = 0; i < n; i++) vel[i] *= fmin(pml->damp_x[i], damp_y);
+        return;
     }
-    
-        // Update velocities
-    double dx = param.dx;
-    double dy = param.dy;
+
+    int lo = (pml->x_lo < n) ? pml->x_lo : n;
+    for (int i = 0; i < lo; i++) vel[i] *= pml->damp_x[i];
+    for (int i = pml->x_hi; i < n; i++) vel[i] *= pml->damp_x[i];
+}
+
+void update_velocities(const parameters_t param,
+                      all_data_t *all_data,
+                      MPITopology *topo) {
+
+    int nx = all_data->eta->nx;
+    int ny = all_data->eta->ny;
+    data_t *eta = all_data->eta;
+    data_t *u = all_data->u;
+    data_t *v = all_data->v;
+    data_t *v_at_u = all_data->v_at_u;
+    data_t *u_at_v = all_data->u_at_v;
+
+    // Neighbour elevations and v columns land in the ghost cells, the
+    // domain edges repeat the last cell (zero gradient)
+    exchange_halo(eta, 200, topo);
+    exchange_halo(v, 300, topo);
+
     double c1 = param.dt * param.g;
     double c2 = param.dt * param.gamma;
-    
-    int pml_width_x = (int)(0.08 * nx_glob);
-    int pml_width_y = (int)(0.08 * ny_glob);
 
-    // Use minimum of both for consistent corners, with a minimum size
-    int pml_width = fmin(pml_width_x, pml_width_y);
-    double sigma_max = 20.0 * (25.0/param.dx);
+    // Average v on the u faces: pre-pass over pairs of v rows, the west and
+    // east faces read the v ghost columns. No Coriolis term on domain walls
+    #pragma omp parallel for
+    for (int j = 0; j < ny; j++) {
+        stagger_average(&GET(v_at_u, 0, j), &GET(v, 0, j), &GET(v, 0, j + 1), nx + 1);
+        if (topo->neighbors[LEFT] == MPI_PROC_NULL) SET(v_at_u, 0, j, 0.0);
+        if (topo->neighbors[RIGHT] == MPI_PROC_NULL) SET(v_at_u, nx, j, 0.0);
+    }
 
     // Update u (includes one extra point in x direction)
     #pragma omp parallel for 
     for (int j = 0; j < ny; j++) {
+        double *u_row = &GET(u, 0, j);
+        const double *eta_c = &GET(eta, 0, j);
+        const double *avg = &GET(v_at_u, 0, j);
+        double coriolis = param.dt * all_data->cor.f_u[j];
+
+        // Faces 0 and nx read the west and east eta ghosts
         for (int i = 0; i < nx + 1; i++) {
-            double eta_ij;
-            double eta_im1j;
-
-            // Get eta values with boundary handling
-            if (i < nx) {
-                eta_ij = GET(all_data->eta, i, j);
-            } else if (topo->neighbors[RIGHT] != MPI_PROC_NULL) {
-                eta_ij = recv_right[j];
-            } else {
-                eta_ij = GET(all_data->eta, nx-1, j);  
-            }
+            u_row[i] = (1.0 - c2) * u_row[i] -
+                       c1 / param.dx * (eta_c[i] - eta_c[i - 1]) +
+                       coriolis * avg[i];
+        }
 
-            if (i > 0) {
-                eta_im1j = GET(all_data->eta, i-1, j);
-            } else if (topo->neighbors[LEFT] != MPI_PROC_NULL) {
-                eta_im1j = recv_left[j];
-            } else {
-                eta_im1j = eta_ij;  
-            }
+        // PML damping, precomputed by init_pml
+        damp_row(u_row, &all_data->pml, j, nx + 1);
+    }
 
-            // Calculate average v at u points
-            double v_avg;
-            if (i > 0 && i <= nx && j < ny) {
-                v_avg = 0.25 * (
-                    GET(all_data->v, i-1, j) + GET(all_data->v, i-1, j+1) +
-                    GET(all_data->v, i, j) + GET(all_data->v, i, j+1)
-                );
-            } else {
-                v_avg = 0.0;  // At boundaries
-            }
+    // The v update sees the new u: its south and north rows need the
+    // neighbours' u rows
+    exchange_halo(u, 400, topo);
 
-            double u_ij = GET(all_data->u, i, j);
-            
-            // Update velocity with Coriolis term
-            double new_u = (1.0 - c2) * u_ij - 
-                         c1 / dx * (eta_ij - eta_im1j) + 
-                         param.dt * param.f * v_avg;
-
-            // Calculate global coordinates
-            int global_i = START_I(gdata, topo->cart_rank) + i;
-            int global_j = START_J(gdata, topo->cart_rank) + j;
-
-            // Apply PML damping
-            double sigma = calculate_pml_damping(global_i, global_j, nx_glob, ny_glob, pml_width, sigma_max);
-            if (sigma > 0.0) new_u *= exp(-sigma * param.dt);
-            
-            
-            SET(all_data->u, i, j, new_u);
+    // Average u on the v faces: pre-pass over pairs of u rows, shifted by
+    // one column so both the i and i+1 faces are read
+    #pragma omp parallel for
+    for (int j = 0; j < ny + 1; j++) {
+        if ((j == 0 && topo->neighbors[DOWN] == MPI_PROC_NULL) ||
+            (j == ny && topo->neighbors[UP] == MPI_PROC_NULL)) {
+            for (int i = 0; i < nx; i++) SET(u_at_v, i, j, 0.0);
+        } else {
+            stagger_average(&GET(u_at_v, 0, j), &GET(u, 1, j - 1), &GET(u, 1, j), nx);
         }
     }
 
     // Update v (includes one extra point in y direction)
     #pragma omp parallel for 
     for (int j = 0; j < ny + 1; j++) {
-        for (int i = 0; i < nx; i++) {
-            double eta_ij;
-            double eta_ijm1;
-
-            // Get eta values with boundary handling
-            if (j < ny) {
-                eta_ij = GET(all_data->eta, i, j);
-            } else if (topo->neighbors[UP] != MPI_PROC_NULL) {
-                eta_ij = recv_up[i];
-            } else {
-                eta_ij = GET(all_data->eta, i, ny-1); 
-            }
-
-            if (j > 0) {
-                eta_ijm1 = GET(all_data->eta, i, j-1);
-            } else if (topo->neighbors[DOWN] != MPI_PROC_NULL) {
-                eta_ijm1 = recv_down[i];
-            } else {
-                eta_ijm1 = eta_ij;  
-            }
-
-            // Calculate average u at v points
-            double u_avg;
-            if (j > 0 && j <= ny && i < nx) {
-                u_avg = 0.25 * (
-                    GET(all_data->u, i, j-1) + GET(all_data->u, i+1, j-1) +
-                    GET(all_data->u, i, j) + GET(all_data->u, i+1, j)
-                );
-            } else {
-                u_avg = 0.0;  // At boundaries
-            }
+        double *v_row = &GET(v, 0, j);
+        const double *eta_c = &GET(eta, 0, j);
+        const double *eta_s = &GET(eta, 0, j - 1);
+        const double *avg = &GET(u_at_v, 0, j);
+        double coriolis = param.dt * all_data->cor.f_v[j];
 
-            double v_ij = GET(all_data->v, i, j);
-            
-            // Update velocity with Coriolis term
-            double new_v = (1.0 - c2) * v_ij - 
-                         c1 / dy * (eta_ij - eta_ijm1) - 
-                         param.dt * param.f * u_avg;
-            
-            // Calculate global coordinates
-            int global_i = START_I(gdata, topo->cart_rank) + i;
-            int global_j = START_J(gdata, topo->cart_rank) + j;
-
-            // Apply PML damping
-            double sigma = calculate_pml_damping(global_i, global_j, nx_glob, ny_glob, pml_width, sigma_max);
-            if (sigma > 0.0) new_v *= exp(-sigma * param.dt);
-    
-            SET(all_data->v, i, j, new_v);
+        // Rows 0 and ny read the south and north eta ghosts
+        for (int i = 0; i < nx; i++) {
+            v_row[i] = (1.0 - c2) * v_row[i] -
+                       c1 / param.dy * (eta_c[i] - eta_s[i]) -
+                       coriolis * avg[i];
         }
-    }
 
-    // Wait for all sends to complete
-    if (send_count > 0) {
-        MPI_Waitall(send_count, request_send, status);
+        // PML damping, precomputed by init_pml
+        damp_row(v_row, &all_data->pml, j, nx);
     }
-    
-    // Clean up
-    free(send_left);
-    free(send_right);
-    free(send_down);
-    free(send_up);
-    if (recv_left) free(recv_left);
-    if (recv_right) free(recv_right);
-    if (recv_down) free(recv_down);
-    if (recv_up) free(recv_up);
 }
 
 
@@ -884,12 +790,18 @@ void gather_and_assemble_data(const parameters_t param,
     // Gather and assemble each field
     for (int field = 0; field < 3; field++) {
         data_t *local_data = output_data[field];
-        int send_size = local_data->nx * local_data->ny;
+
+        // Interior block of the padded field, rows a pitch apart
+        MPI_Datatype interior;
+        MPI_Type_vector(local_data->ny, local_data->nx, local_data->pitch,
+                        MPI_DOUBLE, &interior);
+        MPI_Type_commit(&interior);
 
         // Gathering data
-        MPI_Gatherv(local_data->vals, send_size, MPI_DOUBLE,
+        MPI_Gatherv(local_data->vals, 1, interior,
                     receive_buffers[field], recv_sizes[field],
                     displacements[field], MPI_DOUBLE, 0, topo->cart_comm);
+        MPI_Type_free(&interior);
 
         // Assembly on rank 0
         if (topo->cart_rank == 0) {
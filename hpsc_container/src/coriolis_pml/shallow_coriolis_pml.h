@@ -34,6 +34,23 @@
  ===========================================================*/
 #define INPUT_DIR getenv("SHALLOW_INPUT_DIR")
 #define MAX_PATH_LENGTH 512
+#define SIMD_ENV "SHALLOW_SIMD"    // force a kernel path (scalar, sse2, avx2, avx512)
+#define HUGE_PAGES_ENV "SHALLOW_HUGE_PAGES"  // back the field arena with huge pages
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)     // transparent huge page size
+#define MAX_NUMA_NODES 64                    // nodes shown by the placement report
+#define LATITUDE_ENV "SHALLOW_LATITUDE"      // reference latitude in degrees (default 45)
+#define BETA_PLANE_ENV "SHALLOW_BETA_PLANE"  // nonzero: f varies linearly with y
+
+// Earth rotation rate (rad/s) and radius (m) for the Coriolis parameter
+#define EARTH_OMEGA 7.2921e-5
+#define EARTH_RADIUS 6.371e6
+
+// Padded field layout: GHOST_WIDTH ghost cells around every field and rows
+// padded to a multiple of FIELD_ALIGN bytes (build with -DGHOST_WIDTH=n)
+#ifndef GHOST_WIDTH
+#define GHOST_WIDTH 1
+#endif
+#define FIELD_ALIGN 64
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
@@ -42,8 +59,9 @@
 /*===========================================================
  * DATA ACCESS AND MANIPULATION MACROS
  ===========================================================*/
-#define GET(data, i, j) ((data)->vals[(data)->nx * (j) + (i)])
-#define SET(data, i, j, val) ((data)->vals[(data)->nx * (j) + (i)] = (val))
+// i, j range from -ghost to nx+ghost-1 / ny+ghost-1
+#define GET(data, i, j) ((data)->vals[(data)->pitch * (j) + (i)])
+#define SET(data, i, j, val) ((data)->vals[(data)->pitch * (j) + (i)] = (val))
 #define RANK_NX(gdata, rank) ((gdata)->rank_glob[rank][0].n)
 #define RANK_NY(gdata, rank) ((gdata)->rank_glob[rank][1].n)
 #define START_I(gdata, rank) ((gdata)->rank_glob[rank][0].start)
@@ -72,10 +90,14 @@ typedef struct {
     int n;
 } limit_t;
 
+// Field on the padded layout: interior rows start on a FIELD_ALIGN boundary,
+// halo receives land directly in the ghost rows and columns
 typedef struct {
-    double *vals;
-    double **edge_vals;
+    double *vals;       // points at (0,0)
+    double *storage;    // allocation holding vals and the ghost cells
     int nx, ny;
+    int ghost;          // ghost cells on each side
+    int pitch;          // distance between rows (elements)
     double dx, dy;
 } data_t;
 
@@ -100,7 +122,8 @@ typedef struct {
     int sampling_rate;
     double latitude;
     int boundary_type;
-    double f;
+    double f;           // Coriolis parameter at the domain centre
+    double beta;        // df/dy (0 on an f-plane)
     
     char input_h_filename[MAX_PATH_LENGTH];
     char output_eta_filename[MAX_PATH_LENGTH];
@@ -108,12 +131,43 @@ typedef struct {
     char output_v_filename[MAX_PATH_LENGTH];
 } parameters_t;
 
+// PML damping multipliers exp(-sigma*dt), built once per rank. The profile
+// is separable: the factor of a point is fmin(damp_x[i], damp_y[j])
+typedef struct {
+    double *damp_x;     // per local column, nx+1 entries (u faces)
+    double *damp_y;     // per local row, ny+1 entries (v faces)
+    int x_lo, x_hi;     // undamped columns [x_lo, x_hi)
+} pml_t;
+
+// Coriolis parameter per row, f(y) = f + beta*(y - y_centre)
+typedef struct {
+    double *f_u;        // on the u rows, ny entries
+    double *f_v;        // on the v rows, ny+1 entries
+} coriolis_t;
+
+// Field arena: one page-aligned mapping holding every field except the
+// bathymetry, its pages placed by a parallel first touch
+typedef struct {
+    char *base;         // start of the mapping
+    size_t size;        // mapped bytes
+    char *start;        // first field (huge page aligned)
+    size_t used;        // bytes spanned by the fields
+    int huge_pages;     // huge pages requested through madvise
+} arena_t;
+
 typedef struct {
     data_t *u;
     data_t *v;
     data_t *eta;
     data_t *h;
     data_t *h_interp;
+    data_t *hu;    // u-face depth times dt/dx ((nx+1) x ny)
+    data_t *hv;    // v-face depth times dt/dy (nx x (ny+1))
+    data_t *v_at_u;    // four-point average of v on the u faces ((nx+1) x ny)
+    data_t *u_at_v;    // four-point average of u on the v faces (nx x (ny+1))
+    coriolis_t cor;
+    pml_t pml;
+    arena_t arena;     // storage of every field except h
 } all_data_t;
 
 typedef struct {
@@ -131,6 +185,16 @@ typedef struct {
 } gather_data_t;
 
 
+/**
+ * Row kernel selected at startup by init_simd
+ * eta_row reads one u-face past the segment
+ */
+typedef void (*eta_row_fn)(double *eta, const double *hu, const double *u,
+                           const double *hv, const double *hv_n,
+                           const double *v, const double *v_n, int n);
+
+extern eta_row_fn eta_row;
+
 /*===========================================================
  * FUNCTION PROTOTYPES
  ===========================================================*/
@@ -143,25 +207,31 @@ int initialize_gather_structures(const MPITopology *topo,
                                  double dx, double dy);
 
 // Simulation Core Functions
+const char *init_simd(void);
 void check_cfl(parameters_t param, all_data_t *all_data, MPITopology *topo);
+int init_coriolis(const parameters_t param,
+                  int ny_glob,
+                  all_data_t *all_data,
+                  gather_data_t *gdata,
+                  MPITopology *topo);
+int init_pml(const parameters_t param,
+             int nx_glob,
+             int ny_glob,
+             all_data_t *all_data,
+             gather_data_t *gdata,
+             MPITopology *topo);
 void update_velocities(const parameters_t param,
                        all_data_t *all_data,
-                       gather_data_t *gdata,
                        MPITopology *topo);
-void update_eta(const parameters_t param, 
-                all_data_t *all_data,
+void update_eta(all_data_t *all_data,
                 gather_data_t *gdata,
                 MPITopology *topo);
 
 // Interpolation and Preprocessing
 double interpolate_data(const data_t *data, 
-                        int nx_glob, 
-                        int ny_glob, 
                         double x, 
                         double y);
 void interp_bathy(const parameters_t param, 
-                  int nx_glob, 
-                  int ny_glob, 
                   all_data_t *all_data, 
                   gather_data_t *gdata, 
                   MPITopology *topo);
@@ -196,7 +266,10 @@ int write_data_vtk(const data_t *data, const char *name, const char *filename, i
 int write_manifest_vtk(const char *filename, double dt, int nt, int sampling_rate);
 int init_data(data_t *data, int nx, int ny, double dx, double dy, double val);
 void free_data(data_t *data);
+void fill_ghosts(data_t *data, const MPITopology *topo);
 all_data_t* init_all_data(const parameters_t *param, MPITopology *topo);
+int init_arena(all_data_t *all_data, int nx, int ny, double dx, double dy);
+void report_placement(const arena_t *arena, MPITopology *topo);
 void print_progress(int current_step, int total_steps, double start_time, MPITopology *top);
 void free_all_data(all_data_t* all_data);
 void cleanup(parameters_t *param, MPITopology *topo, gather_data_t *gdata);
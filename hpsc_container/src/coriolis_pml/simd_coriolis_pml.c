@@ -0,0 +1,150 @@
+/*===========================================================
+ * SHALLOW WATER EQUATIONS SOLVER - PARALLEL MPI/OpenMP
+ * SIMD Kernels File
+ * Contains vectorized eta row kernels and runtime ISA dispatch
+ * (velocities keep their scalar Coriolis and PML update)
+ ===========================================================*/
+
+// Keep every path bit-identical to the scalar kernels: no FMA contraction
+#pragma GCC optimize ("fp-contract=off")
+
+#include "shallow_coriolis_pml.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_X86 1
+#endif
+
+/*===========================================================
+ * SCALAR KERNELS
+ ===========================================================*/
+
+/**
+ * Updates eta on one row segment (scalar reference)
+ * Pure flux difference: reads hu[k+1] and u[k+1] (east faces) and the
+ * v-faces of this row and the next one
+ *
+ * @param eta Water elevation row
+ * @param hu, u U-face coefficients and x-velocity on this row
+ * @param hv, hv_n V-face coefficients on this row and the next one
+ * @param v, v_n Y-velocity on this row and the next one
+ * @param n Number of points to update
+ */
+static void eta_row_scalar(double *eta, const double *hu, const double *u,
+                           const double *hv, const double *hv_n,
+                           const double *v, const double *v_n, int n) {
+    for (int k = 0; k < n; k++) {
+        eta[k] = eta[k]
+            - (hu[k + 1] * u[k + 1] - hu[k] * u[k])
+            - (hv_n[k] * v_n[k] - hv[k] * v[k]);
+    }
+}
+
+#ifdef SIMD_X86
+/*===========================================================
+ * SSE2 KERNELS
+ ===========================================================*/
+
+static void eta_row_sse2(double *eta, const double *hu, const double *u,
+                         const double *hv, const double *hv_n,
+                         const double *v, const double *v_n, int n) {
+    int k = 0;
+    for (; k + 2 <= n; k += 2) {
+        __m128d flux_x = _mm_sub_pd(_mm_mul_pd(_mm_loadu_pd(hu + k + 1), _mm_loadu_pd(u + k + 1)),
+                                    _mm_mul_pd(_mm_loadu_pd(hu + k), _mm_loadu_pd(u + k)));
+        __m128d flux_y = _mm_sub_pd(_mm_mul_pd(_mm_loadu_pd(hv_n + k), _mm_loadu_pd(v_n + k)),
+                                    _mm_mul_pd(_mm_loadu_pd(hv + k), _mm_loadu_pd(v + k)));
+        _mm_storeu_pd(eta + k, _mm_sub_pd(_mm_sub_pd(_mm_loadu_pd(eta + k), flux_x), flux_y));
+    }
+    eta_row_scalar(eta + k, hu + k, u + k, hv + k, hv_n + k, v + k, v_n + k, n - k);
+}
+
+/*===========================================================
+ * AVX2 KERNELS
+ ===========================================================*/
+
+__attribute__((target("avx2")))
+static void eta_row_avx2(double *eta, const double *hu, const double *u,
+                         const double *hv, const double *hv_n,
+                         const double *v, const double *v_n, int n) {
+    int k = 0;
+    for (; k + 4 <= n; k += 4) {
+        __m256d flux_x = _mm256_sub_pd(_mm256_mul_pd(_mm256_loadu_pd(hu + k + 1), _mm256_loadu_pd(u + k + 1)),
+                                       _mm256_mul_pd(_mm256_loadu_pd(hu + k), _mm256_loadu_pd(u + k)));
+        __m256d flux_y = _mm256_sub_pd(_mm256_mul_pd(_mm256_loadu_pd(hv_n + k), _mm256_loadu_pd(v_n + k)),
+                                       _mm256_mul_pd(_mm256_loadu_pd(hv + k), _mm256_loadu_pd(v + k)));
+        _mm256_storeu_pd(eta + k, _mm256_sub_pd(_mm256_sub_pd(_mm256_loadu_pd(eta + k), flux_x), flux_y));
+    }
+    eta_row_scalar(eta + k, hu + k, u + k, hv + k, hv_n + k, v + k, v_n + k, n - k);
+}
+
+/*===========================================================
+ * AVX-512 KERNELS
+ ===========================================================*/
+
+__attribute__((target("avx512f")))
+static void eta_row_avx512(double *eta, const double *hu, const double *u,
+                           const double *hv, const double *hv_n,
+                           const double *v, const double *v_n, int n) {
+    int k = 0;
+    for (; k + 8 <= n; k += 8) {
+        __m512d flux_x = _mm512_sub_pd(_mm512_mul_pd(_mm512_loadu_pd(hu + k + 1), _mm512_loadu_pd(u + k + 1)),
+                                       _mm512_mul_pd(_mm512_loadu_pd(hu + k), _mm512_loadu_pd(u + k)));
+        __m512d flux_y = _mm512_sub_pd(_mm512_mul_pd(_mm512_loadu_pd(hv_n + k), _mm512_loadu_pd(v_n + k)),
+                                       _mm512_mul_pd(_mm512_loadu_pd(hv + k), _mm512_loadu_pd(v + k)));
+        _mm512_storeu_pd(eta + k, _mm512_sub_pd(_mm512_sub_pd(_mm512_loadu_pd(eta + k), flux_x), flux_y));
+    }
+    eta_row_scalar(eta + k, hu + k, u + k, hv + k, hv_n + k, v + k, v_n + k, n - k);
+}
+#endif // SIMD_X86
+
+/*===========================================================
+ * RUNTIME DISPATCH
+ ===========================================================*/
+
+// Selected row kernel (scalar until init_simd runs)
+eta_row_fn eta_row = eta_row_scalar;
+
+/**
+ * Selects the widest kernel path supported by the running CPU
+ * SHALLOW_SIMD=scalar|sse2|avx2|avx512 forces a narrower path; other
+ * values are reported and ignored
+ *
+ * @return Name of the selected kernel path
+ */
+const char *init_simd(void) {
+    const char *request = getenv(SIMD_ENV);
+    if (request && !*request) request = NULL;
+
+    // Unknown paths fall back to the default, like SHALLOW_HALO
+    if (request && strcmp(request, "scalar") && strcmp(request, "sse2") &&
+        strcmp(request, "avx2") && strcmp(request, "avx512")) {
+        int rank;
+        MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+        if (rank == 0)
+            printf("Warning: unknown SIMD path '%s', using the widest supported\n", request);
+        request = NULL;
+    }
+    const char *path = "scalar";
+    eta_row = eta_row_scalar;
+
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+    int allow_avx512 = !request || !strcmp(request, "avx512");
+    int allow_avx2 = allow_avx512 || !strcmp(request, "avx2");
+    int allow_sse2 = allow_avx2 || !strcmp(request, "sse2");
+
+    if (allow_avx512 && __builtin_cpu_supports("avx512f")) {
+        eta_row = eta_row_avx512;
+        path = "avx512";
+    } else if (allow_avx2 && __builtin_cpu_supports("avx2")) {
+        eta_row = eta_row_avx2;
+        path = "avx2";
+    } else if (allow_sse2 && __builtin_cpu_supports("sse2")) {
+        eta_row = eta_row_sse2;
+        path = "sse2";
+    }
+#endif
+
+    return path;
+}
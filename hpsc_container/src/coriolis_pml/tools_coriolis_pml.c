@@ -5,6 +5,9 @@
  ===========================================================*/
 
 #include "shallow_coriolis_pml.h"
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 
 /*===========================================================
  * FILE I/O AND PARAMETERS FUNCTIONS
@@ -87,6 +90,15 @@ int read_parameters(parameters_t *param, const char *filename) {
         return 1;
     }
 
+    // Coriolis parameter: f-plane at the reference latitude, or a beta-plane
+    // tangent to it when SHALLOW_BETA_PLANE is set
+    const char *latitude = getenv(LATITUDE_ENV);
+    const char *beta_plane = getenv(BETA_PLANE_ENV);
+    param->latitude = (latitude && *latitude) ? atof(latitude) : 45.0;
+    double phi = param->latitude * M_PI / 180.0;
+    param->f = 2.0 * EARTH_OMEGA * sin(phi);
+    param->beta = (beta_plane && atoi(beta_plane)) ? 2.0 * EARTH_OMEGA * cos(phi) / EARTH_RADIUS : 0.0;
+
     return 0;
 }
 
@@ -104,6 +116,8 @@ void print_parameters(const parameters_t *param) {
     printf(" - dissipation coefficient (gamma): %g 1/s\n", param->gamma);
     printf(" - source type: %d\n", param->source_type);
     printf(" - sampling rate: %d\n", param->sampling_rate);
+    printf(" - Coriolis: f = %g 1/s, beta = %g 1/(m s) (latitude %g deg)\n",
+           param->f, param->beta, param->latitude);
     printf(" - input bathymetry (h) file: '%s'\n", param->input_h_filename);
     printf(" - output elevation (eta) file: '%s'\n", param->output_eta_filename);
     printf(" - output velocity (u, v) files: '%s', '%s'\n",
@@ -139,14 +153,12 @@ int read_data(data_t *data, const char *filename) {
         if(N <= 0) {
             printf("Error: Invalid number of data points %d\n", N);
             ok = 0;
+        } else if(init_data(data, data->nx, data->ny, data->dx, data->dy, 0.0)) {
+            printf("Error: Could not allocate data (%d doubles)\n", N);
+            ok = 0;
         } else {
-            data->vals = (double*)malloc(N * sizeof(double));
-            if(!data->vals) {
-                printf("Error: Could not allocate data (%d doubles)\n", N);
-                ok = 0;
-            } else {
-                ok = (fread(data->vals, sizeof(double), N, fp) == N);
-            }
+            for(int j = 0; ok && j < data->ny; j++)
+                ok = (fread(&GET(data, 0, j), sizeof(double), data->nx, fp) == (size_t)data->nx);
         }
     }
     
@@ -158,6 +170,32 @@ int read_data(data_t *data, const char *filename) {
     return 0;
 }
 
+/**
+ * Sets the dimensions and padded layout of a field without allocating it
+ * Interior rows start on a FIELD_ALIGN boundary: the west ghosts are
+ * padded up to the alignment and the pitch is a whole number of lines
+ * 
+ * @param data Data structure to set up
+ * @param nx, ny Grid dimensions
+ * @param dx, dy Grid spacing
+ * @param offset Set to the position of (0,0) in the storage (elements)
+ * @return Number of elements of the storage
+ */
+static size_t field_layout(data_t *data, int nx, int ny, double dx, double dy, size_t *offset) {
+    data->nx = nx;
+    data->ny = ny;
+    data->dx = dx;
+    data->dy = dy;
+
+    int align = FIELD_ALIGN / sizeof(double);
+    int pad = (GHOST_WIDTH + align - 1) / align * align;
+    data->ghost = GHOST_WIDTH;
+    data->pitch = (pad + nx + GHOST_WIDTH + align - 1) / align * align;
+
+    *offset = (size_t)GHOST_WIDTH * data->pitch + pad;
+    return (size_t)data->pitch * (ny + 2 * GHOST_WIDTH);
+}
+
 /**
  * Initializes data structure with given dimensions and value
  * 
@@ -170,21 +208,44 @@ int read_data(data_t *data, const char *filename) {
 int init_data(data_t *data, int nx, int ny, double dx, double dy, double val) {
     if (data == NULL) return 1;
 
-    data->nx = nx;
-    data->ny = ny;
-    data->dx = dx;
-    data->dy = dy;
-
-    data->vals = (double*)calloc(nx*ny, sizeof(double));
-    if (data->vals == NULL) return 1;
+    size_t offset;
+    size_t count = field_layout(data, nx, ny, dx, dy, &offset);
+    if (posix_memalign((void **)&data->storage, FIELD_ALIGN, count * sizeof(double))) {
+        data->storage = data->vals = NULL;
+        return 1;
+    }
+    data->vals = data->storage + offset;
 
-    for (int i = 0; i < nx*ny; i++) {
-        data->vals[i] = val;
+    for (size_t k = 0; k < count; k++) {
+        data->storage[k] = val;
     }
 
     return 0;
 }
 
+/**
+ * Copies the edge values of a field into its ghost cells on the sides
+ * without a neighbour (zero normal gradient at the domain boundary)
+ * 
+ * @param data Data structure to update
+ * @param topo MPI topology information
+ */
+void fill_ghosts(data_t *data, const MPITopology *topo) {
+    int nx = data->nx;
+    int ny = data->ny;
+
+    for (int g = 1; g <= data->ghost; g++) {
+        if (topo->neighbors[LEFT] == MPI_PROC_NULL)
+            for (int j = 0; j < ny; j++) SET(data, -g, j, GET(data, 0, j));
+        if (topo->neighbors[RIGHT] == MPI_PROC_NULL)
+            for (int j = 0; j < ny; j++) SET(data, nx - 1 + g, j, GET(data, nx - 1, j));
+        if (topo->neighbors[DOWN] == MPI_PROC_NULL)
+            for (int i = 0; i < nx; i++) SET(data, i, -g, GET(data, i, 0));
+        if (topo->neighbors[UP] == MPI_PROC_NULL)
+            for (int i = 0; i < nx; i++) SET(data, i, ny - 1 + g, GET(data, i, ny - 1));
+    }
+}
+
 /*===========================================================
  * OUTPUT FUNCTIONS
  ===========================================================*/
@@ -214,8 +275,8 @@ int write_data(const data_t *data, const char *filename, int step) {
     if(ok) ok = (fwrite(&data->dx, sizeof(double), 1, fp) == 1);
     if(ok) ok = (fwrite(&data->dy, sizeof(double), 1, fp) == 1);
     
-    int N = data->nx * data->ny;
-    if(ok) ok = (fwrite(data->vals, sizeof(double), N, fp) == N);
+    for(int j = 0; ok && j < data->ny; j++)
+        ok = (fwrite(&GET(data, 0, j), sizeof(double), data->nx, fp) == (size_t)data->nx);
     
     fclose(fp);
     if(!ok) {
@@ -271,7 +332,8 @@ int write_data_vtk(const data_t *data, const char *name,
 
     // Write binary data
     fwrite(&num_bytes, sizeof(uint64_t), 1, fp);
-    fwrite(data->vals, sizeof(double), num_points, fp);
+    for (int j = 0; j < data->ny; j++)
+        fwrite(&GET(data, 0, j), sizeof(double), data->nx, fp);
 
     // Write footer
     fprintf(fp, "  </AppendedData>\n");
@@ -323,6 +385,134 @@ int write_manifest_vtk(const char *filename, double dt, int nt,
  * INITIALIZATION AND CLEANUP
  ===========================================================*/
 
+/**
+ * Carves the fields of this rank out of a single anonymous mapping
+ * Every field starts on a page boundary and is first written by the
+ * OpenMP threads with the static row split of the kernels, so each page
+ * lands on the NUMA node of the thread that updates it.
+ * SHALLOW_HUGE_PAGES=1 asks for transparent huge pages
+ * 
+ * @param all_data Simulation data (fields set up in place)
+ * @param nx, ny Local grid dimensions
+ * @param dx, dy Grid spacing
+ * @return 0 on success, 1 on failure
+ */
+int init_arena(all_data_t *all_data, int nx, int ny, double dx, double dy) {
+    data_t *fields[] = {all_data->eta, all_data->u, all_data->v,
+                        all_data->h_interp, all_data->hu, all_data->hv,
+                        all_data->v_at_u, all_data->u_at_v};
+    const int dims[][2] = {{nx, ny}, {nx + 1, ny}, {nx, ny + 1},
+                           {nx, ny}, {nx + 1, ny}, {nx, ny + 1},
+                           {nx + 1, ny}, {nx, ny + 1}};
+    const int num_fields = sizeof(fields) / sizeof(fields[0]);
+    arena_t *arena = &all_data->arena;
+
+    const char *env_huge = getenv(HUGE_PAGES_ENV);
+    arena->huge_pages = env_huge && atoi(env_huge);
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t granule = arena->huge_pages ? HUGE_PAGE_SIZE : page;
+
+    size_t offsets[8], starts[8], total = 0;
+    for (int f = 0; f < num_fields; f++) {
+        size_t count = field_layout(fields[f], dims[f][0], dims[f][1], dx, dy, &offsets[f]);
+        starts[f] = total;
+        total += (count * sizeof(double) + page - 1) / page * page;
+    }
+
+    // Over-map by one granule so the arena can start on a huge page boundary
+    arena->size = (total + granule - 1) / granule * granule + granule;
+    void *map = mmap(NULL, arena->size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        arena->base = NULL;
+        for (int f = 0; f < num_fields; f++) fields[f]->storage = fields[f]->vals = NULL;
+        return 1;
+    }
+    arena->base = map;
+    arena->start = (char *)(((uintptr_t)map + granule - 1) / granule * granule);
+    arena->used = total;
+#ifdef MADV_HUGEPAGE
+    if (arena->huge_pages) madvise(arena->start, total, MADV_HUGEPAGE);
+#endif
+
+    for (int f = 0; f < num_fields; f++) {
+        fields[f]->storage = (double *)(arena->start + starts[f]);
+        fields[f]->vals = fields[f]->storage + offsets[f];
+    }
+
+    // First touch: row j of every field goes to the thread that owns row j
+    // in the kernels, the first and last rows also take the ghost rows
+    #pragma omp parallel for schedule(static)
+    for (int j = 0; j < ny; j++) {
+        for (int f = 0; f < num_fields; f++) {
+            data_t *data = fields[f];
+            int first = (j == 0) ? -data->ghost : j;
+            int last = (j == ny - 1) ? data->ny + data->ghost : j + 1;
+            memset(&GET(data, -data->ghost, first), 0,
+                   (size_t)(last - first) * data->pitch * sizeof(double));
+        }
+    }
+    return 0;
+}
+
+/**
+ * Prints how the pages of the field arenas are spread over NUMA nodes,
+ * summed over all ranks (node numbers are local to each host)
+ * Queries the kernel with move_pages (no migration), so it is only
+ * available on Linux
+ * 
+ * @param arena Field arena of this rank
+ * @param topo MPI topology
+ */
+void report_placement(const arena_t *arena, MPITopology *topo) {
+    // counts[MAX_NUMA_NODES] holds the untouched pages, -1 flags a failure
+    long counts[MAX_NUMA_NODES + 1] = {0};
+    long total[MAX_NUMA_NODES + 1];
+    int failed = 1;
+
+#ifdef SYS_move_pages
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t num_pages = arena->used / page;
+    void *pages[1024];
+    int status[1024];
+    failed = 0;
+    for (size_t p = 0; p < num_pages && !failed; p += 1024) {
+        int batch = (num_pages - p < 1024) ? (int)(num_pages - p) : 1024;
+        for (int k = 0; k < batch; k++) pages[k] = arena->start + (p + k) * page;
+        if (syscall(SYS_move_pages, 0, batch, pages, NULL, status, 0) != 0) {
+            failed = 1;
+            break;
+        }
+        for (int k = 0; k < batch; k++) {
+            if (status[k] >= 0 && status[k] < MAX_NUMA_NODES) counts[status[k]]++;
+            else counts[MAX_NUMA_NODES]++;
+        }
+    }
+#endif
+
+    int any_failed;
+    MPI_Reduce(&failed, &any_failed, 1, MPI_INT, MPI_MAX, 0, topo->cart_comm);
+    MPI_Reduce(counts, total, MAX_NUMA_NODES + 1, MPI_LONG, MPI_SUM, 0, topo->cart_comm);
+    if (topo->cart_rank != 0) return;
+
+    if (any_failed) {
+        printf(" - page placement: unavailable\n");
+        return;
+    }
+    long num_pages_all = 0;
+    for (int node = 0; node <= MAX_NUMA_NODES; node++) num_pages_all += total[node];
+    if (num_pages_all == 0) return;
+
+    printf(" - page placement of %ld pages (%s pages requested):", num_pages_all,
+           arena->huge_pages ? "huge" : "base");
+    for (int node = 0; node < MAX_NUMA_NODES; node++) {
+        if (total[node]) printf(" node %d: %.1f%%", node, 100.0 * total[node] / num_pages_all);
+    }
+    if (total[MAX_NUMA_NODES])
+        printf(" untouched: %.1f%%", 100.0 * total[MAX_NUMA_NODES] / num_pages_all);
+    printf("\n");
+}
+
 /**
  * Initializes all simulation data structures
  * 
@@ -343,6 +533,15 @@ all_data_t* init_all_data(const parameters_t *param, MPITopology *topo) {
     all_data->eta = NULL;
     all_data->h = NULL;
     all_data->h_interp = NULL;
+    all_data->hu = NULL;
+    all_data->hv = NULL;
+    all_data->v_at_u = NULL;
+    all_data->u_at_v = NULL;
+    all_data->cor.f_u = NULL;
+    all_data->cor.f_v = NULL;
+    all_data->pml.damp_x = NULL;
+    all_data->pml.damp_y = NULL;
+    all_data->arena.base = NULL;
 
     // Allocate and read bathymetry data
     all_data->h = malloc(sizeof(data_t));
@@ -382,18 +581,20 @@ all_data_t* init_all_data(const parameters_t *param, MPITopology *topo) {
     all_data->u = malloc(sizeof(data_t));
     all_data->v = malloc(sizeof(data_t));
     all_data->h_interp = malloc(sizeof(data_t));
+    all_data->hu = malloc(sizeof(data_t));
+    all_data->hv = malloc(sizeof(data_t));
+    all_data->v_at_u = malloc(sizeof(data_t));
+    all_data->u_at_v = malloc(sizeof(data_t));
 
-    if (!all_data->eta || !all_data->u || !all_data->v || !all_data->h_interp) {
+    if (!all_data->eta || !all_data->u || !all_data->v || !all_data->h_interp ||
+        !all_data->hu || !all_data->hv || !all_data->v_at_u || !all_data->u_at_v) {
         fprintf(stderr, "Error: Failed to allocate data structures\n");
         free_all_data(all_data);
         return NULL;
     }
 
-    // Initialize each field with appropriate dimensions
-    if (init_data(all_data->eta, local_nx, local_ny, param->dx, param->dy, 0.0) ||
-        init_data(all_data->u, local_nx + 1, local_ny, param->dx, param->dy, 0.0) ||
-        init_data(all_data->v, local_nx, local_ny + 1, param->dx, param->dy, 0.0) ||
-        init_data(all_data->h_interp, local_nx, local_ny, param->dx, param->dy, 0.0)) {
+    // Every field lives in the arena, all starting at zero
+    if (init_arena(all_data, local_nx, local_ny, param->dx, param->dy)) {
         fprintf(stderr, "Error: Failed to initialize fields\n");
         free_all_data(all_data);
         return NULL;
@@ -410,6 +611,17 @@ all_data_t* init_all_data(const parameters_t *param, MPITopology *topo) {
 void free_all_data(all_data_t *all_data) {
     if (all_data == NULL) return;
 
+    // The arena owns the storage of every field except h
+    if (all_data->arena.base) {
+        munmap(all_data->arena.base, all_data->arena.size);
+        all_data->arena.base = NULL;
+        data_t *fields[] = {all_data->eta, all_data->u, all_data->v,
+                            all_data->h_interp, all_data->hu, all_data->hv,
+                            all_data->v_at_u, all_data->u_at_v};
+        for (int f = 0; f < (int)(sizeof(fields) / sizeof(fields[0])); f++)
+            if (fields[f]) fields[f]->storage = fields[f]->vals = NULL;
+    }
+
     if (all_data->u) {
         free_data(all_data->u);
         all_data->u = NULL;
@@ -430,6 +642,26 @@ void free_all_data(all_data_t *all_data) {
         free_data(all_data->h_interp);
         all_data->h_interp = NULL;
     }
+    if (all_data->hu) {
+        free_data(all_data->hu);
+        all_data->hu = NULL;
+    }
+    if (all_data->hv) {
+        free_data(all_data->hv);
+        all_data->hv = NULL;
+    }
+    if (all_data->v_at_u) {
+        free_data(all_data->v_at_u);
+        all_data->v_at_u = NULL;
+    }
+    if (all_data->u_at_v) {
+        free_data(all_data->u_at_v);
+        all_data->u_at_v = NULL;
+    }
+    free(all_data->cor.f_u);
+    free(all_data->cor.f_v);
+    free(all_data->pml.damp_x);
+    free(all_data->pml.damp_y);
 
     free(all_data);
 }
@@ -442,8 +674,9 @@ void free_all_data(all_data_t *all_data) {
 void free_data(data_t *data) {
     if (data == NULL) return;
     
-    if (data->vals) {
-        free(data->vals);
+    if (data->storage) {
+        free(data->storage);
+        data->storage = NULL;
         data->vals = NULL;
     }
     
@@ -31,7 +31,7 @@ mkdir -p "$OUTPUT_PATH"
 
 # Compilation
 echo "Compiling..."
-mpicc -O3 -fopenmp -o "$BIN_PATH/shallow_omp_mpi" "$SCRIPT_DIR/shallow_omp_mpi.c" "$SCRIPT_DIR/tools_omp_mpi.c" "$SCRIPT_DIR/main_omp_mpi.c" -lm
+mpicc -O3 -fopenmp -o "$BIN_PATH/shallow_omp_mpi" "$SCRIPT_DIR/shallow_omp_mpi.c" "$SCRIPT_DIR/tools_omp_mpi.c" "$SCRIPT_DIR/main_omp_mpi.c" "$SCRIPT_DIR/simd_omp_mpi.c" -lm
 
 # Run
 if [ $? -eq 0 ]; then
@@ -34,6 +34,37 @@
  ===========================================================*/
 #define INPUT_DIR getenv("SHALLOW_INPUT_DIR")
 #define MAX_PATH_LENGTH 512
+#define SIMD_ENV "SHALLOW_SIMD"    // force a kernel path (scalar, sse2, avx2, avx512)
+#define OVERLAP_ENV "SHALLOW_OVERLAP"  // 0: wait for the halos before computing
+#define HALO_ENV "SHALLOW_HALO"        // halo backend (p2p, neighbor, rma, shm, bench)
+#define HALO_BENCH_ROUNDS 200         // exchanges per benchmarked backend
+#define SHM_FLAGS_BYTES 128           // ready/done counters of one rank (2 exchanges)
+#define HALO_DEPTH_ENV "SHALLOW_HALO_DEPTH" // deep halo: exchange every k steps (k or auto)
+#define DECOMP_ENV "SHALLOW_DECOMP"        // domain decomposition (uniform, weighted)
+#define DRY_DEPTH_ENV "SHALLOW_DRY_DEPTH"  // cells this shallow or less are dry (m)
+#define DRY_COST_ENV "SHALLOW_DRY_COST"    // cost of a dry cell relative to a wet one
+#define DEFAULT_DRY_COST 0.1               // the kernels skip land, at about a tenth of the cost
+#define DECOMP_WEIGHT_SCALE 1000           // weight of a wet cell (integer sums are exact)
+#define REBALANCE_ENV "SHALLOW_REBALANCE"  // steps between load rebalancing (0: off)
+#define REBALANCE_GAIN 0.05                // predicted gain on the busiest rank to migrate
+#define BATHY_HEADER_BYTES (2 * sizeof(int) + 2 * sizeof(double)) // nx, ny, dx, dy
+#define OUTPUT_ENV "SHALLOW_OUTPUT"        // snapshot writer (gather, mpiio, pieces)
+#define VTK_HEADER_MAX 1024                // XML header of a VTK image (bytes)
+#define IO_SERVERS_ENV "SHALLOW_IO_SERVERS" // ranks set apart to write snapshots (count or node)
+#define IO_FORMAT_ENV "SHALLOW_IO_FORMAT"   // snapshot format of the I/O servers (vtk, raw)
+#define IO_TAG 300                          // snapshot blocks sent to an I/O server
+#define IO_BLOCK_HEADER 7                   // step, x0, y0, nx, ny, nx_glob, ny_glob
+#define HUGE_PAGES_ENV "SHALLOW_HUGE_PAGES"  // back the field arena with huge pages
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)     // transparent huge page size
+#define MAX_NUMA_NODES 64                    // nodes shown by the placement report
+
+// Padded field layout: GHOST_WIDTH ghost cells around every field and rows
+// padded to a multiple of FIELD_ALIGN bytes (build with -DGHOST_WIDTH=n).
+// The ring also bounds the deep halo depth
+#ifndef GHOST_WIDTH
+#define GHOST_WIDTH 4
+#endif
+#define FIELD_ALIGN 64
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
@@ -42,8 +73,9 @@
 /*===========================================================
  * DATA ACCESS AND MANIPULATION MACROS
  ===========================================================*/
-#define GET(data, i, j) ((data)->vals[(data)->nx * (j) + (i)])
-#define SET(data, i, j, val) ((data)->vals[(data)->nx * (j) + (i)] = (val))
+// i, j range from -ghost to nx+ghost-1 / ny+ghost-1
+#define GET(data, i, j) ((data)->vals[(data)->pitch * (j) + (i)])
+#define SET(data, i, j, val) ((data)->vals[(data)->pitch * (j) + (i)] = (val))
 #define RANK_NX(gdata, rank) ((gdata)->rank_glob[rank][0].n)
 #define RANK_NY(gdata, rank) ((gdata)->rank_glob[rank][1].n)
 #define START_I(gdata, rank) ((gdata)->rank_glob[rank][0].start)
@@ -70,11 +102,17 @@ typedef struct {
     int n;
 } limit_t;
 
+// Field on the padded layout: interior rows start on a FIELD_ALIGN boundary,
+// halo receives land directly in the ghost rows and columns
 typedef struct {
-    double *vals;
-    double **edge_vals;
+    double *vals;       // points at (0,0)
+    double *storage;    // allocation holding vals and the ghost cells
     int nx, ny;
+    int ghost;          // ghost cells on each side
+    int pitch;          // distance between rows (elements)
     double dx, dy;
+    int x0, y0;         // file position of (0,0): a bathymetry patch keeps
+                        // the file's nx, ny but only holds its own points
 } data_t;
 
 // MPI Topology management
@@ -86,6 +124,15 @@ typedef struct {
     int coords[2];
     int neighbors[NEIGHBOR_NUM];
     MPI_Comm cart_comm;
+    MPI_Comm node_comm;                 // ranks sharing this node's memory
+    int node_neighbors[NEIGHBOR_NUM];   // neighbour rank in node_comm (MPI_PROC_NULL off node)
+    int *splits[2];                     // first global cell of each process column/row, then nx/ny
+    // I/O servers (SHALLOW_IO_SERVERS) are left out of cart_comm
+    MPI_Comm io_comm;                   // I/O servers (MPI_COMM_NULL on compute ranks)
+    int io_server;                      // world rank of our I/O server (MPI_PROC_NULL: none)
+    int num_io_servers;
+    int *io_clients;                    // world ranks of the compute ranks we serve
+    int num_io_clients;
 } MPITopology;
 
 // Simulation parameters
@@ -99,6 +146,13 @@ typedef struct {
     double latitude;
     int boundary_type;
     double f;
+    int overlap;    // compute the interior while the halos are in flight
+    int weighted;       // bathymetry-weighted decomposition
+    double dry_depth;   // depth at or below which a cell is dry (m)
+    double dry_cost;    // cost of a dry cell relative to a wet one
+    int rebalance;      // steps between load rebalancing (0: off)
+    int output;         // output_mode_t
+    int io_raw;         // I/O servers write raw .dat files instead of VTK
     
     char input_h_filename[MAX_PATH_LENGTH];
     char output_eta_filename[MAX_PATH_LENGTH];
@@ -106,12 +160,150 @@ typedef struct {
     char output_v_filename[MAX_PATH_LENGTH];
 } parameters_t;
 
+// Field arena: one page-aligned mapping holding every field except the
+// bathymetry, its pages placed by a parallel first touch
+typedef struct {
+    char *base;         // start of the mapping
+    size_t size;        // mapped bytes
+    char *start;        // first field (huge page aligned)
+    size_t used;        // bytes spanned by the fields
+    int huge_pages;     // huge pages requested through madvise
+} arena_t;
+
+// Halo exchange backends (SHALLOW_HALO)
+typedef enum {
+    HALO_P2P = 0,        // persistent point-to-point requests
+    HALO_NEIGHBOR = 1,   // MPI_Ineighbor_alltoallw on the Cartesian communicator
+    HALO_RMA = 2,        // MPI_Put into the neighbours' ghosts, PSCW epochs
+    HALO_SHM = 3,        // copies from node-local neighbours' shared memory
+    HALO_BACKEND_NUM = 4
+} halo_backend_t;
+
+// Snapshot writers (SHALLOW_OUTPUT)
+typedef enum {
+    OUTPUT_GATHER = 0,   // MPI_Gatherv to rank 0, which writes the file
+    OUTPUT_MPIIO = 1,    // every rank writes its block, MPI_File_write_at_all
+    OUTPUT_PIECES = 2,   // one .vti piece per rank, rank 0 writes the .pvti master
+    OUTPUT_MODE_NUM = 3
+} output_mode_t;
+
+// Node-shared memory for SHALLOW_HALO=shm: the fields of the ranks of a
+// node live in one MPI_Win_allocate_shared window, next to their counters
+typedef struct {
+    MPI_Win win;        // field storage (MPI_WIN_NULL: private memory)
+    char *base;         // this rank's segment
+    MPI_Win flags_win;  // ready/done counters of every rank
+    long *flags;        // this rank's counters
+} shared_t;
+
+// Persistent halo exchange: each side is a line of the field storage
+// described by a datatype; requests are built once with
+// MPI_Send_init/MPI_Recv_init and restarted every step
+typedef struct {
+    double *send_buf[NEIGHBOR_NUM];      // first element sent (NULL: none)
+    double *recv_buf[NEIGHBOR_NUM];      // first element received (NULL: none)
+    MPI_Datatype type[NEIGHBOR_NUM];     // column (vector) or row (contiguous)
+    int length[NEIGHBOR_NUM];            // points per line
+    int pitch[NEIGHBOR_NUM];             // row pitch of the line's field
+    int send_tag[NEIGHBOR_NUM];
+    int recv_tag[NEIGHBOR_NUM];
+    MPI_Request requests[2 * NEIGHBOR_NUM];
+    int count;               // active requests (sides with a neighbour)
+    int peer[NEIGHBOR_NUM];  // neighbour ranks (MPI_PROC_NULL at the walls)
+    int backend;             // halo_backend_t
+    MPI_Comm comm;           // Cartesian communicator
+    // MPI_Ineighbor_alltoallw arguments, in Cartesian neighbour order and
+    // relative to MPI_BOTTOM (absent lines have a zero count)
+    int send_count[NEIGHBOR_NUM], recv_count[NEIGHBOR_NUM];
+    MPI_Aint send_disp[NEIGHBOR_NUM], recv_disp[NEIGHBOR_NUM];
+    MPI_Datatype send_type[NEIGHBOR_NUM], recv_type[NEIGHBOR_NUM];
+    MPI_Request collective;  // pending neighbourhood collective
+    // One-sided backend: the receiving fields are attached to a dynamic
+    // window, neighbours put their lines at the addresses we sent them
+    data_t *fields[2];                      // fields holding the received lines
+    MPI_Win win;
+    MPI_Group post_group;                   // neighbours that put into us
+    MPI_Group start_group;                  // neighbours we put into
+    MPI_Aint target_disp[NEIGHBOR_NUM];     // address of the neighbour's ghost line
+    MPI_Datatype target_type[NEIGHBOR_NUM]; // line with the neighbour's pitch
+    // Shared-memory backend: node-local lines are copied from the
+    // neighbour's segment, off-node sides keep persistent requests
+    MPI_Request remote[2 * NEIGHBOR_NUM];
+    int remote_count;
+    const double *peer_line[NEIGHBOR_NUM];  // neighbour's line we copy
+    int peer_pitch[NEIGHBOR_NUM];
+    volatile long *peer_flags[NEIGHBOR_NUM]; // neighbour's ready/done counters
+    volatile long *flags;                    // our ready/done counters
+    long epoch;                              // rounds run with this backend
+    data_t *data;            // field whose wall ghosts are filled (NULL for faces)
+    double time;             // seconds spent starting and waiting
+    double started;          // end of the last start_halo
+    double overlap;          // seconds of computation between start and wait
+} halo_t;
+
+// Communication-avoiding deep halo: eta, u and v are exchanged depth cells
+// deep once every depth steps, and the ranks recompute the overlap that
+// shrinks by one cell per step. Columns go first, then rows including the
+// received columns, so the corners come from the diagonal neighbours
+#define DEEP_FIELDS_MAX 3
+typedef struct {
+    int depth;                            // ghost cells exchanged (1: regular halos)
+    int step;                             // steps since the last exchange
+    MPI_Datatype send_type[NEIGHBOR_NUM]; // lines of every field (absolute addresses)
+    MPI_Datatype recv_type[NEIGHBOR_NUM];
+    MPI_Request requests[2][4];           // columns (left, right) then rows (down, up)
+    int count[2];
+    double time;                          // seconds spent exchanging
+    double messages;                      // messages sent per time step (any depth)
+    double bytes;                         // bytes sent per time step (any depth)
+} deep_halo_t;
+
+// Dynamic load balance: the computation time of each rank is measured
+// over a window of steps, and the block cuts move to even it out
+typedef struct {
+    double start;       // start of the step being measured
+    double comm;        // halo seconds at the start of the step
+    double compute;     // seconds of computation in the current window
+    int migrations;     // windows that moved cells
+    long long moved;    // cells moved to another rank, over the run
+    double time;        // seconds spent rebalancing
+} balance_t;
+
+// Points of a field the kernels update, row by row, as [start, end) column
+// runs: land (SHALLOW_DECOMP=weighted) is left out. Without runs (first is
+// NULL) every point is updated
+typedef struct {
+    int row0;           // first row covered (a ghost row)
+    int num_rows;
+    int *first;         // first run of every row (num_rows + 1 entries)
+    int *runs;          // start and end column of every run
+} wet_runs_t;
+
+// Snapshots handed to an I/O server: the block is copied into the free
+// buffer and sent without waiting, while the other one may still be in flight
+typedef struct {
+    double *buf[2];          // IO_BLOCK_HEADER values, then the block's interior
+    size_t size[2];          // doubles allocated per buffer
+    MPI_Request request[2];
+    int next;                // buffer to fill next
+} io_client_t;
+
 typedef struct {
     data_t *u;
     data_t *v;
     data_t *eta;
     data_t *h;
     data_t *h_interp;
+    data_t *hu;    // u-face depth times dt/dx ((nx+1) x ny)
+    data_t *hv;    // v-face depth times dt/dy (nx x (ny+1))
+    halo_t halo_faces; // east u-faces and north v-faces, before update_eta
+    halo_t halo_eta;   // eta ghosts, before update_velocities
+    shared_t shared;   // node-shared field storage (SHALLOW_HALO=shm)
+    deep_halo_t deep;  // eta, u and v every depth steps (SHALLOW_HALO_DEPTH)
+    balance_t balance; // computation time per window (SHALLOW_REBALANCE)
+    wet_runs_t wet_eta, wet_u, wet_v; // points updated by the kernels
+    io_client_t io;    // snapshots in flight to our I/O server
+    arena_t arena; // storage of every field except h
 } all_data_t;
 
 typedef struct {
@@ -129,6 +321,19 @@ typedef struct {
 } gather_data_t;
 
 
+/**
+ * Row kernels selected at startup by init_simd
+ * eta_row reads one u-face past the segment, gradient_row serves u and v
+ */
+typedef void (*eta_row_fn)(double *eta, const double *hu, const double *u,
+                           const double *hv, const double *hv_n,
+                           const double *v, const double *v_n, int n);
+typedef void (*gradient_row_fn)(double *vel, const double *eta, const double *eta_b,
+                                double damping, double c, int n);
+
+extern eta_row_fn eta_row;
+extern gradient_row_fn gradient_row;
+
 /*===========================================================
  * FUNCTION PROTOTYPES
  ===========================================================*/
@@ -139,8 +344,19 @@ int initialize_gather_structures(const MPITopology *topo,
                                  gather_data_t *gdata,
                                  int nx, int ny, 
                                  double dx, double dy);
+int decompose_domain(const parameters_t *param, const data_t *h,
+                     int nx_glob, int ny_glob, MPITopology *topo);
+void report_load(const parameters_t param, const all_data_t *all_data, MPITopology *topo);
+void start_balance_step(all_data_t *all_data);
+void end_balance_step(int timestep, int nt, int nx_glob, int ny_glob,
+                      const parameters_t param,
+                      all_data_t *all_data,
+                      gather_data_t *gdata,
+                      MPITopology *topo);
+void report_balance(const all_data_t *all_data, MPITopology *topo);
 
 // Simulation Core Functions
+const char *init_simd(void);
 void check_cfl(parameters_t param, all_data_t *all_data, MPITopology *topo);
 void update_velocities(const parameters_t param,
                        all_data_t *all_data,
@@ -151,15 +367,37 @@ void update_eta(const parameters_t param,
                 gather_data_t *gdata,
                 MPITopology *topo);
 
+// Halo Exchange
+int shared_halo_requested(void);
+int init_shared_window(shared_t *shared, size_t bytes, MPITopology *topo);
+void free_shared_window(shared_t *shared);
+void clear_halo(halo_t *halo);
+int init_halo(halo_t *halo, data_t *data, int tag, MPITopology *topo);
+int init_face_halo(halo_t *halo, data_t *u, data_t *v, int tag, MPITopology *topo);
+void start_halo(halo_t *halo);
+void wait_halo(halo_t *halo, const MPITopology *topo);
+void free_halo(halo_t *halo);
+void select_halo_backend(all_data_t *all_data, MPITopology *topo);
+void clear_deep_halo(deep_halo_t *deep);
+int init_deep_halo(deep_halo_t *deep, data_t **fields, int num_fields, int nx, int ny,
+                   int depth, int tag, MPITopology *topo);
+void exchange_deep_halo(deep_halo_t *deep);
+void free_deep_halo(deep_halo_t *deep);
+void select_halo_depth(const parameters_t param, all_data_t *all_data, MPITopology *topo);
+void deep_halo_step(int timestep, int nx_glob, int ny_glob,
+                    const parameters_t param,
+                    all_data_t *all_data,
+                    gather_data_t *gdata,
+                    MPITopology *topo);
+void report_halo(const all_data_t *all_data, int nt, MPITopology *topo);
+int build_wet_runs(all_data_t *all_data);
+void free_wet_runs(all_data_t *all_data);
+
 // Interpolation and Preprocessing
 double interpolate_data(const data_t *data, 
-                        int nx_glob, 
-                        int ny_glob, 
                         double x, 
                         double y);
 void interp_bathy(const parameters_t param, 
-                  int nx_glob, 
-                  int ny_glob, 
                   all_data_t *all_data, 
                   gather_data_t *gdata, 
                   MPITopology *topo);
@@ -171,10 +409,12 @@ void apply_source(int timestep,
                   const parameters_t param, 
                   all_data_t *all_data, 
                   gather_data_t *gdata, 
-                  MPITopology *topo);
+                  MPITopology *topo,
+                  int ext);
 void boundary_conditions(const parameters_t param, 
                          all_data_t *all_data, 
-                         MPITopology *topo);
+                         MPITopology *topo,
+                         int ext);
 
 // Data Gathering and Output
 void gather_and_assemble_data(const parameters_t param,
@@ -189,14 +429,32 @@ void gather_and_assemble_data(const parameters_t param,
 int read_parameters(parameters_t *param, const char *filename);
 void print_parameters(const parameters_t *param);
 int read_data(data_t *data, const char *filename);
+int read_bathy_header(data_t *h, const char *filename, MPITopology *topo);
+int read_bathy_patch(data_t *h, const char *filename, double x_min, double x_max,
+                     double y_min, double y_max, MPITopology *topo);
 int write_data(const data_t *data, const char *filename, int step);
 int write_data_vtk(const data_t *data, const char *name, const char *filename, int step);
-int write_manifest_vtk(const char *filename, double dt, int nt, int sampling_rate);
+int write_data_vtk_mpiio(const data_t *data, const char *name, const char *filename, int step,
+                         int nx_glob, int ny_glob, MPITopology *topo);
+int write_data_vtk_pieces(const data_t *data, const char *name, const char *filename, int step,
+                          int nx_glob, int ny_glob, MPITopology *topo);
+int write_manifest_vtk(const char *filename, double dt, int nt, int sampling_rate,
+                       const char *extension);
+int send_io_block(const data_t *data, int step, int nx_glob, int ny_glob, io_client_t *io,
+                  MPITopology *topo);
+void flush_io_blocks(io_client_t *io);
+int run_io_server(const parameters_t *param, const char *name, MPITopology *topo);
 int init_data(data_t *data, int nx, int ny, double dx, double dy, double val);
 void free_data(data_t *data);
+void halo_extent(const MPITopology *topo, int ext, int extent[NEIGHBOR_NUM]);
+void fill_ghosts(data_t *data, const MPITopology *topo, int ext);
 all_data_t* init_all_data(const parameters_t *param, MPITopology *topo);
+int resize_all_data(all_data_t *all_data, const parameters_t *param, MPITopology *topo);
+int init_arena(all_data_t *all_data, int nx, int ny, double dx, double dy, MPITopology *topo);
+void report_placement(const arena_t *arena, MPITopology *topo);
 void print_progress(int current_step, int total_steps, double start_time, MPITopology *top);
 void free_all_data(all_data_t* all_data);
+void free_gather_structures(gather_data_t *gdata, const MPITopology *topo);
 void cleanup(parameters_t *param, MPITopology *topo, gather_data_t *gdata);
 void cleanup_mpi_topology(MPITopology *topo);
 
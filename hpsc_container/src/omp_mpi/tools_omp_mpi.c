@@ -5,11 +5,16 @@
  ===========================================================*/
 
 #include "shallow_omp_mpi.h"
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 
 /*===========================================================
  * FILE I/O AND PARAMETERS FUNCTIONS
  ===========================================================*/
 
+static const char *output_mode_names[OUTPUT_MODE_NUM] = {"gather", "mpiio", "pieces"};
+
 /**
  * Reads simulation parameters from configuration file
  * 
@@ -87,6 +92,40 @@ int read_parameters(parameters_t *param, const char *filename) {
         return 1;
     }
 
+    // Split-phase updates unless SHALLOW_OVERLAP=0
+    const char *overlap = getenv(OVERLAP_ENV);
+    param->overlap = (overlap && *overlap) ? atoi(overlap) != 0 : 1;
+
+    // Uniform blocks unless SHALLOW_DECOMP=weighted (land is then skipped by
+    // the kernels, so a dry cell costs a fraction of a wet one)
+    const char *decomp = getenv(DECOMP_ENV);
+    const char *dry_depth = getenv(DRY_DEPTH_ENV);
+    const char *dry_cost = getenv(DRY_COST_ENV);
+    param->weighted = decomp && !strcmp(decomp, "weighted");
+    param->dry_depth = (dry_depth && *dry_depth) ? atof(dry_depth) : 0.0;
+    param->dry_cost = (dry_cost && *dry_cost) ? atof(dry_cost) : DEFAULT_DRY_COST;
+
+    // Static blocks unless SHALLOW_REBALANCE gives a window of steps
+    const char *rebalance = getenv(REBALANCE_ENV);
+    param->rebalance = (rebalance && *rebalance) ? atoi(rebalance) : 0;
+    if (param->rebalance < 0) param->rebalance = 0;
+
+    // Snapshots gathered on rank 0 unless SHALLOW_OUTPUT names another writer
+    const char *output = getenv(OUTPUT_ENV);
+    param->output = OUTPUT_GATHER;
+    if (output && *output) {
+        int found = 0;
+        for (int m = 0; m < OUTPUT_MODE_NUM; m++)
+            if (!strcmp(output, output_mode_names[m])) param->output = m, found = 1;
+        if (!found)
+            printf("Warning: unknown output mode '%s', using %s\n", output,
+                   output_mode_names[OUTPUT_GATHER]);
+    }
+
+    // I/O servers (SHALLOW_IO_SERVERS) write VTK images unless asked for raw files
+    const char *io_format = getenv(IO_FORMAT_ENV);
+    param->io_raw = io_format && !strcmp(io_format, "raw");
+
     return 0;
 }
 
@@ -108,6 +147,11 @@ void print_parameters(const parameters_t *param) {
     printf(" - output elevation (eta) file: '%s'\n", param->output_eta_filename);
     printf(" - output velocity (u, v) files: '%s', '%s'\n",
            param->output_u_filename, param->output_v_filename);
+    printf(" - halo overlap: %s\n", param->overlap ? "on" : "off");
+    printf(" - decomposition: %s\n", param->weighted ? "weighted" : "uniform");
+    if (param->rebalance) printf(" - rebalancing: every %d steps\n", param->rebalance);
+    else printf(" - rebalancing: off\n");
+    printf(" - output: %s\n", output_mode_names[param->output]);
 }
 
 /*===========================================================
@@ -139,14 +183,12 @@ int read_data(data_t *data, const char *filename) {
         if(N <= 0) {
             printf("Error: Invalid number of data points %d\n", N);
             ok = 0;
+        } else if(init_data(data, data->nx, data->ny, data->dx, data->dy, 0.0)) {
+            printf("Error: Could not allocate data (%d doubles)\n", N);
+            ok = 0;
         } else {
-            data->vals = (double*)malloc(N * sizeof(double));
-            if(!data->vals) {
-                printf("Error: Could not allocate data (%d doubles)\n", N);
-                ok = 0;
-            } else {
-                ok = (fread(data->vals, sizeof(double), N, fp) == N);
-            }
+            for(int j = 0; ok && j < data->ny; j++)
+                ok = (fread(&GET(data, 0, j), sizeof(double), data->nx, fp) == (size_t)data->nx);
         }
     }
     
@@ -158,6 +200,133 @@ int read_data(data_t *data, const char *filename) {
     return 0;
 }
 
+/**
+ * Reads the dimensions and spacing of a bathymetry file on every rank,
+ * without its values (collective)
+ * 
+ * @param h Bathymetry to set up (no storage)
+ * @param filename Input file path
+ * @param topo MPI topology information
+ * @return 0 on success, 1 on failure
+ */
+int read_bathy_header(data_t *h, const char *filename, MPITopology *topo) {
+    MPI_File fh;
+    char header[BATHY_HEADER_BYTES];
+    if (MPI_File_open(topo->cart_comm, filename, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS) {
+        printf("Error: Could not open input data file '%s'\n", filename);
+        return 1;
+    }
+    int err = MPI_File_read_at_all(fh, 0, header, BATHY_HEADER_BYTES, MPI_BYTE, MPI_STATUS_IGNORE);
+    MPI_File_close(&fh);
+
+    memcpy(&h->nx, header, sizeof(int));
+    memcpy(&h->ny, header + sizeof(int), sizeof(int));
+    memcpy(&h->dx, header + 2 * sizeof(int), sizeof(double));
+    memcpy(&h->dy, header + 2 * sizeof(int) + sizeof(double), sizeof(double));
+    h->storage = h->vals = NULL;
+    h->ghost = h->pitch = 0;
+    h->x0 = h->y0 = 0;
+    if (err != MPI_SUCCESS || h->nx <= 0 || h->ny <= 0) {
+        printf("Error reading input data file '%s'\n", filename);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Reads the bathymetry points a rank interpolates between, with one point
+ * of margin, for samples in [x_min, x_max] x [y_min, y_max] (collective)
+ * The file view is the subarray of the patch and the memory type the
+ * interior of the padded layout, so MPI_File_read_at_all places the rows
+ * directly; per-rank reads and memory follow the patch, not the file
+ * 
+ * @param h Bathymetry with its header (storage allocated, free after use)
+ * @param filename Input file path
+ * @param x_min, x_max Range of the sample abscissas (m)
+ * @param y_min, y_max Range of the sample ordinates (m)
+ * @param topo MPI topology information
+ * @return 0 on success, 1 on failure
+ */
+int read_bathy_patch(data_t *h, const char *filename, double x_min, double x_max,
+                     double y_min, double y_max, MPITopology *topo) {
+    // interpolate_data reads points i and i + 1 around each sample
+    const int n[2] = {h->nx, h->ny};
+    const double d[2] = {h->dx, h->dy};
+    const double lo_pos[2] = {x_min, y_min}, hi_pos[2] = {x_max, y_max};
+    int lo[2], hi[2];
+    for (int a = 0; a < 2; a++) {
+        lo[a] = (int)(lo_pos[a] / d[a]) - 1;
+        hi[a] = (int)(hi_pos[a] / d[a]) + 3;
+        if (lo[a] > n[a] - 1) lo[a] = n[a] - 1;
+        if (lo[a] < 0) lo[a] = 0;
+        if (hi[a] > n[a]) hi[a] = n[a];
+        if (hi[a] <= lo[a]) hi[a] = lo[a] + 1;
+    }
+
+    int nx = h->nx, ny = h->ny;
+    if (init_data(h, hi[0] - lo[0], hi[1] - lo[1], h->dx, h->dy, 0.0)) {
+        fprintf(stderr, "Rank %d: Could not allocate the bathymetry patch\n", topo->cart_rank);
+        return 1;
+    }
+    h->nx = nx;
+    h->ny = ny;
+    h->x0 = lo[0];
+    h->y0 = lo[1];
+
+    int sizes[2] = {ny, nx};
+    int subsizes[2] = {hi[1] - lo[1], hi[0] - lo[0]};
+    int starts[2] = {lo[1], lo[0]};
+    MPI_Datatype file_type, mem_type;
+    MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C, MPI_DOUBLE, &file_type);
+    MPI_Type_vector(subsizes[0], subsizes[1], h->pitch, MPI_DOUBLE, &mem_type);
+    MPI_Type_commit(&file_type);
+    MPI_Type_commit(&mem_type);
+
+    MPI_File fh;
+    int err = MPI_File_open(topo->cart_comm, filename, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh);
+    if (err == MPI_SUCCESS) {
+        err = MPI_File_set_view(fh, BATHY_HEADER_BYTES, MPI_DOUBLE, file_type, "native", MPI_INFO_NULL);
+        if (err == MPI_SUCCESS)
+            err = MPI_File_read_at_all(fh, 0, h->vals, 1, mem_type, MPI_STATUS_IGNORE);
+        MPI_File_close(&fh);
+    }
+    MPI_Type_free(&file_type);
+    MPI_Type_free(&mem_type);
+
+    if (err != MPI_SUCCESS) {
+        fprintf(stderr, "Rank %d: Error reading input data file '%s'\n", topo->cart_rank, filename);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Sets the dimensions and padded layout of a field without allocating it
+ * Interior rows start on a FIELD_ALIGN boundary: the west ghosts are
+ * padded up to the alignment and the pitch is a whole number of lines
+ * 
+ * @param data Data structure to set up
+ * @param nx, ny Grid dimensions
+ * @param dx, dy Grid spacing
+ * @param offset Set to the position of (0,0) in the storage (elements)
+ * @return Number of elements of the storage
+ */
+static size_t field_layout(data_t *data, int nx, int ny, double dx, double dy, size_t *offset) {
+    data->nx = nx;
+    data->ny = ny;
+    data->dx = dx;
+    data->dy = dy;
+    data->x0 = data->y0 = 0;
+
+    int align = FIELD_ALIGN / sizeof(double);
+    int pad = (GHOST_WIDTH + align - 1) / align * align;
+    data->ghost = GHOST_WIDTH;
+    data->pitch = (pad + nx + GHOST_WIDTH + align - 1) / align * align;
+
+    *offset = (size_t)GHOST_WIDTH * data->pitch + pad;
+    return (size_t)data->pitch * (ny + 2 * GHOST_WIDTH);
+}
+
 /**
  * Initializes data structure with given dimensions and value
  * 
@@ -170,21 +339,60 @@ int read_data(data_t *data, const char *filename) {
 int init_data(data_t *data, int nx, int ny, double dx, double dy, double val) {
     if (data == NULL) return 1;
 
-    data->nx = nx;
-    data->ny = ny;
-    data->dx = dx;
-    data->dy = dy;
-
-    data->vals = (double*)calloc(nx*ny, sizeof(double));
-    if (data->vals == NULL) return 1;
+    size_t offset;
+    size_t count = field_layout(data, nx, ny, dx, dy, &offset);
+    if (posix_memalign((void **)&data->storage, FIELD_ALIGN, count * sizeof(double))) {
+        data->storage = data->vals = NULL;
+        return 1;
+    }
+    data->vals = data->storage + offset;
 
-    for (int i = 0; i < nx*ny; i++) {
-        data->vals[i] = val;
+    for (size_t k = 0; k < count; k++) {
+        data->storage[k] = val;
     }
 
     return 0;
 }
 
+/**
+ * Extends a region by ext cells on the sides with a neighbour (the deep
+ * halo overlap); the domain walls are never crossed
+ * 
+ * @param topo MPI topology information
+ * @param ext Cells added past the interior towards each neighbour
+ * @param extent Set to the extension of each side
+ */
+void halo_extent(const MPITopology *topo, int ext, int extent[NEIGHBOR_NUM]) {
+    for (int side = 0; side < NEIGHBOR_NUM; side++)
+        extent[side] = (topo->neighbors[side] != MPI_PROC_NULL) ? ext : 0;
+}
+
+/**
+ * Copies the edge values of a field into its ghost cells on the sides
+ * without a neighbour (zero normal gradient at the domain boundary)
+ * 
+ * @param data Data structure to update
+ * @param topo MPI topology information
+ * @param ext Rows/columns past the interior covered along the walls
+ */
+void fill_ghosts(data_t *data, const MPITopology *topo, int ext) {
+    int nx = data->nx;
+    int ny = data->ny;
+    int e[NEIGHBOR_NUM];
+    halo_extent(topo, ext, e);
+
+    for (int g = 1; g <= data->ghost; g++) {
+        if (topo->neighbors[LEFT] == MPI_PROC_NULL)
+            for (int j = -e[DOWN]; j < ny + e[UP]; j++) SET(data, -g, j, GET(data, 0, j));
+        if (topo->neighbors[RIGHT] == MPI_PROC_NULL)
+            for (int j = -e[DOWN]; j < ny + e[UP]; j++) SET(data, nx - 1 + g, j, GET(data, nx - 1, j));
+        if (topo->neighbors[DOWN] == MPI_PROC_NULL)
+            for (int i = -e[LEFT]; i < nx + e[RIGHT]; i++) SET(data, i, -g, GET(data, i, 0));
+        if (topo->neighbors[UP] == MPI_PROC_NULL)
+            for (int i = -e[LEFT]; i < nx + e[RIGHT]; i++) SET(data, i, ny - 1 + g, GET(data, i, ny - 1));
+    }
+}
+
 /*===========================================================
  * OUTPUT FUNCTIONS
  ===========================================================*/
@@ -214,8 +422,8 @@ int write_data(const data_t *data, const char *filename, int step) {
     if(ok) ok = (fwrite(&data->dx, sizeof(double), 1, fp) == 1);
     if(ok) ok = (fwrite(&data->dy, sizeof(double), 1, fp) == 1);
     
-    int N = data->nx * data->ny;
-    if(ok) ok = (fwrite(data->vals, sizeof(double), N, fp) == N);
+    for(int j = 0; ok && j < data->ny; j++)
+        ok = (fwrite(&GET(data, 0, j), sizeof(double), data->nx, fp) == (size_t)data->nx);
     
     fclose(fp);
     if(!ok) {
@@ -225,6 +433,54 @@ int write_data(const data_t *data, const char *filename, int step) {
     return 0;
 }
 
+/**
+ * Builds the path of a VTK snapshot
+ * 
+ * @param out Path buffer (MAX_PATH_LENGTH)
+ * @param filename Base filename
+ * @param step Time step (-1 for none)
+ * @param extension File extension (vti, pvti, dat)
+ */
+static void vtk_path(char *out, const char *filename, int step, const char *extension) {
+    char suffix[16] = "";
+    if (step >= 0) snprintf(suffix, sizeof(suffix), "_%d", step);
+    if (snprintf(out, MAX_PATH_LENGTH, "../../output/omp_mpi_%s%s.%s",
+                 filename, suffix, extension) >= MAX_PATH_LENGTH)
+        fprintf(stderr, "Warning: output path truncated to '%s'\n", out);
+}
+
+/**
+ * Formats the XML header of a single-piece VTK image with one Float64
+ * array, up to the appended data marker
+ * 
+ * @param header Buffer (VTK_HEADER_MAX bytes)
+ * @param nx, ny Image dimensions
+ * @param dx, dy Grid spacing
+ * @param name Data array name
+ * @return Length of the header (bytes)
+ */
+static int vtk_header(char *header, int nx, int ny, double dx, double dy, const char *name) {
+    return snprintf(header, VTK_HEADER_MAX,
+                    "<?xml version=\"1.0\"?>\n"
+                    "<VTKFile type=\"ImageData\" version=\"1.0\" "
+                    "byte_order=\"LittleEndian\" header_type=\"UInt64\">\n"
+                    "  <ImageData WholeExtent=\"0 %d 0 %d 0 0\" "
+                    "Spacing=\"%lf %lf 0.0\">\n"
+                    "    <Piece Extent=\"0 %d 0 %d 0 0\">\n"
+                    "      <PointData Scalars=\"scalar_data\">\n"
+                    "        <DataArray type=\"Float64\" Name=\"%s\" "
+                    "format=\"appended\" offset=\"0\">\n"
+                    "        </DataArray>\n"
+                    "      </PointData>\n"
+                    "    </Piece>\n"
+                    "  </ImageData>\n"
+                    "  <AppendedData encoding=\"raw\">\n_",
+                    nx - 1, ny - 1, dx, dy, nx - 1, ny - 1, name);
+}
+
+// Closes the appended data of a VTK image
+static const char vtk_footer[] = "  </AppendedData>\n</VTKFile>\n";
+
 /**
  * Writes data to VTK image format
  * 
@@ -237,10 +493,7 @@ int write_data(const data_t *data, const char *filename, int step) {
 int write_data_vtk(const data_t *data, const char *name,
                    const char *filename, int step) {
     char out[MAX_PATH_LENGTH];
-    sprintf(out, "../../output/omp_mpi_%s", filename);
-    if (step >= 0) sprintf(out + strlen(out), "_%d", step);
-    strcat(out, ".vti");
-
+    vtk_path(out, filename, step, "vti");
 
     FILE *fp = fopen(out, "wb");
     if(!fp) {
@@ -252,31 +505,185 @@ int write_data_vtk(const data_t *data, const char *name,
     uint64_t num_bytes = num_points * sizeof(double);
 
     // Write VTK XML header
+    char header[VTK_HEADER_MAX];
+    fwrite(header, 1, vtk_header(header, data->nx, data->ny, data->dx, data->dy, name), fp);
+
+    // Write binary data
+    fwrite(&num_bytes, sizeof(uint64_t), 1, fp);
+    for (int j = 0; j < data->ny; j++)
+        fwrite(&GET(data, 0, j), sizeof(double), data->nx, fp);
+
+    // Write footer
+    fputs(vtk_footer, fp);
+
+    fclose(fp);
+    return 0;
+}
+
+/**
+ * Writes one snapshot as a single VTK image from the blocks of every rank
+ * (collective). Every rank formats the same header; rank 0 writes it with
+ * the data size and the footer, and every rank writes its interior through
+ * a subarray file view with MPI_File_write_at_all. No rank holds the
+ * global field, and the file is byte-identical to write_data_vtk's
+ * 
+ * @param data Local field (this rank's block, see topo->splits)
+ * @param name Data array name
+ * @param filename Base filename
+ * @param step Time step (-1 for none)
+ * @param nx_glob, ny_glob Global grid dimensions
+ * @param topo MPI topology information
+ * @return 0 on success, 1 on failure
+ */
+int write_data_vtk_mpiio(const data_t *data, const char *name, const char *filename, int step,
+                         int nx_glob, int ny_glob, MPITopology *topo) {
+    char out[MAX_PATH_LENGTH];
+    vtk_path(out, filename, step, "vti");
+
+    char header[VTK_HEADER_MAX];
+    MPI_Offset header_bytes = vtk_header(header, nx_glob, ny_glob, data->dx, data->dy, name);
+    uint64_t num_bytes = (uint64_t)nx_glob * ny_glob * sizeof(double);
+    MPI_Offset data_start = header_bytes + sizeof(uint64_t);
+
+    MPI_File fh;
+    if (MPI_File_open(topo->cart_comm, out, MPI_MODE_CREATE | MPI_MODE_WRONLY,
+                      MPI_INFO_NULL, &fh) != MPI_SUCCESS) {
+        if (topo->cart_rank == 0) printf("Error: Could not open output VTK file '%s'\n", out);
+        return 1;
+    }
+    int err = MPI_File_set_size(fh, data_start + num_bytes + strlen(vtk_footer));
+
+    if (topo->cart_rank == 0) {
+        err |= MPI_File_write_at(fh, 0, header, header_bytes, MPI_CHAR, MPI_STATUS_IGNORE);
+        err |= MPI_File_write_at(fh, header_bytes, &num_bytes, sizeof(uint64_t), MPI_BYTE,
+                                 MPI_STATUS_IGNORE);
+        err |= MPI_File_write_at(fh, data_start + num_bytes, vtk_footer, strlen(vtk_footer),
+                                 MPI_CHAR, MPI_STATUS_IGNORE);
+    }
+
+    // Block of this rank in the global image, interior of the padded field
+    int sizes[2] = {ny_glob, nx_glob};
+    int subsizes[2] = {data->ny, data->nx};
+    int starts[2] = {topo->splits[1][topo->coords[1]], topo->splits[0][topo->coords[0]]};
+    MPI_Datatype file_type, mem_type;
+    MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C, MPI_DOUBLE, &file_type);
+    MPI_Type_vector(data->ny, data->nx, data->pitch, MPI_DOUBLE, &mem_type);
+    MPI_Type_commit(&file_type);
+    MPI_Type_commit(&mem_type);
+    err |= MPI_File_set_view(fh, data_start, MPI_DOUBLE, file_type, "native", MPI_INFO_NULL);
+    err |= MPI_File_write_at_all(fh, 0, data->vals, 1, mem_type, MPI_STATUS_IGNORE);
+    MPI_File_close(&fh);
+    MPI_Type_free(&file_type);
+    MPI_Type_free(&mem_type);
+
+    if (err != MPI_SUCCESS) {
+        fprintf(stderr, "Rank %d: Error writing output VTK file '%s'\n", topo->cart_rank, out);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Names the piece of a rank, relative to the output directory
+ * 
+ * @param out Name buffer (MAX_PATH_LENGTH)
+ * @param filename Base filename
+ * @param step Time step (-1 for none)
+ * @param rank Rank owning the piece
+ */
+static void vtk_piece_name(char *out, const char *filename, int step, int rank) {
+    char suffix[16] = "";
+    if (step >= 0) snprintf(suffix, sizeof(suffix), "_%d", step);
+    if (snprintf(out, MAX_PATH_LENGTH, "omp_mpi_%s%s_p%d.vti", filename, suffix, rank) >= MAX_PATH_LENGTH)
+        fprintf(stderr, "Warning: piece name truncated to '%s'\n", out);
+}
+
+/**
+ * Writes one snapshot as one VTK image piece per rank, plus the .pvti
+ * master on rank 0. Values are cell data over the block's cells, so
+ * neighbouring pieces only share their boundary points and need no halo
+ * values; the origin is shifted by half a cell to keep the cell centres
+ * on the points of write_data_vtk. Rank 0 takes the extent of every piece
+ * from topo->splits, so no data is communicated
+ * 
+ * @param data Local field (this rank's block, see topo->splits)
+ * @param name Data array name
+ * @param filename Base filename
+ * @param step Time step (-1 for none)
+ * @param nx_glob, ny_glob Global grid dimensions
+ * @param topo MPI topology information
+ * @return 0 on success, 1 on failure
+ */
+int write_data_vtk_pieces(const data_t *data, const char *name, const char *filename, int step,
+                          int nx_glob, int ny_glob, MPITopology *topo) {
+    char piece[MAX_PATH_LENGTH], out[MAX_PATH_LENGTH];
+    double origin_x = -0.5 * data->dx, origin_y = -0.5 * data->dy;
+    int x0 = topo->splits[0][topo->coords[0]], y0 = topo->splits[1][topo->coords[1]];
+
+    vtk_piece_name(piece, filename, step, topo->cart_rank);
+    if (snprintf(out, MAX_PATH_LENGTH, "../../output/%s", piece) >= MAX_PATH_LENGTH)
+        fprintf(stderr, "Warning: output path truncated to '%s'\n", out);
+    FILE *fp = fopen(out, "wb");
+    if(!fp) {
+        fprintf(stderr, "Rank %d: Could not open output VTK file '%s'\n", topo->cart_rank, out);
+        return 1;
+    }
+
+    uint64_t num_bytes = (uint64_t)data->nx * data->ny * sizeof(double);
     fprintf(fp, "<?xml version=\"1.0\"?>\n");
     fprintf(fp, "<VTKFile type=\"ImageData\" version=\"1.0\" "
             "byte_order=\"LittleEndian\" header_type=\"UInt64\">\n");
-    fprintf(fp, "  <ImageData WholeExtent=\"0 %d 0 %d 0 0\" "
-            "Spacing=\"%lf %lf 0.0\">\n",
-            data->nx - 1, data->ny - 1, data->dx, data->dy);
-    fprintf(fp, "    <Piece Extent=\"0 %d 0 %d 0 0\">\n",
-            data->nx - 1, data->ny - 1);
-    fprintf(fp, "      <PointData Scalars=\"scalar_data\">\n");
+    fprintf(fp, "  <ImageData WholeExtent=\"%d %d %d %d 0 0\" Origin=\"%lf %lf 0.0\" "
+            "Spacing=\"%lf %lf 0.0\">\n", x0, x0 + data->nx, y0, y0 + data->ny,
+            origin_x, origin_y, data->dx, data->dy);
+    fprintf(fp, "    <Piece Extent=\"%d %d %d %d 0 0\">\n",
+            x0, x0 + data->nx, y0, y0 + data->ny);
+    fprintf(fp, "      <CellData Scalars=\"scalar_data\">\n");
     fprintf(fp, "        <DataArray type=\"Float64\" Name=\"%s\" "
             "format=\"appended\" offset=\"0\">\n", name);
     fprintf(fp, "        </DataArray>\n");
-    fprintf(fp, "      </PointData>\n");
+    fprintf(fp, "      </CellData>\n");
     fprintf(fp, "    </Piece>\n");
     fprintf(fp, "  </ImageData>\n");
     fprintf(fp, "  <AppendedData encoding=\"raw\">\n_");
 
-    // Write binary data
-    fwrite(&num_bytes, sizeof(uint64_t), 1, fp);
-    fwrite(data->vals, sizeof(double), num_points, fp);
+    int ok = (fwrite(&num_bytes, sizeof(uint64_t), 1, fp) == 1);
+    for (int j = 0; ok && j < data->ny; j++)
+        ok = (fwrite(&GET(data, 0, j), sizeof(double), data->nx, fp) == (size_t)data->nx);
+    fputs(vtk_footer, fp);
+    fclose(fp);
+    if (!ok) {
+        fprintf(stderr, "Rank %d: Error writing output VTK file '%s'\n", topo->cart_rank, out);
+        return 1;
+    }
+    if (topo->cart_rank != 0) return 0;
 
-    // Write footer
-    fprintf(fp, "  </AppendedData>\n");
-    fprintf(fp, "</VTKFile>\n");
+    vtk_path(out, filename, step, "pvti");
+    fp = fopen(out, "wb");
+    if(!fp) {
+        printf("Error: Could not open output VTK file '%s'\n", out);
+        return 1;
+    }
 
+    fprintf(fp, "<?xml version=\"1.0\"?>\n");
+    fprintf(fp, "<VTKFile type=\"PImageData\" version=\"1.0\" "
+            "byte_order=\"LittleEndian\" header_type=\"UInt64\">\n");
+    fprintf(fp, "  <PImageData WholeExtent=\"0 %d 0 %d 0 0\" GhostLevel=\"0\" "
+            "Origin=\"%lf %lf 0.0\" Spacing=\"%lf %lf 0.0\">\n",
+            nx_glob, ny_glob, origin_x, origin_y, data->dx, data->dy);
+    fprintf(fp, "    <PCellData Scalars=\"scalar_data\">\n");
+    fprintf(fp, "      <PDataArray type=\"Float64\" Name=\"%s\"/>\n", name);
+    fprintf(fp, "    </PCellData>\n");
+    for (int rank = 0; rank < topo->nb_process; rank++) {
+        int coords[2];
+        MPI_Cart_coords(topo->cart_comm, rank, 2, coords);
+        vtk_piece_name(piece, filename, step, rank);
+        fprintf(fp, "    <Piece Extent=\"%d %d %d %d 0 0\" Source=\"%s\"/>\n",
+                topo->splits[0][coords[0]], topo->splits[0][coords[0] + 1],
+                topo->splits[1][coords[1]], topo->splits[1][coords[1] + 1], piece);
+    }
+    fprintf(fp, "  </PImageData>\n");
+    fprintf(fp, "</VTKFile>\n");
     fclose(fp);
     return 0;
 }
@@ -288,12 +695,14 @@ int write_data_vtk(const data_t *data, const char *name,
  * @param dt Time step size
  * @param nt Number of time steps
  * @param sampling_rate Output frequency
+ * @param extension Extension of the snapshots (vti, or pvti for the masters)
  * @return 0 on success, 1 on failure
  */
 int write_manifest_vtk(const char *filename, double dt, int nt,
-                       int sampling_rate) {
+                       int sampling_rate, const char *extension) {
     char out[MAX_PATH_LENGTH];
-    sprintf(out, "../../output/omp_mpi_%s.pvd", filename);
+    if (snprintf(out, MAX_PATH_LENGTH, "../../output/omp_mpi_%s.pvd", filename) >= MAX_PATH_LENGTH)
+        fprintf(stderr, "Warning: output path truncated to '%s'\n", out);
 
     FILE *fp = fopen(out, "wb");
     if(!fp) {
@@ -308,8 +717,8 @@ int write_manifest_vtk(const char *filename, double dt, int nt,
     for(int n = 0; n < nt; n++) {
         if(sampling_rate && !(n % sampling_rate)) {
             double t = n * dt;
-            fprintf(fp, "    <DataSet timestep=\"%g\" file='%s_%d.vti'/>\n",
-                    t, filename, n);
+            fprintf(fp, "    <DataSet timestep=\"%g\" file='omp_mpi_%s_%d.%s'/>\n",
+                    t, filename, n, extension);
         }
     }
     
@@ -319,10 +728,452 @@ int write_manifest_vtk(const char *filename, double dt, int nt,
     return 0;
 }
 
+/*===========================================================
+ * I/O SERVERS
+ ===========================================================*/
+
+/**
+ * Hands one snapshot of this rank's block over to its I/O server: the
+ * interior is copied into the free buffer of the pair and sent without
+ * waiting, so the compute rank only pays for the copy (and for a wait when
+ * both buffers are still in flight)
+ *
+ * @param data Local field (this rank's block, see topo->splits)
+ * @param step Time step of the snapshot
+ * @param nx_glob, ny_glob Global grid dimensions
+ * @param io Send buffers of this rank
+ * @param topo MPI topology information
+ * @return 0 on success, 1 on failure
+ */
+int send_io_block(const data_t *data, int step, int nx_glob, int ny_glob, io_client_t *io,
+                  MPITopology *topo) {
+    int b = io->next;
+    MPI_Wait(&io->request[b], MPI_STATUS_IGNORE);
+
+    // Blocks change size when the domain is rebalanced
+    size_t count = IO_BLOCK_HEADER + (size_t)data->nx * data->ny;
+    if (count > io->size[b]) {
+        free(io->buf[b]);
+        io->buf[b] = malloc(count * sizeof(double));
+        io->size[b] = io->buf[b] ? count : 0;
+        if (io->buf[b] == NULL) {
+            fprintf(stderr, "Rank %d: Failed to allocate an I/O buffer\n", topo->cart_rank);
+            return 1;
+        }
+    }
+
+    double *buf = io->buf[b];
+    buf[0] = step;
+    buf[1] = topo->splits[0][topo->coords[0]];
+    buf[2] = topo->splits[1][topo->coords[1]];
+    buf[3] = data->nx;
+    buf[4] = data->ny;
+    buf[5] = nx_glob;
+    buf[6] = ny_glob;
+    for (int j = 0; j < data->ny; j++)
+        memcpy(buf + IO_BLOCK_HEADER + (size_t)j * data->nx, &GET(data, 0, j),
+               data->nx * sizeof(double));
+
+    MPI_Isend(buf, (int)count, MPI_DOUBLE, topo->io_server, IO_TAG, MPI_COMM_WORLD,
+              &io->request[b]);
+    io->next = 1 - b;
+    return 0;
+}
+
+/**
+ * Waits until the I/O server has every snapshot sent so far
+ *
+ * @param io Send buffers of this rank
+ */
+void flush_io_blocks(io_client_t *io) {
+    MPI_Waitall(2, io->request, MPI_STATUSES_IGNORE);
+}
+
+// Row of a received block and its place in the global field
+typedef struct {
+    int offset;          // first point in the global field (row-major)
+    int length;
+    const double *vals;
+} io_row_t;
+
+static int compare_io_rows(const void *a, const void *b) {
+    int oa = ((const io_row_t *)a)->offset, ob = ((const io_row_t *)b)->offset;
+    return (oa > ob) - (oa < ob);
+}
+
+/**
+ * Writes one snapshot from the blocks received by every I/O server
+ * (collective over io_comm). The rows of each server are sorted by file
+ * position and written with one indexed file view; the first server writes
+ * the header (and the VTK footer), so a VTK snapshot is byte-identical to
+ * write_data_vtk's and a raw one follows write_data's layout
+ *
+ * @param rows Rows received by this server
+ * @param num_rows Number of rows
+ * @param packed Buffer for the rows in file order (all their points)
+ * @param param Simulation parameters
+ * @param name Data array name
+ * @param step Time step of the snapshot
+ * @param nx_glob, ny_glob Global grid dimensions
+ * @param topo MPI topology information
+ * @return 0 on success, 1 on failure
+ */
+static int write_io_snapshot(io_row_t *rows, int num_rows, double *packed,
+                             const parameters_t *param, const char *name, int step,
+                             int nx_glob, int ny_glob, MPITopology *topo) {
+    char out[MAX_PATH_LENGTH];
+    char header[VTK_HEADER_MAX];
+    MPI_Offset header_bytes;
+    const char *footer = param->io_raw ? "" : vtk_footer;
+    uint64_t num_bytes = (uint64_t)nx_glob * ny_glob * sizeof(double);
+
+    if (param->io_raw) {
+        vtk_path(out, param->output_eta_filename, step, "dat");
+        memcpy(header, &nx_glob, sizeof(int));
+        memcpy(header + sizeof(int), &ny_glob, sizeof(int));
+        memcpy(header + 2 * sizeof(int), &param->dx, sizeof(double));
+        memcpy(header + 2 * sizeof(int) + sizeof(double), &param->dy, sizeof(double));
+        header_bytes = BATHY_HEADER_BYTES;
+    } else {
+        vtk_path(out, param->output_eta_filename, step, "vti");
+        header_bytes = vtk_header(header, nx_glob, ny_glob, param->dx, param->dy, name);
+        memcpy(header + header_bytes, &num_bytes, sizeof(uint64_t));
+        header_bytes += sizeof(uint64_t);
+    }
+
+    int *lengths = malloc((num_rows + 1) * sizeof(int));
+    int *offsets = malloc((num_rows + 1) * sizeof(int));
+    if (!lengths || !offsets) {
+        fprintf(stderr, "I/O server: Failed to allocate the file view\n");
+        free(lengths);
+        free(offsets);
+        return 1;
+    }
+    qsort(rows, num_rows, sizeof(io_row_t), compare_io_rows);
+    int points = 0;
+    for (int r = 0; r < num_rows; r++) {
+        memcpy(packed + points, rows[r].vals, rows[r].length * sizeof(double));
+        lengths[r] = rows[r].length;
+        offsets[r] = rows[r].offset;
+        points += rows[r].length;
+    }
+
+    MPI_File fh;
+    if (MPI_File_open(topo->io_comm, out, MPI_MODE_CREATE | MPI_MODE_WRONLY,
+                      MPI_INFO_NULL, &fh) != MPI_SUCCESS) {
+        fprintf(stderr, "I/O server: Could not open output file '%s'\n", out);
+        free(lengths);
+        free(offsets);
+        return 1;
+    }
+    int err = MPI_File_set_size(fh, header_bytes + num_bytes + strlen(footer));
+
+    int io_rank;
+    MPI_Comm_rank(topo->io_comm, &io_rank);
+    if (io_rank == 0) {
+        err |= MPI_File_write_at(fh, 0, header, header_bytes, MPI_BYTE, MPI_STATUS_IGNORE);
+        err |= MPI_File_write_at(fh, header_bytes + num_bytes, footer, strlen(footer),
+                                 MPI_CHAR, MPI_STATUS_IGNORE);
+    }
+
+    MPI_Datatype file_type;
+    MPI_Type_indexed(num_rows, lengths, offsets, MPI_DOUBLE, &file_type);
+    MPI_Type_commit(&file_type);
+    err |= MPI_File_set_view(fh, header_bytes, MPI_DOUBLE, file_type, "native", MPI_INFO_NULL);
+    err |= MPI_File_write_at_all(fh, 0, packed, points, MPI_DOUBLE, MPI_STATUS_IGNORE);
+    MPI_File_close(&fh);
+    MPI_Type_free(&file_type);
+    free(lengths);
+    free(offsets);
+
+    if (err != MPI_SUCCESS) {
+        fprintf(stderr, "I/O server: Error writing output file '%s'\n", out);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Runs an I/O server: for every sampled step, receives the block of each
+ * of its compute ranks (in the order each one sent them) and writes the
+ * snapshot with the other servers, while the compute ranks keep stepping
+ *
+ * @param param Simulation parameters
+ * @param name Data array name
+ * @param topo MPI topology information (I/O server)
+ * @return 0 on success, 1 on failure
+ */
+int run_io_server(const parameters_t *param, const char *name, MPITopology *topo) {
+    int nt = floor(param->max_t / param->dt);
+    int num_clients = topo->num_io_clients;
+    double **blocks = calloc(num_clients + 1, sizeof(double *));
+    size_t *sizes = calloc(num_clients + 1, sizeof(size_t));
+    io_row_t *rows = NULL;
+    double *packed = NULL;
+    size_t max_rows = 0, max_points = 0;
+    double write_time = 0.0;
+    int snapshots = 0, err = (blocks == NULL || sizes == NULL);
+
+    for (int n = 0; n < nt && !err; n++) {
+        if (!param->sampling_rate || n % param->sampling_rate) continue;
+
+        size_t num_rows = 0, points = 0;
+        int dims[2] = {0, 0};
+        for (int c = 0; c < num_clients && !err; c++) {
+            MPI_Status status;
+            int count;
+            MPI_Probe(topo->io_clients[c], IO_TAG, MPI_COMM_WORLD, &status);
+            MPI_Get_count(&status, MPI_DOUBLE, &count);
+            if ((size_t)count > sizes[c]) {
+                free(blocks[c]);
+                blocks[c] = malloc(count * sizeof(double));
+                sizes[c] = blocks[c] ? count : 0;
+                if (blocks[c] == NULL) err = 1;
+            }
+            if (err) break;
+            MPI_Recv(blocks[c], count, MPI_DOUBLE, topo->io_clients[c], IO_TAG, MPI_COMM_WORLD,
+                     MPI_STATUS_IGNORE);
+            num_rows += (int)blocks[c][4];
+            points += count - IO_BLOCK_HEADER;
+            dims[0] = (int)blocks[c][5];
+            dims[1] = (int)blocks[c][6];
+        }
+
+        if (!err && (num_rows > max_rows || points > max_points)) {
+            free(rows);
+            free(packed);
+            max_rows = num_rows;
+            max_points = points;
+            rows = malloc((max_rows + 1) * sizeof(io_row_t));
+            packed = malloc((max_points + 1) * sizeof(double));
+            if (!rows || !packed) {
+                fprintf(stderr, "I/O server: Failed to allocate the snapshot buffers\n");
+                err = 1;
+            }
+        }
+
+        // Servers without a compute rank still take part in the write
+        MPI_Allreduce(MPI_IN_PLACE, dims, 2, MPI_INT, MPI_MAX, topo->io_comm);
+        MPI_Allreduce(MPI_IN_PLACE, &err, 1, MPI_INT, MPI_MAX, topo->io_comm);
+        if (err) break;
+
+        num_rows = 0;
+        for (int c = 0; c < num_clients; c++) {
+            const double *block = blocks[c];
+            int x0 = (int)block[1], y0 = (int)block[2];
+            int nx = (int)block[3], ny = (int)block[4];
+            for (int j = 0; j < ny; j++) {
+                rows[num_rows].offset = (y0 + j) * dims[0] + x0;
+                rows[num_rows].length = nx;
+                rows[num_rows].vals = block + IO_BLOCK_HEADER + (size_t)j * nx;
+                num_rows++;
+            }
+        }
+
+        double start = GET_TIME();
+        err = write_io_snapshot(rows, (int)num_rows, packed, param, name, n,
+                                dims[0], dims[1], topo);
+        write_time += GET_TIME() - start;
+        snapshots++;
+    }
+
+    for (int c = 0; c < num_clients && blocks; c++) free(blocks[c]);
+    free(blocks);
+    free(sizes);
+    free(rows);
+    free(packed);
+
+    double max_time;
+    int io_rank;
+    MPI_Reduce(&write_time, &max_time, 1, MPI_DOUBLE, MPI_MAX, 0, topo->io_comm);
+    MPI_Comm_rank(topo->io_comm, &io_rank);
+    if (io_rank == 0)
+        printf("I/O servers: %d snapshots written in %g seconds (slowest of %d servers)\n",
+               snapshots, max_time, topo->nb_process);
+    return err;
+}
+
 /*===========================================================
  * INITIALIZATION AND CLEANUP
  ===========================================================*/
 
+/**
+ * Carves the fields of this rank out of a single anonymous mapping
+ * Every field starts on a page boundary and is first written by the
+ * OpenMP threads with the static row split of the kernels, so each page
+ * lands on the NUMA node of the thread that updates it.
+ * SHALLOW_HUGE_PAGES=1 asks for transparent huge pages; with the
+ * shared-memory halo backend the mapping is this rank's segment of the
+ * node-shared window instead
+ * 
+ * @param all_data Simulation data (fields set up in place)
+ * @param nx, ny Local grid dimensions
+ * @param dx, dy Grid spacing
+ * @param topo MPI topology information
+ * @return 0 on success, 1 on failure
+ */
+int init_arena(all_data_t *all_data, int nx, int ny, double dx, double dy, MPITopology *topo) {
+    data_t *fields[] = {all_data->eta, all_data->u, all_data->v,
+                        all_data->h_interp, all_data->hu, all_data->hv};
+    const int dims[][2] = {{nx, ny}, {nx + 1, ny}, {nx, ny + 1},
+                           {nx, ny}, {nx + 1, ny}, {nx, ny + 1}};
+    const int num_fields = sizeof(fields) / sizeof(fields[0]);
+    arena_t *arena = &all_data->arena;
+
+    const char *env_huge = getenv(HUGE_PAGES_ENV);
+    arena->huge_pages = env_huge && atoi(env_huge);
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t granule = arena->huge_pages ? HUGE_PAGE_SIZE : page;
+
+    size_t offsets[6], starts[6], total = 0;
+    for (int f = 0; f < num_fields; f++) {
+        size_t count = field_layout(fields[f], dims[f][0], dims[f][1], dx, dy, &offsets[f]);
+        starts[f] = total;
+        total += (count * sizeof(double) + page - 1) / page * page;
+    }
+
+    // Over-map by one granule so the arena can start on a huge page boundary
+    arena->size = (total + granule - 1) / granule * granule + granule;
+    void *map = MAP_FAILED;
+    if (shared_halo_requested()) {
+        if (init_shared_window(&all_data->shared, arena->size, topo) == 0)
+            map = all_data->shared.base;
+    } else {
+        map = mmap(NULL, arena->size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    if (map == MAP_FAILED) {
+        arena->base = NULL;
+        for (int f = 0; f < num_fields; f++) fields[f]->storage = fields[f]->vals = NULL;
+        return 1;
+    }
+    arena->base = map;
+    arena->start = (char *)(((uintptr_t)map + granule - 1) / granule * granule);
+    arena->used = total;
+#ifdef MADV_HUGEPAGE
+    if (arena->huge_pages) madvise(arena->start, total, MADV_HUGEPAGE);
+#endif
+
+    for (int f = 0; f < num_fields; f++) {
+        fields[f]->storage = (double *)(arena->start + starts[f]);
+        fields[f]->vals = fields[f]->storage + offsets[f];
+    }
+
+    // First touch: row j of every field goes to the thread that owns row j
+    // in the kernels, the first and last rows also take the ghost rows
+    #pragma omp parallel for schedule(static)
+    for (int j = 0; j < ny; j++) {
+        for (int f = 0; f < num_fields; f++) {
+            data_t *data = fields[f];
+            int first = (j == 0) ? -data->ghost : j;
+            int last = (j == ny - 1) ? data->ny + data->ghost : j + 1;
+            memset(&GET(data, -data->ghost, first), 0,
+                   (size_t)(last - first) * data->pitch * sizeof(double));
+        }
+    }
+    return 0;
+}
+
+/**
+ * Prints how the pages of the field arenas are spread over NUMA nodes,
+ * summed over all ranks (node numbers are local to each host)
+ * Queries the kernel with move_pages (no migration), so it is only
+ * available on Linux
+ * 
+ * @param arena Field arena of this rank
+ * @param topo MPI topology
+ */
+void report_placement(const arena_t *arena, MPITopology *topo) {
+    // counts[MAX_NUMA_NODES] holds the untouched pages, -1 flags a failure
+    long counts[MAX_NUMA_NODES + 1] = {0};
+    long total[MAX_NUMA_NODES + 1];
+    int failed = 1;
+
+#ifdef SYS_move_pages
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t num_pages = arena->used / page;
+    void *pages[1024];
+    int status[1024];
+    failed = 0;
+    for (size_t p = 0; p < num_pages && !failed; p += 1024) {
+        int batch = (num_pages - p < 1024) ? (int)(num_pages - p) : 1024;
+        for (int k = 0; k < batch; k++) pages[k] = arena->start + (p + k) * page;
+        if (syscall(SYS_move_pages, 0, batch, pages, NULL, status, 0) != 0) {
+            failed = 1;
+            break;
+        }
+        for (int k = 0; k < batch; k++) {
+            if (status[k] >= 0 && status[k] < MAX_NUMA_NODES) counts[status[k]]++;
+            else counts[MAX_NUMA_NODES]++;
+        }
+    }
+#endif
+
+    int any_failed;
+    MPI_Reduce(&failed, &any_failed, 1, MPI_INT, MPI_MAX, 0, topo->cart_comm);
+    MPI_Reduce(counts, total, MAX_NUMA_NODES + 1, MPI_LONG, MPI_SUM, 0, topo->cart_comm);
+    if (topo->cart_rank != 0) return;
+
+    if (any_failed) {
+        printf(" - page placement: unavailable\n");
+        return;
+    }
+    long num_pages_all = 0;
+    for (int node = 0; node <= MAX_NUMA_NODES; node++) num_pages_all += total[node];
+    if (num_pages_all == 0) return;
+
+    printf(" - page placement of %ld pages (%s pages requested):", num_pages_all,
+           arena->huge_pages ? "huge" : "base");
+    for (int node = 0; node < MAX_NUMA_NODES; node++) {
+        if (total[node]) printf(" node %d: %.1f%%", node, 100.0 * total[node] / num_pages_all);
+    }
+    if (total[MAX_NUMA_NODES])
+        printf(" untouched: %.1f%%", 100.0 * total[MAX_NUMA_NODES] / num_pages_all);
+    printf("\n");
+}
+
+/**
+ * Allocates the fields of this rank's block (see decompose_domain) and
+ * the halo requests pointing into them
+ * 
+ * @param all_data Simulation data (fields set up in place)
+ * @param param Simulation parameters
+ * @param topo MPI topology information
+ * @return 0 on success, 1 on failure
+ */
+static int init_fields(all_data_t *all_data, const parameters_t *param, MPITopology *topo) {
+    int local_nx = topo->splits[0][topo->coords[0] + 1] - topo->splits[0][topo->coords[0]];
+    int local_ny = topo->splits[1][topo->coords[1] + 1] - topo->splits[1][topo->coords[1]];
+
+    // Allocate all field structures
+    all_data->eta = malloc(sizeof(data_t));
+    all_data->u = malloc(sizeof(data_t));
+    all_data->v = malloc(sizeof(data_t));
+    all_data->h_interp = malloc(sizeof(data_t));
+    all_data->hu = malloc(sizeof(data_t));
+    all_data->hv = malloc(sizeof(data_t));
+
+    if (!all_data->eta || !all_data->u || !all_data->v || !all_data->h_interp ||
+        !all_data->hu || !all_data->hv) {
+        fprintf(stderr, "Error: Failed to allocate data structures\n");
+        return 1;
+    }
+
+    // Every field lives in the arena, all starting at zero
+    if (init_arena(all_data, local_nx, local_ny, param->dx, param->dy, topo)) {
+        fprintf(stderr, "Error: Failed to initialize fields\n");
+        return 1;
+    }
+
+    // Halo requests live as long as the fields they point into
+    if (init_face_halo(&all_data->halo_faces, all_data->u, all_data->v, 101, topo) ||
+        init_halo(&all_data->halo_eta, all_data->eta, 200, topo)) {
+        return 1;
+    }
+
+    return 0;
+}
+
 /**
  * Initializes all simulation data structures
  * 
@@ -343,8 +1194,22 @@ all_data_t* init_all_data(const parameters_t *param, MPITopology *topo) {
     all_data->eta = NULL;
     all_data->h = NULL;
     all_data->h_interp = NULL;
+    all_data->hu = NULL;
+    all_data->hv = NULL;
+    clear_halo(&all_data->halo_faces);
+    clear_halo(&all_data->halo_eta);
+    all_data->shared.win = all_data->shared.flags_win = MPI_WIN_NULL;
+    clear_deep_halo(&all_data->deep);
+    all_data->arena.base = NULL;
+    memset(&all_data->balance, 0, sizeof(balance_t));
+    memset(&all_data->wet_eta, 0, sizeof(wet_runs_t));
+    memset(&all_data->wet_u, 0, sizeof(wet_runs_t));
+    memset(&all_data->wet_v, 0, sizeof(wet_runs_t));
+    memset(&all_data->io, 0, sizeof(io_client_t));
+    all_data->io.request[0] = all_data->io.request[1] = MPI_REQUEST_NULL;
 
-    // Allocate and read bathymetry data
+    // Bathymetry header only: each rank reads the points it interpolates
+    // between in interp_bathy (and decompose_domain)
     all_data->h = malloc(sizeof(data_t));
     if (all_data->h == NULL) {
         fprintf(stderr, "Error: Failed to allocate h structure\n");
@@ -352,7 +1217,7 @@ all_data_t* init_all_data(const parameters_t *param, MPITopology *topo) {
         return NULL;
     }
 
-    if (read_data(all_data->h, param->input_h_filename)) {
+    if (read_bathy_header(all_data->h, param->input_h_filename, topo)) {
         fprintf(stderr, "Error: Failed to read bathymetry data\n");
         free_all_data(all_data);
         return NULL;
@@ -364,12 +1229,14 @@ all_data_t* init_all_data(const parameters_t *param, MPITopology *topo) {
     int nx_glob = floor(hx / param->dx);
     int ny_glob = floor(hy / param->dy);
 
-    int local_nx = nx_glob / topo->dims[0];
-    int local_ny = ny_glob / topo->dims[1];
-
-    // Adjust for non-uniform distribution
-    if (topo->coords[0] < (nx_glob % topo->dims[0])) local_nx++;
-    if (topo->coords[1] < (ny_glob % topo->dims[1])) local_ny++;
+    // Block of this rank (uniform or bathymetry-weighted)
+    if (decompose_domain(param, all_data->h, nx_glob, ny_glob, topo)) {
+        fprintf(stderr, "Error: Failed to decompose the domain\n");
+        free_all_data(all_data);
+        return NULL;
+    }
+    int local_nx = topo->splits[0][topo->coords[0] + 1] - topo->splits[0][topo->coords[0]];
+    int local_ny = topo->splits[1][topo->coords[1] + 1] - topo->splits[1][topo->coords[1]];
 
     if (topo->rank == 0) {
         printf("Rank %d: Global dimensions: %dx%d, Local dimensions: %dx%d\n",
@@ -377,24 +1244,7 @@ all_data_t* init_all_data(const parameters_t *param, MPITopology *topo) {
         fflush(stdout);
     }
 
-    // Allocate all field structures
-    all_data->eta = malloc(sizeof(data_t));
-    all_data->u = malloc(sizeof(data_t));
-    all_data->v = malloc(sizeof(data_t));
-    all_data->h_interp = malloc(sizeof(data_t));
-
-    if (!all_data->eta || !all_data->u || !all_data->v || !all_data->h_interp) {
-        fprintf(stderr, "Error: Failed to allocate data structures\n");
-        free_all_data(all_data);
-        return NULL;
-    }
-
-    // Initialize each field with appropriate dimensions
-    if (init_data(all_data->eta, local_nx, local_ny, param->dx, param->dy, 0.0) ||
-        init_data(all_data->u, local_nx + 1, local_ny, param->dx, param->dy, 0.0) ||
-        init_data(all_data->v, local_nx, local_ny + 1, param->dx, param->dy, 0.0) ||
-        init_data(all_data->h_interp, local_nx, local_ny, param->dx, param->dy, 0.0)) {
-        fprintf(stderr, "Error: Failed to initialize fields\n");
+    if (init_fields(all_data, param, topo)) {
         free_all_data(all_data);
         return NULL;
     }
@@ -403,12 +1253,28 @@ all_data_t* init_all_data(const parameters_t *param, MPITopology *topo) {
 }
 
 /**
- * Releases memory for all data structures
+ * Releases the fields of this rank's block and their halo requests,
+ * keeping the bathymetry
  * 
- * @param all_data Main data structure to free
+ * @param all_data Simulation data (fields left NULL, halos cleared)
  */
-void free_all_data(all_data_t *all_data) {
-    if (all_data == NULL) return;
+static void free_fields(all_data_t *all_data) {
+    free_halo(&all_data->halo_faces);
+    free_halo(&all_data->halo_eta);
+    free_deep_halo(&all_data->deep);
+    free_wet_runs(all_data);
+
+    // The arena owns the storage of every field except h
+    if (all_data->arena.base) {
+        if (all_data->shared.win == MPI_WIN_NULL)
+            munmap(all_data->arena.base, all_data->arena.size);
+        all_data->arena.base = NULL;
+        data_t *fields[] = {all_data->eta, all_data->u, all_data->v,
+                            all_data->h_interp, all_data->hu, all_data->hv};
+        for (int f = 0; f < (int)(sizeof(fields) / sizeof(fields[0])); f++)
+            if (fields[f]) fields[f]->storage = fields[f]->vals = NULL;
+    }
+    free_shared_window(&all_data->shared);
 
     if (all_data->u) {
         free_data(all_data->u);
@@ -422,14 +1288,54 @@ void free_all_data(all_data_t *all_data) {
         free_data(all_data->eta);
         all_data->eta = NULL;
     }
-    if (all_data->h) {
-        free_data(all_data->h);
-        all_data->h = NULL;
-    }
     if (all_data->h_interp) {
         free_data(all_data->h_interp);
         all_data->h_interp = NULL;
     }
+    if (all_data->hu) {
+        free_data(all_data->hu);
+        all_data->hu = NULL;
+    }
+    if (all_data->hv) {
+        free_data(all_data->hv);
+        all_data->hv = NULL;
+    }
+
+    clear_halo(&all_data->halo_faces);
+    clear_halo(&all_data->halo_eta);
+    clear_deep_halo(&all_data->deep);
+}
+
+/**
+ * Moves this rank to its block in topo->splits: the fields are released
+ * and allocated again at the new size, all at zero (collective)
+ * 
+ * @param all_data Simulation data (fields set up in place)
+ * @param param Simulation parameters
+ * @param topo MPI topology information
+ * @return 0 on success, 1 on failure
+ */
+int resize_all_data(all_data_t *all_data, const parameters_t *param, MPITopology *topo) {
+    free_fields(all_data);
+    return init_fields(all_data, param, topo);
+}
+
+/**
+ * Releases memory for all data structures
+ * 
+ * @param all_data Main data structure to free
+ */
+void free_all_data(all_data_t *all_data) {
+    if (all_data == NULL) return;
+
+    free_fields(all_data);
+    if (all_data->h) {
+        free_data(all_data->h);
+        all_data->h = NULL;
+    }
+    flush_io_blocks(&all_data->io);
+    free(all_data->io.buf[0]);
+    free(all_data->io.buf[1]);
 
     free(all_data);
 }
@@ -442,8 +1348,9 @@ void free_all_data(all_data_t *all_data) {
 void free_data(data_t *data) {
     if (data == NULL) return;
     
-    if (data->vals) {
-        free(data->vals);
+    if (data->storage) {
+        free(data->storage);
+        data->storage = NULL;
         data->vals = NULL;
     }
     
@@ -461,7 +1368,18 @@ void cleanup(parameters_t *param, MPITopology *topo, gather_data_t *gdata) {
     if (gdata == NULL || topo == NULL) return;
 
     MPI_Barrier(topo->cart_comm);
+    free_gather_structures(gdata, topo);
+    free(gdata);
+}
 
+/**
+ * Releases the arrays of the gather structures, which can then be
+ * initialized again
+ * 
+ * @param gdata Gather data structure (left empty)
+ * @param topo MPI topology information
+ */
+void free_gather_structures(gather_data_t *gdata, const MPITopology *topo) {
     // Free common arrays
     if (gdata->recv_size_eta) free(gdata->recv_size_eta);
     if (gdata->recv_size_u) free(gdata->recv_size_u);
@@ -472,20 +1390,23 @@ void cleanup(parameters_t *param, MPITopology *topo, gather_data_t *gdata) {
 
     // Free rank 0 specific data
     if (topo->cart_rank == 0) {
-        if (gdata->gathered_output) free(gdata->gathered_output);
+        if (gdata->gathered_output) {
+            for (int i = 0; i < 3; i++) free(gdata->gathered_output[i].vals);
+            free(gdata->gathered_output);
+        }
         if (gdata->receive_data_eta) free(gdata->receive_data_eta);
         if (gdata->receive_data_u) free(gdata->receive_data_u);
         if (gdata->receive_data_v) free(gdata->receive_data_v);
+    }
 
-        if (gdata->rank_glob) {
-            for (int r = 0; r < topo->nb_process; r++) {
-                if (gdata->rank_glob[r]) free(gdata->rank_glob[r]);
-            }
-            free(gdata->rank_glob);
+    // Every rank holds the positions of all ranks
+    if (gdata->rank_glob) {
+        for (int r = 0; r < topo->nb_process; r++) {
+            if (gdata->rank_glob[r]) free(gdata->rank_glob[r]);
         }
+        free(gdata->rank_glob);
     }
-
-    free(gdata);
+    memset(gdata, 0, sizeof(gather_data_t));
 }
 
 /**
@@ -494,6 +1415,13 @@ void cleanup(parameters_t *param, MPITopology *topo, gather_data_t *gdata) {
  * @param topo MPI topology structure to cleanup
  */
 void cleanup_mpi_topology(MPITopology *topo) {
+    free(topo->splits[0]);
+    free(topo->splits[1]);
+    topo->splits[0] = topo->splits[1] = NULL;
+    free(topo->io_clients);
+    topo->io_clients = NULL;
+    if (topo->io_comm != MPI_COMM_NULL) MPI_Comm_free(&topo->io_comm);
+    if (topo->node_comm != MPI_COMM_NULL) MPI_Comm_free(&topo->node_comm);
     if (topo->cart_comm != MPI_COMM_NULL && 
         topo->cart_comm != MPI_COMM_WORLD) {
         MPI_Comm_free(&topo->cart_comm);
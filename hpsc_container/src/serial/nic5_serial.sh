@@ -6,8 +6,14 @@ BIN_PATH="../../bin"
 INPUT_PATH="../../input_data/base_case/"
 export SHALLOW_INPUT_DIR="$INPUT_PATH"
 
+# Optional float32 field storage (arithmetic stays float64): SINGLE=1
+PRECISION_FLAGS=""
+if [ "${SINGLE:-0}" = "1" ]; then
+    PRECISION_FLAGS="-DSHALLOW_SINGLE"
+fi
+
 # Compilation
-gcc -O3 -o ${BIN_PATH}/shallow_serial shallow_serial.c tools_serial.c  -lm
+gcc -O3 ${PRECISION_FLAGS} -o ${BIN_PATH}/shallow_serial shallow_serial.c tools_serial.c simd_serial.c  -pthread -lz -lm
 
 # Execute as temporary user
 if [ $? -eq 0 ]; then
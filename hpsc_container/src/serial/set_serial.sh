@@ -14,8 +14,14 @@ fi
 # Give temporary permissions
 chown -R $TMP_USER:$TMP_USER /opt/hpsc_container
 
+# Optional float32 field storage (arithmetic stays float64): SINGLE=1
+PRECISION_FLAGS=""
+if [ "${SINGLE:-0}" = "1" ]; then
+    PRECISION_FLAGS="-DSHALLOW_SINGLE"
+fi
+
 # Compilation
-gcc -O3 -o ${BIN_PATH}/shallow_serial shallow_serial.c tools_serial.c  -lm
+gcc -O3 ${PRECISION_FLAGS} -o ${BIN_PATH}/shallow_serial shallow_serial.c tools_serial.c simd_serial.c  -pthread -lz -lm
 
 # Execute as temporary user
 if [ $? -eq 0 ]; then
@@ -55,48 +55,83 @@ double interpolate_data(const data_t *data, double x, double y) {
  * MAIN COMPUTATION FUNCTIONS
  ===========================================================*/
 
+/**
+ * Updates water height (eta) on one tile of the grid
+ * Rows are swept in the outer loop so the inner loop is unit-stride;
+ * the face coefficients already hold the boundary faces, so every row
+ * is a single flux-difference sweep. The ghost cells of the tile's
+ * domain edges are refreshed for the velocity update
+ * 
+ * @param i0, i1 Column range of the tile [i0, i1)
+ * @param j0, j1 Row range of the tile [j0, j1)
+ * @param u X-velocity field
+ * @param v Y-velocity field
+ * @param eta Water elevation field
+ * @param hu, hv Face depths times dt/dx and dt/dy (see interp_bathy)
+ */
+static void update_eta_tile(int i0, int i1, int j0, int j1,
+                            data_t *u, data_t *v, data_t *eta,
+                            const data_t *hu, const data_t *hv) {
+    for (int j = j0; j < j1; j++) {
+        eta_row(&GET(eta, i0, j), &GET(hu, i0, j), &GET(u, i0, j),
+                &GET(hv, i0, j), &GET(hv, i0, j + 1),
+                &GET(v, i0, j), &GET(v, i0, j + 1), i1 - i0);
+    }
+    fill_ghosts(eta, i0, i1, j0, j1);
+}
+
+/**
+ * Updates velocity fields (u,v) on one tile of the grid
+ * Rows are swept in the outer loop so the inner loop is unit-stride;
+ * the west and south differences of the first column and row read the
+ * eta ghost cells, which hold the edge values (zero gradient)
+ * 
+ * @param i0, i1 Column range of the tile [i0, i1)
+ * @param j0, j1 Row range of the tile [j0, j1)
+ * @param param Simulation parameters
+ * @param u X-velocity field
+ * @param v Y-velocity field
+ * @param eta Water elevation field
+ */
+static void update_velocities_tile(int i0, int i1, int j0, int j1,
+                                   parameters_t param, data_t *u, data_t *v,
+                                   data_t *eta) {
+    // Compute coefficients
+    double c1 = param.dt * param.g;
+    double c2 = param.dt * param.gamma;
+
+    for (int j = j0; j < j1; j++) {
+        velocity_row(&GET(u, i0, j), &GET(v, i0, j), &GET(eta, i0, j), &GET(eta, i0, j - 1),
+                     1. - c2, c1 / param.dx, c1 / param.dy, i1 - i0);
+    }
+}
+
 /**
  * Updates water height (eta) using shallow water equations
+ * The grid is swept tile by tile (see init_sweep for the tile size)
  * 
  * @param nx, ny Grid dimensions
  * @param param Simulation parameters
  * @param u X-velocity field
  * @param v Y-velocity field
  * @param eta Water elevation field
- * @param h_interp Interpolated bathymetry field
+ * @param hu, hv Face depths times dt/dx and dt/dy
  */
-double update_eta(int nx, int ny, parameters_t param, 
-                 data_t *u, data_t *v, data_t *eta, data_t *h_interp) {
-    for (int i = 0; i < nx; i++) {
-        for (int j = 0; j < ny; j++) {
-            // Get bathymetry values with boundary handling
-            double h_ui_plus_1_j = (i < nx - 1) ? GET(h_interp, i + 1, j) : GET(h_interp, i, j);
-            double h_ui_j = GET(h_interp, i, j);
-            double h_vi_j_plus_1 = (j < ny - 1) ? GET(h_interp, i, j + 1) : GET(h_interp, i, j);
-            double h_vi_j = GET(h_interp, i, j);
-
-            // Get velocity values with boundary handling
-            double u_ip1_j = (i < nx - 1) ? GET(u, i + 1, j) : GET(u, i, j);
-            double u_i_j = GET(u, i, j);
-            double v_i_jp1 = (j < ny - 1) ? GET(v, i, j + 1) : GET(v, i, j);
-            double v_i_j = GET(v, i, j);
-
-            // Compute spatial derivatives
-            double c1_x = param.dt / param.dx;
-            double c1_y = param.dt / param.dy;
-
-            // Update eta value
-            double eta_ij = GET(eta, i, j)
-                - c1_x * (h_ui_plus_1_j * u_ip1_j - h_ui_j * u_i_j)
-                - c1_y * (h_vi_j_plus_1 * v_i_jp1 - h_vi_j * v_i_j);
-
-            SET(eta, i, j, eta_ij);
+void update_eta(int nx, int ny, parameters_t param, 
+                data_t *u, data_t *v, data_t *eta,
+                const data_t *hu, const data_t *hv) {
+    for (int j0 = 0; j0 < ny; j0 += param.tile_ny) {
+        int j1 = (j0 + param.tile_ny < ny) ? j0 + param.tile_ny : ny;
+        for (int i0 = 0; i0 < nx; i0 += param.tile_nx) {
+            int i1 = (i0 + param.tile_nx < nx) ? i0 + param.tile_nx : nx;
+            update_eta_tile(i0, i1, j0, j1, u, v, eta, hu, hv);
         }
     }
 }
 
 /**
  * Updates velocity fields (u,v) using shallow water equations
+ * The grid is swept tile by tile (see init_sweep for the tile size)
  * 
  * @param nx, ny Grid dimensions
  * @param param Simulation parameters
@@ -104,29 +139,79 @@ double update_eta(int nx, int ny, parameters_t param,
  * @param v Y-velocity field
  * @param eta Water elevation field
  */
-double update_velocities(int nx, int ny, parameters_t param,
-                        data_t *u, data_t *v, data_t *eta) {
-    for(int i = 0; i < nx; i++) {
-        for(int j = 0; j < ny; j++) {
-            // Compute coefficients
-            double c1 = param.dt * param.g;
-            double c2 = param.dt * param.gamma;
-
-            // Get eta values with boundary handling
-            double eta_ij = GET(eta, i, j);
-            double eta_imj = GET(eta, (i == 0) ? 0 : i - 1, j);
-            double eta_ijm = GET(eta, i, (j == 0) ? 0 : j - 1);
-
-            // Update velocities
-            double u_ij = (1. - c2) * GET(u, i, j)
-                - c1 / param.dx * (eta_ij - eta_imj);
-            double v_ij = (1. - c2) * GET(v, i, j)
-                - c1 / param.dy * (eta_ij - eta_ijm);
-
-            SET(u, i, j, u_ij);
-            SET(v, i, j, v_ij);
+void update_velocities(int nx, int ny, parameters_t param,
+                       data_t *u, data_t *v, data_t *eta) {
+    for (int j0 = 0; j0 < ny; j0 += param.tile_ny) {
+        int j1 = (j0 + param.tile_ny < ny) ? j0 + param.tile_ny : ny;
+        for (int i0 = 0; i0 < nx; i0 += param.tile_nx) {
+            int i1 = (i0 + param.tile_nx < nx) ? i0 + param.tile_nx : nx;
+            update_velocities_tile(i0, i1, j0, j1, param, u, v, eta);
+        }
+    }
+}
+
+/**
+ * Measures the update rate of a set of tile configurations
+ * Runs a few time steps per configuration on scratch fields,
+ * reports MUpdates/s for each and keeps the fastest in param
+ * 
+ * @param nx, ny Grid dimensions
+ * @param param Simulation parameters (tile size updated in place)
+ * @param hu, hv Face depths times dt/dx and dt/dy
+ */
+void benchmark_sweep(int nx, int ny, parameters_t *param,
+                     const data_t *hu, const data_t *hv) {
+    const int widths[] = {64, 128, 256, 512, 1024, nx};
+    const int heights[] = {4, 16, 64, param->tile_ny};
+    const int num_widths = sizeof(widths) / sizeof(widths[0]);
+    const int num_heights = sizeof(heights) / sizeof(heights[0]);
+
+    // Scratch fields so the benchmark does not disturb the simulation
+    data_t eta, u, v;
+    if (init_data(&eta, nx, ny, param->dx, param->dy, 0.) ||
+        init_data(&u, nx + 1, ny, param->dx, param->dy, 0.) ||
+        init_data(&v, nx, ny + 1, param->dx, param->dy, 0.)) {
+        printf("Error: Could not allocate sweep benchmark fields\n");
+        return;
+    }
+
+    parameters_t trial = *param;
+    double best_rate = 0.0;
+    int best_nx = param->tile_nx;
+    int best_ny = param->tile_ny;
+
+    printf("Sweep benchmark (%d steps per configuration):\n", TILE_BENCH_STEPS);
+    for (int a = 0; a < num_widths; a++) {
+        if (widths[a] > nx || (a < num_widths - 1 && widths[a] == nx)) continue;
+        for (int b = 0; b < num_heights; b++) {
+            if (heights[b] > ny || (b < num_heights - 1 && heights[b] == param->tile_ny)) continue;
+            trial.tile_nx = widths[a];
+            trial.tile_ny = heights[b];
+
+            double start = GET_TIME();
+            for (int n = 0; n < TILE_BENCH_STEPS; n++) {
+                update_eta(nx, ny, trial, &u, &v, &eta, hu, hv);
+                update_velocities(nx, ny, trial, &u, &v, &eta);
+            }
+            double time = GET_TIME() - start;
+            double rate = 1e-6 * (double)nx * (double)ny * TILE_BENCH_STEPS / time;
+
+            printf(" - tile %5d x %-5d: %10.2f MUpdates/s\n", trial.tile_nx, trial.tile_ny, rate);
+            if (rate > best_rate) {
+                best_rate = rate;
+                best_nx = trial.tile_nx;
+                best_ny = trial.tile_ny;
+            }
         }
     }
+
+    param->tile_nx = best_nx;
+    param->tile_ny = best_ny;
+    printf(" - selected tile: %d x %d\n", best_nx, best_ny);
+
+    free_data(&eta);
+    free_data(&u);
+    free_data(&v);
 }
 
 /*===========================================================
@@ -175,15 +260,20 @@ void boundary_condition(int n, int nx, int ny, parameters_t param,
 }
 
 /**
- * Interpolates bathymetry data onto computation grid
+ * Interpolates bathymetry data onto computation grid and builds the
+ * face coefficients used by update_eta: hu(i,j) = dt/dx * h at the u-face
+ * i (the depth of cell i, the last cell for the east wall face) and
+ * hv(i,j) = dt/dy * h at the v-face j (same rule towards the north wall)
  * 
  * @param nx, ny Grid dimensions
  * @param param Simulation parameters
  * @param h_interp Output interpolated bathymetry field
+ * @param hu Output u-face coefficients ((nx+1) x ny)
+ * @param hv Output v-face coefficients (nx x (ny+1))
  * @param h Input bathymetry field
  */
 void interp_bathy(int nx, int ny, parameters_t param,
-                  data_t *h_interp, data_t *h) {
+                  data_t *h_interp, data_t *hu, data_t *hv, data_t *h) {
     for(int i = 0; i < nx; i++) {
         for(int j = 0; j < ny; j++) {
             double x = i * param.dx;
@@ -192,6 +282,19 @@ void interp_bathy(int nx, int ny, parameters_t param,
             SET(h_interp, i, j, val);
         }
     }
+
+    double c1_x = param.dt / param.dx;
+    double c1_y = param.dt / param.dy;
+    for(int j = 0; j < ny; j++) {
+        for(int i = 0; i <= nx; i++) {
+            SET(hu, i, j, c1_x * GET(h_interp, (i < nx) ? i : nx - 1, j));
+        }
+    }
+    for(int j = 0; j <= ny; j++) {
+        for(int i = 0; i < nx; i++) {
+            SET(hv, i, j, c1_y * GET(h_interp, i, (j < ny) ? j : ny - 1));
+        }
+    }
 }
 
 /*===========================================================
@@ -240,9 +343,21 @@ int main(int argc, char **argv) {
     init_data(&v, nx, ny + 1, param.dx, param.dy, 0.);
 
     // Interpolate bathymetry
-    data_t h_interp;
+    data_t h_interp, hu, hv;
     init_data(&h_interp, nx, ny, param.dx, param.dy, 0.);
-    interp_bathy(nx, ny, param, &h_interp, &h);
+    init_data(&hu, nx + 1, ny, param.dx, param.dy, 0.);
+    init_data(&hv, nx, ny + 1, param.dx, param.dy, 0.);
+    interp_bathy(nx, ny, param, &h_interp, &hu, &hv, &h);
+
+    // Choose the kernel path and the sweep tile size
+    printf(" - field storage: %s\n", REAL_NAME);
+    printf(" - SIMD kernels: %s\n", init_simd());
+    init_sweep(&param, nx, ny);
+    if(getenv(TILE_BENCH_ENV)) benchmark_sweep(nx, ny, &param, &hu, &hv);
+
+    // Snapshots are written by a background thread
+    writer_t writer;
+    init_writer(&writer, &eta, "water elevation", param.output_eta_filename);
 
     double start = GET_TIME();
 
@@ -259,19 +374,20 @@ int main(int argc, char **argv) {
 
         // Output solution
         if(param.sampling_rate && !(n % param.sampling_rate)) {
-            write_data_vtk(&eta, "water elevation", 
-                          param.output_eta_filename, n);
+            write_snapshot(&writer, &eta, n);
+            report_deviation(&eta, param.output_eta_filename, n);
         }
 
         // Impose boundary conditions
         boundary_condition(n, nx, ny, param, &u, &v, &eta, &h_interp);
 
         // Update variables
-        update_eta(nx, ny, param, &u, &v, &eta, &h_interp);
+        update_eta(nx, ny, param, &u, &v, &eta, &hu, &hv);
         update_velocities(nx, ny, param, &u, &v, &eta);
     }
 
-    // Write final output manifest
+    // Wait for the last snapshots, then write the output manifest
+    finish_writer(&writer);
     write_manifest_vtk(param.output_eta_filename, param.dt, nt,
                       param.sampling_rate);
 
@@ -282,6 +398,8 @@ int main(int argc, char **argv) {
 
     // Cleanup
     free_data(&h_interp);
+    free_data(&hu);
+    free_data(&hv);
     free_data(&eta);
     free_data(&u);
     free_data(&v);
@@ -15,6 +15,9 @@
 #include <math.h>
 #include <time.h>
 #include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <zlib.h>
 
 /*===========================================================
  * CONSTANTS AND CONFIGURATION MACROS
@@ -26,15 +29,56 @@
 #define INPUT_DIR getenv("SHALLOW_INPUT_DIR")
 #define MAX_PATH_LENGTH 512
 
+// Sweep engine configuration (overridable through the environment)
+#define TILE_NX_ENV "SHALLOW_TILE_NX"          // tile width (grid points)
+#define TILE_NY_ENV "SHALLOW_TILE_NY"          // tile height (grid rows)
+#define TILE_BENCH_ENV "SHALLOW_TILE_BENCH"    // benchmark tile configurations
+#define DEFAULT_L2_BYTES (1024 * 1024)          // fallback when L2 size is unknown
+#define MAX_TILE_NX 1024                        // widest default tile, so a tile keeps several rows in L2
+#define TILE_BENCH_STEPS 20                     // time steps per benchmarked tile
+#define SIMD_ENV "SHALLOW_SIMD"                 // force a kernel path (scalar, sse2, avx2, avx512)
+#define REFERENCE_DIR_ENV "SHALLOW_REFERENCE_DIR"  // float64 outputs to compare against
+#define VTK_COMPRESS_ENV "SHALLOW_VTK_COMPRESS"    // zlib level of VTK snapshots (1-9, 0: raw)
+#define VTK_SHUFFLE_ENV "SHALLOW_VTK_SHUFFLE"      // byte-shuffle compressed values (not VTK-standard)
+#define VTK_SHUFFLE_EXT "vtis"                     // extension of shuffled snapshots (not .vti)
+#define VTK_BLOCK_BYTES (256 * 1024)               // uncompressed bytes per zlib block
+#define WRITER_SLOTS_ENV "SHALLOW_WRITER_SLOTS"    // snapshot buffers of the writer thread (0: none)
+#define WRITER_SLOTS 2                              // default: double buffering
+#define WRITER_POLL_NS 100000                       // pause of a waiting queue end (ns)
+
+// Field storage precision: build with -DSHALLOW_SINGLE to store fields as
+// float32, arithmetic is always carried out in float64
+#ifdef SHALLOW_SINGLE
+typedef float real_t;
+#define REAL_NAME "float32"
+#define VTK_REAL_TYPE "Float32"
+#else
+typedef double real_t;
+#define REAL_NAME "float64"
+#define VTK_REAL_TYPE "Float64"
+#endif
+
+// Padded field layout: GHOST_WIDTH ghost cells around every field and rows
+// padded to a multiple of FIELD_ALIGN bytes (build with -DGHOST_WIDTH=n)
+#ifndef GHOST_WIDTH
+#define GHOST_WIDTH 1
+#endif
+#define FIELD_ALIGN 64
+
 /*===========================================================
  * DATA ACCESS AND TIMING MACROS
  ===========================================================*/
-// Access data in 2D array stored in 1D
-#define GET(data, i, j) ((data)->values[(i) + (j) * (data)->nx])
-#define SET(data, i, j, val) ((data)->values[(i) + (j) * (data)->nx] = (val))
+// Access data in 2D array stored in 1D (i, j from -ghost to nx+ghost-1)
+#define GET(data, i, j) ((data)->values[(i) + (j) * (data)->pitch])
+#define SET(data, i, j, val) ((data)->values[(i) + (j) * (data)->pitch] = (val))
 
-// Timing functions
-#define GET_TIME() clock()/(double)CLOCKS_PER_SEC
+// Timing functions: wall time, clock() would add the writer thread's CPU time
+static inline double get_time(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + 1e-9 * now.tv_nsec;
+}
+#define GET_TIME() get_time()
 
 /*===========================================================
  * TYPE DEFINITIONS
@@ -42,11 +86,15 @@
 
 /**
  * Grid data structure
- * Contains field values and grid information
+ * Contains field values and grid information; interior rows start on
+ * a FIELD_ALIGN boundary and are surrounded by ghost cells
  */
 typedef struct {
-    double *values;              // Field values
+    real_t *values;              // Field values, points at (0,0)
+    real_t *storage;             // Allocation holding values and ghost cells
     int nx, ny;                 // Grid dimensions
+    int ghost;                  // Ghost cells on each side
+    int pitch;                  // Distance between rows (elements)
     double dx, dy;              // Grid spacing
 } data_t;
 
@@ -60,16 +108,61 @@ typedef struct  {
     int source_type;             // Source configuration
     int sampling_rate;           // Output frequency
     int boundary_type;           // Boundary condition type
+    int tile_nx, tile_ny;        // Sweep tile size (grid points)
     char input_h_filename[MAX_PATH_LENGTH];      // Input file paths
     char output_eta_filename[MAX_PATH_LENGTH];   // Output file paths
     char output_u_filename[MAX_PATH_LENGTH];
     char output_v_filename[MAX_PATH_LENGTH];
 } parameters_t;
 
+/**
+ * Background snapshot writer
+ * Single-producer single-consumer ring of snapshot buffers: the time loop
+ * fills slot head, the writer thread writes out slot tail. Both ends only
+ * publish their index (release) and read the other one (acquire)
+ */
+typedef struct {
+    real_t **slots;             // Snapshot buffers (nx * ny values each)
+    int *steps;                 // Time step held by each slot
+    int num_slots;              // 0: write synchronously
+    int nx, ny;                 // Field dimensions
+    double dx, dy;              // Grid spacing
+    const char *name;           // Field name for VTK file
+    const char *filename;       // Base name for output files
+    atomic_int head;            // Slots filled by the time loop
+    atomic_int tail;            // Slots written by the thread
+    atomic_int done;            // No snapshot will follow
+    pthread_t thread;
+    int snapshots, stalls;      // Snapshots handed over, waits on a full queue
+    double copy_time;           // Seconds the time loop spent handing over
+    double stall_time;          // Part of it spent waiting for a free slot
+    double write_time;          // Seconds the writer spent writing
+    int errors;                 // Snapshots that could not be written
+} writer_t;
+
+/**
+ * Row kernels selected at startup by init_simd
+ * eta_row reads one u-face past the segment, velocity_row one point before it
+ */
+typedef void (*eta_row_fn)(real_t *eta, const real_t *hu, const real_t *u,
+                           const real_t *hv, const real_t *hv_n,
+                           const real_t *v, const real_t *v_n, int n);
+typedef void (*velocity_row_fn)(real_t *u, real_t *v, const real_t *eta,
+                                const real_t *eta_s, double damping,
+                                double c_x, double c_y, int n);
+
+extern eta_row_fn eta_row;
+extern velocity_row_fn velocity_row;
+
 /*===========================================================
  * COMPUTATION FUNCTION PROTOTYPES
  ===========================================================*/
 
+/**
+ * Selects the SIMD row kernels for the running CPU
+ */
+const char *init_simd(void);
+
 /**
  * Performs bilinear interpolation of data at given coordinates
  */
@@ -78,14 +171,21 @@ double interpolate_data(const data_t *data, double x, double y);
 /**
  * Updates water height (eta) using shallow water equations
  */
-double update_eta(int nx, int ny, parameters_t param, 
-                 data_t *u, data_t *v, data_t *eta, data_t *h_interp);
+void update_eta(int nx, int ny, parameters_t param, 
+                data_t *u, data_t *v, data_t *eta,
+                const data_t *hu, const data_t *hv);
 
 /**
  * Updates velocity fields (u,v) using shallow water equations
  */
-double update_velocities(int nx, int ny, parameters_t param,
-                        data_t *u, data_t *v, data_t *eta);
+void update_velocities(int nx, int ny, parameters_t param,
+                       data_t *u, data_t *v, data_t *eta);
+
+/**
+ * Measures tile configurations and keeps the fastest one
+ */
+void benchmark_sweep(int nx, int ny, parameters_t *param,
+                     const data_t *hu, const data_t *hv);
 
 /**
  * Apply boundary conditions and source terms
@@ -94,10 +194,10 @@ void boundary_condition(int n, int nx, int ny, parameters_t param,
                        data_t *u, data_t *v, data_t *eta, const data_t *h_interp);
 
 /**
- * Interpolates bathymetry data onto computation grid
+ * Interpolates bathymetry data and builds the face coefficients
  */
 void interp_bathy(int nx, int ny, parameters_t param,
-                  data_t *h_interp, data_t *h);
+                  data_t *h_interp, data_t *hu, data_t *hv, data_t *h);
 
 /*===========================================================
  * I/O AND INITIALIZATION FUNCTION PROTOTYPES
@@ -124,18 +224,49 @@ int read_data(data_t *data, const char *filename);
 int init_data(data_t *data, int nx, int ny, double dx, double dy, 
               double initial_value);
 
+/**
+ * Copy the edge values of a tile into the ghost cells beyond the domain edge
+ */
+void fill_ghosts(data_t *data, int i0, int i1, int j0, int j1);
+
+/**
+ * Choose the tile size used by the sweep engine
+ */
+void init_sweep(parameters_t *param, int nx, int ny);
+
 /**
  * Write data to VTK format file for visualization
  */
 int write_data_vtk(const data_t *data, const char *name, 
                    const char *filename, int step);
 
+/**
+ * Print the deviation of a field from a float64 reference output
+ */
+int report_deviation(const data_t *data, const char *filename, int step);
+
 /**
  * Write VTK manifest file for time series data
  */
 int write_manifest_vtk(const char *filename, double dt, int nt, 
                       int sampling_rate);
 
+/**
+ * Start the background writer of a field
+ */
+int init_writer(writer_t *writer, const data_t *field, const char *name,
+                const char *filename);
+
+/**
+ * Hand a snapshot of the field over to the background writer
+ */
+int write_snapshot(writer_t *writer, const data_t *field, int step);
+
+/**
+ * Drain the background writer and print its statistics
+ */
+int finish_writer(writer_t *writer);
+
 /**
  * Free memory allocated for data structure
  */
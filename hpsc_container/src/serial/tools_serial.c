@@ -6,6 +6,7 @@
 
 #include "shallow_serial.h"
 #include <string.h>
+#include <unistd.h>
 #include <ctype.h>
 
 /*===========================================================
@@ -112,6 +113,40 @@ void print_parameters(parameters_t *param) {
            param->output_u_filename, param->output_v_filename);
 }
 
+/**
+ * Chooses the tile size used by the sweep engine
+ * Defaults to full-width tiles, at most MAX_TILE_NX columns wide, whose
+ * rows of eta, u, v, hu and hv fit in half of the L2 cache. The width cap
+ * keeps a dozen rows per tile on wide grids, so the row above is still in
+ * cache when the next row reads it; SHALLOW_TILE_NX / SHALLOW_TILE_NY
+ * override it
+ * 
+ * @param param Simulation parameters (tile size set in place)
+ * @param nx, ny Grid dimensions
+ */
+void init_sweep(parameters_t *param, int nx, int ny) {
+    long l2_bytes = DEFAULT_L2_BYTES;
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    long detected = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if(detected > 0) l2_bytes = detected;
+#endif
+
+    // Five fields are streamed per tile (eta, u, v, hu, hv)
+    param->tile_nx = (nx < MAX_TILE_NX) ? nx : MAX_TILE_NX;
+    param->tile_ny = (int)(l2_bytes / 2 / (5 * sizeof(real_t) * param->tile_nx));
+
+    const char *env_nx = getenv(TILE_NX_ENV);
+    const char *env_ny = getenv(TILE_NY_ENV);
+    if(env_nx) param->tile_nx = atoi(env_nx);
+    if(env_ny) param->tile_ny = atoi(env_ny);
+
+    if(param->tile_nx <= 0 || param->tile_nx > nx) param->tile_nx = nx;
+    if(param->tile_ny <= 0 || param->tile_ny > ny) param->tile_ny = ny;
+
+    printf(" - sweep tile: %d x %d (L2: %ld KiB)\n",
+           param->tile_nx, param->tile_ny, l2_bytes / 1024);
+}
+
 /*===========================================================
  * DATA I/O FUNCTIONS
  ===========================================================*/
@@ -142,13 +177,20 @@ int read_data(data_t *data, const char *filename) {
         if(N <= 0) {
             printf("Error: Invalid number of data points %d\n", N);
             ok = 0;
+        } else if(init_data(data, data->nx, data->ny, data->dx, data->dy, 0.)) {
+            ok = 0;
         } else {
-            data->values = (double*)malloc(N * sizeof(double));
-            if(!data->values) {
-                printf("Error: Could not allocate data (%d doubles)\n", N);
-                ok = 0;
-            } else {
-                ok = (fread(data->values, sizeof(double), N, fp) == N);
+            for(int j = 0; ok && j < data->ny; j++) {
+#ifdef SHALLOW_SINGLE
+                // Input files are float64: narrow while reading
+                for(int i = 0; ok && i < data->nx; i++) {
+                    double val;
+                    ok = (fread(&val, sizeof(double), 1, fp) == 1);
+                    SET(data, i, j, (real_t)val);
+                }
+#else
+                ok = (fread(&GET(data, 0, j), sizeof(double), data->nx, fp) == (size_t)data->nx);
+#endif
             }
         }
     }
@@ -188,8 +230,17 @@ int write_data(const data_t *data, const char *filename, int step) {
     if(ok) ok = (fwrite(&data->dx, sizeof(double), 1, fp) == 1);
     if(ok) ok = (fwrite(&data->dy, sizeof(double), 1, fp) == 1);
 
-    int N = data->nx * data->ny;
-    if(ok) ok = (fwrite(data->values, sizeof(double), N, fp) == N);
+    for(int j = 0; ok && j < data->ny; j++) {
+#ifdef SHALLOW_SINGLE
+        // The .dat format is float64: widen while writing
+        for(int i = 0; ok && i < data->nx; i++) {
+            double val = GET(data, i, j);
+            ok = (fwrite(&val, sizeof(double), 1, fp) == 1);
+        }
+#else
+        ok = (fwrite(&GET(data, 0, j), sizeof(double), data->nx, fp) == (size_t)data->nx);
+#endif
+    }
 
     fclose(fp);
     if(!ok) {
@@ -199,6 +250,105 @@ int write_data(const data_t *data, const char *filename, int step) {
     return 0;
 }
 
+/**
+ * Reads the VTK compression settings: SHALLOW_VTK_COMPRESS gives the zlib
+ * level (0 or unset: raw data) and SHALLOW_VTK_SHUFFLE byte-shuffles the
+ * values before they are compressed
+ * 
+ * @param shuffle Set to 1 when the values are to be shuffled
+ * @return zlib level (0 for raw data)
+ */
+static int vtk_compression(int *shuffle) {
+    const char *level_env = getenv(VTK_COMPRESS_ENV);
+    const char *shuffle_env = getenv(VTK_SHUFFLE_ENV);
+    int level = (level_env && *level_env) ? atoi(level_env) : 0;
+    if(level < 0) level = 0;
+    if(level > 9) level = 9;
+    *shuffle = level && shuffle_env && atoi(shuffle_env);
+    return level;
+}
+
+/**
+ * Writes the values of a field as appended data in the vtkZLibDataCompressor
+ * layout: a UInt64 header (number of blocks, uncompressed block size, size
+ * of a partial last block or 0, compressed size of every block) followed
+ * by the blocks, each compressed on its own. With shuffle, byte k of
+ * every value goes to the k-th byte plane of the array, which groups the
+ * slowly varying sign and exponent bytes of a smooth field
+ * 
+ * @param fp Output file, positioned after the appended data marker
+ * @param data Field to write
+ * @param level zlib compression level (1-9)
+ * @param shuffle Byte-shuffle the values before compressing them
+ * @return 0 on success, 1 on failure
+ */
+static int write_zlib_blocks(FILE *fp, const data_t *data, int level, int shuffle) {
+    size_t num_points = (size_t)data->nx * data->ny;
+    size_t num_bytes = num_points * sizeof(real_t);
+    size_t num_blocks = (num_bytes + VTK_BLOCK_BYTES - 1) / VTK_BLOCK_BYTES;
+    size_t bound = compressBound(VTK_BLOCK_BYTES);
+
+    unsigned char *raw = malloc(num_bytes + 1);
+    unsigned char *packed = malloc(num_blocks * bound + 1);
+    uint64_t *header = malloc((3 + num_blocks) * sizeof(uint64_t));
+    int failed = !raw || !packed || !header;
+
+    if(!failed) {
+        // Contiguous values, split into byte planes when shuffled
+        for(int j = 0; j < data->ny; j++) {
+            const unsigned char *row = (const unsigned char *)&GET(data, 0, j);
+            size_t first = (size_t)j * data->nx;
+            if(!shuffle) {
+                memcpy(raw + first * sizeof(real_t), row, data->nx * sizeof(real_t));
+                continue;
+            }
+            for(int i = 0; i < data->nx; i++)
+                for(size_t k = 0; k < sizeof(real_t); k++)
+                    raw[k * num_points + first + i] = row[i * sizeof(real_t) + k];
+        }
+
+        for(long b = 0; b < (long)num_blocks; b++) {
+            size_t start = (size_t)b * VTK_BLOCK_BYTES;
+            uLong length = (num_bytes - start < VTK_BLOCK_BYTES) ? num_bytes - start : VTK_BLOCK_BYTES;
+            uLongf size = bound;
+            if(compress2(packed + (size_t)b * bound, &size, raw + start, length, level) != Z_OK)
+                failed = 1;
+            header[3 + b] = size;
+        }
+    }
+
+    if(!failed) {
+        header[0] = num_blocks;
+        header[1] = VTK_BLOCK_BYTES;
+        header[2] = num_bytes % VTK_BLOCK_BYTES;
+        failed = (fwrite(header, sizeof(uint64_t), 3 + num_blocks, fp) != 3 + num_blocks);
+        for(size_t b = 0; !failed && b < num_blocks; b++)
+            failed = (fwrite(packed + b * bound, 1, header[3 + b], fp) != header[3 + b]);
+    }
+
+    free(raw);
+    free(packed);
+    free(header);
+    return failed;
+}
+
+/**
+ * Names a VTK snapshot, relative to the output directory: the files, the
+ * entries of the .pvd manifest and the SHALLOW_REFERENCE_DIR references
+ * all use this name
+ * 
+ * @param out Name buffer (MAX_PATH_LENGTH)
+ * @param filename Base filename
+ * @param step Time step (-1 for none)
+ * @param extension File extension (vti, or VTK_SHUFFLE_EXT)
+ */
+static void vtk_name(char *out, const char *filename, int step, const char *extension) {
+    char suffix[16] = "";
+    if(step >= 0) snprintf(suffix, sizeof(suffix), "_%d", step);
+    if(snprintf(out, MAX_PATH_LENGTH, "serial_%s%s.%s", filename, suffix, extension) >= MAX_PATH_LENGTH)
+        fprintf(stderr, "Warning: snapshot name truncated to '%s'\n", out);
+}
+
 /**
  * Writes field data to VTK image file format
  * 
@@ -210,11 +360,13 @@ int write_data(const data_t *data, const char *filename, int step) {
  */
 int write_data_vtk(const data_t *data, const char *name,
                    const char *filename, int step) {
-    char out[MAX_PATH_LENGTH];
-    if(step < 0)
-        sprintf(out, "../../output/serial_%s.vti", filename);
-    else
-        sprintf(out, "../../output/serial_%s_%d.vti", filename, step);
+    // Shuffled snapshots get their own extension so VTK readers reject them
+    int shuffle;
+    int level = vtk_compression(&shuffle);
+    char snapshot[MAX_PATH_LENGTH], out[MAX_PATH_LENGTH];
+    vtk_name(snapshot, filename, step, shuffle ? VTK_SHUFFLE_EXT : "vti");
+    if(snprintf(out, MAX_PATH_LENGTH, "../../output/%s", snapshot) >= MAX_PATH_LENGTH)
+        fprintf(stderr, "Warning: output path truncated to '%s'\n", out);
 
     FILE *fp = fopen(out, "wb");
     if(!fp) {
@@ -223,12 +375,13 @@ int write_data_vtk(const data_t *data, const char *name,
     }
 
     uint64_t num_points = data->nx * data->ny;
-    uint64_t num_bytes = num_points * sizeof(double);
+    uint64_t num_bytes = num_points * sizeof(real_t);
 
     // Write VTK XML header
     fprintf(fp, "<?xml version=\"1.0\"?>\n");
     fprintf(fp, "<VTKFile type=\"ImageData\" version=\"1.0\" "
-            "byte_order=\"LittleEndian\" header_type=\"UInt64\">\n");
+            "byte_order=\"LittleEndian\" header_type=\"UInt64\"%s>\n",
+            level ? " compressor=\"vtkZLibDataCompressor\"" : "");
     fprintf(fp, "  <ImageData WholeExtent=\"0 %d 0 %d 0 0\" "
             "Spacing=\"%lf %lf 0.0\">\n",
             data->nx - 1, data->ny - 1, data->dx, data->dy);
@@ -237,23 +390,100 @@ int write_data_vtk(const data_t *data, const char *name,
 
     // Write data array information
     fprintf(fp, "      <PointData Scalars=\"scalar_data\">\n");
-    fprintf(fp, "        <DataArray type=\"Float64\" Name=\"%s\" "
-            "format=\"appended\" offset=\"0\">\n", name);
+    fprintf(fp, "        <DataArray type=\"%s\" Name=\"%s\" "
+            "format=\"appended\" offset=\"0\">\n", VTK_REAL_TYPE, name);
     fprintf(fp, "        </DataArray>\n");
     fprintf(fp, "      </PointData>\n");
 
     fprintf(fp, "    </Piece>\n");
     fprintf(fp, "  </ImageData>\n");
 
-    // Write binary data
+    // Write binary data (zlib blocks when compressed)
     fprintf(fp, "  <AppendedData encoding=\"raw\">\n_");
-    fwrite(&num_bytes, sizeof(uint64_t), 1, fp);
-    fwrite(data->values, sizeof(double), num_points, fp);
+    int failed = 0;
+    if(level) {
+        failed = write_zlib_blocks(fp, data, level, shuffle);
+    } else {
+        fwrite(&num_bytes, sizeof(uint64_t), 1, fp);
+        for(int j = 0; j < data->ny; j++)
+            fwrite(&GET(data, 0, j), sizeof(real_t), data->nx, fp);
+    }
 
     fprintf(fp, "  </AppendedData>\n");
     fprintf(fp, "</VTKFile>\n");
 
     fclose(fp);
+    if(failed) {
+        printf("Error: Could not compress VTK file '%s'\n", out);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Compares a field with the same output step of a float64 reference run
+ * Reference files are looked up in SHALLOW_REFERENCE_DIR under the names
+ * written by write_data_vtk, and may be stored as Float64 or Float32
+ * 
+ * @param data Pointer to data structure
+ * @param filename Base name of the output file
+ * @param step Timestep number
+ * @return 0 on success, 1 on failure
+ */
+int report_deviation(const data_t *data, const char *filename, int step) {
+    const char *dir = getenv(REFERENCE_DIR_ENV);
+    if(!dir) return 0;
+
+    char snapshot[MAX_PATH_LENGTH], ref[MAX_PATH_LENGTH];
+    vtk_name(snapshot, filename, step, "vti");
+    if(snprintf(ref, MAX_PATH_LENGTH, "%s/%s", dir, snapshot) >= MAX_PATH_LENGTH)
+        fprintf(stderr, "Warning: reference path truncated to '%s'\n", ref);
+
+    FILE *fp = fopen(ref, "rb");
+    if(!fp) {
+        printf("Error: Could not open reference file '%s'\n", ref);
+        return 1;
+    }
+
+    // Skip the XML header up to the appended data marker
+    const char *marker = "<AppendedData encoding=\"raw\">\n_";
+    int matched = 0, c;
+    while(marker[matched] && (c = fgetc(fp)) != EOF) {
+        if(c == marker[matched]) matched++;
+        else matched = (c == marker[0]) ? 1 : 0;
+    }
+
+    uint64_t num_points = data->nx * data->ny;
+    uint64_t num_bytes = 0;
+    int ok = !marker[matched] && (fread(&num_bytes, sizeof(uint64_t), 1, fp) == 1);
+    int width = ok ? (int)(num_bytes / num_points) : 0;
+    ok = ok && (width == 4 || width == 8) && num_bytes == num_points * width;
+
+    double max_dev = 0.0, max_ref = 0.0, sum_sq = 0.0;
+    for(uint64_t k = 0; ok && k < num_points; k++) {
+        double val;
+        if(width == 8) {
+            ok = (fread(&val, sizeof(double), 1, fp) == 1);
+        } else {
+            float val_f;
+            ok = (fread(&val_f, sizeof(float), 1, fp) == 1);
+            val = val_f;
+        }
+        double dev = fabs((double)GET(data, k % data->nx, k / data->nx) - val);
+        if(dev > max_dev) max_dev = dev;
+        if(fabs(val) > max_ref) max_ref = fabs(val);
+        sum_sq += dev * dev;
+    }
+    fclose(fp);
+
+    if(!ok) {
+        printf("Error reading reference file '%s'\n", ref);
+        return 1;
+    }
+
+    printf(" - step %d: deviation from reference max %.3e (rel %.3e), rms %.3e\n",
+           step, max_dev, (max_ref > 0.0) ? max_dev / max_ref : 0.0,
+           sqrt(sum_sq / num_points));
     return 0;
 }
 
@@ -268,7 +498,7 @@ int write_data_vtk(const data_t *data, const char *name,
  */
 int write_manifest_vtk(const char *filename, double dt, int nt,
                        int sampling_rate) {
-    char out[MAX_PATH_LENGTH];
+    char snapshot[MAX_PATH_LENGTH], out[MAX_PATH_LENGTH];
     sprintf(out, "../../output/serial_%s.pvd", filename);
 
     FILE *fp = fopen(out, "wb");
@@ -278,6 +508,8 @@ int write_manifest_vtk(const char *filename, double dt, int nt,
     }
 
     // Write VTK collection file
+    int shuffle;
+    vtk_compression(&shuffle);
     fprintf(fp, "<VTKFile type=\"Collection\" version=\"0.1\" "
             "byte_order=\"LittleEndian\">\n");
     fprintf(fp, "  <Collection>\n");
@@ -285,8 +517,8 @@ int write_manifest_vtk(const char *filename, double dt, int nt,
     for(int n = 0; n < nt; n++) {
         if(sampling_rate && !(n % sampling_rate)) {
             double t = n * dt;
-            fprintf(fp, "    <DataSet timestep=\"%g\" file='%s_%d.vti'/>\n", t,
-                    filename, n);
+            vtk_name(snapshot, filename, n, shuffle ? VTK_SHUFFLE_EXT : "vti");
+            fprintf(fp, "    <DataSet timestep=\"%g\" file='%s'/>\n", t, snapshot);
         }
     }
 
@@ -296,6 +528,183 @@ int write_manifest_vtk(const char *filename, double dt, int nt,
     return 0;
 }
 
+/*===========================================================
+ * BACKGROUND OUTPUT
+ ===========================================================*/
+
+/**
+ * Pauses the calling thread for WRITER_POLL_NS while a queue end waits
+ */
+static void writer_pause(void) {
+    struct timespec pause = {0, WRITER_POLL_NS};
+    nanosleep(&pause, NULL);
+}
+
+/**
+ * Body of the writer thread: writes the filled slots in order and hands
+ * them back to the time loop, until finish_writer has no more snapshots
+ * 
+ * @param arg Writer
+ * @return NULL
+ */
+static void *writer_main(void *arg) {
+    writer_t *writer = arg;
+    data_t snapshot = {0};
+    snapshot.nx = writer->nx;
+    snapshot.ny = writer->ny;
+    snapshot.pitch = writer->nx;
+    snapshot.dx = writer->dx;
+    snapshot.dy = writer->dy;
+
+    int tail = atomic_load_explicit(&writer->tail, memory_order_relaxed);
+    for(;;) {
+        int head = atomic_load_explicit(&writer->head, memory_order_acquire);
+        if(head == tail) {
+            if(atomic_load_explicit(&writer->done, memory_order_acquire) &&
+               head == atomic_load_explicit(&writer->head, memory_order_acquire)) break;
+            writer_pause();
+            continue;
+        }
+
+        int slot = tail % writer->num_slots;
+        snapshot.values = writer->slots[slot];
+        double start = GET_TIME();
+        if(write_data_vtk(&snapshot, writer->name, writer->filename, writer->steps[slot]))
+            writer->errors++;
+        writer->write_time += GET_TIME() - start;
+
+        // Release the slot only once its values are on their way to disk
+        atomic_store_explicit(&writer->tail, ++tail, memory_order_release);
+    }
+    return NULL;
+}
+
+/**
+ * Sets up the snapshot writer of a field: SHALLOW_WRITER_SLOTS snapshot
+ * buffers (WRITER_SLOTS by default, 0 writes synchronously) and the
+ * thread that empties them
+ * 
+ * @param writer Writer to set up
+ * @param field Field written at every sampled step (only its size is kept)
+ * @param name Field name for VTK file
+ * @param filename Base name for output files
+ * @return 0 on success, 1 on failure
+ */
+int init_writer(writer_t *writer, const data_t *field, const char *name,
+                const char *filename) {
+    memset(writer, 0, sizeof(writer_t));
+    writer->nx = field->nx;
+    writer->ny = field->ny;
+    writer->dx = field->dx;
+    writer->dy = field->dy;
+    writer->name = name;
+    writer->filename = filename;
+    atomic_init(&writer->head, 0);
+    atomic_init(&writer->tail, 0);
+    atomic_init(&writer->done, 0);
+
+    const char *env = getenv(WRITER_SLOTS_ENV);
+    writer->num_slots = (env && *env) ? atoi(env) : WRITER_SLOTS;
+    if(writer->num_slots < 0) writer->num_slots = 0;
+    printf(" - snapshot writer: %s (%d slots)\n",
+           writer->num_slots ? "background thread" : "synchronous", writer->num_slots);
+
+    int shuffle;
+    int level = vtk_compression(&shuffle);
+    if(level)
+        printf(" - VTK compression: zlib level %d%s\n", level, shuffle ? ", byte-shuffled" : "");
+    if(writer->num_slots == 0) return 0;
+
+    size_t bytes = (size_t)writer->nx * writer->ny * sizeof(real_t);
+    writer->slots = calloc(writer->num_slots, sizeof(real_t *));
+    writer->steps = calloc(writer->num_slots, sizeof(int));
+    int ok = writer->slots && writer->steps;
+    for(int s = 0; ok && s < writer->num_slots; s++)
+        ok = !posix_memalign((void **)&writer->slots[s], FIELD_ALIGN, bytes);
+    if(ok) ok = !pthread_create(&writer->thread, NULL, writer_main, writer);
+
+    if(!ok) {
+        printf("Error: Could not start the snapshot writer, writing synchronously\n");
+        for(int s = 0; writer->slots && s < writer->num_slots; s++) free(writer->slots[s]);
+        free(writer->slots);
+        free(writer->steps);
+        writer->slots = NULL;
+        writer->steps = NULL;
+        writer->num_slots = 0;
+    }
+    return 0;
+}
+
+/**
+ * Hands one snapshot of the field to the writer: its interior is copied
+ * into the next free slot and the time loop goes on. When every slot is
+ * still waiting for the disk, the loop stalls until one is written
+ * (back-pressure)
+ * 
+ * @param writer Writer of the field
+ * @param field Field to write
+ * @param step Timestep number
+ * @return 0 on success, 1 on failure
+ */
+int write_snapshot(writer_t *writer, const data_t *field, int step) {
+    double start = GET_TIME();
+    writer->snapshots++;
+    if(writer->num_slots == 0) {
+        int err = write_data_vtk(field, writer->name, writer->filename, step);
+        writer->write_time += GET_TIME() - start;
+        writer->copy_time += GET_TIME() - start;
+        return err;
+    }
+
+    int head = atomic_load_explicit(&writer->head, memory_order_relaxed);
+    if(head - atomic_load_explicit(&writer->tail, memory_order_acquire) >= writer->num_slots) {
+        writer->stalls++;
+        while(head - atomic_load_explicit(&writer->tail, memory_order_acquire) >= writer->num_slots)
+            writer_pause();
+        writer->stall_time += GET_TIME() - start;
+    }
+
+    int slot = head % writer->num_slots;
+    real_t *dst = writer->slots[slot];
+    for(int j = 0; j < field->ny; j++)
+        memcpy(dst + (size_t)j * field->nx, &GET(field, 0, j), field->nx * sizeof(real_t));
+    writer->steps[slot] = step;
+    atomic_store_explicit(&writer->head, head + 1, memory_order_release);
+
+    writer->copy_time += GET_TIME() - start;
+    return 0;
+}
+
+/**
+ * Waits for the writer to empty its slots, stops its thread and prints the
+ * output statistics: time the loop spent handing snapshots over, stalls
+ * on a full queue and time the writer spent writing
+ * 
+ * @param writer Writer to stop
+ * @return 0 on success, 1 if a snapshot could not be written
+ */
+int finish_writer(writer_t *writer) {
+    double start = GET_TIME();
+    if(writer->num_slots) {
+        atomic_store_explicit(&writer->done, 1, memory_order_release);
+        pthread_join(writer->thread, NULL);
+        for(int s = 0; s < writer->num_slots; s++) free(writer->slots[s]);
+        free(writer->slots);
+        free(writer->steps);
+        writer->slots = NULL;
+        writer->steps = NULL;
+    }
+    double drain = GET_TIME() - start;
+
+    if(writer->snapshots) {
+        printf("\nOutput: %d snapshots, %g s in the time loop (%g s stalled in %d full-queue waits), "
+               "%g s writing, %g s draining at the end\n",
+               writer->snapshots, writer->copy_time, writer->stall_time, writer->stalls,
+               writer->write_time, drain);
+    }
+    return writer->errors ? 1 : 0;
+}
+
 /*===========================================================
  * MEMORY MANAGEMENT FUNCTIONS
  ===========================================================*/
@@ -315,20 +724,55 @@ int init_data(data_t *data, int nx, int ny, double dx, double dy,
     data->ny = ny;
     data->dx = dx;
     data->dy = dy;
-    data->values = (double*)malloc(nx * ny * sizeof(double));
-    if(!data->values) {
+
+    // Interior rows start on a FIELD_ALIGN boundary: the west ghosts are
+    // padded up to the alignment and the pitch is a whole number of lines
+    int align = FIELD_ALIGN / sizeof(real_t);
+    int pad = (GHOST_WIDTH + align - 1) / align * align;
+    data->ghost = GHOST_WIDTH;
+    data->pitch = (pad + nx + GHOST_WIDTH + align - 1) / align * align;
+
+    size_t count = (size_t)data->pitch * (ny + 2 * GHOST_WIDTH);
+    if(posix_memalign((void **)&data->storage, FIELD_ALIGN, count * sizeof(real_t))) {
+        data->storage = data->values = NULL;
         printf("Error: Could not allocate data\n");
         return 1;
     }
-    for(int i = 0; i < nx * ny; i++) data->values[i] = val;
+    data->values = data->storage + (size_t)GHOST_WIDTH * data->pitch + pad;
+
+    for(size_t k = 0; k < count; k++) data->storage[k] = val;
     return 0;
 }
 
+/**
+ * Copies the edge values of a tile into the ghost cells beyond the domain
+ * edge (zero normal gradient), so kernels reading past the interior need
+ * no boundary branches
+ * 
+ * @param data Pointer to data structure
+ * @param i0, i1 Column range of the tile [i0, i1)
+ * @param j0, j1 Row range of the tile [j0, j1)
+ */
+void fill_ghosts(data_t *data, int i0, int i1, int j0, int j1) {
+    int nx = data->nx;
+    int ny = data->ny;
+    for(int g = 1; g <= data->ghost; g++) {
+        if(i0 == 0)
+            for(int j = j0; j < j1; j++) SET(data, -g, j, GET(data, 0, j));
+        if(i1 == nx)
+            for(int j = j0; j < j1; j++) SET(data, nx - 1 + g, j, GET(data, nx - 1, j));
+        if(j0 == 0)
+            for(int i = i0; i < i1; i++) SET(data, i, -g, GET(data, i, 0));
+        if(j1 == ny)
+            for(int i = i0; i < i1; i++) SET(data, i, ny - 1 + g, GET(data, i, ny - 1));
+    }
+}
+
 /**
  * Frees memory allocated for data structure
  * 
  * @param data Pointer to data structure
  */
 void free_data(data_t *data) {
-    free(data->values);
+    free(data->storage);
 }
\ No newline at end of file